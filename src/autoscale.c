@@ -0,0 +1,43 @@
+/*
+ * Autoscaling
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "src/autoscale.h"
+
+int autoscale_decide(autoscale_t *self, long fill, long capacity,
+                     unsigned int cnt, unsigned int min, unsigned int max) {
+  if (cnt < min) {
+    return 1;
+  }
+  if (cnt > max) {
+    return -1;
+  }
+  if (capacity <= 0 || fill < 0) {
+    return 0;
+  }
+
+  long const pct = fill * 100 / capacity;
+  if (pct >= AUTOSCALE_HIGH_PCT) {
+    ++self->high_cnt;
+    self->low_cnt = 0;
+  } else if (pct <= AUTOSCALE_LOW_PCT) {
+    ++self->low_cnt;
+    self->high_cnt = 0;
+  } else {
+    self->high_cnt = 0;
+    self->low_cnt = 0;
+  }
+
+  if (self->high_cnt >= AUTOSCALE_UP_SAMPLES && cnt < max) {
+    self->high_cnt = 0;
+    return 1;
+  }
+  if (self->low_cnt >= AUTOSCALE_DOWN_SAMPLES && cnt > min) {
+    self->low_cnt = 0;
+    return -1;
+  }
+  return 0;
+}
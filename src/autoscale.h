@@ -0,0 +1,35 @@
+#ifndef PIPEXEC_AUTOSCALE_H
+#define PIPEXEC_AUTOSCALE_H
+
+/*
+ * Autoscaling
+ *
+ * Decides from the fill level of the input pipes of a node if
+ * replicas should be added or removed.  To avoid flapping, the fill
+ * level must be above the high (below the low) water mark for some
+ * samples in a row; after each change the counting starts again.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Fill level in percent of the capacity
+#define AUTOSCALE_HIGH_PCT 50
+#define AUTOSCALE_LOW_PCT 5
+// Samples in a row needed for a change
+#define AUTOSCALE_UP_SAMPLES 3
+#define AUTOSCALE_DOWN_SAMPLES 10
+
+struct autoscale {
+  unsigned int high_cnt;
+  unsigned int low_cnt;
+};
+
+typedef struct autoscale autoscale_t;
+
+// Returns +1 to add a process, -1 to remove one, else 0.
+// cnt is the current number of processes; min and max the bounds.
+int autoscale_decide(autoscale_t *self, long fill, long capacity,
+                     unsigned int cnt, unsigned int min, unsigned int max);
+
+#endif
@@ -0,0 +1,395 @@
+/*
+ * Batch mode
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "src/batch.h"
+#include "src/logging.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+// The list is read without stdio: exit() in a forked instance would
+// move the offset of the shared fd back to the position of the FILE.
+struct batch_list {
+  int fd;
+  char *buf;
+  size_t size;
+  size_t len;
+  int eof;
+  // errno of a failure while reading - or 0.
+  int error;
+};
+
+struct batch_instance {
+  pid_t pid;
+  size_t number;
+  char *input;
+  struct timespec start;
+};
+
+static volatile sig_atomic_t g_batch_stop = 0;
+
+static void batch_sh_term(int signum) {
+  (void)signum;
+  g_batch_stop = 1;
+}
+
+// Only lets sigsuspend() return.
+static void batch_sh_child(int signum) {
+  (void)signum;
+}
+
+// The signals the batch handles and the handlers of the program which
+// are restored at the end.
+static int const batch_signals[] = {SIGCHLD, SIGINT, SIGQUIT, SIGTERM};
+#define BATCH_SIGNAL_CNT (sizeof(batch_signals) / sizeof(batch_signals[0]))
+
+struct batch_signal_state {
+  // Number of batch_signals with a handler: SIGCHLD only or all.
+  size_t cnt;
+  struct sigaction former[BATCH_SIGNAL_CNT];
+  sigset_t former_mask;
+  // For sigsuspend(): the former mask without the handled signals
+  sigset_t wait_mask;
+};
+
+// The signals are blocked outside of sigsuspend(): a signal between
+// the check and the wait is not lost.
+static void batch_signals_install(struct batch_signal_state *state,
+                                  int const signal_handlers) {
+  state->cnt = signal_handlers ? BATCH_SIGNAL_CNT : 1;
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigprocmask(SIG_BLOCK, NULL, &state->wait_mask);
+  for (size_t sidx = 0; sidx < state->cnt; ++sidx) {
+    struct sigaction sa;
+    sa.sa_handler = sidx == 0 ? batch_sh_child : batch_sh_term;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = sidx == 0 ? SA_NOCLDSTOP : 0;
+    sigaction(batch_signals[sidx], &sa, &state->former[sidx]);
+    sigaddset(&mask, batch_signals[sidx]);
+    sigdelset(&state->wait_mask, batch_signals[sidx]);
+  }
+  sigprocmask(SIG_BLOCK, &mask, &state->former_mask);
+}
+
+static void batch_signals_restore(struct batch_signal_state const *state) {
+  for (size_t sidx = 0; sidx < state->cnt; ++sidx) {
+    sigaction(batch_signals[sidx], &state->former[sidx], NULL);
+  }
+  sigprocmask(SIG_SETMASK, &state->former_mask, NULL);
+}
+
+// Returns a copy of str with each placeholder replaced by input - or
+// str itself if there is nothing to replace.
+static char *batch_substitute(char *str, char const *input) {
+  size_t const plen = strlen(BATCH_INPUT_PLACEHOLDER);
+  size_t cnt = 0;
+  for (char const *pos = strstr(str, BATCH_INPUT_PLACEHOLDER); pos != NULL;
+       pos = strstr(pos + plen, BATCH_INPUT_PLACEHOLDER)) {
+    ++cnt;
+  }
+  if (cnt == 0) {
+    return str;
+  }
+
+  size_t const ilen = strlen(input);
+  char *const result = malloc(strlen(str) + cnt * ilen + 1);
+  if (result == NULL) {
+    logging(lid_internal, "batch", "error", "Memory allocation failed", 0);
+    exit(10);
+  }
+  char *dest = result;
+  char const *src = str;
+  for (char const *pos = strstr(src, BATCH_INPUT_PLACEHOLDER); pos != NULL;
+       pos = strstr(src, BATCH_INPUT_PLACEHOLDER)) {
+    memcpy(dest, src, pos - src);
+    dest += pos - src;
+    memcpy(dest, input, ilen);
+    dest += ilen;
+    src = pos + plen;
+  }
+  strcpy(dest, src);
+  return result;
+}
+
+// In the forked instance: prepares the graph and runs it.  The
+// instance is a process of its own: it has the signal handlers of the
+// supervisor.
+static void batch_instance_run(struct batch_instance const *inst,
+                               int stdin_is_list,
+                               struct batch_signal_state const *signals,
+                               supervisor_config_t const *config,
+                               command_info_t *icmd, size_t command_cnt,
+                               pipe_info_t *ipipe, size_t pipe_cnt) {
+  struct sigaction sa_default;
+  sa_default.sa_handler = SIG_DFL;
+  sigemptyset(&sa_default.sa_mask);
+  sa_default.sa_flags = 0;
+  for (size_t sidx = 0; sidx < BATCH_SIGNAL_CNT; ++sidx) {
+    sigaction(batch_signals[sidx], &sa_default, NULL);
+  }
+  sigprocmask(SIG_SETMASK, &signals->former_mask, NULL);
+  supervisor_config_t instance_config = *config;
+  instance_config.signal_handlers = 1;
+
+  if (stdin_is_list) {
+    // The rest of the list is not for the commands.
+    int const fd = open("/dev/null", O_RDONLY);
+    if (fd != -1) {
+      dup2(fd, 0);
+      close(fd);
+    }
+  }
+
+  SIZETTOCHAR(snumber, 24, inst->number);
+  setenv("PIPEXEC_INPUT", inst->input, 1);
+  setenv("PIPEXEC_INSTANCE", snumber, 1);
+
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    for (char **arg = icmd[cidx].argv; *arg != NULL; ++arg) {
+      *arg = batch_substitute(*arg, inst->input);
+    }
+    icmd[cidx].path = icmd[cidx].argv[0];
+  }
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    if (ipipe[pidx].from.path != NULL) {
+      ipipe[pidx].from.path =
+          batch_substitute(ipipe[pidx].from.path, inst->input);
+    }
+    if (ipipe[pidx].to.path != NULL) {
+      ipipe[pidx].to.path = batch_substitute(ipipe[pidx].to.path, inst->input);
+    }
+  }
+
+  int const result =
+      supervisor_run(&instance_config, icmd, command_cnt, ipipe, pipe_cnt);
+  if (result == -1) {
+    exit(errno == EINVAL ? 1 : 10);
+  }
+  exit(result);
+}
+
+static long batch_usec_since(struct timespec const *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000L +
+         (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+// Logs the end of the instance.  Returns 1 if it failed.
+static int batch_instance_done(struct batch_instance *inst, int status) {
+  int const exit_code = WIFEXITED(status)    ? WEXITSTATUS(status)
+                        : WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                              : -1;
+  SIZETTOCHAR(snumber, 24, inst->number);
+  ITOCHAR(spid, 16, inst->pid);
+  ITOCHAR(sexit_code, 16, exit_code);
+  SIZETTOCHAR(susec, 24, (size_t)batch_usec_since(&inst->start));
+  logging(lid_batch_instance, "batch", exit_code == 0 ? "info" : "warning",
+          "Batch instance finished", 5, "instance", snumber, "input",
+          inst->input, "pipexec_instance_pid", spid, "exit_code", sexit_code,
+          "usec", susec);
+  free(inst->input);
+  inst->input = NULL;
+  inst->pid = 0;
+  return exit_code != 0;
+}
+
+// Waits for the instances only - the program can have children of its
+// own.  Returns the index of a finished instance or -1 if there is
+// none (yet).
+static int batch_reap(struct batch_instance const *insts, int parallel,
+                      int *status) {
+  for (int iidx = 0; iidx < parallel; ++iidx) {
+    if (insts[iidx].pid != 0 &&
+        waitpid(insts[iidx].pid, status, WNOHANG) == insts[iidx].pid) {
+      return iidx;
+    }
+  }
+  return -1;
+}
+
+// Returns a copy of the next non empty line; NULL at the end of the
+// list or on an error (list->error is set then).
+static char *batch_next_input(struct batch_list *list) {
+  while (1) {
+    char *const nl =
+        list->len > 0 ? memchr(list->buf, '\n', list->len) : NULL;
+    if (nl != NULL || (list->eof && list->len > 0)) {
+      size_t const line_len = nl != NULL ? (size_t)(nl - list->buf) : list->len;
+      char *const line = strndup(list->buf, line_len);
+      size_t const used = nl != NULL ? line_len + 1 : line_len;
+      memmove(list->buf, list->buf + used, list->len - used);
+      list->len -= used;
+      if (line == NULL) {
+        logging(lid_internal, "batch", "error", "Memory allocation failed", 0);
+        list->error = ENOMEM;
+        return NULL;
+      }
+      if (line_len > 0) {
+        return line;
+      }
+      free(line);
+      continue;
+    }
+    if (list->eof || list->error != 0) {
+      return NULL;
+    }
+
+    if (list->len == list->size) {
+      size_t const size = list->size == 0 ? 4096 : list->size * 2;
+      char *const buf = realloc(list->buf, size);
+      if (buf == NULL) {
+        logging(lid_internal, "batch", "error", "Memory allocation failed", 0);
+        list->error = ENOMEM;
+        return NULL;
+      }
+      list->buf = buf;
+      list->size = size;
+    }
+    ssize_t const rd =
+        read(list->fd, list->buf + list->len, list->size - list->len);
+    if (rd == -1 && errno == EINTR) {
+      continue;
+    }
+    if (rd <= 0) {
+      list->eof = 1;
+    } else {
+      list->len += rd;
+    }
+  }
+}
+
+int batch_run(char const *list_path, int parallel,
+              supervisor_config_t const *config,
+              command_info_t *icmd, size_t command_cnt,
+              pipe_info_t *ipipe, size_t pipe_cnt) {
+  int const stdin_is_list = strcmp(list_path, "-") == 0;
+  struct batch_list list = {
+      stdin_is_list ? 0 : open(list_path, O_RDONLY | O_CLOEXEC), NULL, 0, 0,
+      0, 0};
+  if (list.fd == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "batch", "error", "Cannot open input list", 3,
+            "path", list_path, "errno", serrno, "error", strerror(errno));
+    errno = EINVAL;
+    return -1;
+  }
+  struct batch_instance *const insts =
+      calloc(parallel, sizeof(struct batch_instance));
+  if (insts == NULL) {
+    logging(lid_internal, "batch", "error", "Memory allocation failed", 0);
+    if (!stdin_is_list) {
+      close(list.fd);
+    }
+    errno = ENOMEM;
+    return -1;
+  }
+
+  g_batch_stop = 0;
+  struct batch_signal_state signals;
+  batch_signals_install(&signals, config->signal_handlers);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  size_t started = 0;
+  size_t failed = 0;
+  int running = 0;
+  int stop_sent = 0;
+  // errno of a failure to start an instance - or 0.
+  int start_error = 0;
+  char *input = batch_next_input(&list);
+
+  while (running > 0 || (input != NULL && !g_batch_stop && start_error == 0)) {
+    if (g_batch_stop && !stop_sent) {
+      // Each instance drains / terminates its own graph.
+      for (int iidx = 0; iidx < parallel; ++iidx) {
+        if (insts[iidx].pid != 0) {
+          kill(insts[iidx].pid, SIGTERM);
+        }
+      }
+      stop_sent = 1;
+    }
+
+    if (input != NULL && !g_batch_stop && start_error == 0 &&
+        running < parallel) {
+      struct batch_instance *inst = insts;
+      while (inst->pid != 0) {
+        ++inst;
+      }
+      inst->number = started++;
+      inst->input = input;
+      clock_gettime(CLOCK_MONOTONIC, &inst->start);
+      fflush(NULL);
+      pid_t const pid = fork();
+      if (pid == -1) {
+        // The running instances are finished, no new one is started.
+        start_error = errno;
+        logging(lid_internal, "batch", "error", "Cannot fork", 1, "error",
+                strerror(errno));
+        inst->input = NULL;
+        --started;
+        continue;
+      }
+      if (pid == 0) {
+        batch_instance_run(inst, stdin_is_list, &signals, config, icmd,
+                           command_cnt, ipipe, pipe_cnt);
+      }
+      inst->pid = pid;
+      ++running;
+      input = batch_next_input(&list);
+      continue;
+    }
+
+    int status;
+    int const iidx = batch_reap(insts, parallel, &status);
+    if (iidx == -1) {
+      // A SIGCHLD or a termination signal
+      sigsuspend(&signals.wait_mask);
+      continue;
+    }
+    failed += batch_instance_done(&insts[iidx], status);
+    --running;
+  }
+  batch_signals_restore(&signals);
+
+  // Inputs which were not started because of a termination
+  size_t skipped = 0;
+  while (input != NULL) {
+    ++skipped;
+    free(input);
+    input = batch_next_input(&list);
+  }
+
+  SIZETTOCHAR(sstarted, 24, started);
+  SIZETTOCHAR(sfailed, 24, failed);
+  SIZETTOCHAR(sskipped, 24, skipped);
+  SIZETTOCHAR(susec, 24, (size_t)batch_usec_since(&start));
+  logging(lid_batch_done, "batch", failed == 0 ? "info" : "warning",
+          "Batch finished", 4, "instances", sstarted, "failed", sfailed,
+          "skipped", sskipped, "usec", susec);
+
+  free(insts);
+  free(list.buf);
+  if (!stdin_is_list) {
+    close(list.fd);
+  }
+  if (start_error != 0 || list.error != 0) {
+    errno = start_error != 0 ? start_error : list.error;
+    return -1;
+  }
+  return failed > 0 || skipped > 0;
+}
@@ -0,0 +1,32 @@
+#ifndef PIPEXEC_BATCH_H
+#define PIPEXEC_BATCH_H
+
+/*
+ * Batch mode
+ *
+ * The graph is parsed once and then run once per input of a list -
+ * with up to 'parallel' instances at the same time.  Each instance is
+ * a forked copy of pipexec which runs the supervisor for the graph.
+ * In the instance the input is in the environment variable
+ * PIPEXEC_INPUT (and the number of the instance, starting with 0, in
+ * PIPEXEC_INSTANCE); each '@INPUT@' in the arguments of the commands
+ * and in the paths of FILE ends is replaced by the input.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "src/supervisor.h"
+
+// Text which is replaced by the input.
+#define BATCH_INPUT_PLACEHOLDER "@INPUT@"
+
+// Runs the graph for each (non empty) line of list_path ('-': stdin).
+// Returns 1 if any instance failed, else 0 - or -1 with errno set when
+// the batch cannot be run (EINVAL: the list cannot be opened).
+int batch_run(char const *list_path, int parallel,
+              supervisor_config_t const *config,
+              command_info_t *icmd, size_t command_cnt,
+              pipe_info_t *ipipe, size_t pipe_cnt);
+
+#endif
@@ -0,0 +1,572 @@
+/*
+ * Cache for deterministic nodes
+ *
+ * Runs in the forked child of the supervisor: it must not return to
+ * the supervisor code - it ends with _exit().
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _GNU_SOURCE
+
+#include "src/cache.h"
+#include "src/logging.h"
+
+#include <sys/types.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Bytes read and written at once
+#define CACHE_CHUNK (1024 * 1024)
+// Two hashes as hex
+#define CACHE_KEY_LEN 32
+
+/*
+ * Hash: xxHash64.  Four independent lanes over 32 byte stripes: the
+ * multiplications of the lanes run in parallel in the CPU.
+ */
+#define CACHE_P1 11400714785074694791ULL
+#define CACHE_P2 14029467366897019727ULL
+#define CACHE_P3 1609587929392839161ULL
+#define CACHE_P4 9650029242287828579ULL
+#define CACHE_P5 2870177450012600261ULL
+
+struct cache_hash {
+  uint64_t lane[4];
+  uint64_t total;
+  unsigned char buf[32];
+  size_t buf_len;
+};
+
+static uint64_t cache_rotl(uint64_t const val, int const bits) {
+  return (val << bits) | (val >> (64 - bits));
+}
+
+static uint64_t cache_read64(unsigned char const *const ptr) {
+  uint64_t val;
+  memcpy(&val, ptr, sizeof(val));
+  return val;
+}
+
+static uint64_t cache_round(uint64_t acc, uint64_t const input) {
+  acc += input * CACHE_P2;
+  return cache_rotl(acc, 31) * CACHE_P1;
+}
+
+static uint64_t cache_merge(uint64_t const acc, uint64_t const lane) {
+  return (acc ^ cache_round(0, lane)) * CACHE_P1 + CACHE_P4;
+}
+
+static void cache_hash_init(struct cache_hash *const hash,
+                            uint64_t const seed) {
+  hash->lane[0] = seed + CACHE_P1 + CACHE_P2;
+  hash->lane[1] = seed + CACHE_P2;
+  hash->lane[2] = seed;
+  hash->lane[3] = seed - CACHE_P1;
+  hash->total = 0;
+  hash->buf_len = 0;
+}
+
+static void cache_hash_stripe(struct cache_hash *const hash,
+                              unsigned char const *const ptr) {
+  for (int lidx = 0; lidx < 4; ++lidx) {
+    hash->lane[lidx] =
+        cache_round(hash->lane[lidx], cache_read64(ptr + 8 * lidx));
+  }
+}
+
+static void cache_hash_update(struct cache_hash *const hash,
+                              void const *const data, size_t len) {
+  unsigned char const *ptr = data;
+  hash->total += len;
+  if (hash->buf_len > 0) {
+    size_t const fill =
+        32 - hash->buf_len < len ? 32 - hash->buf_len : len;
+    memcpy(hash->buf + hash->buf_len, ptr, fill);
+    hash->buf_len += fill;
+    ptr += fill;
+    len -= fill;
+    if (hash->buf_len < 32) {
+      return;
+    }
+    cache_hash_stripe(hash, hash->buf);
+    hash->buf_len = 0;
+  }
+  for (; len >= 32; ptr += 32, len -= 32) {
+    cache_hash_stripe(hash, ptr);
+  }
+  memcpy(hash->buf, ptr, len);
+  hash->buf_len = len;
+}
+
+static uint64_t cache_hash_digest(struct cache_hash const *const hash) {
+  uint64_t acc;
+  if (hash->total >= 32) {
+    acc = cache_rotl(hash->lane[0], 1) + cache_rotl(hash->lane[1], 7) +
+          cache_rotl(hash->lane[2], 12) + cache_rotl(hash->lane[3], 18);
+    for (int lidx = 0; lidx < 4; ++lidx) {
+      acc = cache_merge(acc, hash->lane[lidx]);
+    }
+  } else {
+    // The seed
+    acc = hash->lane[2] + CACHE_P5;
+  }
+  acc += hash->total;
+
+  unsigned char const *ptr = hash->buf;
+  unsigned char const *const end = hash->buf + hash->buf_len;
+  for (; ptr + 8 <= end; ptr += 8) {
+    acc ^= cache_round(0, cache_read64(ptr));
+    acc = cache_rotl(acc, 27) * CACHE_P1 + CACHE_P4;
+  }
+  if (ptr + 4 <= end) {
+    uint32_t val;
+    memcpy(&val, ptr, sizeof(val));
+    acc ^= val * CACHE_P1;
+    acc = cache_rotl(acc, 23) * CACHE_P2 + CACHE_P3;
+    ptr += 4;
+  }
+  for (; ptr < end; ++ptr) {
+    acc ^= *ptr * CACHE_P5;
+    acc = cache_rotl(acc, 11) * CACHE_P1;
+  }
+
+  acc ^= acc >> 33;
+  acc *= CACHE_P2;
+  acc ^= acc >> 29;
+  acc *= CACHE_P3;
+  acc ^= acc >> 32;
+  return acc;
+}
+
+/*
+ * I/O helpers
+ */
+
+static int cache_write_all(int const fd, char const *buf, size_t len) {
+  while (len > 0) {
+    ssize_t const wr = write(fd, buf, len);
+    if (wr == -1 && errno == EINTR) {
+      continue;
+    }
+    if (wr == -1 && errno == EAGAIN) {
+      struct pollfd pfd = {fd, POLLOUT, 0};
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    if (wr <= 0) {
+      return -1;
+    }
+    buf += wr;
+    len -= wr;
+  }
+  return 0;
+}
+
+static ssize_t cache_read(int const fd, char *const buf, size_t const len) {
+  ssize_t rd;
+  do {
+    rd = read(fd, buf, len);
+  } while (rd == -1 && errno == EINTR);
+  return rd;
+}
+
+// A file in the cache directory: 'tmp.XXXXXX'.
+static int cache_tmp_file(char const *const dir, char **const path) {
+  if (asprintf(path, "%s/tmp.XXXXXX", dir) == -1) {
+    *path = NULL;
+    return -1;
+  }
+  int const fd = mkostemp(*path, O_CLOEXEC);
+  if (fd == -1) {
+    free(*path);
+    *path = NULL;
+  }
+  return fd;
+}
+
+// What the exec would do: the supervisor's fds are not inherited.
+static void cache_close_cloexec() {
+  DIR *const fds = opendir("/proc/self/fd");
+  if (fds == NULL) {
+    return;
+  }
+  int const dfd = dirfd(fds);
+  struct dirent *ent;
+  while ((ent = readdir(fds)) != NULL) {
+    if (ent->d_name[0] < '0' || ent->d_name[0] > '9') {
+      continue;
+    }
+    int const fd = atoi(ent->d_name);
+    int const flags = fcntl(fd, F_GETFD);
+    if (fd != dfd && flags != -1 && (flags & FD_CLOEXEC)) {
+      close(fd);
+    }
+  }
+  closedir(fds);
+}
+
+/*
+ * Eviction
+ */
+
+struct cache_entry {
+  char name[CACHE_KEY_LEN + 1];
+  off_t size;
+  struct timespec mtime;
+};
+
+static int cache_entry_cmp(void const *lhs, void const *rhs) {
+  struct cache_entry const *const left = lhs;
+  struct cache_entry const *const right = rhs;
+  if (left->mtime.tv_sec != right->mtime.tv_sec) {
+    return left->mtime.tv_sec < right->mtime.tv_sec ? -1 : 1;
+  }
+  if (left->mtime.tv_nsec != right->mtime.tv_nsec) {
+    return left->mtime.tv_nsec < right->mtime.tv_nsec ? -1 : 1;
+  }
+  return 0;
+}
+
+static int cache_is_key(char const *const name) {
+  size_t len = 0;
+  for (; name[len] != '\0'; ++len) {
+    if (!((name[len] >= '0' && name[len] <= '9') ||
+          (name[len] >= 'a' && name[len] <= 'f'))) {
+      return 0;
+    }
+  }
+  return len == CACHE_KEY_LEN;
+}
+
+// Removes the least recently used entries until the rest fits into
+// max_bytes.  Other instances might do the same at the same time: an
+// entry which is already gone is no error.
+static void cache_evict(char const *const dir, uint64_t const max_bytes) {
+  DIR *const cdir = opendir(dir);
+  if (cdir == NULL) {
+    return;
+  }
+  struct cache_entry *entries = NULL;
+  size_t entry_cnt = 0;
+  size_t entry_size = 0;
+  uint64_t total = 0;
+  struct dirent *ent;
+  while ((ent = readdir(cdir)) != NULL) {
+    struct stat st;
+    if (!cache_is_key(ent->d_name) ||
+        fstatat(dirfd(cdir), ent->d_name, &st, 0) == -1) {
+      continue;
+    }
+    if (entry_cnt == entry_size) {
+      entry_size = entry_size == 0 ? 64 : entry_size * 2;
+      struct cache_entry *const nentries =
+          realloc(entries, entry_size * sizeof(struct cache_entry));
+      if (nentries == NULL) {
+        break;
+      }
+      entries = nentries;
+    }
+    struct cache_entry *const entry = &entries[entry_cnt++];
+    memcpy(entry->name, ent->d_name, CACHE_KEY_LEN + 1);
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    total += st.st_size;
+  }
+
+  if (total > max_bytes) {
+    qsort(entries, entry_cnt, sizeof(struct cache_entry), cache_entry_cmp);
+    size_t removed = 0;
+    for (size_t eidx = 0; eidx < entry_cnt && total > max_bytes; ++eidx) {
+      unlinkat(dirfd(cdir), entries[eidx].name, 0);
+      total -= entries[eidx].size;
+      ++removed;
+    }
+    SIZETTOCHAR(sremoved, 24, removed);
+    logging(lid_internal, "cache", "info", "Cache entries evicted", 2,
+            "directory", dir, "entries", sremoved);
+  }
+  free(entries);
+  closedir(cdir);
+}
+
+/*
+ * Hit and miss
+ */
+
+static void cache_exit(int const status) {
+  if (WIFSIGNALED(status)) {
+    signal(WTERMSIG(status), SIG_DFL);
+    raise(WTERMSIG(status));
+  }
+  _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+static void cache_hit_failed() {
+  ITOCHAR(serrno, 16, errno);
+  logging(lid_internal, "cache", "error", "Cannot write cached output", 2,
+          "errno", serrno, "error", strerror(errno));
+  _exit(1);
+}
+
+static void cache_hit(int const fd, char const *const key) {
+  // For the LRU eviction
+  futimens(fd, NULL);
+  logging(lid_internal, "cache", "info", "Cache hit", 1, "key", key);
+  while (1) {
+    ssize_t const sent = sendfile(1, fd, NULL, CACHE_CHUNK);
+    if (sent == 0) {
+      _exit(0);
+    }
+    if (sent == -1 && errno == EINTR) {
+      continue;
+    }
+    if (sent == -1 && errno == EAGAIN) {
+      struct pollfd pfd = {1, POLLOUT, 0};
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    if (sent == -1 && errno == EINVAL) {
+      // E.g. an appending file: read and write
+      break;
+    }
+    if (sent == -1) {
+      cache_hit_failed();
+    }
+  }
+
+  char *const buf = malloc(CACHE_CHUNK);
+  if (buf == NULL) {
+    cache_hit_failed();
+  }
+  ssize_t rd;
+  while ((rd = cache_read(fd, buf, CACHE_CHUNK)) > 0) {
+    if (cache_write_all(1, buf, rd) == -1) {
+      cache_hit_failed();
+    }
+  }
+  if (rd == -1) {
+    cache_hit_failed();
+  }
+  _exit(0);
+}
+
+static volatile pid_t g_cache_child = 0;
+
+static void cache_sh_forward(int signum) {
+  if (g_cache_child > 0) {
+    kill(g_cache_child, signum);
+  }
+}
+
+// Runs the command with the spooled input: its output goes to fd 1
+// and into a new cache entry.
+static void cache_miss(command_info_t const *const params,
+                       char const *const dir, uint64_t const max_bytes,
+                       int const spool, char const *const key) {
+  logging(lid_internal, "cache", "info", "Cache miss", 1, "key", key);
+  int out[2];
+  if (lseek(spool, 0, SEEK_SET) == -1 || pipe2(out, O_CLOEXEC) == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "cache", "error", "Cannot run command", 2,
+            "errno", serrno, "error", strerror(errno));
+    _exit(10);
+  }
+
+  // A signal for the command which comes before g_cache_child is set
+  // is forwarded afterwards.
+  struct sigaction sa_forward;
+  sa_forward.sa_handler = cache_sh_forward;
+  sigemptyset(&sa_forward.sa_mask);
+  sa_forward.sa_flags = SA_RESTART;
+  sigset_t forwarded;
+  sigset_t old_mask;
+  sigemptyset(&forwarded);
+  int const signums[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM};
+  for (size_t sidx = 0; sidx < sizeof(signums) / sizeof(signums[0]);
+       ++sidx) {
+    sigaddset(&forwarded, signums[sidx]);
+    sigaction(signums[sidx], &sa_forward, NULL);
+  }
+  sigprocmask(SIG_BLOCK, &forwarded, &old_mask);
+
+  pid_t const pid = fork();
+  if (pid == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "exec", "error", "Error during fork()", 2,
+            "errno", serrno, "error", strerror(errno));
+    _exit(10);
+  }
+  if (pid == 0) {
+    // The exec resets the handlers - but not the mask.
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    dup2(spool, 0);
+    dup2(out[1], 1);
+    execv(params->path, params->argv);
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "exec", "error", "Calling execv", 4,
+            "command", params->cmd_name, "path", params->path,
+            "errno", serrno, "error", strerror(errno));
+    abort();
+  }
+  close(out[1]);
+  close(spool);
+
+  g_cache_child = pid;
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  // Without an entry file the output is only passed on.
+  char *tmp_path;
+  int store = cache_tmp_file(dir, &tmp_path);
+  char *const buf = malloc(CACHE_CHUNK);
+  int passed = buf != NULL;
+  while (passed) {
+    ssize_t const rd = cache_read(out[0], buf, CACHE_CHUNK);
+    if (rd <= 0) {
+      break;
+    }
+    if (cache_write_all(1, buf, rd) == -1) {
+      // The reader is gone: the output is not complete.
+      passed = 0;
+      break;
+    }
+    if (store != -1 && cache_write_all(store, buf, rd) == -1) {
+      close(store);
+      unlink(tmp_path);
+      store = -1;
+    }
+  }
+  free(buf);
+  close(out[0]);
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+  }
+  if (store != -1) {
+    close(store);
+    if (passed && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      char *entry_path;
+      if (asprintf(&entry_path, "%s/%s", dir, key) != -1) {
+        if (rename(tmp_path, entry_path) == 0) {
+          logging(lid_internal, "cache", "info", "Cache entry stored", 1,
+                  "key", key);
+        }
+        free(entry_path);
+      }
+      cache_evict(dir, max_bytes);
+    }
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  cache_exit(status);
+}
+
+// Hash of everything but the input data.  Of the environment only the
+// input of a batch instance is part of it (see cache_run()).
+static uint64_t cache_context_hash(command_info_t const *const params,
+                                   struct stat const *const st,
+                                   uint64_t const input_len) {
+  struct cache_hash hash;
+  cache_hash_init(&hash, 1);
+  for (char *const *arg = params->argv; *arg != NULL; ++arg) {
+    // With the '\0': 'a b' differs from 'ab'.
+    cache_hash_update(&hash, *arg, strlen(*arg) + 1);
+  }
+  // The marker keeps an empty input apart from none.
+  char const *const input = getenv("PIPEXEC_INPUT");
+  if (input != NULL) {
+    cache_hash_update(&hash, "\0", 1);
+    cache_hash_update(&hash, input, strlen(input) + 1);
+  }
+  uint64_t const identity[] = {
+      st->st_dev, st->st_ino, st->st_size, st->st_mtim.tv_sec,
+      st->st_mtim.tv_nsec, input_len};
+  cache_hash_update(&hash, identity, sizeof(identity));
+  return cache_hash_digest(&hash);
+}
+
+void cache_run(command_info_t const *params, char const *dir,
+               uint64_t max_bytes) {
+  cache_close_cloexec();
+  // The number of the batch instance would make each run unique: a
+  // cached process does not get it.
+  unsetenv("PIPEXEC_INSTANCE");
+  struct stat st;
+  if (stat(params->path, &st) == -1) {
+    // execv reports it.
+    return;
+  }
+  if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "cache", "warning",
+            "Cannot create cache directory - running without cache", 3,
+            "directory", dir, "errno", serrno, "error", strerror(errno));
+    return;
+  }
+  char *spool_path;
+  int const spool = cache_tmp_file(dir, &spool_path);
+  char *const buf = malloc(CACHE_CHUNK);
+  if (spool == -1 || buf == NULL) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "cache", "warning",
+            "Cannot create spool file - running without cache", 3,
+            "directory", dir, "errno", serrno, "error", strerror(errno));
+    if (spool != -1) {
+      close(spool);
+      unlink(spool_path);
+    }
+    free(spool_path);
+    free(buf);
+    return;
+  }
+  // Only the fd is needed.
+  unlink(spool_path);
+  free(spool_path);
+
+  struct cache_hash hash;
+  cache_hash_init(&hash, 0);
+  while (1) {
+    ssize_t const rd = cache_read(0, buf, CACHE_CHUNK);
+    if (rd == 0) {
+      break;
+    }
+    if (rd == -1 || cache_write_all(spool, buf, rd) == -1) {
+      // The input is consumed: there is no way back to a plain run.
+      ITOCHAR(serrno, 16, errno);
+      logging(lid_internal, "cache", "error", "Cannot spool input", 3,
+              "command", params->cmd_name, "errno", serrno,
+              "error", strerror(errno));
+      _exit(10);
+    }
+    cache_hash_update(&hash, buf, rd);
+  }
+  free(buf);
+  close(0);
+
+  char key[CACHE_KEY_LEN + 1];
+  snprintf(key, sizeof(key), "%016llx%016llx",
+           (unsigned long long)cache_hash_digest(&hash),
+           (unsigned long long)cache_context_hash(params, &st, hash.total));
+
+  char *entry_path;
+  if (asprintf(&entry_path, "%s/%s", dir, key) == -1) {
+    _exit(10);
+  }
+  int const entry = open(entry_path, O_RDONLY | O_CLOEXEC);
+  free(entry_path);
+  if (entry != -1) {
+    close(spool);
+    cache_hit(entry, key);
+  }
+  cache_miss(params, dir, max_bytes, spool, key);
+}
@@ -0,0 +1,39 @@
+#ifndef PIPEXEC_CACHE_H
+#define PIPEXEC_CACHE_H
+
+/*
+ * Cache for deterministic nodes
+ *
+ * A node with the option 'cache' is run by a wrapper in the forked
+ * child instead of the exec:
+ *  o The input (fd 0) is read completely into a spool file in the
+ *    cache directory and hashed on the way.
+ *  o The key is the hash of the input and the hash of the input
+ *    length, the arguments and the identity of the binary (device,
+ *    inode, size and modification time).
+ *  o Hit: the cached output is written to fd 1; the command is not
+ *    run at all.
+ *  o Miss: the command is run with the spool file as input; its
+ *    output (fd 1) is passed on and written to the cache.  When the
+ *    command exits with 0 the entry is added.  Then the oldest
+ *    entries (modification time - it is updated on each hit) are
+ *    removed until the cache fits into its size.
+ * The wrapper exits like the command: the supervisor does not see a
+ * difference.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "src/command_info.h"
+
+#include <stdint.h>
+
+// In the forked child: runs the command through the cache in dir
+// which holds up to max_bytes.  Returns only if the cache cannot be
+// used - before the input is touched: then the command is run as
+// usual.
+void cache_run(command_info_t const *params, char const *dir,
+               uint64_t max_bytes);
+
+#endif
@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 unsigned int command_info_clp_count(
    int const start_argc, int const argc, char * const argv[]) {
@@ -15,14 +18,98 @@ unsigned int command_info_clp_count(
    return cnt;
 }
 
+// Parses one option of a command.  Returns -1 on error.
+static int command_info_parse_option(command_info_t *self, char *const opt) {
+  char *const eq = strchr(opt, '=');
+  char const *val = "";
+  if (eq != NULL) {
+    *eq = '\0';
+    val = eq + 1;
+  }
+
+  if (strcmp(opt, "notify") == 0) {
+    char *end_val;
+    long const fd = strtol(val, &end_val, 10);
+    if (*val == '\0' || *end_val != '\0' || fd < 0 || fd > 0xffff) {
+      logging(lid_internal, "command_line", "error",
+	      "Invalid syntax: notify needs a fd", 2,
+	      "command", self->cmd_name, "value", val);
+      errno = EINVAL;
+      return -1;
+    }
+    self->notify_fd = (int)fd;
+  } else if (strcmp(opt, "scale") == 0) {
+    char *end_min;
+    char *end_max = end_min;
+    long const min = strtol(val, &end_min, 10);
+    long const max = *end_min == '-' ? strtol(end_min + 1, &end_max, 10) : 0;
+    if (*end_min != '-' || *end_max != '\0' || min < 1 || max < 2 ||
+        min > max || max > 1024) {
+      logging(lid_internal, "command_line", "error",
+	      "Invalid syntax: scale needs MIN-MAX processes", 2,
+	      "command", self->cmd_name, "value", val);
+      errno = EINVAL;
+      return -1;
+    }
+    self->scale_min = (unsigned int)min;
+    self->scale_max = (unsigned int)max;
+  } else if (strcmp(opt, "standby") == 0 && eq == NULL) {
+    self->standby = 1;
+  } else if (strcmp(opt, "cache") == 0 && eq == NULL) {
+    self->cache = 1;
+  } else {
+    logging(lid_internal, "command_line", "error",
+	    "Invalid syntax: unknown command option", 2,
+	    "command", self->cmd_name, "option", opt);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+// Splits 'NAME,opt,opt=val' in the name and the options.
+// Returns -1 on error.
+static int command_info_parse_options(command_info_t *self) {
+  self->notify_fd = -1;
+  self->standby = 0;
+  self->scale_min = 0;
+  self->scale_max = 0;
+  self->cache = 0;
+  char *opt = strchr(self->cmd_name, ',');
+  if (opt == NULL) {
+    return 0;
+  }
+  *opt++ = '\0';
+  while (opt != NULL) {
+    char *const next = strchr(opt, ',');
+    if (next != NULL) {
+      *next = '\0';
+    }
+    if (command_info_parse_option(self, opt) == -1) {
+      return -1;
+    }
+    opt = next != NULL ? next + 1 : NULL;
+  }
+  // The wrapper of a cached node is the process the supervisor sees.
+  if (self->cache &&
+      (self->notify_fd != -1 || self->standby || self->scale_max != 0)) {
+    logging(lid_internal, "command_line", "error",
+	    "Invalid syntax: cache cannot be combined with notify, standby"
+	    " or scale", 1, "command", self->cmd_name);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
 /**
  * Placement constructor:
  * pass in a unititialized memory region.
  * Please note that this function modifies the 'argv'.
  */
-unsigned int command_info_array_constrcutor(
+int command_info_array_constrcutor(
      command_info_t *icmd, int const start_argc, int const argc, char *argv[]) {
-  unsigned int handled_args = 0;
+  int handled_args = 0;
   bool in_cmd = false;
   unsigned int cmd_no = 0;
   for (int i = start_argc; i < argc; ++i) {
@@ -33,6 +120,9 @@ unsigned int command_info_array_constrcutor(
       icmd[cmd_no].cmd_name = &argv[i][1];
       icmd[cmd_no].path = argv[i + 1];
       icmd[cmd_no].argv = &argv[i + 1];
+      if (command_info_parse_options(&icmd[cmd_no]) == -1) {
+        return -1;
+      }
       ++cmd_no;
       in_cmd = true;
     }
@@ -41,6 +131,9 @@ unsigned int command_info_array_constrcutor(
       icmd[cmd_no].cmd_name = argv[i + 1];
       icmd[cmd_no].path = argv[i + 2];
       icmd[cmd_no].argv = &argv[i + 2];
+      if (command_info_parse_options(&icmd[cmd_no]) == -1) {
+        return -1;
+      }
       ++cmd_no;
       in_cmd = true;
     } else if (argv[i][0] == ']') {
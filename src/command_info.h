@@ -10,11 +10,24 @@ struct command_info {
    char * cmd_name;
    char * path;
    char ** argv;
+   // Options are given after the name: '[ NAME,notify=3 ...'
+   // fd where the process signals that it is ready (-1: none).
+   int notify_fd;
+   // 'standby': keep a second instance ready for a fast restart.
+   int standby;
+   // 'scale=MIN-MAX': number of processes (0: no scaling).
+   unsigned int scale_min;
+   unsigned int scale_max;
+   // 'cache': the node is deterministic - its output is cached
+   // (see cache.h).
+   int cache;
 };
 
 typedef struct command_info command_info_t;
 
-unsigned int command_info_array_constrcutor(
+// Returns the number of handled args - or -1 (errno EINVAL) if an
+// option of a command is wrong.
+int command_info_array_constrcutor(
    command_info_t * icmd,
    int const start_argc, int const argc, char * argv[]);
 
@@ -0,0 +1,268 @@
+/*
+ * Control socket
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "src/control.h"
+#include "src/event_loop.h"
+#include "src/supervisor.h"
+#include "src/server_socket.h"
+#include "src/logging.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define CONTROL_LINE_MAX 1024
+
+struct control_client {
+  int fd;
+  size_t len;
+  char line[CONTROL_LINE_MAX];
+};
+
+static int g_control_fd = -1;
+static char const *g_control_path = NULL;
+
+static struct {
+  char const *name;
+  int signum;
+} const g_signal_names[] = {
+  {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+  {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"TERM", SIGTERM},
+  {"CONT", SIGCONT}, {"STOP", SIGSTOP}
+};
+
+// Accepts 'TERM', 'SIGTERM' and '15'.  Returns -1 if unknown.
+static int control_signal_parse(char const *str) {
+  if (*str >= '0' && *str <= '9') {
+    return atoi(str);
+  }
+  if (strncmp(str, "SIG", 3) == 0) {
+    str += 3;
+  }
+  for (size_t sidx = 0;
+       sidx < sizeof(g_signal_names) / sizeof(g_signal_names[0]); ++sidx) {
+    if (strcmp(str, g_signal_names[sidx].name) == 0) {
+      return g_signal_names[sidx].signum;
+    }
+  }
+  return -1;
+}
+
+static void control_send(int fd, char const *buf, size_t len);
+
+// Parses the options of 'tap': every=N and rate=BYTES.
+// Returns NULL on success or an error message.
+static char const *control_tap_option(char const *opt, unsigned int *every,
+                                      uint64_t *rate) {
+  if (opt == NULL) {
+    return NULL;
+  }
+  char const *const eq = strchr(opt, '=');
+  if (eq == NULL || eq[1] < '0' || eq[1] > '9') {
+    return "invalid tap option";
+  }
+  char *end = NULL;
+  unsigned long long const value = strtoull(eq + 1, &end, 10);
+  if (*end != '\0' || value == 0) {
+    return "invalid tap option";
+  }
+  if (strncmp(opt, "every=", 6) == 0 && value <= UINT_MAX) {
+    *every = value;
+  } else if (strncmp(opt, "rate=", 5) == 0 && value <= (1ULL << 40)) {
+    *rate = value;
+  } else {
+    return "invalid tap option";
+  }
+  return NULL;
+}
+
+// Executes one command; the answer is written to out.  Returns 1 if
+// the connection was handed over to a tap, 2 if it must be closed.
+static int control_execute(char *line, FILE *out, int fd) {
+  char *saveptr = NULL;
+  char const *const cmd = strtok_r(line, " \t\r", &saveptr);
+  char const *const arg1 = strtok_r(NULL, " \t\r", &saveptr);
+  char const *const arg2 = strtok_r(NULL, " \t\r", &saveptr);
+  char const *const arg3 = strtok_r(NULL, " \t\r", &saveptr);
+  char const *error = NULL;
+
+  if (cmd == NULL) {
+    return 0;
+  }
+
+  logging(lid_internal, "control", "info", "Command received", 1,
+          "command", cmd);
+
+  if (strcmp(cmd, "list") == 0) {
+    supervisor_print_nodes(out);
+    supervisor_print_pipes(out);
+  } else if (strcmp(cmd, "metrics") == 0) {
+    supervisor_print_metrics(out);
+  } else if (strcmp(cmd, "graph") == 0) {
+    error = supervisor_print_graph(out, arg1 != NULL ? arg1 : "dot");
+  } else if (strcmp(cmd, "restart") == 0 && arg1 != NULL) {
+    error = supervisor_node_restart(arg1);
+  } else if (strcmp(cmd, "pause") == 0 && arg1 != NULL) {
+    error = supervisor_node_pause(arg1, 1);
+  } else if (strcmp(cmd, "resume") == 0 && arg1 != NULL) {
+    error = supervisor_node_pause(arg1, 0);
+  } else if (strcmp(cmd, "signal") == 0 && arg1 != NULL && arg2 != NULL) {
+    int const signum = control_signal_parse(arg2);
+    error = signum <= 0 ? "unknown signal"
+                        : supervisor_node_signal(arg1, signum);
+  } else if (strcmp(cmd, "tap") == 0 && arg1 != NULL) {
+    unsigned int every = 1;
+    uint64_t rate = 0;
+    error = control_tap_option(arg2, &every, &rate);
+    if (error == NULL) {
+      error = control_tap_option(arg3, &every, &rate);
+    }
+    if (error == NULL) {
+      error = supervisor_pipe_tap(arg1, -1, every, rate);
+    }
+    if (error == NULL) {
+      // The answer must be there before the first sample.
+      control_send(fd, "ok\n", 3);
+      return supervisor_pipe_tap(arg1, fd, every, rate) == NULL ? 1 : 2;
+    }
+  } else {
+    error = "unknown command or missing parameter";
+  }
+
+  if (error == NULL) {
+    fprintf(out, "ok\n");
+  } else {
+    fprintf(out, "error: %s\n", error);
+  }
+  return 0;
+}
+
+static void control_client_close(struct control_client *client) {
+  event_loop_remove_fd(client->fd);
+  close(client->fd);
+  free(client);
+}
+
+// The supervisor must never block because of a slow client: the
+// answer is sent without waiting - what does not fit is lost.
+static void control_send(int fd, char const *buf, size_t len) {
+  while (len > 0) {
+    ssize_t const wr = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (wr <= 0) {
+      if (wr == -1 && errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    buf += wr;
+    len -= wr;
+  }
+}
+
+static void control_client_read(int fd, void *data) {
+  struct control_client *const client = data;
+  ssize_t const rd =
+      read(fd, client->line + client->len, CONTROL_LINE_MAX - client->len);
+  if (rd == -1 && (errno == EINTR || errno == EAGAIN)) {
+    return;
+  }
+  if (rd <= 0) {
+    control_client_close(client);
+    return;
+  }
+  client->len += rd;
+
+  char *nl;
+  while ((nl = memchr(client->line, '\n', client->len)) != NULL) {
+    *nl = '\0';
+    size_t const line_len = nl - client->line + 1;
+
+    char *obuf = NULL;
+    size_t olen = 0;
+    FILE *const out = open_memstream(&obuf, &olen);
+    if (out == NULL) {
+      control_client_close(client);
+      return;
+    }
+    int const handed_over = control_execute(client->line, out, fd);
+    fclose(out);
+    control_send(fd, obuf, olen);
+    free(obuf);
+    if (handed_over == 2) {
+      control_client_close(client);
+      return;
+    }
+    if (handed_over == 1) {
+      // The fd belongs to the tap now; further commands are ignored.
+      event_loop_remove_fd(fd);
+      free(client);
+      return;
+    }
+
+    memmove(client->line, client->line + line_len, client->len - line_len);
+    client->len -= line_len;
+  }
+
+  if (client->len == CONTROL_LINE_MAX) {
+    logging(lid_internal, "control", "warning", "Command line too long", 0);
+    control_client_close(client);
+  }
+}
+
+static void control_accept(int fd, void *data) {
+  (void)data;
+  int const cfd = accept(fd, NULL, NULL);
+  if (cfd == -1) {
+    return;
+  }
+  server_socket_set_flags(cfd);
+
+  struct control_client *const client = malloc(sizeof(struct control_client));
+  if (client == NULL) {
+    close(cfd);
+    return;
+  }
+  client->fd = cfd;
+  client->len = 0;
+  event_loop_add_fd(cfd, control_client_read, client);
+}
+
+int control_open(char const *path) {
+  int const fd = server_socket_unix(path);
+  if (fd == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "control", "error", "Cannot create control socket",
+            3, "path", path, "errno", serrno, "error", strerror(errno));
+    return -1;
+  }
+
+  logging(lid_internal, "control", "info", "Control socket created", 1,
+          "path", path);
+  g_control_fd = fd;
+  g_control_path = path;
+  event_loop_add_fd(fd, control_accept, NULL);
+  return 0;
+}
+
+void control_close() {
+  if (g_control_fd == -1) {
+    return;
+  }
+  event_loop_remove_fd(g_control_fd);
+  close(g_control_fd);
+  unlink(g_control_path);
+  g_control_fd = -1;
+}
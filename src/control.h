@@ -0,0 +1,31 @@
+#ifndef PIPEXEC_CONTROL_H
+#define PIPEXEC_CONTROL_H
+
+/*
+ * Control socket
+ *
+ * A unix domain stream socket which can be used to look at and change
+ * the graph during run time.  The protocol is line based: one command
+ * per line; each answer ends with a line 'ok' or 'error: <message>'.
+ *
+ *   list                 nodes (with pid and state) and pipes
+ *   metrics              metrics in OpenMetrics text format
+ *   restart NAME         restart one node (needs -R)
+ *   signal NAME SIGNAL   send a signal (name like TERM or number)
+ *   pause NAME           stop the node (SIGSTOP)
+ *   resume NAME          continue the node (SIGCONT)
+ *   tap INDEX [every=N] [rate=BYTES]
+ *                        after 'ok' the connection gets samples of the
+ *                        data of the relay pipe (see relay.h)
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Creates the socket and registers it in the event loop.
+// Returns -1 if this is not possible (the error is logged).
+int control_open(char const *path);
+// Closes the socket and removes it from the file system.
+void control_close();
+
+#endif
@@ -0,0 +1,382 @@
+/*
+ * Event loop of the supervisor
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "src/event_loop.h"
+#include "src/logging.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+struct event_loop_watch {
+  int fd;
+  event_loop_cb_t cb;
+  void *data;
+};
+
+static struct event_loop_watch *g_watches = NULL;
+static size_t g_watch_cnt = 0;
+static size_t g_watch_size = 0;
+// The pollfds in the order of the watches: [widx + 1] is the pollfd of
+// g_watches[widx]; [0] is the SIGCHLD self-pipe.
+static struct pollfd *g_pfds = NULL;
+// For each fd: the index of its watch + 1 (0: not watched).
+static size_t *g_fd_index = NULL;
+static size_t g_fd_index_size = 0;
+
+// SIGCHLD writes into [1]; the loop polls [0].
+static int g_sigchld_pipe[2] = {-1, -1};
+// The handler is installed: the former one is restored afterwards.
+static int g_sigchld_installed = 0;
+static struct sigaction g_sigchld_former;
+static volatile sig_atomic_t g_break = 0;
+// A child might have terminated since the reaper was called last.
+static volatile sig_atomic_t g_child_pending = 1;
+static event_loop_reap_t g_reap = NULL;
+// Created on demand: all fds of the loop for the poll of an embedding
+// program.
+static int g_epoll_fd = -1;
+
+static void sh_child(int signum) {
+  if (signum == SIGCHLD) {
+    g_child_pending = 1;
+  }
+  int const serrno = errno;
+  ssize_t const wr = write(g_sigchld_pipe[1], "c", 1);
+  (void)wr;
+  errno = serrno;
+}
+
+static void epoll_watch(int fd) {
+  if (g_epoll_fd == -1) {
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int event_loop_install();
+
+static void set_nonblock_cloexec(int fd) {
+  int const flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+int event_loop_init() {
+  if (g_sigchld_pipe[0] != -1) {
+    return event_loop_install();
+  }
+  if (pipe(g_sigchld_pipe) == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "event_loop", "error", "Cannot create pipe", 2,
+            "errno", serrno, "error", strerror(errno));
+    return -1;
+  }
+  set_nonblock_cloexec(g_sigchld_pipe[0]);
+  set_nonblock_cloexec(g_sigchld_pipe[1]);
+  return event_loop_install();
+}
+
+// Again after event_loop_release()
+static int event_loop_install() {
+  if (g_sigchld_installed) {
+    return 0;
+  }
+  struct sigaction sa_child;
+  sa_child.sa_handler = sh_child;
+  sigemptyset(&sa_child.sa_mask);
+  // Stopped (paused) children must not wake up the loop.
+  sa_child.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  if (sigaction(SIGCHLD, &sa_child, &g_sigchld_former) == -1) {
+    return -1;
+  }
+  g_sigchld_installed = 1;
+  return 0;
+}
+
+void event_loop_uninstall() {
+  struct sigaction sa_default;
+  sa_default.sa_handler = SIG_DFL;
+  sigemptyset(&sa_default.sa_mask);
+  sa_default.sa_flags = 0;
+  sigaction(SIGCHLD, &sa_default, NULL);
+}
+
+void event_loop_release() {
+  if (!g_sigchld_installed) {
+    return;
+  }
+  sigaction(SIGCHLD, &g_sigchld_former, NULL);
+  g_sigchld_installed = 0;
+}
+
+void event_loop_break() {
+  g_break = 1;
+  sh_child(0);
+}
+
+// Returns the index of the watch of the fd - or -1.
+static ssize_t watch_index(int fd) {
+  if (fd < 0 || (size_t)fd >= g_fd_index_size || g_fd_index[fd] == 0) {
+    return -1;
+  }
+  return (ssize_t)g_fd_index[fd] - 1;
+}
+
+static int watches_grow(int fd) {
+  if (g_watch_cnt == g_watch_size) {
+    size_t const nsize = g_watch_size == 0 ? 8 : g_watch_size * 2;
+    struct event_loop_watch *const nwatches =
+        realloc(g_watches, nsize * sizeof(struct event_loop_watch));
+    if (nwatches == NULL) {
+      return -1;
+    }
+    g_watches = nwatches;
+    struct pollfd *const npfds =
+        realloc(g_pfds, (nsize + 1) * sizeof(struct pollfd));
+    if (npfds == NULL) {
+      return -1;
+    }
+    g_pfds = npfds;
+    g_watch_size = nsize;
+  }
+  if ((size_t)fd >= g_fd_index_size) {
+    size_t nsize = g_fd_index_size == 0 ? 64 : g_fd_index_size;
+    while (nsize <= (size_t)fd) {
+      nsize *= 2;
+    }
+    size_t *const nindex = realloc(g_fd_index, nsize * sizeof(size_t));
+    if (nindex == NULL) {
+      return -1;
+    }
+    memset(nindex + g_fd_index_size, 0,
+           (nsize - g_fd_index_size) * sizeof(size_t));
+    g_fd_index = nindex;
+    g_fd_index_size = nsize;
+  }
+  return 0;
+}
+
+void event_loop_add_fd(int fd, event_loop_cb_t cb, void *data) {
+  if (fd < 0 || watches_grow(fd) == -1) {
+    logging(lid_internal, "event_loop", "error",
+	    "Memory allocation failed", 0);
+    return;
+  }
+  g_watches[g_watch_cnt].fd = fd;
+  g_watches[g_watch_cnt].cb = cb;
+  g_watches[g_watch_cnt].data = data;
+  g_pfds[g_watch_cnt + 1].fd = fd;
+  g_pfds[g_watch_cnt + 1].events = POLLIN;
+  g_pfds[g_watch_cnt + 1].revents = 0;
+  ++g_watch_cnt;
+  g_fd_index[fd] = g_watch_cnt;
+  epoll_watch(fd);
+}
+
+void event_loop_remove_fd(int fd) {
+  ssize_t const widx = watch_index(fd);
+  if (widx == -1) {
+    return;
+  }
+  // The last watch (and its pollfd with the pending events) moves
+  // into the gap.
+  size_t const last = g_watch_cnt - 1;
+  g_watches[widx] = g_watches[last];
+  g_pfds[widx + 1] = g_pfds[last + 1];
+  g_fd_index[g_watches[widx].fd] = widx + 1;
+  g_fd_index[fd] = 0;
+  --g_watch_cnt;
+  if (g_epoll_fd != -1) {
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  }
+}
+
+// A timer is a timerfd which is watched like any other fd.
+struct event_loop_timer {
+  event_loop_timer_cb_t cb;
+  void *data;
+};
+
+static void event_loop_timer_read(int fd, void *data) {
+  struct event_loop_timer const *const timer = data;
+  uint64_t expirations;
+  if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+    return;
+  }
+  timer->cb(timer->data);
+}
+
+int event_loop_add_timer(int interval_ms, event_loop_timer_cb_t cb,
+                         void *data) {
+  struct event_loop_timer *const timer =
+      malloc(sizeof(struct event_loop_timer));
+  int const fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer == NULL || fd == -1) {
+    free(timer);
+    return -1;
+  }
+  struct itimerspec its;
+  its.it_interval.tv_sec = interval_ms / 1000;
+  its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+  its.it_value = its.it_interval;
+  if (timerfd_settime(fd, 0, &its, NULL) == -1) {
+    close(fd);
+    free(timer);
+    return -1;
+  }
+  timer->cb = cb;
+  timer->data = data;
+  event_loop_add_fd(fd, event_loop_timer_read, timer);
+  return fd;
+}
+
+void event_loop_remove_timer(int id) {
+  ssize_t const widx = watch_index(id);
+  if (widx != -1) {
+    free(g_watches[widx].data);
+  }
+  event_loop_remove_fd(id);
+  close(id);
+}
+
+void event_loop_set_reaper(event_loop_reap_t reap) {
+  g_reap = reap;
+  g_child_pending = 1;
+}
+
+int event_loop_fd() {
+  if (event_loop_init() == -1) {
+    return -1;
+  }
+  if (g_epoll_fd != -1) {
+    return g_epoll_fd;
+  }
+  g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (g_epoll_fd == -1) {
+    return -1;
+  }
+  epoll_watch(g_sigchld_pipe[0]);
+  for (size_t widx = 0; widx < g_watch_cnt; ++widx) {
+    epoll_watch(g_watches[widx].fd);
+  }
+  return g_epoll_fd;
+}
+
+static long now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+// Calls the callbacks of all readable fds.  A callback might add or
+// remove fds: a removed watch is replaced by the last one (with its
+// events) - therefore the same index is checked again.  Events of a
+// watch which moved to an index already visited are seen by the next
+// poll.
+static void event_loop_dispatch() {
+  size_t pidx = 1;
+  while (pidx <= g_watch_cnt) {
+    if (g_pfds[pidx].revents == 0) {
+      ++pidx;
+      continue;
+    }
+    g_pfds[pidx].revents = 0;
+    struct event_loop_watch const watch = g_watches[pidx - 1];
+    watch.cb(watch.fd, watch.data);
+  }
+}
+
+// Without status: only the events are dispatched.
+static pid_t event_loop_run(int *status, struct rusage *usage,
+                            int timeout_ms) {
+  if (event_loop_init() == -1) {
+    return -1;
+  }
+  long const deadline = timeout_ms == -1 ? 0 : now_ms() + timeout_ms;
+  int polled = 0;
+
+  while (1) {
+    if (status != NULL && g_child_pending) {
+      g_child_pending = 0;
+      pid_t const cpid = g_reap(status, usage);
+      if (cpid != 0) {
+        // A terminated child (there might be more) or an error (e.g.
+        // no child at all)
+        g_child_pending = 1;
+        return cpid;
+      }
+    }
+    if (g_break) {
+      g_break = 0;
+      return 0;
+    }
+
+    int wait_ms = -1;
+    if (timeout_ms != -1) {
+      long const left = deadline - now_ms();
+      // A timeout of 0 still dispatches what is there.
+      if (left < 0 || (left == 0 && polled)) {
+        return 0;
+      }
+      wait_ms = (int)left;
+    }
+    polled = 1;
+
+    if (g_pfds == NULL) {
+      g_pfds = malloc(sizeof(struct pollfd));
+      if (g_pfds == NULL) {
+        return -1;
+      }
+    }
+    g_pfds[0].fd = g_sigchld_pipe[0];
+    g_pfds[0].events = POLLIN;
+
+    int const pres = poll(g_pfds, g_watch_cnt + 1, wait_ms);
+    if (pres == -1) {
+      if (errno == EINTR) {
+        // A signal handler might have waited for the children.
+        continue;
+      }
+      return -1;
+    }
+
+    if (g_pfds[0].revents & POLLIN) {
+      char buf[64];
+      while (read(g_sigchld_pipe[0], buf, sizeof(buf)) > 0) {
+      }
+    }
+    event_loop_dispatch();
+  }
+}
+
+pid_t event_loop_wait_child(int *status, struct rusage *usage,
+                            int timeout_ms) {
+  return event_loop_run(status, usage, timeout_ms);
+}
+
+int event_loop_wait(int timeout_ms) {
+  return event_loop_run(NULL, NULL, timeout_ms) == -1 ? -1 : 0;
+}
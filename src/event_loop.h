@@ -0,0 +1,68 @@
+#ifndef PIPEXEC_EVENT_LOOP_H
+#define PIPEXEC_EVENT_LOOP_H
+
+/*
+ * Event loop of the supervisor
+ *
+ * Instead of blocking in wait(2), the supervisor waits with poll(2)
+ * for terminated children (SIGCHLD is converted into a readable
+ * self-pipe) and for other fds like the control socket.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+typedef void (*event_loop_cb_t)(int fd, void *data);
+
+// Installs the SIGCHLD handler and creates the self-pipe.  Returns -1
+// on error.
+int event_loop_init();
+// Resets the SIGCHLD handler: used in forked children.
+void event_loop_uninstall();
+// Restores the SIGCHLD handler which was there before.
+void event_loop_release();
+
+// Lets event_loop_wait_child() return 0 as soon as possible.
+// Can be called from a signal handler.
+void event_loop_break();
+
+// The callback is called when the fd is readable.
+void event_loop_add_fd(int fd, event_loop_cb_t cb, void *data);
+void event_loop_remove_fd(int fd);
+
+// Periodic timer: the callback is called every interval_ms.
+// Returns an id for event_loop_remove_timer() - or -1 on error.
+typedef void (*event_loop_timer_cb_t)(void *data);
+int event_loop_add_timer(int interval_ms, event_loop_timer_cb_t cb,
+                         void *data);
+void event_loop_remove_timer(int id);
+
+// An fd which is readable when there is something to do for
+// event_loop_wait_child(): for the poll loop of an embedding program.
+// Returns -1 on error.
+int event_loop_fd();
+
+// Waits for the children after a SIGCHLD: like wait4(2) with WNOHANG
+// it returns the pid of a terminated child, 0 if there is none and -1
+// on error.  It only waits for the children it knows: the others are
+// left to their owner.
+typedef pid_t (*event_loop_reap_t)(int *status, struct rusage *usage);
+void event_loop_set_reaper(event_loop_reap_t reap);
+
+// Waits until a child terminated while dispatching all other events.
+// Returns the pid and sets status and usage as the reaper does.
+// Returns 0 if timeout_ms (if not -1) elapsed without a terminated
+// child or event_loop_break() was called and -1 on error (e.g. ECHILD).
+// With timeout_ms 0 the events which are there are dispatched once.
+pid_t event_loop_wait_child(int *status, struct rusage *usage,
+                            int timeout_ms);
+
+// Dispatches the events without waiting for children (e.g. when there
+// is none until a timer starts one).  Returns 0 when timeout_ms (if
+// not -1) elapsed or event_loop_break() was called and -1 on error.
+int event_loop_wait(int timeout_ms);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ * Common fd I/O of ptee, peet and ppart
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _GNU_SOURCE
+
+#include "src/fdio.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Size of explicit huge pages: the mapping is rounded up to this.
+#define FDIO_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+struct fdio_pool {
+  char *mem;
+  size_t mem_size;
+  size_t buffer_size;
+  // Stack of the free buffers
+  void **free;
+  size_t free_cnt;
+};
+
+fdio_pool_t *fdio_pool_create(size_t const buffer_size,
+                              size_t const buffer_cnt,
+                              int const use_hugepages) {
+  fdio_pool_t *const self = malloc(sizeof(fdio_pool_t));
+  void **const free_list = malloc(buffer_cnt * sizeof(void *));
+  if (self == NULL || free_list == NULL) {
+    free(free_list);
+    free(self);
+    return NULL;
+  }
+
+  self->mem_size = buffer_size * buffer_cnt;
+  self->mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (use_hugepages) {
+    size_t const huge_size = (self->mem_size + FDIO_HUGEPAGE_SIZE - 1) /
+                             FDIO_HUGEPAGE_SIZE * FDIO_HUGEPAGE_SIZE;
+    self->mem = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (self->mem != MAP_FAILED) {
+      self->mem_size = huge_size;
+    }
+  }
+#endif
+  if (self->mem == MAP_FAILED) {
+    self->mem = mmap(NULL, self->mem_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (self->mem == MAP_FAILED) {
+      int const err = errno;
+      free(free_list);
+      free(self);
+      errno = err;
+      return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (use_hugepages) {
+      // Only a hint: fine if transparent huge pages are not available.
+      madvise(self->mem, self->mem_size, MADV_HUGEPAGE);
+    }
+#endif
+  }
+
+  self->buffer_size = buffer_size;
+  self->free = free_list;
+  self->free_cnt = buffer_cnt;
+  for (size_t bidx = 0; bidx < buffer_cnt; ++bidx) {
+    // The first buffer is handed out first.
+    self->free[bidx] = self->mem + (buffer_cnt - 1 - bidx) * buffer_size;
+  }
+  return self;
+}
+
+void fdio_pool_destroy(fdio_pool_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  munmap(self->mem, self->mem_size);
+  free(self->free);
+  free(self);
+}
+
+size_t fdio_pool_buffer_size(fdio_pool_t const *self) {
+  return self->buffer_size;
+}
+
+void *fdio_pool_get(fdio_pool_t *self) {
+  if (self->free_cnt == 0) {
+    return NULL;
+  }
+  return self->free[--self->free_cnt];
+}
+
+void fdio_pool_put(fdio_pool_t *self, void *buffer) {
+  self->free[self->free_cnt++] = buffer;
+}
+
+void fdio_adapt_init(fdio_adapt_t *self, size_t const min, size_t const max) {
+  self->min = min < max ? min : max;
+  self->max = max;
+  self->cur = self->min;
+}
+
+size_t fdio_adapt_size(fdio_adapt_t const *self, int const fd) {
+  int avail = 0;
+  if (ioctl(fd, FIONREAD, &avail) == 0 && avail > 0) {
+    size_t const size = avail;
+    if (size > self->max) {
+      return self->max;
+    }
+    // Do not go below the observed bursts: more may be on the way.
+    return size > self->cur ? size : self->cur;
+  }
+  return self->cur;
+}
+
+void fdio_adapt_update(fdio_adapt_t *self, size_t const requested,
+                       size_t const got) {
+  if (got >= requested && self->cur < self->max) {
+    self->cur = self->cur * 2 < self->max ? self->cur * 2 : self->max;
+  } else if (got < self->cur / 4 && self->cur > self->min) {
+    self->cur = self->cur / 2 > self->min ? self->cur / 2 : self->min;
+  }
+}
+
+enum fdio_type fdio_fd_type(int const fd) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return ft_other;
+  }
+  if (S_ISFIFO(st.st_mode)) {
+    return ft_pipe;
+  }
+  if (S_ISSOCK(st.st_mode)) {
+    return ft_socket;
+  }
+  if (S_ISREG(st.st_mode)) {
+    return ft_file;
+  }
+  return ft_other;
+}
+
+int fdio_can_splice(int const in_fd, int const out_fd) {
+  enum fdio_type const in_type = fdio_fd_type(in_fd);
+  enum fdio_type const out_type = fdio_fd_type(out_fd);
+  if (in_type == ft_other || out_type == ft_other) {
+    return 0;
+  }
+  // Appending files cannot be written by splice.
+  if (out_type == ft_file && (fcntl(out_fd, F_GETFL) & O_APPEND)) {
+    return 0;
+  }
+  return in_type == ft_pipe || out_type == ft_pipe;
+}
+
+ssize_t fdio_read(int const fd, void *buffer, size_t const len) {
+  ssize_t rd;
+  do {
+    rd = read(fd, buffer, len);
+  } while (rd == -1 && errno == EINTR);
+  return rd;
+}
+
+static int fdio_wait(int const fd, short const events) {
+  struct pollfd pfd = {fd, events, 0};
+  int ret;
+  do {
+    ret = poll(&pfd, 1, -1);
+  } while (ret == -1 && errno == EINTR);
+  return ret == -1 ? -1 : 0;
+}
+
+int fdio_write_all(int const fd, void const *buffer, size_t len) {
+  char const *data = buffer;
+  while (len > 0) {
+    ssize_t const wr = write(fd, data, len);
+    if (wr == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN && fdio_wait(fd, POLLOUT) == 0) {
+        continue;
+      }
+      return -1;
+    }
+    data += wr;
+    len -= wr;
+  }
+  return 0;
+}
+
+int fdio_writev_all(int const fd, struct iovec *iov, int cnt) {
+  while (cnt > 0) {
+    ssize_t wr = writev(fd, iov, cnt);
+    if (wr == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN && fdio_wait(fd, POLLOUT) == 0) {
+        continue;
+      }
+      return -1;
+    }
+    // Skip over what was written.
+    while (cnt > 0 && (size_t)wr >= iov->iov_len) {
+      wr -= iov->iov_len;
+      ++iov;
+      --cnt;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + wr;
+      iov->iov_len -= wr;
+    }
+  }
+  return 0;
+}
+
+ssize_t fdio_splice(int const in_fd, int const out_fd, size_t const len) {
+  while (1) {
+    ssize_t const moved =
+        splice(in_fd, NULL, out_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (moved >= 0) {
+      return moved;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN) {
+      return -1;
+    }
+    // For non-blocking fds EAGAIN means: the input is empty or the
+    // output is full.  Only the latter is waited for.
+    struct pollfd pfd = {in_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0 || fdio_wait(out_fd, POLLOUT) == -1) {
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+}
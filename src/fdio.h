@@ -0,0 +1,71 @@
+#ifndef PIPEXEC_FDIO_H
+#define PIPEXEC_FDIO_H
+
+/*
+ * Common fd I/O of ptee, peet and ppart
+ *
+ * - A pool of equally sized buffers in one mapping which can be backed
+ *   by huge pages.
+ * - Adaptive read sizes: the size of the next read follows the data
+ *   which is available (FIONREAD) and the size of the last reads.
+ * - Detection of the fd type to move data between pipes with splice(2)
+ *   instead of read / write.
+ * - read / write / splice with EINTR and short write handling.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Buffer pool: not thread safe - get and put must be serialized.
+typedef struct fdio_pool fdio_pool_t;
+
+// Returns NULL if the memory cannot be allocated (errno is set).
+// With use_hugepages, explicit huge pages are tried first, then
+// transparent huge pages.
+fdio_pool_t *fdio_pool_create(size_t buffer_size, size_t buffer_cnt,
+                              int use_hugepages);
+void fdio_pool_destroy(fdio_pool_t *self);
+size_t fdio_pool_buffer_size(fdio_pool_t const *self);
+// Returns NULL if all buffers are in use.
+void *fdio_pool_get(fdio_pool_t *self);
+void fdio_pool_put(fdio_pool_t *self, void *buffer);
+
+// Adaptive read size between min and max.
+struct fdio_adapt {
+  size_t min;
+  size_t max;
+  size_t cur;
+};
+
+typedef struct fdio_adapt fdio_adapt_t;
+
+void fdio_adapt_init(fdio_adapt_t *self, size_t min, size_t max);
+// Size of the next read from fd.
+size_t fdio_adapt_size(fdio_adapt_t const *self, int fd);
+// Adapts to the result of the last read: grows when the read was
+// full, shrinks when it was much smaller.
+void fdio_adapt_update(fdio_adapt_t *self, size_t requested, size_t got);
+
+enum fdio_type { ft_pipe, ft_socket, ft_file, ft_other };
+
+enum fdio_type fdio_fd_type(int fd);
+// splice(2) needs a pipe on (at least) one side.
+int fdio_can_splice(int in_fd, int out_fd);
+
+// read(2) which is restarted on EINTR.
+ssize_t fdio_read(int fd, void *buffer, size_t len);
+// Writes all data; waits for non-blocking fds.
+// Returns 0 or -1 (errno is set).
+int fdio_write_all(int fd, void const *buffer, size_t len);
+// The same for a list of buffers; iov is changed.
+int fdio_writev_all(int fd, struct iovec *iov, int cnt);
+// Moves up to len bytes from in_fd to out_fd.  Waits when out_fd is
+// full - but not when in_fd is empty: then -1 with EAGAIN is returned.
+// Returns the number of bytes moved, 0 on EOF.
+ssize_t fdio_splice(int in_fd, int out_fd, size_t len);
+
+#endif
@@ -0,0 +1,339 @@
+/*
+ * Graph export
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "src/graph_export.h"
+#include "src/metrics.h"
+#include "src/relay.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Bytes of each edge at the last export: for the throughput.
+static uint64_t *g_last_bytes = NULL;
+static size_t g_last_cnt = 0;
+static long long g_last_usec = 0;
+
+// Run time data of one node or edge; -1: not known.
+struct node_data {
+  double cpu;
+  long rss;
+};
+
+struct edge_data {
+  long fill;
+  long capacity;
+  long long bytes;
+  double rate;
+};
+
+int graph_export_format(char const *name) {
+  if (strcmp(name, "dot") == 0) {
+    return gf_dot;
+  }
+  if (strcmp(name, "json") == 0) {
+    return gf_json;
+  }
+  return -1;
+}
+
+static long long now_usec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static struct node_data node_data_get(node_info_t const *node) {
+  struct node_data data = {node->cpu_usec / 1e6, -1};
+  double cpu;
+  long rss;
+  if (node->pid != 0 && metrics_proc_sample(node->pid, &cpu, &rss) == 0) {
+    data.cpu += cpu;
+    data.rss = rss;
+  }
+  return data;
+}
+
+// Only relays and shm rings count the bytes.
+static long long edge_bytes(size_t pidx, pipe_info_t const *pipe) {
+  relay_stats_t stats;
+  if (relay_stats(pidx, &stats) == 0) {
+    return (long long)stats.bytes;
+  }
+  if (pipe->type == pt_shm && pipe->ring != NULL) {
+    return (long long)shm_ring_read_total(pipe->ring);
+  }
+  return -1;
+}
+
+static struct edge_data *edge_data_get(pipe_info_t const *ipipe,
+                                       size_t pipe_cnt) {
+  struct edge_data *const data =
+      malloc((pipe_cnt + 1) * sizeof(struct edge_data));
+  if (data == NULL) {
+    return NULL;
+  }
+  if (g_last_cnt < pipe_cnt) {
+    free(g_last_bytes);
+    g_last_bytes = calloc(pipe_cnt, sizeof(uint64_t));
+    g_last_cnt = g_last_bytes == NULL ? 0 : pipe_cnt;
+    g_last_usec = 0;
+  }
+  long long const now = now_usec();
+  double const seconds = (now - g_last_usec) / 1e6;
+
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    data[pidx].fill = pipe_info_fill(&ipipe[pidx]);
+    data[pidx].capacity = pipe_info_capacity(&ipipe[pidx]);
+    data[pidx].bytes = edge_bytes(pidx, &ipipe[pidx]);
+    data[pidx].rate = -1;
+    if (data[pidx].bytes == -1 || g_last_cnt == 0) {
+      continue;
+    }
+    // A restart of the graph starts the counters again.
+    if (g_last_usec != 0 &&
+        (uint64_t)data[pidx].bytes >= g_last_bytes[pidx]) {
+      data[pidx].rate = (data[pidx].bytes - g_last_bytes[pidx]) / seconds;
+    }
+    g_last_bytes[pidx] = data[pidx].bytes;
+  }
+  if (g_last_cnt != 0) {
+    g_last_usec = now;
+  }
+  return data;
+}
+
+// Escapes for DOT and JSON strings are the same for the characters
+// which can be part of names and paths.  The prefix is not escaped.
+static void write_string(FILE *out, char const *prefix, char const *str) {
+  fputc('"', out);
+  fputs(prefix, out);
+  for (; *str != '\0'; ++str) {
+    if (*str == '\\' || *str == '"') {
+      fputc('\\', out);
+      fputc(*str, out);
+    } else if (*str == '\n') {
+      fputs("\\n", out);
+    } else if ((unsigned char)*str < 0x20) {
+      fprintf(out, "\\u%04x", *str);
+    } else {
+      fputc(*str, out);
+    }
+  }
+  fputc('"', out);
+}
+
+// The DOT node of a pipe's end: files, FIFOs and fds of pipexec are
+// nodes of their own.
+static void dot_end_id(FILE *out, pipes_end_info_t const *pend) {
+  char buf[32];
+  switch (pend->type) {
+  case pet_command:
+    write_string(out, "", pend->name);
+    break;
+  case pet_file:
+    write_string(out, "FILE:", pend->path);
+    break;
+  case pet_parent:
+    snprintf(buf, sizeof(buf), "%d", pend->fd);
+    write_string(out, "PARENT:", buf);
+    break;
+  case pet_fifo:
+    write_string(out, "FIFO:", pend->path);
+    break;
+  }
+}
+
+static void dot_end_decl(FILE *out, pipes_end_info_t const *pend) {
+  if (pend->type == pet_command) {
+    return;
+  }
+  fputs("  ", out);
+  dot_end_id(out, pend);
+  fputs(pend->type == pet_file   ? " [shape=note];\n"
+        : pend->type == pet_fifo ? " [shape=cds];\n"
+                                 : " [shape=box];\n",
+        out);
+}
+
+static void write_dot(FILE *out, command_info_t const *icmd,
+                      node_info_t const *nodes, size_t command_cnt,
+                      pipe_info_t const *ipipe, size_t pipe_cnt,
+                      struct edge_data const *edges) {
+  fputs("digraph pipexec {\n  rankdir=LR;\n  node [shape=ellipse];\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    node_info_t const *const node = &nodes[cidx];
+    struct node_data const data = node_data_get(node);
+    char label[256];
+    int len = snprintf(label, sizeof(label), "%s\npid %d %s\nrestarts %u"
+                       " cpu %.2fs", icmd[cidx].cmd_name, (int)node->pid,
+                       node_state_name(node->state), node->restart_cnt,
+                       data.cpu);
+    if (data.rss != -1 && len > 0 && (size_t)len < sizeof(label)) {
+      snprintf(label + len, sizeof(label) - len, " rss %ldK", data.rss / 1024);
+    }
+    fputs("  ", out);
+    write_string(out, "", icmd[cidx].cmd_name);
+    fputs(" [label=", out);
+    write_string(out, "", label);
+    fputs(node->state == ns_running ? "];\n" : ", style=dashed];\n", out);
+  }
+
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    pipe_info_t const *const pipe = &ipipe[pidx];
+    dot_end_decl(out, &pipe->from);
+    dot_end_decl(out, &pipe->to);
+
+    char label[256];
+    int len = snprintf(label, sizeof(label), "%d>%d %s", pipe->from.fd,
+                       pipe->to.fd, pipe_type_name(pipe->type));
+    double ratio = 0;
+    if (edges != NULL && edges[pidx].fill != -1 &&
+        edges[pidx].capacity > 0 && len > 0 && (size_t)len < sizeof(label)) {
+      ratio = (double)edges[pidx].fill / edges[pidx].capacity;
+      len += snprintf(label + len, sizeof(label) - len, "\nfill %ld / %ld",
+                      edges[pidx].fill, edges[pidx].capacity);
+    }
+    if (edges != NULL && edges[pidx].rate >= 0 && len > 0 &&
+        (size_t)len < sizeof(label)) {
+      snprintf(label + len, sizeof(label) - len, "\n%.0f bytes/s",
+               edges[pidx].rate);
+    }
+
+    fputs("  ", out);
+    dot_end_id(out, &pipe->from);
+    fputs(" -> ", out);
+    dot_end_id(out, &pipe->to);
+    fputs(" [label=", out);
+    write_string(out, "", label);
+    fprintf(out, ", penwidth=%.1f%s];\n", 1 + 4 * ratio,
+            ratio >= 0.75 ? ", color=red" : ratio >= 0.25 ? ", color=orange"
+                                                          : "");
+  }
+  fputs("}\n", out);
+}
+
+static void json_end(FILE *out, pipes_end_info_t const *pend) {
+  switch (pend->type) {
+  case pet_command:
+    fputs("{\"node\":", out);
+    write_string(out, "", pend->name);
+    fprintf(out, ",\"fd\":%d}", pend->fd);
+    break;
+  case pet_file:
+    fputs("{\"file\":", out);
+    write_string(out, "", pend->path);
+    fputc('}', out);
+    break;
+  case pet_parent:
+    fprintf(out, "{\"parent_fd\":%d}", pend->fd);
+    break;
+  case pet_fifo:
+    fputs("{\"fifo\":", out);
+    write_string(out, "", pend->path);
+    fputc('}', out);
+    break;
+  }
+}
+
+static void write_json(FILE *out, command_info_t const *icmd,
+                       node_info_t const *nodes, size_t command_cnt,
+                       pipe_info_t const *ipipe, size_t pipe_cnt,
+                       struct edge_data const *edges) {
+  fputs("{\"nodes\":[", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    node_info_t const *const node = &nodes[cidx];
+    struct node_data const data = node_data_get(node);
+    fputs(cidx == 0 ? "\n{\"name\":" : ",\n{\"name\":", out);
+    write_string(out, "", icmd[cidx].cmd_name);
+    fputs(",\"path\":", out);
+    write_string(out, "", icmd[cidx].path);
+    fprintf(out, ",\"pid\":%d,\"state\":\"%s\",\"restarts\":%u,"
+            "\"cpu_seconds\":%.3f", (int)node->pid,
+            node_state_name(node->state), node->restart_cnt, data.cpu);
+    if (data.rss != -1) {
+      fprintf(out, ",\"rss_bytes\":%ld", data.rss);
+    }
+    fputc('}', out);
+  }
+
+  fputs("],\n\"edges\":[", out);
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    pipe_info_t const *const pipe = &ipipe[pidx];
+    fprintf(out, "%s{\"index\":%zu,\"from\":", pidx == 0 ? "\n" : ",\n",
+            pidx);
+    json_end(out, &pipe->from);
+    fputs(",\"to\":", out);
+    json_end(out, &pipe->to);
+    fprintf(out, ",\"type\":\"%s\"", pipe_type_name(pipe->type));
+    if (edges != NULL && edges[pidx].capacity != -1) {
+      fprintf(out, ",\"capacity_bytes\":%ld", edges[pidx].capacity);
+    }
+    if (edges != NULL && edges[pidx].fill != -1) {
+      fprintf(out, ",\"fill_bytes\":%ld", edges[pidx].fill);
+    }
+    if (edges != NULL && edges[pidx].bytes != -1) {
+      fprintf(out, ",\"bytes\":%lld", edges[pidx].bytes);
+    }
+    if (edges != NULL && edges[pidx].rate >= 0) {
+      fprintf(out, ",\"bytes_per_second\":%.0f", edges[pidx].rate);
+    }
+    fputc('}', out);
+  }
+  fputs("]}\n", out);
+}
+
+void graph_export_write(FILE *out, enum graph_format format,
+                        command_info_t const *icmd, node_info_t const *nodes,
+                        size_t command_cnt, pipe_info_t const *ipipe,
+                        size_t pipe_cnt) {
+  // Without memory the graph is written without the edge data.
+  struct edge_data *const edges = edge_data_get(ipipe, pipe_cnt);
+  if (format == gf_json) {
+    write_json(out, icmd, nodes, command_cnt, ipipe, pipe_cnt, edges);
+  } else {
+    write_dot(out, icmd, nodes, command_cnt, ipipe, pipe_cnt, edges);
+  }
+  free(edges);
+}
+
+int graph_export_file(char const *path, command_info_t const *icmd,
+                      node_info_t const *nodes, size_t command_cnt,
+                      pipe_info_t const *ipipe, size_t pipe_cnt) {
+  size_t const len = strlen(path);
+  enum graph_format const format =
+      len > 5 && strcmp(path + len - 5, ".json") == 0 ? gf_json : gf_dot;
+
+  char *const tmp_path = malloc(len + 5);
+  if (tmp_path == NULL) {
+    return -1;
+  }
+  snprintf(tmp_path, len + 5, "%s.tmp", path);
+  FILE *const out = fopen(tmp_path, "w");
+  if (out == NULL) {
+    int const err = errno;
+    free(tmp_path);
+    errno = err;
+    return -1;
+  }
+  graph_export_write(out, format, icmd, nodes, command_cnt, ipipe, pipe_cnt);
+  int res = fclose(out);
+  if (res == 0) {
+    res = rename(tmp_path, path);
+  }
+  if (res != 0) {
+    int const err = errno;
+    unlink(tmp_path);
+    errno = err;
+  }
+  free(tmp_path);
+  return res == 0 ? 0 : -1;
+}
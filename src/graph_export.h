@@ -0,0 +1,43 @@
+#ifndef PIPEXEC_GRAPH_EXPORT_H
+#define PIPEXEC_GRAPH_EXPORT_H
+
+/*
+ * Graph export
+ *
+ * Writes the graph as it is wired up - as Graphviz DOT or as JSON -
+ * with the run time data which is available: pid, state, restarts,
+ * CPU and RSS of the processes; fds, type, capacity, fill level and
+ * throughput of the pipes.  In DOT the edges are drawn thicker the
+ * fuller they are; nearly full edges are red: the process they lead
+ * to is a bottleneck.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "src/command_info.h"
+#include "src/pipe_info.h"
+#include "src/supervisor.h"
+
+#include <stdio.h>
+
+enum graph_format { gf_dot, gf_json };
+
+// 'dot' or 'json'; returns -1 if unknown.
+int graph_export_format(char const *name);
+
+// The throughput is the number of bytes (relay and shm edges) since
+// the last export divided by the time since then.
+void graph_export_write(FILE *out, enum graph_format format,
+                        command_info_t const *icmd, node_info_t const *nodes,
+                        size_t command_cnt, pipe_info_t const *ipipe,
+                        size_t pipe_cnt);
+
+// Writes to a temporary file which is renamed: a reader never sees a
+// partial graph.  The format is JSON if the path ends with '.json'.
+// Returns -1 on error (errno is set).
+int graph_export_file(char const *path, command_info_t const *icmd,
+                      node_info_t const *nodes, size_t command_cnt,
+                      pipe_info_t const *ipipe, size_t pipe_cnt);
+
+#endif
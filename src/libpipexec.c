@@ -0,0 +1,659 @@
+/*
+ * libpipexec
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "src/libpipexec.h"
+#include "src/logging.h"
+#include "src/version.h"
+#include "src/command_info.h"
+#include "src/pipe_info.h"
+#include "src/supervisor.h"
+#include "src/event_loop.h"
+#include "src/metrics.h"
+#include "src/batch.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+enum pipexec_state { ps_new, ps_running, ps_finished };
+
+struct pipexec {
+  // The graph in the syntax of the command line.  The parsed commands
+  // and pipes point into these strings.
+  char **strings;
+  size_t string_cnt;
+  size_t string_size;
+  // The parser changes the vector itself.
+  char **args;
+
+  supervisor_config_t config;
+  int kill_all;
+  char *control_path;
+  char *metrics_addr;
+  char *graph_path;
+  char *pid_file;
+  char *cache_dir;
+
+  command_info_t *icmd;
+  size_t command_cnt;
+  pipe_info_t *ipipe;
+  size_t pipe_cnt;
+
+  enum pipexec_state state;
+  int result;
+
+  // Queue of the events
+  struct pipexec_event *events;
+  size_t event_first;
+  size_t event_cnt;
+  size_t event_size;
+};
+
+// The supervisor has global state: only one graph runs at a time.
+static pipexec_t *g_running = NULL;
+
+char const *pipexec_version(void) {
+  return app_version;
+}
+
+void pipexec_log_text(int fd) {
+  if (fd == -1) {
+    logging_text_set_global_use_syslog();
+  } else {
+    logging_text_set_global_log_fd(fd);
+  }
+}
+
+void pipexec_log_json(int fd) {
+  if (fd == -1) {
+    logging_json_set_global_use_syslog();
+  } else {
+    logging_json_set_global_log_fd(fd);
+  }
+}
+
+pipexec_t *pipexec_new(void) {
+  pipexec_t *const self = calloc(1, sizeof(pipexec_t));
+  if (self == NULL) {
+    return NULL;
+  }
+  self->config.ready_timeout = 10;
+  self->config.scale_interval = 1000;
+  self->config.cache_size = 1024;
+  self->result = -1;
+  return self;
+}
+
+static void pipexec_remove_pid_file(char const *const pid_file) {
+  ITOCHAR(spid, 16, getpid());
+  logging(lid_internal, "tracing", "info", "Removing pid file", 2,
+          "pid_file", pid_file, "pid", spid);
+  if (unlink(pid_file) == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "tracing", "error", "Cannot remove pid file", 2,
+            "error", strerror(errno), "errno", serrno);
+  }
+}
+
+static void pipexec_finish(pipexec_t *self) {
+  self->result = supervisor_finish();
+  self->state = ps_finished;
+  g_running = NULL;
+  if (self->pid_file != NULL) {
+    pipexec_remove_pid_file(self->pid_file);
+  }
+}
+
+void pipexec_free(pipexec_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  if (self->state == ps_running) {
+    supervisor_stop();
+    while (supervisor_step(-1) != ss_finished) {
+    }
+    pipexec_finish(self);
+  }
+  for (size_t sidx = 0; sidx < self->string_cnt; ++sidx) {
+    free(self->strings[sidx]);
+  }
+  free(self->strings);
+  free(self->args);
+  free(self->control_path);
+  free(self->metrics_addr);
+  free(self->graph_path);
+  free(self->pid_file);
+  free(self->cache_dir);
+  free(self->icmd);
+  free(self->ipipe);
+  free(self->events);
+  free(self);
+}
+
+int pipexec_set_int(pipexec_t *self, enum pipexec_option option, int value) {
+  int *target;
+  int min = 0;
+  switch (option) {
+  case pipexec_opt_sleep_timer:
+    target = &self->config.sleep_timer;
+    break;
+  case pipexec_opt_node_restart:
+    target = &self->config.node_restart;
+    break;
+  case pipexec_opt_kill_all:
+    target = &self->kill_all;
+    break;
+  case pipexec_opt_drain_timeout:
+    target = &self->config.drain_timeout;
+    break;
+  case pipexec_opt_ready_timeout:
+    target = &self->config.ready_timeout;
+    break;
+  case pipexec_opt_scale_interval:
+    target = &self->config.scale_interval;
+    min = 1;
+    break;
+  case pipexec_opt_watchdog_timeout:
+    target = &self->config.watchdog_timeout;
+    break;
+  case pipexec_opt_watchdog_restart:
+    target = &self->config.watchdog_restart;
+    break;
+  case pipexec_opt_signal_handlers:
+    target = &self->config.signal_handlers;
+    break;
+  case pipexec_opt_cache_size:
+    target = &self->config.cache_size;
+    min = 1;
+    break;
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+  if (value < min || self->state != ps_new) {
+    errno = EINVAL;
+    return -1;
+  }
+  *target = value;
+  return 0;
+}
+
+int pipexec_set_string(pipexec_t *self, enum pipexec_option option,
+                       char const *value) {
+  char **target;
+  switch (option) {
+  case pipexec_opt_control_path:
+    target = &self->control_path;
+    break;
+  case pipexec_opt_metrics_addr:
+    target = &self->metrics_addr;
+    break;
+  case pipexec_opt_graph_path:
+    target = &self->graph_path;
+    break;
+  case pipexec_opt_pid_file:
+    target = &self->pid_file;
+    break;
+  case pipexec_opt_cache_dir:
+    target = &self->cache_dir;
+    break;
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+  if (self->state != ps_new) {
+    errno = EINVAL;
+    return -1;
+  }
+  char *const copy = value == NULL ? NULL : strdup(value);
+  if (value != NULL && copy == NULL) {
+    return -1;
+  }
+  free(*target);
+  *target = copy;
+  self->config.control_path = self->control_path;
+  self->config.metrics_addr = self->metrics_addr;
+  self->config.graph_path = self->graph_path;
+  self->config.cache_dir = self->cache_dir;
+  return 0;
+}
+
+// Takes the string over.
+static int pipexec_add_string(pipexec_t *self, char *str) {
+  if (str == NULL) {
+    return -1;
+  }
+  if (self->string_cnt == self->string_size) {
+    size_t const nsize = self->string_size == 0 ? 16 : self->string_size * 2;
+    char **const nstrings = realloc(self->strings, nsize * sizeof(char *));
+    if (nstrings == NULL) {
+      free(str);
+      return -1;
+    }
+    self->strings = nstrings;
+    self->string_size = nsize;
+  }
+  self->strings[self->string_cnt++] = str;
+  return 0;
+}
+
+int pipexec_add_args(pipexec_t *self, int argc, char const *const argv[]) {
+  if (self->state != ps_new) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (int aidx = 0; aidx < argc; ++aidx) {
+    if (pipexec_add_string(self, strdup(argv[aidx])) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Parses the name and its options on a scratch copy: errors are found
+// when the node is added.
+static int pipexec_check_node(char const *name) {
+  char *const copy = strdup(name);
+  if (copy == NULL) {
+    return -1;
+  }
+  char open[] = "[", path[] = "-", close[] = "]";
+  char *argv[] = {open, copy, path, close, NULL};
+  command_info_t icmd[1];
+  memset(icmd, 0, sizeof(icmd));
+  int const result = command_info_array_constrcutor(icmd, 0, 4, argv);
+  free(copy);
+  return result == -1 ? -1 : 0;
+}
+
+// The same for a pipe.
+static int pipexec_check_pipe(char const *spec) {
+  char *const copy = strdup(spec);
+  if (copy == NULL) {
+    return -1;
+  }
+  char *argv[] = {copy, NULL};
+  pipe_info_t ipipe[1];
+  memset(ipipe, 0, sizeof(ipipe));
+  int result = -1;
+  if (pipe_info_clp_count(0, 1, argv) != 1) {
+    logging(lid_internal, "command_line", "error",
+            "Invalid syntax: no pipe desc", 1, "spec", spec);
+    errno = EINVAL;
+  } else {
+    result = pipe_info_parse(ipipe, 0, 1, argv);
+    free(ipipe[0].from.path);
+    free(ipipe[0].to.path);
+  }
+  free(copy);
+  return result;
+}
+
+int pipexec_add_node(pipexec_t *self, char const *name, char const *path,
+                     char const *const args[]) {
+  if (self->state != ps_new) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (pipexec_check_node(name) == -1) {
+    return -1;
+  }
+  char const *const head[] = {"[", name, path};
+  if (pipexec_add_args(self, 3, head) == -1) {
+    return -1;
+  }
+  for (; args != NULL && *args != NULL; ++args) {
+    if (pipexec_add_args(self, 1, args) == -1) {
+      return -1;
+    }
+  }
+  char const *const tail[] = {"]"};
+  return pipexec_add_args(self, 1, tail);
+}
+
+int pipexec_add_pipe(pipexec_t *self, char const *spec) {
+  if (self->state != ps_new) {
+    errno = EINVAL;
+    return -1;
+  }
+  size_t const len = strlen(spec);
+  char *const str = malloc(len + 3);
+  if (str == NULL) {
+    return -1;
+  }
+  snprintf(str, len + 3, spec[0] == '{' ? "%s" : "{%s}", spec);
+  if (pipexec_check_pipe(str) == -1) {
+    free(str);
+    return -1;
+  }
+  return pipexec_add_string(self, str);
+}
+
+static int pipexec_parse(pipexec_t *self) {
+  int const argc = self->string_cnt;
+  self->args = malloc((argc + 1) * sizeof(char *));
+  if (self->args == NULL) {
+    return -1;
+  }
+  memcpy(self->args, self->strings, argc * sizeof(char *));
+  self->args[argc] = NULL;
+  char **const argv = self->args;
+
+  self->command_cnt = command_info_clp_count(0, argc, argv);
+  self->pipe_cnt = pipe_info_clp_count(0, argc, argv);
+
+  SIZETTOCHAR(scommand_cnt, 20, self->command_cnt);
+  logging(lid_internal, "command_line", "info", "Number of commands", 1,
+          "command_cnt", scommand_cnt);
+  SIZETTOCHAR(spipe_cnt, 20, self->pipe_cnt);
+  logging(lid_internal, "command_line", "info", "Number of pipes", 1,
+          "pipe_cnt", spipe_cnt);
+
+  // On the heap: a graph might have thousands of nodes and pipes.
+  self->icmd = calloc(self->command_cnt + 1, sizeof(command_info_t));
+  self->ipipe = calloc(self->pipe_cnt + 1, sizeof(pipe_info_t));
+  if (self->icmd == NULL || self->ipipe == NULL) {
+    return -1;
+  }
+
+  int const handled_args =
+      command_info_array_constrcutor(self->icmd, 0, argc, argv);
+  if (handled_args == -1) {
+    return -1;
+  }
+  command_info_array_print(self->icmd, self->command_cnt);
+
+  if (pipe_info_parse(self->ipipe, 0, argc, argv) == -1) {
+    return -1;
+  }
+  pipe_info_print(self->ipipe, self->pipe_cnt);
+  if (pipe_info_check_for_duplicates(self->ipipe, self->pipe_cnt) == -1) {
+    return -1;
+  }
+
+  ITOCHAR(shandled_args, 16, handled_args);
+  logging(lid_internal, "command_line", "info", "Number of handled args", 1,
+          "handled_args", shandled_args);
+  int const not_processed_args = argc - self->pipe_cnt - handled_args;
+  ITOCHAR(snot_processed_args, 16, not_processed_args);
+  logging(lid_internal, "command_line", "info", "Not processed args", 1,
+          "not_processed_args", snot_processed_args);
+
+  if (not_processed_args > 0) {
+    logging(lid_internal, "command_line", "error",
+            "Error: rubbish / unparsable parameters given", 0);
+    errno = EINVAL;
+    return -1;
+  }
+  for (size_t cidx = 0; cidx < self->command_cnt; ++cidx) {
+    if (self->icmd[cidx].cache && self->cache_dir == NULL) {
+      logging(lid_internal, "command_line", "error",
+              "The option cache needs a cache directory", 1,
+              "command", self->icmd[cidx].cmd_name);
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void pipexec_write_pid_file(char const *const pid_file) {
+  ITOCHAR(spid, 16, getpid());
+  logging(lid_internal, "tracing", "info", "Writing pid file", 2,
+          "pid_file", pid_file, "pid", spid);
+  char pbuf[20];
+  int const plen = snprintf(pbuf, 20, "%d\n", getpid());
+  int const fd =
+      open(pid_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "tracing", "error", "Cannot open pid file", 2,
+            "error", strerror(errno), "errno", serrno);
+    return;
+  }
+  ssize_t const written = write(fd, pbuf, plen);
+  if (written != plen) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "tracing", "error", "Write error writing pid", 2,
+            "error", strerror(errno), "errno", serrno);
+  }
+  close(fd);
+}
+
+static void pipexec_queue(pipexec_t *self, enum pipexec_event_type type,
+                          size_t node, pid_t pid, int status) {
+  if (self->event_cnt == self->event_size) {
+    size_t const nsize = self->event_size == 0 ? 64 : self->event_size * 2;
+    struct pipexec_event *const nevents =
+        malloc(nsize * sizeof(struct pipexec_event));
+    if (nevents == NULL) {
+      logging(lid_internal, "status", "error", "Memory allocation failed", 0);
+      return;
+    }
+    for (size_t eidx = 0; eidx < self->event_cnt; ++eidx) {
+      nevents[eidx] =
+          self->events[(self->event_first + eidx) % self->event_size];
+    }
+    free(self->events);
+    self->events = nevents;
+    self->event_first = 0;
+    self->event_size = nsize;
+  }
+  struct pipexec_event *const event =
+      &self->events[(self->event_first + self->event_cnt) % self->event_size];
+  event->type = type;
+  event->node = node;
+  event->pid = pid;
+  event->status = status;
+  ++self->event_cnt;
+}
+
+static void pipexec_event_cb(enum supervisor_event event, size_t node,
+                             pid_t pid, int status, void *data) {
+  pipexec_queue(data,
+                event == se_started ? pipexec_ev_started : pipexec_ev_exited,
+                node, pid, status);
+}
+
+int pipexec_start(pipexec_t *self) {
+  if (g_running != NULL) {
+    errno = EBUSY;
+    return -1;
+  }
+  if (self->state != ps_new) {
+    errno = EINVAL;
+    return -1;
+  }
+  logging(lid_internal, "version", "info", "pipexec", 1,
+          "version", app_version);
+  if (pipexec_parse(self) == -1) {
+    // The parser changed the arguments: there is no second try.
+    self->state = ps_finished;
+    return -1;
+  }
+  if (self->pid_file != NULL) {
+    pipexec_write_pid_file(self->pid_file);
+  }
+  if (self->kill_all) {
+    set_kill_child_processes();
+  }
+  // The signal handlers would call the callback: it allocates memory.
+  if (!self->config.signal_handlers) {
+    self->config.event_cb = pipexec_event_cb;
+    self->config.event_data = self;
+  }
+  g_running = self;
+  self->state = ps_running;
+  if (supervisor_start(&self->config, self->icmd, self->command_cnt,
+                       self->ipipe, self->pipe_cnt) == -1) {
+    int const serr = errno;
+    self->state = ps_finished;
+    g_running = NULL;
+    if (self->pid_file != NULL) {
+      pipexec_remove_pid_file(self->pid_file);
+    }
+    errno = serr;
+    return -1;
+  }
+  return 0;
+}
+
+int pipexec_fd(pipexec_t *self) {
+  (void)self;
+  return event_loop_fd();
+}
+
+int pipexec_dispatch(pipexec_t *self, int timeout_ms) {
+  if (self->state != ps_running) {
+    return self->state == ps_finished ? 1 : -1;
+  }
+  enum supervisor_step step = supervisor_step(timeout_ms);
+  // All which is pending: the fd is not readable for the rest.
+  while (step == ss_event) {
+    step = supervisor_step(0);
+  }
+  if (step != ss_finished) {
+    return 0;
+  }
+  pipexec_finish(self);
+  pipexec_queue(self, pipexec_ev_finished, 0, 0, self->result);
+  return 1;
+}
+
+void pipexec_stop(pipexec_t *self) {
+  if (self->state == ps_running) {
+    supervisor_stop();
+  }
+}
+
+int pipexec_result(pipexec_t const *self) {
+  return self->result;
+}
+
+int pipexec_run(pipexec_t *self) {
+  if (pipexec_start(self) == -1) {
+    return -1;
+  }
+  while (pipexec_dispatch(self, -1) == 0) {
+  }
+  // Nobody asks for them.
+  self->event_cnt = 0;
+  return self->result;
+}
+
+int pipexec_run_batch(pipexec_t *self, char const *list_path, int parallel) {
+  if (self->control_path != NULL || self->metrics_addr != NULL ||
+      self->graph_path != NULL) {
+    logging(lid_internal, "command_line", "error",
+            "Control socket, metrics and graph export are not available"
+            " in batch mode", 0);
+    errno = EINVAL;
+    return -1;
+  }
+  if (self->state != ps_new || parallel <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  logging(lid_internal, "version", "info", "pipexec", 1,
+          "version", app_version);
+  if (pipexec_parse(self) == -1) {
+    self->state = ps_finished;
+    return -1;
+  }
+  if (self->pid_file != NULL) {
+    pipexec_write_pid_file(self->pid_file);
+  }
+  if (self->kill_all) {
+    set_kill_child_processes();
+  }
+  g_running = self;
+  self->state = ps_running;
+  int const result = batch_run(list_path, parallel, &self->config,
+                               self->icmd, self->command_cnt, self->ipipe,
+                               self->pipe_cnt);
+  int const serr = errno;
+  self->result = result == -1 ? 1 : result;
+  self->state = ps_finished;
+  g_running = NULL;
+  if (self->pid_file != NULL) {
+    pipexec_remove_pid_file(self->pid_file);
+  }
+  errno = serr;
+  return result;
+}
+
+int pipexec_next_event(pipexec_t *self, struct pipexec_event *event) {
+  if (self->event_cnt == 0) {
+    return -1;
+  }
+  *event = self->events[self->event_first];
+  self->event_first = (self->event_first + 1) % self->event_size;
+  --self->event_cnt;
+  return 0;
+}
+
+size_t pipexec_node_count(pipexec_t const *self) {
+  return self->command_cnt;
+}
+
+int pipexec_node_index(pipexec_t const *self, char const *name) {
+  for (size_t cidx = 0; cidx < self->command_cnt; ++cidx) {
+    if (strcmp(self->icmd[cidx].cmd_name, name) == 0) {
+      return cidx;
+    }
+  }
+  return -1;
+}
+
+int pipexec_node_status(pipexec_t const *self, size_t node,
+                        struct pipexec_node_status *status) {
+  if (self->state != ps_running || node >= self->command_cnt) {
+    errno = EINVAL;
+    return -1;
+  }
+  node_info_t const *const info = &supervisor_nodes()[node];
+  status->name = self->icmd[node].cmd_name;
+  status->state = node_state_name(info->state);
+  status->pid = info->pid;
+  status->restarts = info->restart_cnt;
+  status->exits = info->exit_cnt;
+  status->failures = info->failure_cnt;
+  status->last_status = info->last_status;
+  status->cpu_seconds = info->cpu_usec / 1e6;
+  status->rss_bytes = -1;
+  double cpu;
+  long rss;
+  if (info->pid != 0 && metrics_proc_sample(info->pid, &cpu, &rss) == 0) {
+    status->cpu_seconds += cpu;
+    status->rss_bytes = rss;
+  }
+  return 0;
+}
+
+int pipexec_write_metrics(pipexec_t const *self, FILE *out) {
+  if (self->state != ps_running) {
+    errno = EINVAL;
+    return -1;
+  }
+  supervisor_print_metrics(out);
+  return 0;
+}
+
+int pipexec_write_graph(pipexec_t const *self, FILE *out,
+                        char const *format) {
+  if (self->state != ps_running ||
+      supervisor_print_graph(out, format) != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,183 @@
+#ifndef PIPEXEC_LIBPIPEXEC_H
+#define PIPEXEC_LIBPIPEXEC_H
+
+/*
+ * libpipexec
+ *
+ * The graph, the spawning and the supervision of pipexec as a library:
+ * a program builds a graph of processes and pipes, starts it and
+ * handles its events in its own event loop - the fd of pipexec_fd()
+ * is readable when there is something to do for pipexec_dispatch().
+ * The pipexec command is a client of this interface.
+ *
+ * The supervisor is made to be the parent of all children:
+ *  o There is only one running graph per process.
+ *  o Only the processes of the graph are waited for (with a pidfd
+ *    each): the program can have children of its own.  While the
+ *    graph runs, a SIGCHLD handler is installed which only wakes up
+ *    the loop; the former handler is restored afterwards.
+ *  o Handlers for SIGHUP, SIGINT, SIGQUIT and SIGTERM are only
+ *    installed with the option pipexec_opt_signal_handlers.
+ *  o Errors in the graph description (see pipexec(1)) are logged and
+ *    returned as -1 with errno EINVAL; the library never exits the
+ *    process.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef struct pipexec pipexec_t;
+
+// Version of the library (and of pipexec).
+char const *pipexec_version(void);
+
+// Logging of all graphs: to the fd or (fd -1) to syslog.
+// Default: no logging.
+void pipexec_log_text(int fd);
+void pipexec_log_json(int fd);
+
+pipexec_t *pipexec_new(void);
+// Stops the graph if it is still running.
+void pipexec_free(pipexec_t *self);
+
+// The options are the ones of pipexec(1).  They must be set before
+// the start.  Both functions return -1 (errno EINVAL) if the option is
+// not of the type or the value is out of range.
+enum pipexec_option {
+  // int: seconds before a restart; 0 (default): no restart (-s)
+  pipexec_opt_sleep_timer,
+  // int: restart single processes instead of all (-R)
+  pipexec_opt_node_restart,
+  // int: kill all processes when one terminates abnormally (-k)
+  pipexec_opt_kill_all,
+  // int: seconds per stage of a drain on the stop (-d)
+  pipexec_opt_drain_timeout,
+  // int: seconds to wait for a process to get ready (-w)
+  pipexec_opt_ready_timeout,
+  // int: milli seconds between two autoscaling checks (-a)
+  pipexec_opt_scale_interval,
+  // int: seconds without progress until a process is stalled (-g)
+  pipexec_opt_watchdog_timeout,
+  // int: restart stalled processes (-G)
+  pipexec_opt_watchdog_restart,
+  // int: install the termination and restart signal handlers
+  pipexec_opt_signal_handlers,
+  // int: size of the cache in MiB (default 1024) (-M)
+  pipexec_opt_cache_size,
+  // string: path of the control socket (-c)
+  pipexec_opt_control_path,
+  // string: address of the metrics exporter (-m)
+  pipexec_opt_metrics_addr,
+  // string: file the graph is exported to after each start (-x)
+  pipexec_opt_graph_path,
+  // string: file the pid is written to while the graph runs (-p)
+  pipexec_opt_pid_file,
+  // string: directory of the cache of the nodes with the option
+  // 'cache' (-C)
+  pipexec_opt_cache_dir
+};
+
+int pipexec_set_int(pipexec_t *self, enum pipexec_option option, int value);
+// The value is copied.
+int pipexec_set_string(pipexec_t *self, enum pipexec_option option,
+                       char const *value);
+
+// The graph: all strings are copied.  Syntax errors of a node name or
+// a pipe are found when it is added (-1, errno EINVAL); errors of the
+// whole graph during the start.
+// Adds process and pipe descriptions in the syntax of the command line,
+// e.g. "[", "A", "/bin/cat", "]", "{A:1>B:0}".
+int pipexec_add_args(pipexec_t *self, int argc, char const *const argv[]);
+// name can have options: "B,notify=3".  args are the arguments after
+// the path (NULL terminated; can be NULL).
+int pipexec_add_node(pipexec_t *self, char const *name, char const *path,
+                     char const *const args[]);
+// spec as in the command line - the braces can be left out:
+// "A:1>B:0,relay"
+int pipexec_add_pipe(pipexec_t *self, char const *spec);
+
+// Starts the graph.  Returns -1 with errno EBUSY if a graph is already
+// running, EINVAL if the graph is wrong (e.g. unparsable arguments or
+// options which do not fit together) and the errno of a failing system
+// call.  A graph which failed to start cannot be started again.
+int pipexec_start(pipexec_t *self);
+// Readable when pipexec_dispatch() has something to do; -1 on error.
+int pipexec_fd(pipexec_t *self);
+// Handles the events: waits up to timeout_ms (0: does not block, -1:
+// no limit) for the first one.  Returns 1 when the graph is finished,
+// else 0 - and -1 if it is not running.
+int pipexec_dispatch(pipexec_t *self, int timeout_ms);
+// Terminates all processes - after a drain if configured.  Does not
+// block: pipexec_dispatch() returns 1 when all of them are gone.
+void pipexec_stop(pipexec_t *self);
+// Result of the finished graph: 1 if a process failed, else 0; -1 if
+// it is not finished.
+int pipexec_result(pipexec_t const *self);
+
+// Start, dispatch until the graph is finished and return the result.
+int pipexec_run(pipexec_t *self);
+// Runs the graph once per line of list_path ('-': stdin) with up to
+// parallel instances: see option -B of pipexec(1).  Blocks until all
+// instances are finished; only the instances are waited for.  A
+// SIGCHLD handler (and with pipexec_opt_signal_handlers the ones for
+// the termination) is installed meanwhile and the former ones are
+// restored afterwards.
+int pipexec_run_batch(pipexec_t *self, char const *list_path, int parallel);
+
+// Events of the running graph: collected by pipexec_dispatch().
+enum pipexec_event_type {
+  pipexec_ev_started,
+  // status: as returned by wait(2)
+  pipexec_ev_exited,
+  // The graph is finished: status is the result.
+  pipexec_ev_finished
+};
+
+struct pipexec_event {
+  enum pipexec_event_type type;
+  size_t node;
+  pid_t pid;
+  int status;
+};
+
+// Returns 0 and removes the oldest event - or -1 if there is none.
+int pipexec_next_event(pipexec_t *self, struct pipexec_event *event);
+
+// Status of the nodes of the running graph.
+struct pipexec_node_status {
+  char const *name;
+  // 'stopped', 'running', 'paused' or 'exited'
+  char const *state;
+  // 0: not running
+  pid_t pid;
+  unsigned int restarts;
+  unsigned int exits;
+  unsigned int failures;
+  // Of the last termination as returned by wait(2)
+  int last_status;
+  // Of all runs
+  double cpu_seconds;
+  // Of the current run; -1: not known
+  long rss_bytes;
+};
+
+size_t pipexec_node_count(pipexec_t const *self);
+// Returns -1 if there is no such node.
+int pipexec_node_index(pipexec_t const *self, char const *name);
+// Returns -1 (errno EINVAL) if the graph is not running or there is
+// no such node.
+int pipexec_node_status(pipexec_t const *self, size_t node,
+                        struct pipexec_node_status *status);
+
+// The metrics (OpenMetrics) and the graph ('dot' or 'json') as the
+// control socket writes them.  Return -1 (errno EINVAL) if the graph
+// is not running or the format is unknown.
+int pipexec_write_metrics(pipexec_t const *self, FILE *out);
+int pipexec_write_graph(pipexec_t const *self, FILE *out,
+                        char const *format);
+
+#endif
@@ -204,6 +204,11 @@ void logging_json(enum logid lid, char const * const type,
   }
 }
 
+int logging_enabled() {
+  return g_log_text_fd!=-1 || g_log_text_use_syslog==1
+    || g_log_json_fd!=-1 || g_log_json_use_syslog==1;
+}
+
 void logging(enum logid lid, char const * const type,
 	     char const * const serverity,
 	     char const * const msg,
@@ -21,9 +21,17 @@ void logging_json_set_global_use_syslog();
 enum logid {
   lid_internal = 0,
   lid_command_pid = 1,
-  lid_child_exit = 2
+  lid_child_exit = 2,
+  lid_command_ready = 3,
+  lid_node_stalled = 4,
+  lid_batch_instance = 5,
+  lid_batch_done = 6
 };
 
+// Returns 1 if log messages are written anywhere: messages which are
+// expensive to build can be skipped else.
+int logging_enabled();
+
 void logging(enum logid lid,
 	     char const * const type,
 	     char const * const serverity,
@@ -0,0 +1,455 @@
+/*
+ * Metrics
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _GNU_SOURCE
+
+#include "src/metrics.h"
+#include "src/event_loop.h"
+#include "src/server_socket.h"
+#include "src/logging.h"
+#include "src/relay.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define METRICS_REQUEST_MAX 4096
+
+struct metrics_client {
+  int fd;
+  size_t len;
+  char request[METRICS_REQUEST_MAX];
+};
+
+static int g_metrics_fd = -1;
+static char const *g_metrics_path = NULL;
+
+// Label values must escape backslash, double quote and newline.
+static void metrics_label(FILE *out, char const *str) {
+  for (; *str != '\0'; ++str) {
+    if (*str == '\\' || *str == '"') {
+      fputc('\\', out);
+      fputc(*str, out);
+    } else if (*str == '\n') {
+      fputs("\\n", out);
+    } else {
+      fputc(*str, out);
+    }
+  }
+}
+
+static void metrics_node_labels(FILE *out, command_info_t const *cmd) {
+  fputs("{node=\"", out);
+  metrics_label(out, cmd->cmd_name);
+  fputs("\"}", out);
+}
+
+static void metrics_pipe_end(FILE *out, pipes_end_info_t const *pend) {
+  switch (pend->type) {
+  case pet_command:
+    metrics_label(out, pend->name);
+    fprintf(out, ":%d", pend->fd);
+    break;
+  case pet_file:
+    fputs("FILE:", out);
+    metrics_label(out, pend->path);
+    break;
+  case pet_parent:
+    fprintf(out, "PARENT:%d", pend->fd);
+    break;
+  case pet_fifo:
+    fputs("FIFO:", out);
+    metrics_label(out, pend->path);
+    break;
+  }
+}
+
+static void metrics_edge_labels(FILE *out, size_t pidx,
+                                pipe_info_t const *pipe) {
+  fprintf(out, "{edge=\"%zu\",from=\"", pidx);
+  metrics_pipe_end(out, &pipe->from);
+  fputs("\",to=\"", out);
+  metrics_pipe_end(out, &pipe->to);
+  fputs("\"}", out);
+}
+
+int metrics_proc_sample(pid_t pid, double *cpu, long *rss) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  FILE *const stat = fopen(path, "r");
+  if (stat == NULL) {
+    return -1;
+  }
+  char buf[1024];
+  size_t const len = fread(buf, 1, sizeof(buf) - 1, stat);
+  fclose(stat);
+  buf[len] = '\0';
+
+  // The command name might contain spaces and parenthesis.
+  char const *const cmd_end = strrchr(buf, ')');
+  unsigned long utime, stime;
+  long rss_pages;
+  if (cmd_end == NULL ||
+      sscanf(cmd_end + 1,
+             " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu"
+             " %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+             &utime, &stime, &rss_pages) != 3) {
+    return -1;
+  }
+  *cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+  *rss = rss_pages * sysconf(_SC_PAGESIZE);
+  return 0;
+}
+
+static void metrics_write_nodes(FILE *out, command_info_t const *icmd,
+                                node_info_t const *nodes,
+                                size_t command_cnt) {
+  time_t const now = time(NULL);
+
+  fputs("# TYPE pipexec_node_up gauge\n"
+        "# HELP pipexec_node_up 1 if the process is running.\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    fputs("pipexec_node_up", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %d\n", nodes[cidx].pid != 0 ? 1 : 0);
+  }
+
+  fputs("# TYPE pipexec_node_restarts counter\n"
+        "# HELP pipexec_node_restarts Restarts of the single process.\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    fputs("pipexec_node_restarts_total", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %u\n", nodes[cidx].restart_cnt);
+  }
+
+  fputs("# TYPE pipexec_node_exits counter\n"
+        "# HELP pipexec_node_exits Terminations of the process.\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    fputs("pipexec_node_exits_total", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %u\n", nodes[cidx].exit_cnt);
+  }
+
+  fputs("# TYPE pipexec_node_failures counter\n"
+        "# HELP pipexec_node_failures Terminations with a status != 0.\n",
+        out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    fputs("pipexec_node_failures_total", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %u\n", nodes[cidx].failure_cnt);
+  }
+
+  fputs("# TYPE pipexec_node_stalls counter\n"
+        "# HELP pipexec_node_stalls Stalls found by the watchdog.\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    fputs("pipexec_node_stalls_total", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %u\n", nodes[cidx].stall_cnt);
+  }
+
+  fputs("# TYPE pipexec_node_last_exit_code gauge\n"
+        "# HELP pipexec_node_last_exit_code Exit code of the last"
+        " termination; 128 + signal if signaled.\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    if (nodes[cidx].exit_cnt == 0) {
+      continue;
+    }
+    int const status = nodes[cidx].last_status;
+    fputs("pipexec_node_last_exit_code", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %d\n", WIFEXITED(status) ? WEXITSTATUS(status)
+                                            : 128 + WTERMSIG(status));
+  }
+
+  fputs("# TYPE pipexec_node_uptime_seconds gauge\n"
+        "# HELP pipexec_node_uptime_seconds Time since the last start.\n",
+        out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    fputs("pipexec_node_uptime_seconds", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %ld\n",
+            nodes[cidx].pid != 0 ? (long)(now - nodes[cidx].start_time) : 0L);
+  }
+
+  fputs("# TYPE pipexec_node_ready_seconds gauge\n"
+        "# HELP pipexec_node_ready_seconds Time from fork until the"
+        " process was ready.\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    if (nodes[cidx].pid == 0 || !nodes[cidx].ready) {
+      continue;
+    }
+    fputs("pipexec_node_ready_seconds", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %.6f\n", nodes[cidx].ready_usec / 1e6);
+  }
+
+  fputs("# TYPE pipexec_node_processes gauge\n"
+        "# HELP pipexec_node_processes Running processes of a scaled"
+        " node (including replicas).\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    if (icmd[cidx].scale_max == 0) {
+      continue;
+    }
+    unsigned int processes = nodes[cidx].pid != 0;
+    for (unsigned int ridx = 0; ridx < nodes[cidx].replica_cnt; ++ridx) {
+      processes += !nodes[cidx].replicas[ridx].stopping;
+    }
+    fputs("pipexec_node_processes", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %u\n", processes);
+  }
+
+  // CPU and RSS are sampled in one go: one read of /proc per process.
+  double *const cpu = malloc((command_cnt + 1) * sizeof(double));
+  long *const rss = malloc((command_cnt + 1) * sizeof(long));
+  if (cpu == NULL || rss == NULL) {
+    free(cpu);
+    free(rss);
+    return;
+  }
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    cpu[cidx] = 0;
+    rss[cidx] = -1;
+    if (nodes[cidx].pid != 0) {
+      metrics_proc_sample(nodes[cidx].pid, &cpu[cidx], &rss[cidx]);
+    }
+  }
+
+  fputs("# TYPE pipexec_node_cpu_seconds counter\n"
+        "# HELP pipexec_node_cpu_seconds User and system CPU time of all"
+        " runs of the process.\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    fputs("pipexec_node_cpu_seconds_total", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %.3f\n", nodes[cidx].cpu_usec / 1e6 + cpu[cidx]);
+  }
+
+  fputs("# TYPE pipexec_node_rss_bytes gauge\n"
+        "# HELP pipexec_node_rss_bytes Resident set size of the running"
+        " process.\n", out);
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    if (rss[cidx] == -1) {
+      continue;
+    }
+    fputs("pipexec_node_rss_bytes", out);
+    metrics_node_labels(out, &icmd[cidx]);
+    fprintf(out, " %ld\n", rss[cidx]);
+  }
+  free(cpu);
+  free(rss);
+}
+
+static void metrics_write_edges(FILE *out, pipe_info_t const *ipipe,
+                                size_t pipe_cnt) {
+  // The fill level is only known for shm rings and the pipes where
+  // the supervisor kept the read end.
+  fputs("# TYPE pipexec_edge_fill_bytes gauge\n"
+        "# HELP pipexec_edge_fill_bytes Bytes written but not yet read.\n",
+        out);
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    long const fill = pipe_info_fill(&ipipe[pidx]);
+    if (fill == -1) {
+      continue;
+    }
+    fputs("pipexec_edge_fill_bytes", out);
+    metrics_edge_labels(out, pidx, &ipipe[pidx]);
+    fprintf(out, " %ld\n", fill);
+  }
+
+  fputs("# TYPE pipexec_edge_capacity_bytes gauge\n"
+        "# HELP pipexec_edge_capacity_bytes Size of the pipe buffer.\n",
+        out);
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    long const capacity = pipe_info_capacity(&ipipe[pidx]);
+    if (capacity == -1) {
+      continue;
+    }
+    fputs("pipexec_edge_capacity_bytes", out);
+    metrics_edge_labels(out, pidx, &ipipe[pidx]);
+    fprintf(out, " %ld\n", capacity);
+  }
+
+  fputs("# TYPE pipexec_edge_bytes counter\n"
+        "# HELP pipexec_edge_bytes Bytes transferred over the edge.\n", out);
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    relay_stats_t stats;
+    if (relay_stats(pidx, &stats) == 0) {
+      fputs("pipexec_edge_bytes_total", out);
+      metrics_edge_labels(out, pidx, &ipipe[pidx]);
+      fprintf(out, " %llu\n", (unsigned long long)stats.bytes);
+      continue;
+    }
+    if (ipipe[pidx].type != pt_shm || ipipe[pidx].ring == NULL) {
+      continue;
+    }
+    fputs("pipexec_edge_bytes_total", out);
+    metrics_edge_labels(out, pidx, &ipipe[pidx]);
+    fprintf(out, " %llu\n",
+            (unsigned long long)shm_ring_read_total(ipipe[pidx].ring));
+  }
+
+  // Only relays know about chunks and stalls.
+  fputs("# TYPE pipexec_edge_chunks counter\n"
+        "# HELP pipexec_edge_chunks Chunks moved by the relay.\n", out);
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    relay_stats_t stats;
+    if (relay_stats(pidx, &stats) == 0) {
+      fputs("pipexec_edge_chunks_total", out);
+      metrics_edge_labels(out, pidx, &ipipe[pidx]);
+      fprintf(out, " %llu\n", (unsigned long long)stats.chunks);
+    }
+  }
+
+  fputs("# TYPE pipexec_edge_stall_seconds counter\n"
+        "# HELP pipexec_edge_stall_seconds Time the reader's pipe was full"
+        " while data was waiting.\n", out);
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    relay_stats_t stats;
+    if (relay_stats(pidx, &stats) == 0) {
+      fputs("pipexec_edge_stall_seconds_total", out);
+      metrics_edge_labels(out, pidx, &ipipe[pidx]);
+      fprintf(out, " %.6f\n", stats.stall_usec / 1e6);
+    }
+  }
+}
+
+void metrics_write(FILE *out, command_info_t const *icmd,
+                   node_info_t const *nodes, size_t command_cnt,
+                   pipe_info_t const *ipipe, size_t pipe_cnt) {
+  metrics_write_nodes(out, icmd, nodes, command_cnt);
+  metrics_write_edges(out, ipipe, pipe_cnt);
+  fputs("# EOF\n", out);
+}
+
+static void metrics_client_close(struct metrics_client *client) {
+  event_loop_remove_fd(client->fd);
+  close(client->fd);
+  free(client);
+}
+
+// The answer can be large (thousands of nodes): it is sent blocking,
+// but with a timeout - a stuck scraper must not stop the supervisor.
+static void metrics_respond(int fd) {
+  char *body = NULL;
+  size_t body_len = 0;
+  FILE *const out = open_memstream(&body, &body_len);
+  if (out == NULL) {
+    return;
+  }
+  supervisor_print_metrics(out);
+  fclose(out);
+
+  char header[256];
+  int const header_len = snprintf(
+      header, sizeof(header),
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: application/openmetrics-text; version=1.0.0;"
+      " charset=utf-8\r\n"
+      "Content-Length: %zu\r\n"
+      "Connection: close\r\n\r\n",
+      body_len);
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+  struct timeval const timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  char const *bufs[2] = {header, body};
+  size_t lens[2] = {(size_t)header_len, body_len};
+  for (int bidx = 0; bidx < 2; ++bidx) {
+    while (lens[bidx] > 0) {
+      ssize_t const wr = send(fd, bufs[bidx], lens[bidx], MSG_NOSIGNAL);
+      if (wr == -1 && errno == EINTR) {
+        continue;
+      }
+      if (wr <= 0) {
+        free(body);
+        return;
+      }
+      bufs[bidx] += wr;
+      lens[bidx] -= wr;
+    }
+  }
+  free(body);
+}
+
+static void metrics_client_read(int fd, void *data) {
+  struct metrics_client *const client = data;
+  ssize_t const rd = read(fd, client->request + client->len,
+                          METRICS_REQUEST_MAX - 1 - client->len);
+  if (rd == -1 && (errno == EINTR || errno == EAGAIN)) {
+    return;
+  }
+  if (rd <= 0) {
+    metrics_client_close(client);
+    return;
+  }
+  client->len += rd;
+  client->request[client->len] = '\0';
+
+  // Whatever is requested: the answer is always the same.
+  if (strstr(client->request, "\r\n\r\n") != NULL ||
+      strstr(client->request, "\n\n") != NULL ||
+      client->len == METRICS_REQUEST_MAX - 1) {
+    metrics_respond(fd);
+    metrics_client_close(client);
+  }
+}
+
+static void metrics_accept(int fd, void *data) {
+  (void)data;
+  int const cfd = accept(fd, NULL, NULL);
+  if (cfd == -1) {
+    return;
+  }
+  server_socket_set_flags(cfd);
+
+  struct metrics_client *const client = malloc(sizeof(struct metrics_client));
+  if (client == NULL) {
+    close(cfd);
+    return;
+  }
+  client->fd = cfd;
+  client->len = 0;
+  event_loop_add_fd(cfd, metrics_client_read, client);
+}
+
+int metrics_open(char const *addr) {
+  int const is_unix = addr[0] == '/';
+  int const fd = is_unix ? server_socket_unix(addr) : server_socket_tcp(addr);
+  if (fd == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "metrics", "error", "Cannot create metrics socket",
+            3, "address", addr, "errno", serrno, "error", strerror(errno));
+    return -1;
+  }
+
+  logging(lid_internal, "metrics", "info", "Metrics socket created", 1,
+          "address", addr);
+  g_metrics_fd = fd;
+  g_metrics_path = is_unix ? addr : NULL;
+  event_loop_add_fd(fd, metrics_accept, NULL);
+  return 0;
+}
+
+void metrics_close() {
+  if (g_metrics_fd == -1) {
+    return;
+  }
+  event_loop_remove_fd(g_metrics_fd);
+  close(g_metrics_fd);
+  if (g_metrics_path != NULL) {
+    unlink(g_metrics_path);
+  }
+  g_metrics_fd = -1;
+}
@@ -0,0 +1,39 @@
+#ifndef PIPEXEC_METRICS_H
+#define PIPEXEC_METRICS_H
+
+/*
+ * Metrics
+ *
+ * Writes the state of the graph in the OpenMetrics text format and
+ * serves it on a unix domain or (loopback) TCP socket via HTTP, e.g.
+ * for Prometheus.
+ * The counters are kept up to date by the supervisor when something
+ * happens (start or termination of a process); a scrape only reads
+ * them and samples the values of the running processes (CPU, RSS)
+ * and pipes (fill level).
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "src/command_info.h"
+#include "src/pipe_info.h"
+#include "src/supervisor.h"
+
+#include <stdio.h>
+
+void metrics_write(FILE *out, command_info_t const *icmd,
+                   node_info_t const *nodes, size_t command_cnt,
+                   pipe_info_t const *ipipe, size_t pipe_cnt);
+
+// Reads CPU time (in seconds) and RSS (in bytes) of a running process.
+// Returns -1 if the process is not available (any longer).
+int metrics_proc_sample(pid_t pid, double *cpu, long *rss);
+
+// addr is a path (starting with '/') for a unix domain socket or
+// '[ipv4-address:]port' for TCP.  Returns -1 on error (the error is
+// logged).
+int metrics_open(char const *addr);
+void metrics_close();
+
+#endif
@@ -18,9 +18,36 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/uio.h>
 #include "src/version.h"
-
-size_t const buffer_size = 4096;
+#include "src/uring.h"
+#include "src/fdio.h"
+
+// user_data of the write request; reads use the input index.
+#define PEET_URING_WRITE UINT64_MAX
+// Maximum number of buffers in one writev (IOV_MAX on Linux).
+#define PEET_URING_MAX_IOV 1024
+// Default bytes per input and cycle for the rr and wfq policies
+#define PEET_DEFAULT_QUOTA (64 * 1024)
+// Without -b: default size of the buffer of each input; the reads
+// start with the minimum size and adapt up to the buffer size.
+#define PEET_DEFAULT_BUFFER_SIZE (64 * 1024)
+#define PEET_MIN_READ_SIZE 4096
+
+/* Which input is read next when more than one has data. */
+enum merge_policy {
+  // Each input once in the order of the command line
+  mp_order,
+  // Round-robin: each input up to the quota per cycle
+  mp_rr,
+  // Weighted fair: deficit round-robin with quota * weight per cycle
+  mp_wfq,
+  // Strict priority: only the input with the highest weight is read
+  mp_prio
+};
 
 /* This is the structure which is created for each file descriptor.
    As the boundary read / write needs always complete blocks,
@@ -32,10 +59,23 @@ struct fddata_t {
   ssize_t m_buffer_used;
   int m_use_boundary;
   int m_eof_seen;
+  // Without boundary: move the data with splice when possible and
+  // adapt the size of the reads.
+  int m_use_splice;
+  fdio_adapt_t m_adapt;
+  // Merge policy: weight (or priority) and bytes left in this cycle
+  int m_weight;
+  int64_t m_deficit;
+  // Statistics: bytes forwarded and time the input had data waiting
+  uint64_t m_bytes;
+  uint64_t m_wait_usec;
+  // When the data became available; 0: no data waiting
+  uint64_t m_ready_since;
 };
 
 void fddata_init(struct fddata_t *self, struct pollfd *pfd, int fd,
-		 int use_boundary, int block_size) {
+		 int write_fd, int use_boundary, char *buffer,
+		 size_t buffer_size) {
   pfd->fd = fd;
   pfd->events = POLLIN;
 
@@ -46,12 +86,19 @@ void fddata_init(struct fddata_t *self, struct pollfd *pfd, int fd,
     exit(2);
   }
 
-  self->m_buffer_size = block_size;
+  self->m_buffer_size = buffer_size;
   self->m_buffer_used = 0;
-  self->m_buffer = malloc(block_size);
+  self->m_buffer = buffer;
 
   self->m_use_boundary = use_boundary;
   self->m_eof_seen = 0;
+  self->m_use_splice = !use_boundary && fdio_can_splice(fd, write_fd);
+  fdio_adapt_init(&self->m_adapt, PEET_MIN_READ_SIZE, buffer_size);
+  self->m_weight = 1;
+  self->m_deficit = 0;
+  self->m_bytes = 0;
+  self->m_wait_usec = 0;
+  self->m_ready_since = 0;
 }
 
 void fddata_write(struct fddata_t *self, int write_fd, int use_debug_log) {
@@ -60,18 +107,11 @@ void fddata_write(struct fddata_t *self, int write_fd, int use_debug_log) {
     fprintf(stderr, "WRITE len [%zd]\n", self->m_buffer_used);
   }
 
-  ssize_t const wr = write(write_fd, self->m_buffer, self->m_buffer_used);
-
-  if (wr == -1) {
+  if (fdio_write_all(write_fd, self->m_buffer, self->m_buffer_used) == -1) {
     perror("write");
     exit(2);
   }
 
-  if (wr != self->m_buffer_used) {
-    perror("Could not write all data");
-    exit(2);
-  }
-
   self->m_buffer_used = 0;
 }
 
@@ -87,11 +127,13 @@ int fddata_read_write(struct fddata_t *self, struct pollfd *pfd,
 
   if (pfd->revents & POLLIN) {
 
-    size_t const bytes_to_read = self->m_buffer_size - self->m_buffer_used;
-    ssize_t const bytes_read = read(
-       pfd->fd, self->m_buffer + self->m_buffer_used, bytes_to_read);
-    if (bytes_read < 0 && errno == EINTR)
-      return 0;
+    size_t const bytes_to_read =
+      self->m_use_boundary ? (size_t)(self->m_buffer_size - self->m_buffer_used)
+      : fdio_adapt_size(&self->m_adapt, pfd->fd);
+    ssize_t const bytes_read = self->m_use_splice
+      ? fdio_splice(pfd->fd, write_fd, bytes_to_read)
+      : fdio_read(pfd->fd, self->m_buffer + self->m_buffer_used,
+		  bytes_to_read);
     if (bytes_read < 0 && errno == EAGAIN)
       // Fd would block
       return 0;
@@ -108,6 +150,14 @@ int fddata_read_write(struct fddata_t *self, struct pollfd *pfd,
       return 1;
     }
     pfd->revents &= (!POLLIN);
+    self->m_bytes += bytes_read;
+    fdio_adapt_update(&self->m_adapt, bytes_to_read, bytes_read);
+    if (self->m_use_splice) {
+      if (use_debug_log) {
+	fprintf(stderr, "SPLICE len [%zd]\n", bytes_read);
+      }
+      return 0;
+    }
     self->m_buffer_used += bytes_read;
     assert(self->m_buffer_used <= self->m_buffer_size);
     if (! self->m_use_boundary || self->m_buffer_used == self->m_buffer_size) {
@@ -137,6 +187,15 @@ static void usage() {
   fprintf(stderr, " -h              display this help\n");
   fprintf(stderr, " -b num          read num bytes from each input\n");
   fprintf(stderr, " -d              print some debug output\n");
+  fprintf(stderr, " -H              use huge pages for the buffers\n");
+  fprintf(stderr, " -m bytes        buffer size per input without -b\n");
+  fprintf(stderr, "                 (default 65536)\n");
+  fprintf(stderr, " -p policy       merge policy: order (default), rr, wfq,\n");
+  fprintf(stderr, "                 prio; give weights as fd:weight\n");
+  fprintf(stderr, " -q bytes        bytes per input and cycle for rr and wfq\n");
+  fprintf(stderr, " -s              print statistics per input at the end\n");
+  fprintf(stderr, " -u              use io_uring (falls back to poll / read /\n");
+  fprintf(stderr, "                 write if not available)\n");
   fprintf(stderr, " -w fd           fd to write to\n");
   exit(1);
 }
@@ -170,15 +229,305 @@ int read_write(struct fddata_t * fddata, struct pollfd * fds, int fd_cnt, int wr
   return 1;
 }
 
+static uint64_t now_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Reads from one input until budget bytes are forwarded or there is
+// no more data.  Returns 0 if no readable fd is available any longer.
+static int serve_input(struct fddata_t *fddata, struct pollfd *fds,
+		       int fd_cnt, int fdidx, int64_t budget, int write_fd,
+		       int use_debug_log) {
+  struct fddata_t *const self = &fddata[fdidx];
+  if (self->m_ready_since != 0) {
+    self->m_wait_usec += now_usec() - self->m_ready_since;
+    self->m_ready_since = 0;
+  }
+  while (!self->m_eof_seen) {
+    uint64_t const before = self->m_bytes;
+    if (fddata_read_write(self, &fds[fdidx], write_fd, use_debug_log)) {
+      if (use_debug_log) {
+	fprintf(stderr, "EOF SEEN idx [%d]\n", fdidx);
+      }
+      return readable_fd_available(fddata, fd_cnt);
+    }
+    int64_t const got = self->m_bytes - before;
+    self->m_deficit -= got;
+    budget -= got;
+    if (got == 0 || budget <= 0) {
+      break;
+    }
+    // Non-blocking: the next read returns EAGAIN if there is nothing.
+    fds[fdidx].revents = POLLIN;
+  }
+  return 1;
+}
+
+// One round of the rr, wfq or prio policy.
+// Returns 0 if no readable fd is available any longer.
+static int read_write_policy(enum merge_policy policy,
+			     struct fddata_t *fddata, struct pollfd *fds,
+			     int fd_cnt, int *next, int64_t quota,
+			     int write_fd, int use_debug_log) {
+  uint64_t const now = now_usec();
+  for (int fdidx = 0; fdidx < fd_cnt; ++fdidx) {
+    if (fds[fdidx].revents != 0 && fddata[fdidx].m_ready_since == 0) {
+      fddata[fdidx].m_ready_since = now;
+    }
+  }
+
+  if (policy == mp_prio) {
+    int best = -1;
+    for (int fdidx = 0; fdidx < fd_cnt; ++fdidx) {
+      if (fds[fdidx].revents != 0 &&
+	  (best == -1 || fddata[fdidx].m_weight > fddata[best].m_weight)) {
+	best = fdidx;
+      }
+    }
+    // One buffer only: then the higher priorities are polled again.
+    return best == -1 || serve_input(fddata, fds, fd_cnt, best, 1, write_fd,
+				     use_debug_log);
+  }
+
+  // Start each cycle with the next input: no input is preferred
+  // because of its position.
+  for (int cnt = 0; cnt < fd_cnt; ++cnt) {
+    int const fdidx = (*next + cnt) % fd_cnt;
+    struct fddata_t *const self = &fddata[fdidx];
+    if (fds[fdidx].revents == 0) {
+      // Deficit round-robin: an idle input does not save up.
+      self->m_deficit = 0;
+      continue;
+    }
+    int64_t budget = quota;
+    if (policy == mp_wfq) {
+      self->m_deficit += quota * self->m_weight;
+      if (self->m_deficit <= 0) {
+	continue;
+      }
+      budget = self->m_deficit;
+    }
+    if (!serve_input(fddata, fds, fd_cnt, fdidx, budget, write_fd,
+		     use_debug_log)) {
+      return 0;
+    }
+  }
+  *next = (*next + 1) % fd_cnt;
+  return 1;
+}
+
+static void print_statistics(int const *in_fds, struct fddata_t *fddata,
+			     size_t fd_cnt) {
+  for (size_t fdidx = 0; fdidx < fd_cnt; ++fdidx) {
+    fprintf(stderr, "STAT fd [%d] weight [%d] bytes [%" PRIu64
+	    "] wait_usec [%" PRIu64 "]\n", in_fds[fdidx],
+	    fddata[fdidx].m_weight, fddata[fdidx].m_bytes,
+	    fddata[fdidx].m_wait_usec);
+  }
+}
+
+/* State of one input in io_uring mode. */
+struct uring_input_t {
+  char * m_buffer;
+  size_t m_buffer_used;
+  int m_eof_seen;
+  // Buffer is complete and waits to be written.
+  int m_ready;
+  // Buffer is part of the currently running write.
+  int m_in_write;
+};
+
+static void uring_arm_read(uring_t *ring, struct uring_input_t *input,
+			   size_t idx, size_t block_size) {
+  uring_prep_read_fixed(ring, idx + 1, input->m_buffer + input->m_buffer_used,
+			block_size - input->m_buffer_used, idx, idx);
+}
+
+// Starts one writev for all complete buffers.
+// Returns the number of buffers in the write.
+static size_t uring_start_write(uring_t *ring, struct uring_input_t *inputs,
+				size_t fd_cnt, struct iovec *wiov,
+				int use_debug_log) {
+  size_t iov_cnt = 0;
+  size_t len = 0;
+  for (size_t fdidx = 0; fdidx < fd_cnt && iov_cnt < PEET_URING_MAX_IOV; ++fdidx) {
+    if (inputs[fdidx].m_ready) {
+      wiov[iov_cnt].iov_base = inputs[fdidx].m_buffer;
+      wiov[iov_cnt].iov_len = inputs[fdidx].m_buffer_used;
+      len += inputs[fdidx].m_buffer_used;
+      inputs[fdidx].m_ready = 0;
+      inputs[fdidx].m_in_write = 1;
+      ++iov_cnt;
+    }
+  }
+  if (iov_cnt > 0) {
+    if (use_debug_log) {
+      fprintf(stderr, "WRITE len [%zu] buffers [%zu]\n", len, iov_cnt);
+    }
+    uring_prep_writev(ring, 0, wiov, iov_cnt, PEET_URING_WRITE);
+  }
+  return iov_cnt;
+}
+
+// io_uring variant: there is always one read per input in flight.
+// All complete buffers are written with one writev; all this is
+// submitted with one system call per loop.
+// Returns -1 if io_uring cannot be used (nothing was read then).
+static int read_write_uring(int const *in_fds, size_t fd_cnt, int write_fd,
+			    int use_boundary, fdio_pool_t *pool,
+			    int use_debug_log) {
+  size_t const block_size = fdio_pool_buffer_size(pool);
+  unsigned entries = 1;
+  while (entries < fd_cnt + 1) {
+    entries <<= 1;
+  }
+  uring_t *const ring = uring_create(entries);
+  if (ring == NULL) {
+    return -1;
+  }
+
+  struct uring_input_t *const inputs =
+    calloc(fd_cnt, sizeof(struct uring_input_t));
+  struct iovec *const biov = malloc(fd_cnt * sizeof(struct iovec));
+  struct iovec *const wiov = malloc(fd_cnt * sizeof(struct iovec));
+  // File index 0 is the write fd, index i+1 the input in_fds[i].
+  int *const files = malloc((fd_cnt + 1) * sizeof(int));
+  if (inputs == NULL || biov == NULL || wiov == NULL || files == NULL) {
+    perror("malloc");
+    exit(2);
+  }
+
+  files[0] = write_fd;
+  for (size_t fdidx = 0; fdidx < fd_cnt; ++fdidx) {
+    inputs[fdidx].m_buffer = fdio_pool_get(pool);
+    biov[fdidx].iov_base = inputs[fdidx].m_buffer;
+    biov[fdidx].iov_len = block_size;
+    files[fdidx + 1] = in_fds[fdidx];
+  }
+  if (uring_register_buffers(ring, biov, fd_cnt) != 0
+      || uring_register_files(ring, files, fd_cnt + 1) != 0) {
+    uring_destroy(ring);
+    for (size_t fdidx = 0; fdidx < fd_cnt; ++fdidx) {
+      fdio_pool_put(pool, inputs[fdidx].m_buffer);
+    }
+    free(files);
+    free(wiov);
+    free(biov);
+    free(inputs);
+    return -1;
+  }
+
+  for (size_t fdidx = 0; fdidx < fd_cnt; ++fdidx) {
+    uring_arm_read(ring, &inputs[fdidx], fdidx, block_size);
+  }
+  size_t active = fd_cnt;
+  // Number of iovecs of the running write; 0: no write running.
+  size_t write_iov_cnt = 0;
+  size_t write_iov_first = 0;
+
+  while (active > 0 || write_iov_cnt > 0) {
+    if (uring_submit_and_wait(ring, 1) < 0) {
+      perror("io_uring_enter");
+      exit(2);
+    }
+
+    uint64_t user_data;
+    int res;
+    while (uring_next_cqe(ring, &user_data, &res)) {
+      if (user_data == PEET_URING_WRITE) {
+	if (res < 0) {
+	  errno = -res;
+	  perror("write");
+	  exit(2);
+	}
+	// Skip over what was written; resubmit the rest.
+	size_t left = res;
+	while (write_iov_first < write_iov_cnt
+	       && left >= wiov[write_iov_first].iov_len) {
+	  left -= wiov[write_iov_first].iov_len;
+	  ++write_iov_first;
+	}
+	if (write_iov_first < write_iov_cnt) {
+	  wiov[write_iov_first].iov_base =
+	    (char *)wiov[write_iov_first].iov_base + left;
+	  wiov[write_iov_first].iov_len -= left;
+	  uring_prep_writev(ring, 0, &wiov[write_iov_first],
+			    write_iov_cnt - write_iov_first, PEET_URING_WRITE);
+	  continue;
+	}
+
+	write_iov_cnt = 0;
+	write_iov_first = 0;
+	for (size_t fdidx = 0; fdidx < fd_cnt; ++fdidx) {
+	  if (inputs[fdidx].m_in_write) {
+	    inputs[fdidx].m_in_write = 0;
+	    inputs[fdidx].m_buffer_used = 0;
+	    if (!inputs[fdidx].m_eof_seen) {
+	      uring_arm_read(ring, &inputs[fdidx], fdidx, block_size);
+	    }
+	  }
+	}
+	continue;
+      }
+
+      size_t const fdidx = user_data;
+      struct uring_input_t *const input = &inputs[fdidx];
+      if (res == -EINTR || res == -EAGAIN) {
+	uring_arm_read(ring, input, fdidx, block_size);
+	continue;
+      }
+      if (res <= 0) {
+	// EOF from this fd: write possible remaining data.
+	if (use_debug_log) {
+	  fprintf(stderr, "EOF SEEN idx [%zu]\n", fdidx);
+	}
+	input->m_eof_seen = 1;
+	--active;
+	input->m_ready = input->m_buffer_used > 0;
+	continue;
+      }
+      input->m_buffer_used += res;
+      if (!use_boundary || input->m_buffer_used == block_size) {
+	input->m_ready = 1;
+      } else {
+	uring_arm_read(ring, input, fdidx, block_size);
+      }
+    }
+
+    if (write_iov_cnt == 0) {
+      write_iov_cnt = uring_start_write(ring, inputs, fd_cnt, wiov,
+					use_debug_log);
+    }
+  }
+
+  uring_destroy(ring);
+  for (size_t fdidx = 0; fdidx < fd_cnt; ++fdidx) {
+    fdio_pool_put(pool, inputs[fdidx].m_buffer);
+  }
+  free(files);
+  free(wiov);
+  free(biov);
+  free(inputs);
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
 
   int write_fd = 1;
   int use_debug_log = 0;
   int block_size = 4096;
   int use_boundary = 0;
+  size_t buffer_size = PEET_DEFAULT_BUFFER_SIZE;
+  int use_hugepages = 0;
+  int use_uring = 0;
+  int use_statistics = 0;
+  enum merge_policy policy = mp_order;
+  int64_t quota = PEET_DEFAULT_QUOTA;
 
   int opt;
-  while ((opt = getopt(argc, argv, "b:dhw:")) != -1) {
+  while ((opt = getopt(argc, argv, "b:dhHm:p:q:suw:")) != -1) {
     switch (opt) {
     case 'b':
       block_size = atoi(optarg);
@@ -190,6 +539,41 @@ int main(int argc, char *argv[]) {
     case 'h':
       usage();
       break;
+    case 'H':
+      use_hugepages = 1;
+      break;
+    case 'm':
+      buffer_size = atol(optarg);
+      if (buffer_size == 0) {
+	usage();
+      }
+      break;
+    case 'p':
+      if (strcmp(optarg, "order") == 0) {
+	policy = mp_order;
+      } else if (strcmp(optarg, "rr") == 0) {
+	policy = mp_rr;
+      } else if (strcmp(optarg, "wfq") == 0) {
+	policy = mp_wfq;
+      } else if (strcmp(optarg, "prio") == 0) {
+	policy = mp_prio;
+      } else {
+	fprintf(stderr, "Error: unknown policy [%s]\n", optarg);
+	usage();
+      }
+      break;
+    case 'q':
+      quota = atoll(optarg);
+      if (quota <= 0) {
+	usage();
+      }
+      break;
+    case 's':
+      use_statistics = 1;
+      break;
+    case 'u':
+      use_uring = 1;
+      break;
     case 'w':
       write_fd = atoi(optarg);
       break;
@@ -203,16 +587,52 @@ int main(int argc, char *argv[]) {
     usage();
   }
 
-  // All parameters are fds.
+  // All parameters are fds - optional with a weight: fd:weight
   size_t fd_cnt = argc - optind;
+  int in_fds[fd_cnt];
+  int weights[fd_cnt];
+  size_t fdidx = 0;
+  for (int aidx = optind; aidx < argc; ++aidx, ++fdidx) {
+    in_fds[fdidx] = atoi(argv[aidx]);
+    char const *const colon = strchr(argv[aidx], ':');
+    weights[fdidx] = colon == NULL ? 1 : atoi(colon + 1);
+    if (weights[fdidx] <= 0) {
+      fprintf(stderr, "Error: invalid weight [%s]\n", argv[aidx]);
+      usage();
+    }
+  }
+
+  // One buffer per input; with -b it holds exactly one block.
+  fdio_pool_t *const pool =
+    fdio_pool_create(use_boundary ? (size_t)block_size : buffer_size,
+		     fd_cnt, use_hugepages);
+  if (pool == NULL) {
+    perror("buffer pool");
+    exit(2);
+  }
+
+  // The merge policies and the statistics need the poll loop.
+  if (use_uring && policy == mp_order && !use_statistics) {
+    if (read_write_uring(in_fds, fd_cnt, write_fd, use_boundary, pool,
+			 use_debug_log) == 0) {
+      fdio_pool_destroy(pool);
+      return 0;
+    }
+    if (use_debug_log) {
+      fprintf(stderr, "io_uring not available - using poll\n");
+    }
+  }
+
   // The structure for the fd data structs
   struct fddata_t fddata[fd_cnt];
   struct pollfd fds[fd_cnt];
 
-  size_t fdidx = 0;
-  for (int aidx = optind; aidx < argc; ++aidx, ++fdidx) {
-    fddata_init(&fddata[fdidx], &fds[fdidx], atoi(argv[aidx]), use_boundary, block_size);
+  for (fdidx = 0; fdidx < fd_cnt; ++fdidx) {
+    fddata_init(&fddata[fdidx], &fds[fdidx], in_fds[fdidx], write_fd,
+		use_boundary, fdio_pool_get(pool), fdio_pool_buffer_size(pool));
+    fddata[fdidx].m_weight = weights[fdidx];
   }
+  int next = 0;
 
   while (1) {
     // Wait forever
@@ -227,10 +647,20 @@ int main(int argc, char *argv[]) {
       exit(2);
     }
 
-    if( ! read_write(fddata, fds, fd_cnt, write_fd, use_debug_log) ) {
+    int const readable =
+      policy == mp_order
+      ? read_write(fddata, fds, fd_cnt, write_fd, use_debug_log)
+      : read_write_policy(policy, fddata, fds, fd_cnt, &next, quota,
+			  write_fd, use_debug_log);
+    if( ! readable ) {
       break;
     }
   }
 
+  if (use_statistics) {
+    print_statistics(in_fds, fddata, fd_cnt);
+  }
+  fdio_pool_destroy(pool);
+
   return 0;
 }
@@ -0,0 +1,140 @@
+/*
+ * Map of the child pids
+ *
+ * Open addressing with linear probing.  The table has at least twice
+ * the number of slots as pids: the probe sequences stay short.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "src/pid_map.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+struct pid_entry {
+  // 0: the slot is empty
+  pid_t pid;
+  int child_idx;
+  enum pid_owner owner;
+};
+
+struct pid_map {
+  struct pid_entry *entries;
+  // Power of 2
+  size_t size;
+  size_t cnt;
+  size_t max_cnt;
+};
+
+pid_map_t *pid_map_create(size_t const max_cnt) {
+  pid_map_t *const self = malloc(sizeof(pid_map_t));
+  if (self == NULL) {
+    return NULL;
+  }
+  self->size = 16;
+  while (self->size < 2 * max_cnt) {
+    self->size *= 2;
+  }
+  self->entries = calloc(self->size, sizeof(struct pid_entry));
+  if (self->entries == NULL) {
+    free(self);
+    return NULL;
+  }
+  self->cnt = 0;
+  self->max_cnt = max_cnt;
+  return self;
+}
+
+void pid_map_destroy(pid_map_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  free(self->entries);
+  free(self);
+}
+
+static size_t pid_map_slot(pid_map_t const *self, pid_t const pid) {
+  // Multiplicative hashing: pids are often consecutive.
+  return ((uint32_t)pid * UINT32_C(2654435761)) & (self->size - 1);
+}
+
+// Returns the slot of the pid - or the empty slot where it belongs.
+static size_t pid_map_probe(pid_map_t const *self, pid_t const pid) {
+  size_t slot = pid_map_slot(self, pid);
+  while (self->entries[slot].pid != 0 && self->entries[slot].pid != pid) {
+    slot = (slot + 1) & (self->size - 1);
+  }
+  return slot;
+}
+
+int pid_map_insert(pid_map_t *self, pid_t const pid, int const child_idx,
+                   enum pid_owner const owner) {
+  struct pid_entry *const entry = &self->entries[pid_map_probe(self, pid)];
+  if (entry->pid == 0) {
+    if (self->cnt == self->max_cnt) {
+      return -1;
+    }
+    ++self->cnt;
+  }
+  entry->pid = pid;
+  entry->child_idx = child_idx;
+  entry->owner = owner;
+  return 0;
+}
+
+int pid_map_find(pid_map_t const *self, pid_t const pid,
+                 enum pid_owner *owner) {
+  if (pid <= 0) {
+    return -1;
+  }
+  struct pid_entry const *const entry =
+      &self->entries[pid_map_probe(self, pid)];
+  if (entry->pid == 0) {
+    return -1;
+  }
+  if (owner != NULL) {
+    *owner = entry->owner;
+  }
+  return entry->child_idx;
+}
+
+void pid_map_remove(pid_map_t *self, pid_t const pid) {
+  if (pid <= 0) {
+    return;
+  }
+  size_t hole = pid_map_probe(self, pid);
+  if (self->entries[hole].pid == 0) {
+    return;
+  }
+  --self->cnt;
+
+  // Move the following entries of the probe sequence into the hole:
+  // no tombstones are needed.
+  size_t slot = hole;
+  while (1) {
+    slot = (slot + 1) & (self->size - 1);
+    if (self->entries[slot].pid == 0) {
+      break;
+    }
+    size_t const home = pid_map_slot(self, self->entries[slot].pid);
+    // The entry can move if its home is not between hole and slot.
+    if (((slot - home) & (self->size - 1)) >=
+        ((slot - hole) & (self->size - 1))) {
+      self->entries[hole] = self->entries[slot];
+      hole = slot;
+    }
+  }
+  self->entries[hole].pid = 0;
+}
+
+pid_t pid_map_next(pid_map_t const *self, size_t *pos) {
+  while (*pos < self->size) {
+    pid_t const pid = self->entries[(*pos)++].pid;
+    if (pid != 0) {
+      return pid;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef PIPEXEC_PID_MAP_H
+#define PIPEXEC_PID_MAP_H
+
+/*
+ * Map of the child pids
+ *
+ * Finds the node of a terminated child without a search over all
+ * nodes: with thousands of nodes a linear search for each exit makes
+ * the shutdown of the graph quadratic.
+ * The map has a fixed capacity and does not allocate memory after
+ * its creation: it is also used from the signal handlers.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// The kind of process which has the pid.
+enum pid_owner { po_node, po_standby, po_replica };
+
+typedef struct pid_map pid_map_t;
+
+// Returns NULL if memory allocation fails.
+pid_map_t *pid_map_create(size_t max_cnt);
+void pid_map_destroy(pid_map_t *self);
+
+// Adds the pid - or changes the entry of a known pid.
+// Returns -1 if the map already holds max_cnt pids.
+int pid_map_insert(pid_map_t *self, pid_t pid, int child_idx,
+                   enum pid_owner owner);
+// Returns the index of the node of the pid or -1 if it is unknown.
+// owner can be NULL.
+int pid_map_find(pid_map_t const *self, pid_t pid, enum pid_owner *owner);
+void pid_map_remove(pid_map_t *self, pid_t pid);
+// Iterates over all pids: returns the next pid at or after the
+// position pos (start with 0) and moves pos behind it - or 0 at the
+// end.
+pid_t pid_map_next(pid_map_t const *self, size_t *pos);
+
+#endif
@@ -1,16 +1,36 @@
 // Copyright 2015,2022 by Andreas Florath
 // SPDX-License-Identifier: GPL-2.0-or-later
 
+#define _GNU_SOURCE
+
 #include "src/pipe_info.h"
 #include "src/logging.h"
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
 
-char *pipes_end_info_parse(pipes_end_info_t *const pend, char *const str) {
+// Logs a syntax error of a pipe description.  Returns -1 with errno
+// EINVAL.
+static int pipe_info_syntax_error(char const *const msg) {
+  logging(lid_internal, "command_line", "error", msg, 0);
+  errno = EINVAL;
+  return -1;
+}
+
+// Parses one end of a pipe description.
+// For files everything up to one of the characters in 'terms' is
+// the path.  Returns NULL on error.
+char *pipes_end_info_parse(pipes_end_info_t *const pend, char *const str,
+                           char const *const terms) {
   /*
     GCC 12 introduces a new dangling pointer check.
     > dangling pointer ‘colon’ to ‘end_fd’ may be used
@@ -30,12 +50,34 @@ char *pipes_end_info_parse(pipes_end_info_t *const pend, char *const str) {
 
   char *const colon = strchr(str, ':');
   if (colon == NULL) {
-    logging(lid_internal, "command_line", "error",
-	    "Invalid syntax: no colon in pipe desc found", 0);
-    exit(1);
+    pipe_info_syntax_error("Invalid syntax: no colon in pipe desc found");
+    return NULL;
   }
   *colon = '\0';
   pend->name = str;
+  pend->path = NULL;
+
+  int const is_file = strcmp(pend->name, "FILE") == 0;
+  if (is_file || strcmp(pend->name, "FIFO") == 0) {
+    char *const end_path = strpbrk(colon + 1, terms);
+    if (end_path == NULL || end_path == colon + 1) {
+      pipe_info_syntax_error(
+          is_file ? "Invalid syntax: no path for FILE in pipe desc found"
+                  : "Invalid syntax: no path for FIFO in pipe desc found");
+      return NULL;
+    }
+    pend->type = is_file ? pet_file : pet_fifo;
+    pend->fd = -1;
+    pend->path = strndup(colon + 1, end_path - (colon + 1));
+    if (pend->path == NULL) {
+      logging(lid_internal, "command_line", "error",
+	      "Memory allocation failed", 0);
+      return NULL;
+    }
+    return end_path;
+  }
+
+  pend->type = strcmp(pend->name, "PARENT") == 0 ? pet_parent : pet_command;
   char *end_fd;
   pend->fd = strtol(colon + 1, &end_fd, 10);
   return end_fd;
@@ -47,15 +89,40 @@ char *pipes_end_info_parse(pipes_end_info_t *const pend, char *const str) {
 #endif
 }
 
+char const *pipe_type_name(enum pipe_type const type) {
+  switch (type) {
+  case pt_pipe:
+    return "pipe";
+  case pt_stream:
+    return "stream";
+  case pt_seqpacket:
+    return "seqpacket";
+  case pt_shm:
+    return "shm";
+  }
+  return "unknown";
+}
+
+// The name of the end which is logged: the path for files and FIFOs.
+static char const *pipes_end_info_log_name(pipes_end_info_t const *const pend) {
+  return pend->path != NULL ? pend->path : pend->name;
+}
+
 void pipe_info_print(pipe_info_t const *const ipipe, unsigned long const cnt) {
   for (unsigned int pidx = 0; pidx < cnt; ++pidx) {
     ITOCHAR(spidx, 16, pidx);
     ITOCHAR(sin_pipe_fd, 16, ipipe[pidx].from.fd);
     ITOCHAR(sout_pipe_fd, 16, ipipe[pidx].to.fd);
-    logging(lid_internal, "pipe", "info", "pipe_info", 5,
-	    "pipe_index", spidx, "from_pipe_name", ipipe[pidx].from.name,
-	    "from_pipe_fd", sin_pipe_fd, "to_pipe_name", ipipe[pidx].to.name,
-	    "to_pipe_fd", sout_pipe_fd);
+    ITOCHAR(ssndbuf, 16, ipipe[pidx].sndbuf);
+    ITOCHAR(srcvbuf, 16, ipipe[pidx].rcvbuf);
+    logging(lid_internal, "pipe", "info", "pipe_info", 8,
+	    "pipe_index", spidx,
+	    "from_pipe_name", pipes_end_info_log_name(&ipipe[pidx].from),
+	    "from_pipe_fd", sin_pipe_fd,
+	    "to_pipe_name", pipes_end_info_log_name(&ipipe[pidx].to),
+	    "to_pipe_fd", sout_pipe_fd,
+	    "pipe_type", pipe_type_name(ipipe[pidx].type),
+	    "sndbuf", ssndbuf, "rcvbuf", srcvbuf);
   }
 }
 
@@ -63,58 +130,492 @@ unsigned int pipe_info_clp_count(int const start_argc, int const argc,
                                  char *const argv[]) {
   unsigned int cnt = 0;
   for (int i = start_argc; i < argc; ++i) {
-    if (argv[i][0] == '{' && strchr(argv[i], '>') != NULL) {
+    if (argv[i][0] == '{' &&
+        (strchr(argv[i], '>') != NULL || strchr(argv[i], '=') != NULL)) {
       ++cnt;
     }
   }
   return cnt;
 }
 
-void pipe_info_parse(pipe_info_t *const ipipe, int const start_argc,
-                     int const argc, char *const argv[], char const sep) {
+// Returns -1 on error.
+static long long pipe_info_parse_number(char const *const opt,
+                                        char const *const val,
+                                        long long const max) {
+  char *end_val;
+  long long const size = strtoll(val, &end_val, 10);
+  if (*val == '\0' || *end_val != '\0' || size <= 0 || size > max) {
+    SIZETTOCHAR(smax, 24, (size_t)max);
+    logging(lid_internal, "command_line", "error",
+	    "Invalid syntax: pipe option needs a positive size", 3,
+	    "option", opt, "value", val, "max", smax);
+    errno = EINVAL;
+    return -1;
+  }
+  return size;
+}
+
+static int pipe_info_parse_size(char const *const opt, char const *const val) {
+  return (int)pipe_info_parse_number(opt, val, 0x7fffffffL);
+}
+
+// Parses one option of a pipe description.
+// The option string is modified: a '=' is replaced by '\0'.
+// Returns -1 on error.
+static int pipe_info_parse_option(pipe_info_t *const ipipe, char *const opt) {
+  char *const eq = strchr(opt, '=');
+  char const *val = "";
+  if (eq != NULL) {
+    *eq = '\0';
+    val = eq + 1;
+  }
+
+  if (strcmp(opt, "pipe") == 0) {
+    ipipe->type = pt_pipe;
+  } else if (strcmp(opt, "stream") == 0) {
+    ipipe->type = pt_stream;
+  } else if (strcmp(opt, "seqpacket") == 0) {
+    ipipe->type = pt_seqpacket;
+  } else if (strcmp(opt, "shm") == 0) {
+    ipipe->type = pt_shm;
+  } else if (strcmp(opt, "size") == 0) {
+    int const size = (int)pipe_info_parse_number(opt, val, SHM_RING_MAX_SIZE);
+    if (size == -1) {
+      return -1;
+    }
+    ipipe->shm_size = size;
+  } else if (strcmp(opt, "append") == 0) {
+    ipipe->open_flags |= O_APPEND;
+  } else if (strcmp(opt, "direct") == 0) {
+#ifdef O_DIRECT
+    ipipe->open_flags |= O_DIRECT;
+#else
+    return pipe_info_syntax_error(
+        "O_DIRECT is not supported on this platform");
+#endif
+  } else if (strcmp(opt, "prealloc") == 0) {
+    ipipe->prealloc = pipe_info_parse_number(opt, val, 0x7fffffffffffffffLL);
+    return ipipe->prealloc == -1 ? -1 : 0;
+  } else if (strcmp(opt, "sndbuf") == 0) {
+    ipipe->sndbuf = pipe_info_parse_size(opt, val);
+    return ipipe->sndbuf == -1 ? -1 : 0;
+  } else if (strcmp(opt, "rcvbuf") == 0) {
+    ipipe->rcvbuf = pipe_info_parse_size(opt, val);
+    return ipipe->rcvbuf == -1 ? -1 : 0;
+  } else if (strcmp(opt, "relay") == 0) {
+    ipipe->relay = 1;
+  } else if (strcmp(opt, "record") == 0 && *val != '\0') {
+    ipipe->relay = 1;
+    ipipe->record_path = val;
+  } else if (strcmp(opt, "timing") == 0) {
+    ipipe->record_timing = 1;
+  } else {
+    logging(lid_internal, "command_line", "error",
+	    "Invalid syntax: unknown pipe option", 1, "option", opt);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+// Parses the comma separated option list which follows the
+// destination.  'str' points to the first character after the first
+// comma; the list must be terminated by '}'.  Returns -1 on error.
+static int pipe_info_parse_options(pipe_info_t *const ipipe, char *str) {
+  while (1) {
+    char *const end_opt = strpbrk(str, ",}");
+    if (end_opt == NULL) {
+      return pipe_info_syntax_error(
+          "Invalid syntax: no '}' closing pipe desc found");
+    }
+    char const term = *end_opt;
+    *end_opt = '\0';
+    if (pipe_info_parse_option(ipipe, str) == -1) {
+      return -1;
+    }
+    if (term == '}') {
+      return 0;
+    }
+    str = end_opt + 1;
+  }
+}
+
+// Checks the constraints for pipes with a FILE, FIFO or PARENT end.
+// Returns -1 if they are not met.
+static int pipe_info_check_ends(pipe_info_t const *const ipipe,
+                                 char const sep) {
+  int const from_file = ipipe->from.type == pet_file;
+  int const to_file = ipipe->to.type == pet_file;
+  int const from_parent = ipipe->from.type == pet_parent;
+  int const to_parent = ipipe->to.type == pet_parent;
+  if (sep == '=' && !from_parent && !to_parent) {
+    return pipe_info_syntax_error(
+        "Invalid syntax: '=' needs a PARENT end");
+  }
+  if (from_parent || to_parent) {
+    if (ipipe->from.type != pet_command && ipipe->to.type != pet_command) {
+      return pipe_info_syntax_error(
+          "Invalid syntax: at least one end must be a command");
+    }
+    if (ipipe->type != pt_pipe || ipipe->open_flags != 0 ||
+        ipipe->prealloc != 0) {
+      return pipe_info_syntax_error(
+          "Invalid syntax: a PARENT end cannot have options");
+    }
+    return 0;
+  }
+  if (ipipe->from.type == pet_fifo || ipipe->to.type == pet_fifo) {
+    if (ipipe->from.type != pet_command && ipipe->to.type != pet_command) {
+      return pipe_info_syntax_error(
+          "Invalid syntax: at least one end must be a command");
+    }
+    if (ipipe->type != pt_pipe || ipipe->open_flags != 0 ||
+        ipipe->prealloc != 0) {
+      return pipe_info_syntax_error(
+          "Invalid syntax: a FIFO end cannot have options");
+    }
+    return 0;
+  }
+  if (!from_file && !to_file) {
+    if (ipipe->open_flags != 0 || ipipe->prealloc != 0) {
+      return pipe_info_syntax_error(
+          "Invalid syntax: append / direct / prealloc need a FILE end");
+    }
+    return 0;
+  }
+  if (from_file && to_file) {
+    return pipe_info_syntax_error(
+        "Invalid syntax: at least one end must be a command");
+  }
+  if (ipipe->type != pt_pipe) {
+    return pipe_info_syntax_error(
+        "Invalid syntax: a FILE end cannot be combined with a pipe type");
+  }
+  if (from_file && ((ipipe->open_flags & O_APPEND) || ipipe->prealloc != 0)) {
+    return pipe_info_syntax_error(
+        "Invalid syntax: append / prealloc only for output files");
+  }
+  return 0;
+}
+
+int pipe_info_parse(pipe_info_t *const ipipe, int const start_argc,
+                    int const argc, char *const argv[]) {
   unsigned int pipe_no = 0;
   for (int i = start_argc; i < argc; ++i) {
     if (argv[i] == NULL) {
       continue;
     }
 
-    if (argv[i][0] == '{' && strchr(argv[i], sep) != NULL) {
+    if (argv[i][0] == '{' &&
+        (strchr(argv[i], '>') != NULL || strchr(argv[i], '=') != NULL)) {
+      // A file which is read can only be used with '>'.
       char *const end_from =
-          pipes_end_info_parse(&ipipe[pipe_no].from, &argv[i][1]);
-      if (*end_from != sep) {
-        logging(lid_internal, "command_line", "error", "Invalid syntax: no ':' in pipe desc found", 0);
-        exit(1);
+          pipes_end_info_parse(&ipipe[pipe_no].from, &argv[i][1], ">");
+      if (end_from == NULL) {
+        return -1;
+      }
+      char const sep = *end_from;
+      if (sep != '>' && sep != '=') {
+        return pipe_info_syntax_error(
+            "Invalid syntax: no '>' or '=' in pipe desc found");
       }
 
       char *const end_to =
-          pipes_end_info_parse(&ipipe[pipe_no].to, end_from + 1);
-      if (*end_to != '}') {
-        logging(lid_internal, "command_line", "error", "Invalid syntax: no '}' closing pipe desc found", 0);
-        exit(1);
+          pipes_end_info_parse(&ipipe[pipe_no].to, end_from + 1, ",}");
+      if (end_to == NULL) {
+        return -1;
+      }
+      ipipe[pipe_no].type = pt_pipe;
+      ipipe[pipe_no].sndbuf = 0;
+      ipipe[pipe_no].rcvbuf = 0;
+      ipipe[pipe_no].shm_size = 0;
+      ipipe[pipe_no].ring = NULL;
+      ipipe[pipe_no].pipefds[0] = -1;
+      ipipe[pipe_no].pipefds[1] = -1;
+      ipipe[pipe_no].open_flags = 0;
+      ipipe[pipe_no].prealloc = 0;
+      ipipe[pipe_no].relay = 0;
+      ipipe[pipe_no].record_path = NULL;
+      ipipe[pipe_no].record_timing = 0;
+      ipipe[pipe_no].fifo_hold = -1;
+      ipipe[pipe_no].fifo_created = 0;
+      if (*end_to == ',') {
+        if (pipe_info_parse_options(&ipipe[pipe_no], end_to + 1) == -1) {
+          return -1;
+        }
+      } else if (*end_to != '}') {
+        return pipe_info_syntax_error(
+            "Invalid syntax: no '}' closing pipe desc found");
+      }
+      if ((ipipe[pipe_no].type == pt_pipe || ipipe[pipe_no].type == pt_shm) &&
+          (ipipe[pipe_no].sndbuf != 0 || ipipe[pipe_no].rcvbuf != 0)) {
+        return pipe_info_syntax_error(
+            "Invalid syntax: sndbuf / rcvbuf need a socket pipe type");
+      }
+      if (ipipe[pipe_no].type != pt_shm && ipipe[pipe_no].shm_size != 0) {
+        return pipe_info_syntax_error(
+            "Invalid syntax: size needs the shm pipe type");
+      }
+      if (ipipe[pipe_no].record_timing && ipipe[pipe_no].record_path == NULL) {
+        return pipe_info_syntax_error("Invalid syntax: timing needs record");
+      }
+      if (pipe_info_check_ends(&ipipe[pipe_no], sep) == -1) {
+        return -1;
+      }
+      if (ipipe[pipe_no].relay &&
+          (ipipe[pipe_no].type != pt_pipe ||
+           ipipe[pipe_no].from.type != pet_command ||
+           ipipe[pipe_no].to.type != pet_command)) {
+        return pipe_info_syntax_error(
+            "Invalid syntax: relay and record need a pipe between two"
+            " commands");
       }
       ++pipe_no;
     }
   }
+  return 0;
+}
+
+static void pipe_info_set_sockbuf(int const fd, int const optname,
+                                  int const size) {
+  if (size == 0) {
+    return;
+  }
+  if (setsockopt(fd, SOL_SOCKET, optname, &size, sizeof(size)) == -1) {
+    ITOCHAR(sfd, 16, fd);
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "pipe", "warning", "setsockopt", 3,
+	    "fd", sfd, "errno", serrno, "error", strerror(errno));
+  }
+}
+
+// Creates the socketpair for a stream or seqpacket pipe.
+// Both ends can be used for reading and writing: the 'from' process
+// gets pipefds[1], the 'to' process pipefds[0] - as with pipes.
+static int pipe_info_create_socketpair(pipe_info_t *const ipipe) {
+  int const stype = ipipe->type == pt_stream ? SOCK_STREAM : SOCK_SEQPACKET;
+  int const sres =
+      socketpair(AF_UNIX, stype | SOCK_CLOEXEC, 0, ipipe->pipefds);
+  if (sres == -1) {
+    return -1;
+  }
+  for (int sidx = 0; sidx < 2; ++sidx) {
+    pipe_info_set_sockbuf(ipipe->pipefds[sidx], SO_SNDBUF, ipipe->sndbuf);
+    pipe_info_set_sockbuf(ipipe->pipefds[sidx], SO_RCVBUF, ipipe->rcvbuf);
+  }
+  return 0;
+}
+
+// Creates the shared memory ring for a shm pipe.
+// Both processes get the same memfd; the supervisor keeps its own
+// mapping to be able to signal EOF.
+static int pipe_info_create_shm(pipe_info_t *const ipipe) {
+  shm_ring_detach(ipipe->ring);
+  ipipe->ring = NULL;
+
+  int const fd = shm_ring_create(ipipe->shm_size);
+  if (fd == -1) {
+    return -1;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  int const dfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (dfd == -1) {
+    close(fd);
+    return -1;
+  }
+  ipipe->ring = shm_ring_attach(fd);
+  if (ipipe->ring == NULL) {
+    close(fd);
+    close(dfd);
+    return -1;
+  }
+  ipipe->pipefds[1] = fd;
+  ipipe->pipefds[0] = dfd;
+  return 0;
+}
+
+// Opens the file of a FILE end.
+// The fd is stored at the place of the pipe's end which is used by
+// the command: a file which is read is used like the read end of a
+// pipe.  The other fd is -1.
+static int pipe_info_open_file(pipe_info_t *const ipipe) {
+  if (ipipe->from.type == pet_file) {
+    ipipe->pipefds[1] = -1;
+    ipipe->pipefds[0] =
+        open(ipipe->from.path, O_RDONLY | O_CLOEXEC | ipipe->open_flags);
+    return ipipe->pipefds[0];
+  }
+
+  int const trunc = (ipipe->open_flags & O_APPEND) ? 0 : O_TRUNC;
+  ipipe->pipefds[0] = -1;
+  ipipe->pipefds[1] =
+      open(ipipe->to.path,
+           O_WRONLY | O_CREAT | O_CLOEXEC | trunc | ipipe->open_flags,
+           S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (ipipe->pipefds[1] == -1 || ipipe->prealloc == 0) {
+    return ipipe->pipefds[1];
+  }
+
+#ifdef FALLOC_FL_KEEP_SIZE
+  // Allocate the blocks behind the current end, but keep the size:
+  // the process appends to the file.
+  off_t const offset = lseek(ipipe->pipefds[1], 0, SEEK_END);
+  int const fres = fallocate(ipipe->pipefds[1], FALLOC_FL_KEEP_SIZE,
+                             offset == -1 ? 0 : offset, ipipe->prealloc);
+  if (fres != 0) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "pipe", "warning", "fallocate", 3,
+	    "path", ipipe->to.path, "errno", serrno, "error", strerror(errno));
+  }
+#else
+  logging(lid_internal, "pipe", "warning",
+	  "prealloc is not supported on this platform", 1,
+	  "path", ipipe->to.path);
+#endif
+  return ipipe->pipefds[1];
+}
+
+// Creates the FIFO of a FIFO end (if it does not exist yet) and opens
+// it for the process.  Both opens are non blocking: neither waits for
+// the other side.  The supervisor holds the other side: a reading
+// process does not see EOF when an external writer detaches and a
+// writing process gets no SIGPIPE without a reader - it blocks when
+// the FIFO is full.  As for files, the fd is stored at the place of
+// the command's end.
+static int pipe_info_open_fifo(pipe_info_t *const ipipe) {
+  int const from_fifo = ipipe->from.type == pet_fifo;
+  char const *const path = from_fifo ? ipipe->from.path : ipipe->to.path;
+  if (mkfifo(path, S_IRUSR | S_IWUSR) == 0) {
+    ipipe->fifo_created = 1;
+  } else if (errno != EEXIST) {
+    return -1;
+  }
+  struct stat st;
+  if (stat(path, &st) == -1) {
+    return -1;
+  }
+  if (!S_ISFIFO(st.st_mode)) {
+    errno = EEXIST;
+    return -1;
+  }
+
+  if (from_fifo) {
+    ipipe->pipefds[1] = -1;
+    ipipe->pipefds[0] = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (ipipe->pipefds[0] == -1) {
+      return -1;
+    }
+    // The process reads blocking.
+    fcntl(ipipe->pipefds[0], F_SETFL,
+          fcntl(ipipe->pipefds[0], F_GETFL) & ~O_NONBLOCK);
+    if (ipipe->fifo_hold == -1) {
+      ipipe->fifo_hold = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    }
+    return ipipe->fifo_hold == -1 ? -1 : ipipe->pipefds[0];
+  }
+
+  ipipe->pipefds[0] = -1;
+  if (ipipe->fifo_hold == -1) {
+    ipipe->fifo_hold = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  }
+  if (ipipe->fifo_hold == -1) {
+    ipipe->pipefds[1] = -1;
+    return -1;
+  }
+  // There is a reader: this does not block.
+  ipipe->pipefds[1] = open(path, O_WRONLY | O_CLOEXEC);
+  return ipipe->pipefds[1];
 }
 
-void pipe_info_create_pipes(pipe_info_t *const ipipe,
-                            unsigned long const pipe_cnt) {
+// Duplicates the fd of pipexec for a PARENT end.
+// As for files, the fd is stored at the place of the command's end.
+static int pipe_info_dup_parent(pipe_info_t *const ipipe) {
+  int const from_parent = ipipe->from.type == pet_parent;
+  int const parent_fd = from_parent ? ipipe->from.fd : ipipe->to.fd;
+  int const dfd = fcntl(parent_fd, F_DUPFD_CLOEXEC, 0);
+  ipipe->pipefds[from_parent ? 0 : 1] = dfd;
+  ipipe->pipefds[from_parent ? 1 : 0] = -1;
+  return dfd;
+}
+
+// All fds are close-on-exec: a process gets only its own ends, which
+// are dup2()ed to the fds it uses.  Closing all the others one by one
+// in each child would be quadratic for large graphs.
+int pipe_info_create_pipes(pipe_info_t *const ipipe,
+                           unsigned long const pipe_cnt) {
+  // fds which are still kept from the last run
+  pipe_info_close_all(ipipe, pipe_cnt);
+
   // Open up all the pipes.
   for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
-    int const pres = pipe(ipipe[pidx].pipefds);
-    if (pres == -1) {
-      perror("pipe");
-      exit(10);
+    if (ipipe[pidx].from.type == pet_parent ||
+        ipipe[pidx].to.type == pet_parent) {
+      if (pipe_info_dup_parent(&ipipe[pidx]) == -1) {
+        SIZETTOCHAR(spidx, 20, pidx);
+        ITOCHAR(serrno, 16, errno);
+        logging(lid_internal, "pipe", "error", "Cannot use fd of parent", 3,
+                "pipe_index", spidx, "errno", serrno, "error", strerror(errno));
+        return -1;
+      }
+    } else if (ipipe[pidx].from.type == pet_file ||
+               ipipe[pidx].to.type == pet_file) {
+      if (pipe_info_open_file(&ipipe[pidx]) == -1) {
+        ITOCHAR(serrno, 16, errno);
+        logging(lid_internal, "pipe", "error", "Cannot open file", 3,
+                "path", ipipe[pidx].from.type == pet_file
+                ? ipipe[pidx].from.path : ipipe[pidx].to.path,
+                "errno", serrno, "error", strerror(errno));
+        return -1;
+      }
+    } else if (ipipe[pidx].from.type == pet_fifo ||
+               ipipe[pidx].to.type == pet_fifo) {
+      if (pipe_info_open_fifo(&ipipe[pidx]) == -1) {
+        ITOCHAR(serrno, 16, errno);
+        logging(lid_internal, "pipe", "error", "Cannot open FIFO", 3,
+                "path", ipipe[pidx].from.type == pet_fifo
+                ? ipipe[pidx].from.path : ipipe[pidx].to.path,
+                "errno", serrno, "error", strerror(errno));
+        return -1;
+      }
+    } else if (ipipe[pidx].type == pt_pipe) {
+      int const pres = pipe2(ipipe[pidx].pipefds, O_CLOEXEC);
+      if (pres == -1) {
+        ITOCHAR(serrno, 16, errno);
+        logging(lid_internal, "pipe", "error", "Cannot create pipe", 2,
+                "errno", serrno, "error", strerror(errno));
+        return -1;
+      }
+    } else if (ipipe[pidx].type == pt_shm) {
+      int const sres = pipe_info_create_shm(&ipipe[pidx]);
+      if (sres == -1) {
+        ITOCHAR(serrno, 16, errno);
+        logging(lid_internal, "pipe", "error", "Cannot create shm ring", 2,
+                "errno", serrno, "error", strerror(errno));
+        return -1;
+      }
+    } else {
+      int const sres = pipe_info_create_socketpair(&ipipe[pidx]);
+      if (sres == -1) {
+        ITOCHAR(serrno, 16, errno);
+        logging(lid_internal, "pipe", "error", "Cannot create socketpair", 2,
+                "errno", serrno, "error", strerror(errno));
+        return -1;
+      }
     }
     SIZETTOCHAR(spidx, 20, pidx);
     ITOCHAR(sfrom_fd, 16, ipipe[pidx].pipefds[1]);
     ITOCHAR(sto_fd, 16, ipipe[pidx].pipefds[0]);
 
-    logging(lid_internal, "pipe", "info", "pipe_created", 3,
-	    "pipe_index", spidx, "from_fd", sfrom_fd, "to_fd", sto_fd);
+    logging(lid_internal, "pipe", "info", "pipe_created", 4,
+	    "pipe_index", spidx, "from_fd", sfrom_fd, "to_fd", sto_fd,
+	    "pipe_type", pipe_type_name(ipipe[pidx].type));
   }
+  return 0;
 }
 
+static void pipe_info_close_fd(size_t const pidx, int *const fd,
+                               char const *const msg);
+
 // This is similar to the parent_pipe_info_dup_in_piped_for_pipe_end
 // function - but has some differences in the data.
 // Might be hard to refactor (unify).
@@ -122,7 +623,11 @@ static void
 pipe_info_dup_in_piped_for_pipe_end(size_t const pidx, char *cmd_name,
                                     pipes_end_info_t const *const pend,
                                     int pipe_fd, int close_unused) {
-  if (strcmp(cmd_name, pend->name) == 0) {
+  if (pipe_fd == -1) {
+    // The end of a file: there is no fd.
+    return;
+  }
+  if (pend->type == pet_command && strcmp(cmd_name, pend->name) == 0) {
     SIZETTOCHAR(spidx, 20, pidx);
     ITOCHAR(from_pipe_fd, 16, pipe_fd);
     ITOCHAR(to_pipe_fd, 16, pend->fd);
@@ -155,6 +660,22 @@ pipe_info_dup_in_piped_for_pipe_end(size_t const pidx, char *cmd_name,
   }
 }
 
+void pipe_info_close_foreign(pipe_info_t *ipipe, unsigned long pipe_cnt,
+                             char const *cmd_name) {
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    pipes_end_info_t const *const ends[2] = {&ipipe[pidx].from,
+                                             &ipipe[pidx].to};
+    int *const fds[2] = {&ipipe[pidx].pipefds[1], &ipipe[pidx].pipefds[0]};
+    for (int eidx = 0; eidx < 2; ++eidx) {
+      if (*fds[eidx] != -1 &&
+          (ends[eidx]->type != pet_command ||
+           strcmp(ends[eidx]->name, cmd_name) != 0)) {
+        pipe_info_close_fd(pidx, fds[eidx], "closing foreign fd");
+      }
+    }
+  }
+}
+
 void pipe_info_dup_in_pipes(pipe_info_t *ipipe, unsigned long pipe_cnt,
                             char *cmd_name, int close_unused) {
   for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
@@ -165,23 +686,109 @@ void pipe_info_dup_in_pipes(pipe_info_t *ipipe, unsigned long pipe_cnt,
   }
 }
 
-void pipe_info_close_all(pipe_info_t const *const ipipe,
+static void pipe_info_close_fd(size_t const pidx, int *const fd,
+                               char const *const msg) {
+  if (*fd == -1) {
+    return;
+  }
+  SIZETTOCHAR(spidx, 20, pidx);
+  ITOCHAR(sfd, 16, *fd);
+  logging(lid_internal, "pipe", "info", msg, 2, "pipe_index", spidx, "fd", sfd);
+  close(*fd);
+  *fd = -1;
+}
+
+// Called when a process terminates (and is not started again):
+// close the fds of the process which are kept by the supervisor.
+// The other side of a shm pipe is not informed by the kernel (as it
+// is for pipes): do it here.
+void pipe_info_command_exited(pipe_info_t *const ipipe,
+                              unsigned long const pipe_cnt,
+                              char const *const cmd_name) {
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    int const is_from = ipipe[pidx].from.type == pet_command &&
+                        strcmp(ipipe[pidx].from.name, cmd_name) == 0;
+    int const is_to = ipipe[pidx].to.type == pet_command &&
+                      strcmp(ipipe[pidx].to.name, cmd_name) == 0;
+    if (is_from) {
+      pipe_info_close_fd(pidx, &ipipe[pidx].pipefds[1], "closing kept fd from");
+    }
+    if (is_to) {
+      pipe_info_close_fd(pidx, &ipipe[pidx].pipefds[0], "closing kept fd to");
+    }
+
+    if (ipipe[pidx].type != pt_shm || ipipe[pidx].ring == NULL) {
+      continue;
+    }
+    if (is_from) {
+      shm_ring_close_writer(ipipe[pidx].ring);
+    }
+    if (is_to) {
+      shm_ring_close_reader(ipipe[pidx].ring);
+    }
+  }
+}
+
+void pipe_info_close_all(pipe_info_t *const ipipe,
                          unsigned long const pipe_cnt) {
   for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
-    SIZETTOCHAR(spidx, 20, pidx);
-    ITOCHAR(from_fd, 16, ipipe[pidx].pipefds[1]);
-    logging(lid_internal, "pipe", "info", "closing fd from", 2,
-	    "pipe_index", spidx, "fd", from_fd);
-    close(ipipe[pidx].pipefds[1]);
-    ITOCHAR(to_fd, 16, ipipe[pidx].pipefds[0]);
-    logging(lid_internal, "pipe", "info", "closing fd to", 2,
-	    "pipe_index", spidx, "fd", to_fd);
-    close(ipipe[pidx].pipefds[0]);
+    pipe_info_close_fd(pidx, &ipipe[pidx].pipefds[1], "closing fd from");
+    pipe_info_close_fd(pidx, &ipipe[pidx].pipefds[0], "closing fd to");
   }
 }
 
+void pipe_info_fifo_close(pipe_info_t *const ipipe,
+                          unsigned long const pipe_cnt) {
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    pipe_info_close_fd(pidx, &ipipe[pidx].fifo_hold, "closing FIFO");
+  }
+}
+
+void pipe_info_release(pipe_info_t *const ipipe,
+                       unsigned long const pipe_cnt) {
+  pipe_info_fifo_close(ipipe, pipe_cnt);
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    if (ipipe[pidx].fifo_created) {
+      unlink(ipipe[pidx].from.type == pet_fifo ? ipipe[pidx].from.path
+                                               : ipipe[pidx].to.path);
+      ipipe[pidx].fifo_created = 0;
+    }
+  }
+}
+
+void pipe_info_close_unkept(pipe_info_t *const ipipe,
+                            unsigned long const pipe_cnt,
+                            enum pipe_keep const keep) {
+  if (keep == pk_all) {
+    return;
+  }
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    pipe_info_close_fd(pidx, &ipipe[pidx].pipefds[1], "closing fd from");
+    // Only the read end of a real pipe between two processes
+    // tells the fill level.
+    if (keep == pk_read && ipipe[pidx].type == pt_pipe &&
+        ipipe[pidx].from.type == pet_command &&
+        ipipe[pidx].to.type == pet_command) {
+      continue;
+    }
+    pipe_info_close_fd(pidx, &ipipe[pidx].pipefds[0], "closing fd to");
+  }
+}
+
+// Returns 1 if the fd is passed from pipexec to a process.
+static int is_parent_fd(pipe_info_t const *const ipipe,
+                        unsigned long const cnt, int const fd) {
+  for (unsigned long pidx = 0; pidx < cnt; ++pidx) {
+    if ((ipipe[pidx].from.type == pet_parent && ipipe[pidx].from.fd == fd) ||
+        (ipipe[pidx].to.type == pet_parent && ipipe[pidx].to.fd == fd)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 static void block_fd(pipes_end_info_t const *const pend, int blocking_fd) {
-  if (pend->fd > 2 && pend->fd != blocking_fd) {
+  if (pend->type == pet_command && pend->fd > 2 && pend->fd != blocking_fd) {
     ITOCHAR(pipe_fd, 16, pend->fd);
     ITOCHAR(sbfd, 16, blocking_fd);
     logging(lid_internal, "pipe", "info", "blocking_fd", 2,
@@ -196,50 +803,119 @@ static void block_fd(pipes_end_info_t const *const pend, int blocking_fd) {
 // Block all FDs for really used pipes:
 // o open an additional unused pipe
 // o dup2() one fd of this unused pipe for all later on used fds.
-void pipe_info_block_used_fds(pipe_info_t const *const ipipe,
-                              unsigned long const cnt) {
+int pipe_info_block_used_fds(pipe_info_t const *const ipipe,
+                             unsigned long const cnt) {
   logging(lid_internal, "pipe", "info", "Blocking used fds", 0);
 
   logging(lid_internal, "pipe", "info", "Creating extra pipe for blocking fds", 0);
   int block_pipefds[2];
   int const pres = pipe(block_pipefds);
   if (pres == -1) {
-    perror("pipe");
-    exit(10);
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "pipe", "error", "Cannot create pipe", 2,
+            "errno", serrno, "error", strerror(errno));
+    return -1;
   }
   // One is enough:
   close(block_pipefds[1]);
   ITOCHAR(sbfd, 16, block_pipefds[0]);
   logging(lid_internal, "pipe", "info", "fd for blocking", 1, "fd", sbfd);
 
+  // fds which are passed from pipexec are open anyway: they must
+  // not be overwritten.
   for (unsigned int pidx = 0; pidx < cnt; ++pidx) {
-    block_fd(&ipipe[pidx].from, block_pipefds[0]);
-    block_fd(&ipipe[pidx].to, block_pipefds[0]);
+    if (!is_parent_fd(ipipe, cnt, ipipe[pidx].from.fd)) {
+      block_fd(&ipipe[pidx].from, block_pipefds[0]);
+    }
+    if (!is_parent_fd(ipipe, cnt, ipipe[pidx].to.fd)) {
+      block_fd(&ipipe[pidx].to, block_pipefds[0]);
+    }
   }
+  return 0;
 }
 
 #define PI_CHECK_FOR_DUPS(iPiPe, cNt, fOrT)				\
   do {									\
     for(unsigned long ocmp = 0; ocmp < cNt - 1; ++ocmp) {		\
       for(unsigned long tcmp = ocmp + 1; tcmp < cNt; ++tcmp) {		\
-        if(strcmp(iPiPe[ocmp].fOrT.name, iPiPe[tcmp].fOrT.name) == 0 && \
+        if(iPiPe[ocmp].fOrT.type == pet_command &&                     \
+           strcmp(iPiPe[ocmp].fOrT.name, iPiPe[tcmp].fOrT.name) == 0 && \
 	   (iPiPe[ocmp].fOrT.fd == iPiPe[tcmp].fOrT.fd)) {		\
            fprintf(stderr, "ERROR: Duplicate pipe in command line: [%s] [%s] [%d]\n", \
 		   #fOrT, iPiPe[ocmp].fOrT.name, iPiPe[ocmp].fOrT.fd);  \
-	   exit(1);                                                     \
+	   errno = EINVAL;                                              \
+	   return -1;                                                   \
         }								\
       }									\
     }									\
   } while(0)
 
 // Check for any duplicates in the from or the to pipes
-void pipe_info_check_for_duplicates(pipe_info_t const *const ipipe,
-				    unsigned long const cnt) {
+int pipe_info_check_for_duplicates(pipe_info_t const *const ipipe,
+				   unsigned long const cnt) {
   // Handle simple case where there is no or only one pipe info
   if(cnt <= 1) {
-    return;
+    return 0;
   }
 
   PI_CHECK_FOR_DUPS(ipipe, cnt, from);
   PI_CHECK_FOR_DUPS(ipipe, cnt, to);
+  return 0;
+}
+
+static int pipe_info_between_commands(pipe_info_t const *const pipe) {
+  return pipe->from.type == pet_command && pipe->to.type == pet_command;
+}
+
+// For pipes FIONREAD on the read end gives the fill level.  For the
+// socket types this gives only the size of the next record: there the
+// bytes queued at the write end (SIOCOUTQ) are used.
+long pipe_info_fill(pipe_info_t const *const pipe) {
+  if (pipe->type == pt_shm && pipe->ring != NULL) {
+    return (long)shm_ring_fill(pipe->ring);
+  }
+  int fill;
+  // Either end of a FIFO tells it.
+  if (pipe->fifo_hold != -1) {
+    return ioctl(pipe->fifo_hold, FIONREAD, &fill) == -1 ? -1 : fill;
+  }
+  if (!pipe_info_between_commands(pipe)) {
+    return -1;
+  }
+  if (pipe->type == pt_pipe) {
+    if (pipe->pipefds[0] == -1 ||
+        ioctl(pipe->pipefds[0], FIONREAD, &fill) == -1) {
+      return -1;
+    }
+    return fill;
+  }
+  if ((pipe->type == pt_stream || pipe->type == pt_seqpacket) &&
+      pipe->pipefds[1] != -1 && ioctl(pipe->pipefds[1], SIOCOUTQ, &fill) == 0) {
+    return fill;
+  }
+  return -1;
+}
+
+long pipe_info_capacity(pipe_info_t const *const pipe) {
+  if (pipe->type == pt_shm && pipe->ring != NULL) {
+    return (long)shm_ring_size(pipe->ring);
+  }
+  if (pipe->fifo_hold != -1) {
+    return fcntl(pipe->fifo_hold, F_GETPIPE_SZ);
+  }
+  if (!pipe_info_between_commands(pipe)) {
+    return -1;
+  }
+  if (pipe->type == pt_pipe) {
+    return pipe->pipefds[0] == -1 ? -1
+                                  : fcntl(pipe->pipefds[0], F_GETPIPE_SZ);
+  }
+  int sndbuf;
+  socklen_t len = sizeof(sndbuf);
+  if ((pipe->type == pt_stream || pipe->type == pt_seqpacket) &&
+      pipe->pipefds[1] != -1 &&
+      getsockopt(pipe->pipefds[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0) {
+    return sndbuf;
+  }
+  return -1;
 }
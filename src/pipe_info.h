@@ -1,49 +1,157 @@
 #ifndef PIPEXEC_PIPE_INFO_H
 #define PIPEXEC_PIPE_INFO_H
 
+#include "src/shm_ring.h"
+
+#include <stddef.h>
+
+/*
+ * The kind of a pipe's end.
+ * pet_command is a process of the graph.  pet_file is a file which
+ * is opened by pipexec and passed directly to the process at the
+ * other end: 'FILE:/path/to/file'.  pet_parent is an fd of pipexec
+ * itself which is passed directly to the process: 'PARENT:0'.
+ * pet_fifo is a named pipe which pipexec creates: an attach point for
+ * processes outside of the graph: 'FIFO:/run/input'.
+ */
+enum pipes_end_type {
+  pet_command = 0,
+  pet_file = 1,
+  pet_parent = 2,
+  pet_fifo = 3
+};
+
 /*
  * Information about one pipe's end:
  * The name of the process and the fd it should get.
+ * For files and FIFOs the path is stored instead of the fd (which is
+ * -1).
  */
 struct pipes_end_info {
   char *name;
   int fd;
+  enum pipes_end_type type;
+  char *path;
 };
 
 typedef struct pipes_end_info pipes_end_info_t;
 
-char *pipes_end_info_parse(pipes_end_info_t *const pend, char *const str);
+// Returns NULL on error.
+char *pipes_end_info_parse(pipes_end_info_t *const pend, char *const str,
+                           char const *const terms);
+
+/*
+ * The kind of channel which is created for one pipe description.
+ * pt_pipe is the classic anonymous pipe(2); the socket types create
+ * a socketpair(2) where each end can be used in both directions.
+ * pt_shm is a shared memory ring buffer (see shm_ring.h): both
+ * processes get the same memfd.
+ */
+enum pipe_type {
+  pt_pipe = 0,
+  pt_stream = 1,
+  pt_seqpacket = 2,
+  pt_shm = 3
+};
+
+char const *pipe_type_name(enum pipe_type const type);
 
 /*
  * Pipe information
  *
  * This contains the source (name and fd) and the destination
  * (also name and fd).
+ * The separator is '>' for pipes and '=' for the direct assignment of
+ * an fd of pipexec: '{PARENT:0=A:0}'.
+ * The options (type and socket buffer sizes) are given after the
+ * destination, separated by commas: '{A:3>B:3,seqpacket,sndbuf=65536}'.
+ * A buffer size of 0 means: use the system default.
+ * For file ends open_flags are the additional flags for open(2) and
+ * prealloc the number of bytes to allocate for an output file.
+ * For shm pipes the supervisor keeps the ring mapped to be able to
+ * signal EOF when one of the processes terminates.
+ * For FIFO ends the supervisor keeps the other side of the FIFO open
+ * (fifo_hold) as long as it runs: external processes can attach and
+ * detach without the process seeing EOF or SIGPIPE.
  */
 struct pipe_info {
   pipes_end_info_t from;
   pipes_end_info_t to;
   int pipefds[2];
+  enum pipe_type type;
+  int sndbuf;
+  int rcvbuf;
+  size_t shm_size;
+  shm_ring_t *ring;
+  int open_flags;
+  long long prealloc;
+  // 'relay': the data is moved by the supervisor (see relay.h)
+  int relay;
+  // 'record=path' (implies relay) and 'timing': see recording.h
+  char const *record_path;
+  int record_timing;
+  int fifo_hold;
+  // The FIFO was created by pipexec: it is removed at the end.
+  int fifo_created;
 };
 
 typedef struct pipe_info pipe_info_t;
 
-void pipe_info_parse(pipe_info_t *const ipipe, int const start_argc,
-                     int const argc, char *const argv[], char const sep);
-void pipe_info_create_pipes(pipe_info_t *const ipipe,
-                            unsigned long const pipe_cnt);
-void pipe_info_close_all(pipe_info_t const *const ipipe,
+// The parsing and the creation return -1 on error (errno EINVAL for
+// syntax errors); the error is logged.
+int pipe_info_parse(pipe_info_t *const ipipe, int const start_argc,
+                    int const argc, char *const argv[]);
+int pipe_info_create_pipes(pipe_info_t *const ipipe,
+                           unsigned long const pipe_cnt);
+void pipe_info_close_all(pipe_info_t *const ipipe,
                          unsigned long const pipe_cnt);
+// On termination: closes the side of the FIFOs which the supervisor
+// holds.  A process sees EOF (reading) or EPIPE (writing) when the
+// external side is gone as well.  The next start opens them again.
+void pipe_info_fifo_close(pipe_info_t *const ipipe,
+                          unsigned long const pipe_cnt);
+// At the end: closes the FIFOs and removes the created ones.
+void pipe_info_release(pipe_info_t *const ipipe,
+                       unsigned long const pipe_cnt);
+
+/*
+ * The fds which the supervisor keeps open after all processes are
+ * started.  pk_read keeps the read ends of pipes to be able to look
+ * at their fill level; pk_all keeps everything to be able to start a
+ * single process again.  A kept fd is closed when the process using
+ * it terminates (see pipe_info_command_exited()).
+ */
+enum pipe_keep {
+  pk_none = 0,
+  pk_read = 1,
+  pk_all = 2
+};
+
+void pipe_info_close_unkept(pipe_info_t *const ipipe,
+                            unsigned long const pipe_cnt,
+                            enum pipe_keep const keep);
 void pipe_info_dup_in_pipes(pipe_info_t *ipipe, unsigned long pipe_cnt,
                             char *cmd_name, int close_unused);
+// In the child: closes the fds of the pipe ends of other processes.
+void pipe_info_close_foreign(pipe_info_t *ipipe, unsigned long pipe_cnt,
+                             char const *cmd_name);
 void pipe_info_print(pipe_info_t const *const ipipe, unsigned long const cnt);
-void pipe_info_check_for_duplicates(
+void pipe_info_command_exited(pipe_info_t *const ipipe,
+                              unsigned long const pipe_cnt,
+                              char const *const cmd_name);
+int pipe_info_check_for_duplicates(
         pipe_info_t const *const ipipe, unsigned long const cnt);
 
 unsigned int pipe_info_clp_count(int const start_argc, int const argc,
                                  char *const argv[]);
 
-void pipe_info_block_used_fds(pipe_info_t const *const ipipe,
-                              unsigned long const cnt);
+int pipe_info_block_used_fds(pipe_info_t const *const ipipe,
+                             unsigned long const cnt);
+
+// Bytes written but not yet read and the size of the buffer.
+// Only known for shm rings, FIFOs and pipes between two processes
+// where the supervisor kept the needed end; -1 else.
+long pipe_info_fill(pipe_info_t const *const pipe);
+long pipe_info_capacity(pipe_info_t const *const pipe);
 
 #endif
@@ -2,6 +2,7 @@
  * pipexec
  *
  * Build up a directed graph of processes and pipes.
+ * The command line client of libpipexec.
  *
  * Copyright 2015,2022 by Andreas Florath
  * SPDX-License-Identifier: GPL-2.0-or-later
@@ -9,326 +10,13 @@
 #define _POSIX_C_SOURCE 200809L
 #define _DEFAULT_SOURCE
 
-#include "src/logging.h"
+#include "src/libpipexec.h"
 #include "src/version.h"
-#include "src/command_info.h"
-#include "src/pipe_info.h"
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/wait.h>
-#include <fcntl.h>
 #include <stdio.h>
-#include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <stdbool.h>
-#include <signal.h>
 #include <errno.h>
-#include <time.h>
-
-/**
- * Globals
- * Used for communication between signal handler and main program.
- */
-volatile int g_restart = 0;
-volatile int g_terminate = 0;
-volatile int g_kill_child_processes = 0;
-
-/**
- * Should the processes restart - pass in a 1.
- * If the process in the termination phase (e.g. it received itself
- * a signal) - this has no effect.
- */
-void set_restart(int rs) {
-  if (g_terminate) {
-    logging(lid_internal, "status", "warning",
-	    "Cannot set restart flag - process will terminate", 0);
-    return;
-  }
-  g_restart = rs;
-}
-
-/**
- * If an appropriate signal was sent to this process,
- * it will terminate - indeptendent of the results the childs return
- * during their shutdown.
- */
-void set_terminate() {
-  g_terminate = 1;
-  g_restart = 0;
-}
-
-/**
- * An array with the pids of all child processes.
- * If a child is not running (e.g. during cleanup or restart phase)
- * the appropriate entry it set to 0.
- *
- * This needs to be global, because it is also accessed from the
- * interrupt handler.
- */
-volatile int g_child_cnt = 0;
-volatile pid_t *g_child_pids = NULL;
-
-/**
- * Unset the given pid.
- */
-void child_pids_unset(pid_t cpid) {
-  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
-    if (g_child_pids[child_idx] == cpid) {
-      g_child_pids[child_idx] = 0;
-      return;
-    }
-  }
-  ITOCHAR(spid, 16, cpid);
-  logging(lid_internal, "status", "warning",
-	  "child_pids_unset: PID not found in list", 1, "pid", spid);
-}
-
-void child_pids_print() {
-  int pilen = 4096;
-  char *pbuf = (char *)malloc(pilen * sizeof(char));
-  if (pbuf == NULL) {
-    logging(lid_internal, "status", "error", "Memory allocation failed", 0);
-    return;
-  }
-  pbuf[0] = '[';
-  int poffset = 1;
-  bool first = true;
-
-  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
-    if (g_child_pids[child_idx] == 0) {
-      continue;
-    }
-
-    if (!first) {
-      pbuf[poffset++] = ',';
-    }
-
-    while (poffset + 32 >= pilen) { // Ensure enough space for new data
-      pilen *= 2;
-      char *new_pbuf = (char *)realloc(pbuf, pilen * sizeof(char));
-      if (new_pbuf == NULL) {
-        free(pbuf);
-        logging(lid_internal, "status", "error", "Memory reallocation failed", 0);
-        return;
-      }
-      pbuf = new_pbuf;
-    }
-
-    int const written = snprintf(pbuf + poffset, pilen - poffset, "%d", g_child_pids[child_idx]);
-    if (written < 0) {
-      free(pbuf);
-      logging(lid_internal, "status", "error", "snprintf failed", 0);
-      return;
-    }
-    poffset += written;
-    first = false;
-  }
-
-  pbuf[poffset++] = ']';
-  pbuf[poffset] = '\0';
-
-  logging(lid_internal, "status", "info", "Child pids", 1, "pids", pbuf);
-  free(pbuf);
-}
-
-void child_pids_kill_all() {
-  if(! g_kill_child_processes) {
-    logging(lid_internal, "tracing", "info", "Do not kill child processes", 0);
-    return;
-  }
-
-  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
-    if (g_child_pids[child_idx] != 0) {
-      pid_t const to_kill = g_child_pids[child_idx];
-      ITOCHAR(skill, 16, to_kill);
-      logging(lid_internal, "tracing", "info", "Sending SIGTERM", 1, "pid", skill);
-      kill(to_kill, SIGTERM);
-    }
-  }
-}
-
-void child_pids_wait_all() {
-  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
-    if (g_child_pids[child_idx] != 0) {
-      pid_t const to_wait = g_child_pids[child_idx];
-      ITOCHAR(swait, 16, to_wait);
-      logging(lid_internal, "tracing", "info", "Wait for pid to terminate",
-	      1, "pid", swait);
-      int status;
-      pid_t const rw = waitpid(to_wait, &status, 0);
-      if (rw == -1) {
-	ITOCHAR(swait, 16, to_wait);
-	ITOCHAR(serrno, 16, errno);
-	logging(lid_internal, "tracing", "error", "Error waiting", 3,
-		"pid", swait, "error", strerror(errno),
-		"errno", serrno);
-      } else {
-	ITOCHAR(spid, 16, to_wait);
-	ITOCHAR(sstatus, 16, status);
-	ITOCHAR(snormal_exit, 16, WIFEXITED(status));
-	ITOCHAR(schild_status, 16, WEXITSTATUS(status));
-	ITOCHAR(schild_signaled, 16, WIFSIGNALED(status));
-	logging(lid_child_exit, "exec", "info", "child exit", 5,
-		"command_pid", spid, "status", schild_status,
-		"normal_exit", snormal_exit, "child_status", schild_status,
-		"child_signaled", schild_signaled);
-
-        if (WIFSIGNALED(status)) {
-          logging(lid_internal, "tracing", "info", "Signaled child",
-		  2, "pid", spid, "signaled_with", WTERMSIG(status));
-          if (WTERMSIG(status) != SIGTERM) {
-	    logging(lid_internal, "tracing", "error",
-		    "Child terminated because of a different signal - not SIGTERM "
-                    "Do not restart",
-		    1, "pid", spid);
-            set_terminate();
-          }
-        }
-      }
-      child_pids_unset(to_wait);
-    }
-  }
-  logging(lid_internal, "tracing", "debug", "Finished waiting for all children", 0);
-}
-
-void child_pids_kill_all_and_wait() {
-  child_pids_kill_all();
-  child_pids_wait_all();
-}
-
-/**
- * Signal Related.
- */
-
-void sh_term(int signum, siginfo_t *siginfo, void *ucontext) {
-  (void)siginfo;
-  (void)ucontext;
-
-  ITOCHAR(ssignum, 16, signum);
-  logging(lid_internal, "signal", "info",
-	  "signal terminate handler called - signal received",
-	  1, "signal", ssignum);
-
-  // Kill all children and stop
-  set_terminate();
-  child_pids_kill_all_and_wait();
-}
-
-void sh_restart(int signum, siginfo_t *siginfo, void *ucontext) {
-  (void)siginfo;
-  (void)ucontext;
-
-  ITOCHAR(ssignum, 16, signum);
-  logging(lid_internal, "signal", "info",
-	  "signal restart handler called - signal received",
-	  1, "signal", ssignum);
-
-  // Kill all children and restart
-  set_restart(1);
-  child_pids_kill_all_and_wait();
-}
-
-void install_signal_handler() {
-
-  struct sigaction sa_term;
-  sa_term.sa_sigaction = sh_term;
-  sigemptyset(&sa_term.sa_mask);
-  sa_term.sa_flags = SA_SIGINFO | SA_NODEFER;
-
-  struct sigaction sa_restart;
-  sa_restart.sa_sigaction = sh_restart;
-  sigemptyset(&sa_restart.sa_mask);
-  sa_restart.sa_flags = SA_SIGINFO | SA_NODEFER;
-
-  sigaction(SIGHUP, &sa_restart, NULL);
-  sigaction(SIGINT, &sa_term, NULL);
-  sigaction(SIGQUIT, &sa_term, NULL);
-  sigaction(SIGTERM, &sa_term, NULL);
-}
-
-void uninstall_signal_handler() {
-
-  struct sigaction sa_default;
-  sa_default.sa_handler = SIG_DFL;
-  sigemptyset(&sa_default.sa_mask);
-  sa_default.sa_flags = SA_SIGINFO | SA_NODEFER;
-
-  sigaction(SIGHUP, &sa_default, NULL);
-  sigaction(SIGINT, &sa_default, NULL);
-  sigaction(SIGQUIT, &sa_default, NULL);
-  sigaction(SIGTERM, &sa_default, NULL);
-}
-
-// Functions using the upper data structures
-static void pipe_execv_one(command_info_t const *params,
-                           pipe_info_t *const ipipe, size_t const pipe_cnt) {
-  pipe_info_dup_in_pipes(ipipe, pipe_cnt, params->cmd_name, 1);
-
-  logging(lid_internal, "exec", "info", "Calling execv",
-	  2, "command", params->cmd_name, "path", params->path);
-  execv(params->path, params->argv);
-
-  ITOCHAR(serrno, 16, errno);
-  logging(lid_internal, "exec", "error", "Calling execv",
-	  2, "command", params->cmd_name, "path", params->path,
-	  "errno", serrno, "error", strerror(errno));
-  abort();
-}
-
-static pid_t pipe_execv_fork_one(command_info_t const *params,
-                                 pipe_info_t *const ipipe,
-                                 size_t const pipe_cnt) {
-  command_info_print(params);
-  pid_t const fpid = fork();
-
-  if (fpid == -1) {
-    ITOCHAR(serrno, 16, errno);
-    logging(lid_internal, "exec", "error", "Error during fork()", 2,
-	    "errno", serrno, "error", strerror(errno));
-    exit(10);
-  } else if (fpid == 0) {
-    uninstall_signal_handler();
-    pipe_execv_one(params, ipipe, pipe_cnt);
-    // Neverreached
-    abort();
-  }
-
-  ITOCHAR(spid, 16, fpid);
-  logging(lid_command_pid, "exec", "info", "New child forked", 2,
-	  "command", params->cmd_name, "command_pid", spid);
-  // fpid>0: parent
-  return fpid;
-}
-
-int pipe_execv(command_info_t *const icmd, size_t const command_cnt,
-               pipe_info_t *const ipipe, size_t const pipe_cnt,
-               pid_t *child_pids) {
-
-  pipe_info_block_used_fds(ipipe, pipe_cnt);
-  pipe_info_create_pipes(ipipe, pipe_cnt);
-
-  // Looks that messing around with the pipes (storing them and propagating
-  // them to all children) is not a good idea.
-  // ... but in this case there is no other way....
-  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
-    child_pids[cidx] = pipe_execv_fork_one(&icmd[cidx], ipipe, pipe_cnt);
-  }
-
-  pipe_info_close_all(ipipe, pipe_cnt);
-
-  return 0;
-}
-
-int next_running_child() {
-  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
-    if (g_child_pids[child_idx] != 0) {
-      return child_idx;
-    }
-  }
-  return g_child_cnt;
-}
 
 static void usage() {
   fprintf(stderr, "pipexec version %s\n", app_version);
@@ -337,91 +25,139 @@ static void usage() {
   fprintf(stderr, "\n");
   fprintf(stderr, "Usage: pipexec [options] -- process-pipe-graph\n");
   fprintf(stderr, "Options:\n");
+  fprintf(stderr, " -a interval     milli seconds between two autoscaling\n");
+  fprintf(stderr, "                 checks (default 1000)\n");
+  fprintf(stderr, " -B list         batch: run the graph once per line of\n");
+  fprintf(stderr, "                 the file list ('-': stdin)\n");
+  fprintf(stderr, " -c path         create a control socket\n");
+  fprintf(stderr, " -C dir          cache directory for nodes with the\n");
+  fprintf(stderr, "                 option cache\n");
+  fprintf(stderr, " -d timeout      on termination stop the processes along\n");
+  fprintf(stderr, "                 the pipes: timeout (seconds) per stage\n");
+  fprintf(stderr, " -g timeout      report processes which make no progress\n");
+  fprintf(stderr, "                 for timeout seconds while input waits\n");
+  fprintf(stderr, " -G              restart stalled processes (needs -R)\n");
   fprintf(stderr, " -h              display this help\n");
   fprintf(stderr, " -j logfd        set fd which is used for json logging\n");
   fprintf(stderr, " -k              kill all child processes when one \n");
   fprintf(stderr, "                 terminates abnormally\n");
   fprintf(stderr, " -l logfd        set fd which is used for text logging\n");
+  fprintf(stderr, " -M size         size of the cache in MiB (default 1024)\n");
+  fprintf(stderr, " -m address      serve metrics (OpenMetrics) on the\n");
+  fprintf(stderr, "                 unix socket path or [ipv4-address:]port\n");
   fprintf(stderr, " -p pidfile      specify a pidfile\n");
+  fprintf(stderr, " -P num          batch: number of parallel instances\n");
+  fprintf(stderr, " -R              restart single processes instead of all\n");
   fprintf(stderr, " -s sleep_time   time to wait before a restart\n");
+  fprintf(stderr, " -w timeout      time to wait for a process to get ready\n");
+  fprintf(stderr, "                 before its producers are started\n");
+  fprintf(stderr, " -x file         export the graph after the start (DOT,\n");
+  fprintf(stderr, "                 JSON if the file ends with .json)\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "process-pipe-graph is a list of process descriptions\n");
   fprintf(stderr, "                   and pipe descriptions.\n");
   fprintf(stderr, "process description: '[ NAME /path/to/proc <optional args> ]'\n");
-  fprintf(stderr, "pipe description: '{NAME1:fd1>NAME2:fd2}'\n");
+  fprintf(stderr, "process options: notify=fd, standby, scale=min-max, cache, e.g.\n");
+  fprintf(stderr, "                 '[ NAME,notify=fd,standby /path/to/proc ... ]'\n");
+  fprintf(stderr, "pipe description: '{NAME1:fd1>NAME2:fd2[,option...]}'\n");
+  fprintf(stderr, "pipe options: pipe, stream, seqpacket, sndbuf=size, rcvbuf=size,\n");
+  fprintf(stderr, "              shm, size=size, append, direct, prealloc=size, relay,\n");
+  fprintf(stderr, "              record=path, timing\n");
+  fprintf(stderr, "file as pipe end: '{FILE:/path>NAME:fd}' '{NAME:fd>FILE:/path}'\n");
+  fprintf(stderr, "fd of pipexec: '{PARENT:fd=NAME:fd}' '{NAME:fd=PARENT:fd}'\n");
+  fprintf(stderr, "FIFO to attach: '{FIFO:/path>NAME:fd}' '{NAME:fd>FIFO:/path}'\n");
   exit(1);
 }
 
-static void write_pid_file(char const *const pid_file) {
-  ITOCHAR(spid, 16, getpid());
-  logging(lid_internal, "tracing", "info", "Writing pid file", 2,
-	  "pid_file", pid_file, "pid", spid);
-  char pbuf[20];
-  int const plen = snprintf(pbuf, 20, "%d\n", getpid());
-  int const fd =
-      open(pid_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IRGRP | S_IROTH);
-  if (fd == -1) {
-    ITOCHAR(serrno, 16, errno);
-    logging(lid_internal, "tracing", "error", "Cannot open pid file", 2,
-	    "error", strerror(errno), "errno", serrno);
-    return;
-  }
-  ssize_t const written = write(fd, pbuf, plen);
-  if (written != plen) {
-    ITOCHAR(serrno, 16, errno);
-    logging(lid_internal, "tracing", "error", "Write error writing pid", 2,
-	    "error", strerror(errno), "errno", serrno);
+// Sets an option of the library; a value out of range is a usage error.
+static void set_int(pipexec_t *pe, enum pipexec_option option, int value) {
+  if (pipexec_set_int(pe, option, value) == -1) {
+    usage();
   }
-  close(fd);
 }
 
-static void remove_pid_file(char const *const pid_file) {
-  ITOCHAR(spid, 16, getpid());
-  logging(lid_internal, "tracing", "info", "Removing pid file", 2,
-	  "pid_file", pid_file, "pid", spid);
-  int const rval = unlink(pid_file);
-  if (rval == -1) {
-    ITOCHAR(serrno, 16, errno);
-    logging(lid_internal, "tracing", "error", "Cannot remove pid file", 2,
-	    "error", strerror(errno), "errno", serrno);
+static void set_string(pipexec_t *pe, enum pipexec_option option,
+                       char const *value) {
+  if (pipexec_set_string(pe, option, value) == -1) {
+    perror("pipexec");
+    exit(10);
   }
 }
 
 int main(int argc, char *argv[]) {
 
-  int sleep_timer = 0;
-  char *pid_file = NULL;
+  pipexec_t *const pe = pipexec_new();
+  if (pe == NULL) {
+    perror("pipexec");
+    exit(10);
+  }
+  char const *batch_list = NULL;
+  int batch_parallel = 1;
+
+  set_int(pe, pipexec_opt_signal_handlers, 1);
 
   int opt;
-  while ((opt = getopt(argc, argv, "hj:kl:p:s:-")) != -1) {
+  while ((opt = getopt(argc, argv, "a:B:c:C:d:g:Ghj:kl:m:M:p:P:Rs:w:x:-")) != -1) {
     switch (opt) {
+    case 'a':
+      set_int(pe, pipexec_opt_scale_interval, atoi(optarg));
+      break;
+    case 'B':
+      batch_list = optarg;
+      break;
+    case 'c':
+      set_string(pe, pipexec_opt_control_path, optarg);
+      break;
+    case 'C':
+      set_string(pe, pipexec_opt_cache_dir, optarg);
+      break;
+    case 'd':
+      set_int(pe, pipexec_opt_drain_timeout, atoi(optarg));
+      break;
+    case 'g':
+      set_int(pe, pipexec_opt_watchdog_timeout, atoi(optarg));
+      break;
+    case 'G':
+      set_int(pe, pipexec_opt_watchdog_restart, 1);
+      break;
     case 'h':
       usage();
       break;
-    case 'j': {
-      if(*optarg=='s') {
-        logging_json_set_global_use_syslog();
-      } else {
-        int const logfd = atoi(optarg);
-        logging_json_set_global_log_fd(logfd);
-      }
-    } break;
+    case 'j':
+      pipexec_log_json(*optarg == 's' ? -1 : atoi(optarg));
+      break;
     case 'k':
-      g_kill_child_processes = 1;
+      set_int(pe, pipexec_opt_kill_all, 1);
+      break;
+    case 'l':
+      pipexec_log_text(*optarg == 's' ? -1 : atoi(optarg));
+      break;
+    case 'm':
+      set_string(pe, pipexec_opt_metrics_addr, optarg);
+      break;
+    case 'M':
+      set_int(pe, pipexec_opt_cache_size, atoi(optarg));
       break;
-    case 'l': {
-      if(*optarg=='s') {
-        logging_text_set_global_use_syslog();
-      } else {
-        int const logfd = atoi(optarg);
-        logging_text_set_global_log_fd(logfd);
-      }
-    } break;
     case 'p':
-      pid_file = optarg;
+      set_string(pe, pipexec_opt_pid_file, optarg);
+      break;
+    case 'P':
+      batch_parallel = atoi(optarg);
+      if (batch_parallel <= 0) {
+        usage();
+      }
+      break;
+    case 'R':
+      set_int(pe, pipexec_opt_node_restart, 1);
       break;
     case 's':
-      sleep_timer = atoi(optarg);
+      set_int(pe, pipexec_opt_sleep_timer, atoi(optarg));
+      break;
+    case 'w':
+      set_int(pe, pipexec_opt_ready_timeout, atoi(optarg));
+      break;
+    case 'x':
+      set_string(pe, pipexec_opt_graph_path, optarg);
       break;
     case '-':
       // The rest are commands.....
@@ -436,134 +172,29 @@ int main(int argc, char *argv[]) {
     usage();
   }
 
-  if(sleep_timer==0) {
-    // When there is no restart give - terminate all processes when done
-    set_restart(0);
-    set_terminate();
-  }
-
-  logging(lid_internal, "version", "info", "pipexec", 1, "version", app_version);
-
-  if (pid_file != NULL) {
-    write_pid_file(pid_file);
-  }
-
-  install_signal_handler();
-
-  int const command_cnt = command_info_clp_count(optind, argc, argv);
-  int const pipe_cnt = pipe_info_clp_count(optind, argc, argv);
-
-  ITOCHAR(scommand_cnt, 16, command_cnt);
-  logging(lid_internal, "command_line", "info", "Number of commands", 1,
-	  "command_cnt", scommand_cnt);
-  ITOCHAR(spipe_cnt, 16, pipe_cnt);
-  logging(lid_internal, "command_line", "info", "Number of pipes", 1,
-	  "command_cnt", scommand_cnt);
-
-  int handled_args = 0;
-
-  command_info_t icmd[command_cnt];
-  handled_args += command_info_array_constrcutor(icmd, optind, argc, argv);
-  command_info_array_print(icmd, command_cnt);
-
-  pipe_info_t ipipe[pipe_cnt];
-  pipe_info_parse(ipipe, optind, argc, argv, '>');
-  pipe_info_print(ipipe, pipe_cnt);
-  pipe_info_check_for_duplicates(ipipe, pipe_cnt);
-
-  ITOCHAR(shandled_args, 16, handled_args);
-  logging(lid_internal, "command_line", "info", "Number of handled args", 1,
-	  "handled_args", shandled_args);
-  int const not_processed_args = argc - optind - pipe_cnt - handled_args;
-  ITOCHAR(snot_processed_args, 16, not_processed_args);
-  logging(lid_internal, "command_line", "info", "Not processed args", 1,
-	  "not_processed_args", snot_processed_args);
-
-  if(not_processed_args > 0) {
-    logging(lid_internal, "command_line", "error",
-	    "Error: rubbish / unparsable parameters given", 0);
-    usage();
-  }
-
-  // Provide memory for child_pids and initialize.
-  pid_t child_pids[command_cnt];
-  for (int i = 0; i < command_cnt; ++i) {
-    child_pids[i] = 0;
+  if (pipexec_add_args(pe, argc - optind,
+                       (char const *const *)argv + optind) == -1) {
+    perror("pipexec");
+    exit(10);
   }
-  g_child_pids = child_pids;
-  g_child_cnt = command_cnt;
 
-  bool child_failed = false;
+  int const child_failed =
+      batch_list != NULL
+          ? pipexec_run_batch(pe, batch_list, batch_parallel)
+          : pipexec_run(pe);
 
-  do {
-    if (next_running_child() == command_cnt) {
-      set_restart(0);
-      ITOCHAR(schild_count, 16, command_cnt);
-      logging(lid_internal, "exec", "info", "Start all children", 1,
-	      "child_count", schild_count);
-      pipe_execv(icmd, command_cnt, ipipe, pipe_cnt, child_pids);
+  if (child_failed == -1) {
+    if (errno != EINVAL) {
+      perror("pipexec");
+      exit(10);
     }
-
-    logging(lid_internal, "exec", "info", "Wait for termination of children", 0);
-
-    while (next_running_child() != command_cnt) {
-      // Still running children
-      logging(lid_internal, "exec", "info", "Wait for next child to terminate", 0);
-      child_pids_print();
-      int status;
-      logging(lid_internal, "exec", "info", "Calling wait", 0);
-
-      pid_t const cpid = wait(&status);
-
-      if (cpid == -1) {
-	ITOCHAR(swait, 16, cpid);
-	ITOCHAR(serrno, 16, errno);
-	logging(lid_internal, "tracing", "error", "Error waiting", 3,
-		"pid", swait, "error", strerror(errno),
-		"errno", serrno);
-      } else {
-	ITOCHAR(spid, 16, cpid);
-	ITOCHAR(sstatus, 16, status);
-	ITOCHAR(snormal_exit, 16, WIFEXITED(status));
-	ITOCHAR(schild_status, 16, WEXITSTATUS(status));
-	ITOCHAR(schild_signaled, 16, WIFSIGNALED(status));
-	logging(lid_child_exit, "exec", "info", "child exit", 5,
-		"command_pid", spid, "status", schild_status,
-		"normal_exit", snormal_exit, "child_status", schild_status,
-		"child_signaled", schild_signaled);
-        child_pids_unset(cpid);
-
-	if( status!=0 ) {
-	  child_failed = true;
-	}
-
-        if (!WIFEXITED(status) || WIFSIGNALED(status)) {
-          logging(lid_internal, "tracing", "warning",
-		  "Unnormal termination/signaling of child - restarting", 1,
-		  "pid", spid);
-          set_restart(1);
-          child_pids_kill_all_and_wait();
-        }
-      }
-
-      logging(lid_internal, "tracing", "debug", "Remaining children", 0);
-      child_pids_print();
-
-      if (g_restart && sleep_timer != 0) {
-	ITOCHAR(ssleep_timer, 16, sleep_timer);
-        logging(lid_internal, "tracing", "info", "Waiting for before restart", 1,
-		"sleep_timer", ssleep_timer);
-        sleep(sleep_timer);
-        logging(lid_internal, "tracing", "info", "Continue restarting", 0);
-      }
+    // The library logged what is wrong.
+    if (batch_list != NULL) {
+      exit(1);
     }
-  } while (g_restart);
-
-  if (pid_file != NULL) {
-    remove_pid_file(pid_file);
+    usage();
   }
 
-  logging(lid_internal, "tracing", "info", "exiting", 0);
-
-  return child_failed ? 1 : 0;
+  pipexec_free(pe);
+  return child_failed;
 }
@@ -0,0 +1,277 @@
+/*
+ * ppart
+ *
+ * Partitions a stream of records by key: each record is written to
+ * one of the output fds, chosen by the hash of its key.  All records
+ * with the same key end up in the same output - so stateful stages
+ * (aggregation per key, dedup) can run in many processes.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "src/version.h"
+#include "src/fdio.h"
+
+// Initial size of the read buffer; it grows for longer records.
+#define PPART_BUFFER_SIZE (256 * 1024)
+// Maximum number of records in one writev (IOV_MAX on Linux).
+#define PPART_MAX_IOV 1024
+
+static void usage() {
+   fprintf(stderr, "ppart from pipexec version %s\n", app_version);
+   fprintf(stderr, "%s\n", desc_copyight);
+   fprintf(stderr, "%s\n", desc_license);
+   fprintf(stderr, "\n");
+   fprintf(stderr, "Usage: ppart [options] fd [fd ...]\n");
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, " -d delim        field delimiter (default tab)\n");
+   fprintf(stderr, " -f field        number of the key field (default 1)\n");
+   fprintf(stderr, " -h              display this help\n");
+   fprintf(stderr, " -l length       key length for -o (default: rest of\n");
+   fprintf(stderr, "                 the record)\n");
+   fprintf(stderr, " -o offset       key starts at byte offset (instead of\n");
+   fprintf(stderr, "                 a field)\n");
+   fprintf(stderr, " -r fd           fd to read from (default 0)\n");
+   fprintf(stderr, " -s sep          record separator (default newline)\n");
+   exit(1);
+}
+
+struct key_spec {
+   char delim;
+   unsigned field;
+   // -1: use the field
+   long offset;
+   // 0: up to the end of the record
+   size_t length;
+};
+
+/* Records which are collected for one output.  The iovecs point into
+   the read buffer: they must be written before the buffer changes. */
+struct output {
+   int fd;
+   struct iovec iov[PPART_MAX_IOV];
+   int iov_cnt;
+};
+
+// '\t' and '\n' can be given as escapes.
+static char parse_char(char const * str) {
+   if(str[0]=='\\' && str[1]=='t') {
+      return '\t';
+   }
+   if(str[0]=='\\' && str[1]=='n') {
+      return '\n';
+   }
+   if(str[0]=='\0' || str[1]!='\0') {
+      fprintf(stderr, "Error: expected one character [%s]\n", str);
+      usage();
+   }
+   return str[0];
+}
+
+// Finds the key in the record (without separator).  A record with
+// less fields or bytes has an (partly) empty key.
+static void find_key(struct key_spec const * spec, char const * rec,
+                     size_t len, char const ** key, size_t * key_len) {
+   if(spec->offset >= 0) {
+      size_t const offset =
+         (size_t)spec->offset < len ? (size_t)spec->offset : len;
+      *key = rec + offset;
+      *key_len = len - offset;
+      if(spec->length > 0 && spec->length < *key_len) {
+         *key_len = spec->length;
+      }
+      return;
+   }
+
+   char const * start = rec;
+   char const * const end = rec + len;
+   for(unsigned fidx=1; fidx<spec->field; ++fidx) {
+      char const * const delim = memchr(start, spec->delim, end - start);
+      if(delim==NULL) {
+         *key = end;
+         *key_len = 0;
+         return;
+      }
+      start = delim + 1;
+   }
+   char const * const delim = memchr(start, spec->delim, end - start);
+   *key = start;
+   *key_len = (delim==NULL ? end : delim) - start;
+}
+
+// FNV-1a: fast and good enough to spread the keys.
+static uint64_t hash_key(char const * key, size_t len) {
+   uint64_t hash = UINT64_C(14695981039346656037);
+   for(size_t idx=0; idx<len; ++idx) {
+      hash ^= (unsigned char)key[idx];
+      hash *= UINT64_C(1099511628211);
+   }
+   return hash;
+}
+
+static void output_flush(struct output * out) {
+   if(out->iov_cnt==0) {
+      return;
+   }
+   if(fdio_writev_all(out->fd, out->iov, out->iov_cnt)==-1) {
+      perror("writev");
+      exit(2);
+   }
+   out->iov_cnt = 0;
+}
+
+static void output_add(struct output * out, char const * rec, size_t len) {
+   // Records which follow each other in the buffer are one iovec.
+   if(out->iov_cnt > 0) {
+      struct iovec * const last = &out->iov[out->iov_cnt - 1];
+      if((char const *)last->iov_base + last->iov_len == rec) {
+         last->iov_len += len;
+         return;
+      }
+   }
+   if(out->iov_cnt==PPART_MAX_IOV) {
+      output_flush(out);
+   }
+   out->iov[out->iov_cnt].iov_base = (void *)rec;
+   out->iov[out->iov_cnt].iov_len = len;
+   ++out->iov_cnt;
+}
+
+static void route(struct key_spec const * spec, struct output * outputs,
+                  size_t out_cnt, char const * rec, size_t len,
+                  size_t rec_len) {
+   char const * key;
+   size_t key_len;
+   find_key(spec, rec, rec_len, &key, &key_len);
+   output_add(&outputs[hash_key(key, key_len) % out_cnt], rec, len);
+}
+
+static void partition(int read_fd, char sep, struct key_spec const * spec,
+                      struct output * outputs, size_t out_cnt) {
+   size_t size = PPART_BUFFER_SIZE;
+   char * buffer = malloc(size);
+   if(buffer==NULL) {
+      perror("malloc");
+      exit(2);
+   }
+   size_t used = 0;
+
+   while(1) {
+      ssize_t const bytes_read = fdio_read(read_fd, buffer + used,
+                                           size - used);
+      if(bytes_read<0) {
+         // A truncated partition must not look complete.
+         perror("read");
+         exit(2);
+      }
+      used += bytes_read;
+
+      // memchr is vectorized by the C library.
+      char const * pos = buffer;
+      char const * const end = buffer + used;
+      char const * found;
+      while((found = memchr(pos, sep, end - pos)) != NULL) {
+         route(spec, outputs, out_cnt, pos, found + 1 - pos, found - pos);
+         pos = found + 1;
+      }
+      if(bytes_read<=0 && pos < end) {
+         // EOF: the last record has no separator.
+         route(spec, outputs, out_cnt, pos, end - pos, end - pos);
+         pos = end;
+      }
+
+      for(size_t oidx=0; oidx<out_cnt; ++oidx) {
+         output_flush(&outputs[oidx]);
+      }
+      if(bytes_read<=0) {
+         break;
+      }
+
+      // Keep the beginning of the next record.
+      used = end - pos;
+      memmove(buffer, pos, used);
+      if(used==size) {
+         size *= 2;
+         char * const nbuffer = realloc(buffer, size);
+         if(nbuffer==NULL) {
+            perror("realloc");
+            exit(2);
+         }
+         buffer = nbuffer;
+      }
+   }
+   free(buffer);
+}
+
+int main(int argc, char * argv[]) {
+
+   int read_fd = 0;
+   char sep = '\n';
+   struct key_spec spec = { '\t', 1, -1, 0 };
+
+   int opt;
+   while ((opt = getopt(argc, argv, "d:f:hl:o:r:s:")) != -1) {
+      switch (opt) {
+      case 'd':
+         spec.delim = parse_char(optarg);
+         break;
+      case 'f':
+         if(atoi(optarg) <= 0) {
+            usage();
+         }
+         spec.field = atoi(optarg);
+         break;
+      case 'h':
+         usage();
+         break;
+      case 'l':
+         spec.length = atol(optarg);
+         break;
+      case 'o':
+         spec.offset = atol(optarg);
+         if(spec.offset < 0) {
+            usage();
+         }
+         break;
+      case 'r':
+         read_fd = atoi(optarg);
+         break;
+      case 's':
+         sep = parse_char(optarg);
+         break;
+      default: /* '?' */
+         usage();
+      }
+   }
+
+   if(optind==argc) {
+      fprintf(stderr, "Error: No fds given\n");
+      usage();
+   }
+
+   // All parameters are fds.
+   size_t const out_cnt = argc - optind;
+   struct output * const outputs = calloc(out_cnt, sizeof(struct output));
+   if(outputs==NULL) {
+      perror("calloc");
+      exit(2);
+   }
+   for(size_t oidx=0; oidx<out_cnt; ++oidx) {
+      outputs[oidx].fd = atoi(argv[optind + oidx]);
+   }
+
+   partition(read_fd, sep, &spec, outputs, out_cnt);
+
+   free(outputs);
+   return 0;
+}
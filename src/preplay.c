@@ -0,0 +1,211 @@
+/*
+ * preplay
+ *
+ * Replays an edge recording (see the pipe options 'record' and
+ * 'timing' of pipexec): the data is written to an fd with the
+ * original timing, scaled or as fast as possible.  At the end the
+ * achieved throughput is reported.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "src/version.h"
+#include "src/fdio.h"
+#include "src/recording.h"
+
+// Maximum bytes moved at once as fast as possible
+#define PREPLAY_CHUNK (1024 * 1024)
+
+static void usage() {
+   fprintf(stderr, "preplay from pipexec version %s\n", app_version);
+   fprintf(stderr, "%s\n", desc_copyight);
+   fprintf(stderr, "%s\n", desc_license);
+   fprintf(stderr, "\n");
+   fprintf(stderr, "Usage: preplay [options] recording\n");
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, " -a              as fast as possible (ignore the\n");
+   fprintf(stderr, "                 timing index)\n");
+   fprintf(stderr, " -h              display this help\n");
+   fprintf(stderr, " -q              do not report the throughput\n");
+   fprintf(stderr, " -s speed        speed factor for the timing\n");
+   fprintf(stderr, "                 (default 1: original timing)\n");
+   fprintf(stderr, " -w fd           fd to write to (default 1)\n");
+   exit(1);
+}
+
+static uint64_t now_usec() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t usec) {
+   struct timespec const ts = { usec / 1000000, (usec % 1000000) * 1000 };
+   while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+         == EINTR) {
+   }
+}
+
+/* Moves up to len bytes (until EOF) from in_fd to out_fd.  Returns
+   the number of bytes moved. */
+static uint64_t copy(int in_fd, int out_fd, uint64_t len, int use_splice,
+                     char * buffer) {
+   uint64_t done = 0;
+   while(done < len) {
+      size_t const want =
+         len - done < PREPLAY_CHUNK ? len - done : PREPLAY_CHUNK;
+      ssize_t moved;
+      if(use_splice) {
+         moved = fdio_splice(in_fd, out_fd, want);
+      } else {
+         moved = fdio_read(in_fd, buffer, want);
+         if(moved > 0 && fdio_write_all(out_fd, buffer, moved)==-1) {
+            perror("write");
+            exit(2);
+         }
+      }
+      if(moved==-1) {
+         perror("replay");
+         exit(2);
+      }
+      if(moved==0) {
+         break;
+      }
+      done += moved;
+   }
+   return done;
+}
+
+// Opens the timing index; returns NULL if there is none.
+static FILE * index_open(char const * path) {
+   size_t const plen = strlen(path);
+   char * const idx_path = malloc(plen + sizeof(RECORDING_INDEX_SUFFIX));
+   if(idx_path==NULL) {
+      perror("malloc");
+      exit(2);
+   }
+   memcpy(idx_path, path, plen);
+   memcpy(idx_path + plen, RECORDING_INDEX_SUFFIX,
+          sizeof(RECORDING_INDEX_SUFFIX));
+   FILE * const idx = fopen(idx_path, "r");
+   if(idx==NULL) {
+      free(idx_path);
+      return NULL;
+   }
+   char magic[RECORDING_INDEX_MAGIC_LEN];
+   if(fread(magic, sizeof(magic), 1, idx)!=1
+      || memcmp(magic, RECORDING_INDEX_MAGIC, sizeof(magic))!=0) {
+      fprintf(stderr, "Error: [%s] is no timing index\n", idx_path);
+      exit(2);
+   }
+   free(idx_path);
+   return idx;
+}
+
+int main(int argc, char * argv[]) {
+
+   int out_fd = 1;
+   int fast = 0;
+   int quiet = 0;
+   double speed = 0.0;
+
+   int opt;
+   while ((opt = getopt(argc, argv, "ahqs:w:")) != -1) {
+      switch (opt) {
+      case 'a':
+         fast = 1;
+         break;
+      case 'h':
+         usage();
+         break;
+      case 'q':
+         quiet = 1;
+         break;
+      case 's':
+         speed = atof(optarg);
+         if(speed <= 0.0) {
+            usage();
+         }
+         break;
+      case 'w':
+         out_fd = atoi(optarg);
+         break;
+      default: /* '?' */
+         usage();
+      }
+   }
+
+   if(optind + 1 != argc) {
+      fprintf(stderr, "Error: No recording given\n");
+      usage();
+   }
+   if(fast && speed != 0.0) {
+      fprintf(stderr, "Error: -a and -s exclude each other\n");
+      usage();
+   }
+
+   char const * const path = argv[optind];
+   int const in_fd = open(path, O_RDONLY | O_CLOEXEC);
+   if(in_fd==-1) {
+      perror(path);
+      exit(2);
+   }
+   // Without index: as fast as possible
+   FILE * const idx = fast ? NULL : index_open(path);
+   if(idx==NULL && speed != 0.0) {
+      fprintf(stderr, "Error: -s needs the timing index of the recording\n");
+      exit(2);
+   }
+   if(speed==0.0) {
+      speed = 1.0;
+   }
+
+   int const use_splice = fdio_can_splice(in_fd, out_fd);
+   char * const buffer = use_splice ? NULL : malloc(PREPLAY_CHUNK);
+   if(!use_splice && buffer==NULL) {
+      perror("malloc");
+      exit(2);
+   }
+
+   uint64_t const start = now_usec();
+   uint64_t bytes = 0;
+   uint64_t recorded_usec = 0;
+   if(idx!=NULL) {
+      struct recording_entry entry;
+      while(fread(&entry, sizeof(entry), 1, idx)==1) {
+         sleep_until(start + (uint64_t)(entry.usec / speed));
+         bytes += copy(in_fd, out_fd, entry.bytes, use_splice, buffer);
+         recorded_usec = entry.usec;
+      }
+      fclose(idx);
+   }
+   // Data behind the index (or all without index)
+   bytes += copy(in_fd, out_fd, UINT64_MAX, use_splice, buffer);
+   uint64_t const elapsed = now_usec() - start;
+
+   if(!quiet) {
+      double const seconds = elapsed / 1e6;
+      fprintf(stderr, "preplay: %llu bytes in %.3f s: %.2f MB/s",
+              (unsigned long long)bytes, seconds,
+              seconds > 0.0 ? bytes / seconds / 1e6 : 0.0);
+      if(recorded_usec != 0) {
+         fprintf(stderr, " (recorded: %.3f s)", recorded_usec / 1e6);
+      }
+      fputc('\n', stderr);
+   }
+
+   free(buffer);
+   close(in_fd);
+   return 0;
+}
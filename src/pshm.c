@@ -0,0 +1,132 @@
+/*
+ * pshm
+ *
+ * Adapter between a shared memory ring (see shm_ring.h) and a normal
+ * fd.  This makes it possible to connect programs which do not use the
+ * shm ring library to a 'shm' pipe of pipexec.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include "src/version.h"
+#include "src/shm_ring.h"
+
+static void usage() {
+   fprintf(stderr, "pshm from pipexec version %s\n", app_version);
+   fprintf(stderr, "%s\n", desc_copyight);
+   fprintf(stderr, "%s\n", desc_license);
+   fprintf(stderr, "\n");
+   fprintf(stderr, "Usage: pshm [options] -i ringfd | -o ringfd\n");
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, " -h              display this help\n");
+   fprintf(stderr, " -i ringfd       copy from the shm ring to an fd\n");
+   fprintf(stderr, " -o ringfd       copy from an fd into the shm ring\n");
+   fprintf(stderr, " -r fd           fd to read from (default 0)\n");
+   fprintf(stderr, " -w fd           fd to write to (default 1)\n");
+   exit(1);
+}
+
+static shm_ring_t *attach_or_exit(int ring_fd) {
+   shm_ring_t *const ring = shm_ring_attach(ring_fd);
+   if(ring==NULL) {
+      perror("shm_ring_attach");
+      exit(2);
+   }
+   return ring;
+}
+
+// Reads directly into the free space of the ring.
+static int fd_to_ring(int read_fd, int ring_fd) {
+   shm_ring_t *const ring = attach_or_exit(ring_fd);
+   while(1) {
+      size_t space;
+      void *const dest = shm_ring_write_reserve(ring, &space);
+      if(dest==NULL) {
+         // Reader is gone
+         break;
+      }
+      ssize_t const bytes_read = read(read_fd, dest, space);
+      if(bytes_read<0 && errno==EINTR)
+         continue;
+      if(bytes_read<=0)
+         // EOF
+         break;
+      shm_ring_write_commit(ring, bytes_read);
+   }
+   shm_ring_close_writer(ring);
+   shm_ring_detach(ring);
+   return 0;
+}
+
+// Writes directly out of the used space of the ring.
+static int ring_to_fd(int ring_fd, int write_fd) {
+   shm_ring_t *const ring = attach_or_exit(ring_fd);
+   int ret = 0;
+   while(1) {
+      size_t avail;
+      void const *const src = shm_ring_read_acquire(ring, &avail);
+      if(avail==0)
+         // EOF
+         break;
+      ssize_t const wr = write(write_fd, src, avail);
+      if(wr<0 && errno==EINTR)
+         continue;
+      if(wr<0) {
+         perror("write");
+         ret = 2;
+         break;
+      }
+      shm_ring_read_release(ring, wr);
+   }
+   shm_ring_close_reader(ring);
+   shm_ring_detach(ring);
+   return ret;
+}
+
+int main(int argc, char * argv[]) {
+
+   int read_fd = 0;
+   int write_fd = 1;
+   int ring_in_fd = -1;
+   int ring_out_fd = -1;
+
+   int opt;
+   while ((opt = getopt(argc, argv, "hi:o:r:w:")) != -1) {
+      switch (opt) {
+      case 'h':
+         usage();
+         break;
+      case 'i':
+         ring_in_fd = atoi(optarg);
+         break;
+      case 'o':
+         ring_out_fd = atoi(optarg);
+         break;
+      case 'r':
+         read_fd = atoi(optarg);
+         break;
+      case 'w':
+         write_fd = atoi(optarg);
+         break;
+      default: /* '?' */
+         usage();
+      }
+   }
+
+   if((ring_in_fd==-1) == (ring_out_fd==-1) || optind!=argc) {
+      fprintf(stderr, "Error: exactly one of -i and -o must be given\n");
+      usage();
+   }
+
+   if(ring_in_fd!=-1) {
+      return ring_to_fd(ring_in_fd, write_fd);
+   }
+   return fd_to_ring(read_fd, ring_out_fd);
+}
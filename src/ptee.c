@@ -15,7 +15,22 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
 #include "src/version.h"
+#include "src/uring.h"
+#include "src/fdio.h"
+
+// user_data of the read request; writes use the output index.
+#define PTEE_URING_READ UINT64_MAX
+
+// Number of buffers in the pool (used by the threaded mode) and the
+// default size of each; io_uring mode uses two, the others one.
+#define PTEE_POOL_BUFFERS 16
+#define PTEE_DEFAULT_BUFFER_SIZE (64 * 1024)
+// Reads start with this size and adapt up to the buffer size.
+#define PTEE_MIN_READ_SIZE 4096
 
 static void usage() {
    fprintf(stderr, "ptee from pipexec version %s\n", app_version);
@@ -25,23 +40,373 @@ static void usage() {
    fprintf(stderr, "Usage: ptee [options] fd [fd ...]\n");
    fprintf(stderr, "Options:\n");
    fprintf(stderr, " -h              display this help\n");
+   fprintf(stderr, " -H              use huge pages for the buffers\n");
+   fprintf(stderr, " -m bytes        size of each buffer (default 65536)\n");
    fprintf(stderr, " -r fd           fd to read from\n");
+   fprintf(stderr, " -t              use one writer thread per output\n");
+   fprintf(stderr, " -u              use io_uring (falls back to read / write\n");
+   fprintf(stderr, "                 if not available)\n");
    exit(1);
 }
 
+// With only one output there is nothing to copy: when one of the fds
+// is a pipe, the data is moved by the kernel.
+// Returns -1 if splice cannot be used (nothing was read then).
+static int tee_splice(int read_fd, int * fds, size_t fd_cnt,
+                      size_t buffer_size) {
+   if(fd_cnt!=1 || ! fdio_can_splice(read_fd, fds[0])) {
+      return -1;
+   }
+   fdio_adapt_t adapt;
+   fdio_adapt_init(&adapt, PTEE_MIN_READ_SIZE, buffer_size);
+   while(1) {
+      size_t const len = fdio_adapt_size(&adapt, read_fd);
+      ssize_t const moved = fdio_splice(read_fd, fds[0], len);
+      if(moved==-1) {
+         perror("splice - closing fd");
+         close(fds[0]);
+         fds[0]=-1;
+         return 0;
+      }
+      if(moved==0) {
+         // EOF
+         return 0;
+      }
+      fdio_adapt_update(&adapt, len, moved);
+   }
+}
+
+static void tee_rw(int read_fd, int * fds, size_t fd_cnt,
+                   fdio_pool_t * pool) {
+   char * const buffer = fdio_pool_get(pool);
+   fdio_adapt_t adapt;
+   fdio_adapt_init(&adapt, PTEE_MIN_READ_SIZE, fdio_pool_buffer_size(pool));
+   while(1) {
+      size_t const len = fdio_adapt_size(&adapt, read_fd);
+      ssize_t const bytes_read = fdio_read(read_fd, buffer, len);
+      if(bytes_read<=0)
+         // EOF
+         break;
+      fdio_adapt_update(&adapt, len, bytes_read);
+
+      for(size_t fdidx=0; fdidx<fd_cnt; ++fdidx) {
+         if(fds[fdidx]!=-1
+            && fdio_write_all(fds[fdidx], buffer, bytes_read)==-1) {
+            perror("write - closing fd");
+            close(fds[fdidx]);
+            fds[fdidx]=-1;
+         }
+      }
+   }
+   fdio_pool_put(pool, buffer);
+}
+
+static void close_output(int * fds, size_t fdidx, int err, char const * msg) {
+   errno = err;
+   perror(msg);
+   close(fds[fdidx]);
+   fds[fdidx]=-1;
+}
+
+// io_uring variant: while the writes of one buffer to all outputs are
+// running, the next read is already submitted into the second buffer.
+// All this is done with one system call per buffer.
+// Returns -1 if io_uring cannot be used (nothing was read then).
+static int tee_uring(int read_fd, int * fds, size_t fd_cnt,
+                     fdio_pool_t * pool) {
+   unsigned entries = 1;
+   while(entries < fd_cnt + 1) {
+      entries <<= 1;
+   }
+   uring_t * const ring = uring_create(entries);
+   if(ring==NULL) {
+      return -1;
+   }
+
+   size_t const buffer_size = fdio_pool_buffer_size(pool);
+   char * const buffers[2] = { fdio_pool_get(pool), fdio_pool_get(pool) };
+   struct iovec const iov[2] = {
+      { buffers[0], buffer_size },
+      { buffers[1], buffer_size } };
+   // File index 0 is the read fd, index i+1 the output fds[i].
+   int files[fd_cnt + 1];
+   files[0] = read_fd;
+   memcpy(&files[1], fds, fd_cnt * sizeof(int));
+   if(uring_register_buffers(ring, iov, 2) != 0
+      || uring_register_files(ring, files, fd_cnt + 1) != 0) {
+      uring_destroy(ring);
+      fdio_pool_put(pool, buffers[1]);
+      fdio_pool_put(pool, buffers[0]);
+      return -1;
+   }
+
+   // Bytes of the current buffer already written per output.
+   size_t written[fd_cnt];
+   unsigned cur = 0;
+   uring_prep_read_fixed(ring, 0, buffers[cur], buffer_size,
+                         cur, PTEE_URING_READ);
+   unsigned outstanding = 1;
+   size_t bytes_read = 0;
+   // Length of the buffer which is currently written.
+   size_t write_len = 0;
+   int read_done = 0;
+
+   while(1) {
+      if(uring_submit_and_wait(ring, outstanding) < 0) {
+         perror("io_uring_enter");
+         exit(2);
+      }
+
+      uint64_t user_data;
+      int res;
+      while(uring_next_cqe(ring, &user_data, &res)) {
+         --outstanding;
+         if(user_data==PTEE_URING_READ) {
+            read_done = 1;
+            // EOF or error (as in the read / write loop)
+            bytes_read = res > 0 ? (size_t)res : 0;
+            continue;
+         }
+
+         size_t const fdidx = user_data;
+         if(res<0) {
+            close_output(fds, fdidx, -res, "write - closing fd");
+            continue;
+         }
+         written[fdidx] += res;
+         if(written[fdidx] < write_len) {
+            // Short write: write the rest.
+            uring_prep_write_fixed(ring, fdidx + 1,
+                                   buffers[1 - cur] + written[fdidx],
+                                   write_len - written[fdidx], 1 - cur,
+                                   fdidx);
+            ++outstanding;
+         }
+      }
+
+      if(outstanding > 0 || ! read_done) {
+         continue;
+      }
+      if(bytes_read==0) {
+         // EOF
+         break;
+      }
+
+      // All writes of the last buffer are done and the next buffer
+      // is filled: write it out and read into the other one.
+      read_done = 0;
+      write_len = bytes_read;
+      for(size_t fdidx=0; fdidx<fd_cnt; ++fdidx) {
+         if(fds[fdidx]!=-1) {
+            written[fdidx] = 0;
+            uring_prep_write_fixed(ring, fdidx + 1, buffers[cur], write_len,
+                                   cur, fdidx);
+            ++outstanding;
+         }
+      }
+      cur = 1 - cur;
+      uring_prep_read_fixed(ring, 0, buffers[cur], buffer_size,
+                            cur, PTEE_URING_READ);
+      ++outstanding;
+   }
+
+   uring_destroy(ring);
+   fdio_pool_put(pool, buffers[1]);
+   fdio_pool_put(pool, buffers[0]);
+   return 0;
+}
+
+// Threaded variant: one reader fills the buffers of the pool in turn;
+// each output has its own writer thread which writes the buffers in
+// the same order.  A buffer holds a reference for each output which
+// did not write it yet; the reader waits until the buffer it wants to
+// fill next has no references any longer.  So a slow output only
+// blocks the others when it is a whole pool behind.
+struct tee_buffer {
+   size_t len;
+   unsigned refcnt;
+   char * data;
+};
+
+struct tee_pool {
+   pthread_mutex_t mutex;
+   // Signaled when a buffer was filled or at EOF
+   pthread_cond_t filled;
+   // Signaled when the last reference to a buffer is gone
+   pthread_cond_t released;
+   struct tee_buffer buffers[PTEE_POOL_BUFFERS];
+   // Number of buffers filled so far; buffer n is in
+   // buffers[n % PTEE_POOL_BUFFERS].
+   uint64_t filled_cnt;
+   int eof;
+   // Outputs which still write
+   unsigned active;
+};
+
+struct tee_writer {
+   struct tee_pool * pool;
+   pthread_t thread;
+   int * fd;
+   // Next buffer to write
+   uint64_t pos;
+};
+
+// Drops the references of the writer to all buffers it did not write
+// yet.  Must be called with the mutex held.
+static void tee_writer_detach(struct tee_writer * writer) {
+   struct tee_pool * const pool = writer->pool;
+   for(; writer->pos < pool->filled_cnt; ++writer->pos) {
+      --pool->buffers[writer->pos % PTEE_POOL_BUFFERS].refcnt;
+   }
+   --pool->active;
+   pthread_cond_signal(&pool->released);
+}
+
+static void * tee_writer_run(void * data) {
+   struct tee_writer * const writer = data;
+   struct tee_pool * const pool = writer->pool;
+
+   pthread_mutex_lock(&pool->mutex);
+   while(1) {
+      while(writer->pos == pool->filled_cnt && ! pool->eof) {
+         pthread_cond_wait(&pool->filled, &pool->mutex);
+      }
+      if(writer->pos == pool->filled_cnt) {
+         // EOF and all written
+         break;
+      }
+      struct tee_buffer * const buffer =
+         &pool->buffers[writer->pos % PTEE_POOL_BUFFERS];
+      pthread_mutex_unlock(&pool->mutex);
+
+      // The buffer cannot change while this writer holds a reference.
+      int const ret = fdio_write_all(*writer->fd, buffer->data, buffer->len);
+
+      pthread_mutex_lock(&pool->mutex);
+      if(ret==-1) {
+         perror("write - closing fd");
+         close(*writer->fd);
+         *writer->fd = -1;
+         tee_writer_detach(writer);
+         pthread_mutex_unlock(&pool->mutex);
+         return NULL;
+      }
+      ++writer->pos;
+      if(--buffer->refcnt == 0) {
+         pthread_cond_signal(&pool->released);
+      }
+   }
+   --pool->active;
+   pthread_mutex_unlock(&pool->mutex);
+   return NULL;
+}
+
+// Returns -1 if the threads cannot be created (nothing was read then).
+static int tee_threads(int read_fd, int * fds, size_t fd_cnt,
+                       fdio_pool_t * buffers) {
+   static struct tee_pool pool = {
+      PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+      PTHREAD_COND_INITIALIZER, { { 0, 0, NULL } }, 0, 0, 0 };
+   struct tee_writer writers[fd_cnt];
+   for(size_t bidx=0; bidx<PTEE_POOL_BUFFERS; ++bidx) {
+      pool.buffers[bidx].data = fdio_pool_get(buffers);
+   }
+   size_t const buffer_size = fdio_pool_buffer_size(buffers);
+   fdio_adapt_t adapt;
+   fdio_adapt_init(&adapt, PTEE_MIN_READ_SIZE, buffer_size);
+
+   pthread_mutex_lock(&pool.mutex);
+   for(size_t fdidx=0; fdidx<fd_cnt; ++fdidx) {
+      writers[fdidx].pool = &pool;
+      writers[fdidx].fd = &fds[fdidx];
+      writers[fdidx].pos = 0;
+      if(pthread_create(&writers[fdidx].thread, NULL,
+                        tee_writer_run, &writers[fdidx]) != 0) {
+         perror("pthread_create");
+         // The started writers see EOF without any data.
+         pool.eof = 1;
+         pthread_cond_broadcast(&pool.filled);
+         pthread_mutex_unlock(&pool.mutex);
+         for(size_t widx=0; widx<fdidx; ++widx) {
+            pthread_join(writers[widx].thread, NULL);
+         }
+         pool.eof = 0;
+         pool.active = 0;
+         for(size_t bidx=0; bidx<PTEE_POOL_BUFFERS; ++bidx) {
+            fdio_pool_put(buffers, pool.buffers[bidx].data);
+         }
+         return -1;
+      }
+      ++pool.active;
+   }
+
+   while(pool.active > 0) {
+      struct tee_buffer * const buffer =
+         &pool.buffers[pool.filled_cnt % PTEE_POOL_BUFFERS];
+      while(buffer->refcnt > 0) {
+         pthread_cond_wait(&pool.released, &pool.mutex);
+      }
+      pthread_mutex_unlock(&pool.mutex);
+
+      size_t const len = fdio_adapt_size(&adapt, read_fd);
+      ssize_t const bytes_read = fdio_read(read_fd, buffer->data, len);
+
+      pthread_mutex_lock(&pool.mutex);
+      if(bytes_read<=0) {
+         // EOF
+         break;
+      }
+      fdio_adapt_update(&adapt, len, bytes_read);
+      buffer->len = bytes_read;
+      buffer->refcnt = pool.active;
+      ++pool.filled_cnt;
+      pthread_cond_broadcast(&pool.filled);
+   }
+   pool.eof = 1;
+   pthread_cond_broadcast(&pool.filled);
+   pthread_mutex_unlock(&pool.mutex);
+
+   for(size_t fdidx=0; fdidx<fd_cnt; ++fdidx) {
+      pthread_join(writers[fdidx].thread, NULL);
+   }
+   for(size_t bidx=0; bidx<PTEE_POOL_BUFFERS; ++bidx) {
+      fdio_pool_put(buffers, pool.buffers[bidx].data);
+   }
+   return 0;
+}
+
 int main(int argc, char * argv[]) {
 
    int read_fd = 0;
+   int use_uring = 0;
+   int use_threads = 0;
+   int use_hugepages = 0;
+   size_t buffer_size = PTEE_DEFAULT_BUFFER_SIZE;
 
    int opt;
-   while ((opt = getopt(argc, argv, "hr:")) != -1) {
+   while ((opt = getopt(argc, argv, "hHm:r:tu")) != -1) {
       switch (opt) {
       case 'h':
          usage();
          break;
+      case 'H':
+         use_hugepages = 1;
+         break;
+      case 'm':
+         buffer_size = atol(optarg);
+         if(buffer_size==0) {
+            usage();
+         }
+         break;
       case 'r':
          read_fd = atoi(optarg);
          break;
+      case 't':
+         use_threads = 1;
+         break;
+      case 'u':
+         use_uring = 1;
+         break;
       default: /* '?' */
          usage();
       }
@@ -61,35 +426,25 @@ int main(int argc, char * argv[]) {
       fds[fdidx] = atoi(argv[aidx]);
    }
 
-   char buffer[4096];
-   while(1) {
-      ssize_t const bytes_read = read(read_fd, buffer, sizeof(buffer));
-      if(bytes_read<0 && errno==EINTR)
-         continue;
-      if(bytes_read<=0)
-         // EOF
-         break;
-
-      for(size_t fdidx=0; fdidx<fd_cnt; ++fdidx) {
-         if(fds[fdidx]!=-1) {
-            ssize_t const wr = write(fds[fdidx], buffer, bytes_read);
-
-            if(wr==-1) {
-               perror("write - closing fd");
-               close(fds[fdidx]);
-               fds[fdidx]=-1;
-               continue;
-            }
+   fdio_pool_t * const pool =
+      fdio_pool_create(buffer_size, PTEE_POOL_BUFFERS, use_hugepages);
+   if(pool==NULL) {
+      perror("buffer pool");
+      exit(2);
+   }
 
-            if(wr!=bytes_read) {
-               perror("Could not write all data");
-               close(fds[fdidx]);
-               fds[fdidx]=-1;
-               continue;
-            }
-          }
+   if(use_threads) {
+      if(tee_threads(read_fd, fds, fd_cnt, pool) != 0) {
+         tee_rw(read_fd, fds, fd_cnt, pool);
+      }
+   } else if(use_uring) {
+      if(tee_uring(read_fd, fds, fd_cnt, pool) != 0) {
+         tee_rw(read_fd, fds, fd_cnt, pool);
       }
+   } else if(tee_splice(read_fd, fds, fd_cnt, buffer_size) != 0) {
+      tee_rw(read_fd, fds, fd_cnt, pool);
    }
+   fdio_pool_destroy(pool);
 
    for(size_t fdidx=1; fdidx<fd_cnt; ++fdidx) {
       if(fds[fdidx]!=-1) {
@@ -0,0 +1,30 @@
+#ifndef PIPEXEC_RECORDING_H
+#define PIPEXEC_RECORDING_H
+
+/*
+ * Edge recordings
+ *
+ * A recording of a pipe with the 'record=path' option consists of the
+ * data file (path): the bytes as they went over the pipe, nothing
+ * else - and with the 'timing' option the timing index (path.idx).
+ * The index starts with the magic and has one entry per chunk which
+ * was moved by the relay.  The numbers are in host byte order.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+
+#define RECORDING_INDEX_MAGIC "PXRIDX1\n"
+#define RECORDING_INDEX_MAGIC_LEN 8
+#define RECORDING_INDEX_SUFFIX ".idx"
+
+struct recording_entry {
+  // Since the start of the recording
+  uint64_t usec;
+  // Size of the chunk
+  uint64_t bytes;
+};
+
+#endif
@@ -0,0 +1,676 @@
+/*
+ * Relays for instrumented edges
+ *
+ * The I/O thread does not use any locks (no stdio, no malloc): the
+ * supervisor forks while the thread is running.  The counters are
+ * read by the supervisor with atomic loads.
+ *
+ * A tap is set up by the supervisor; it is handed over to the thread
+ * by storing tap_sock (release).  From then on only the thread touches
+ * it until it sets tap_sock back to -1.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _GNU_SOURCE
+
+#include "src/relay.h"
+#include "src/recording.h"
+#include "src/logging.h"
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+// Maximum bytes moved by one splice call
+#define RELAY_CHUNK (1 << 20)
+// splice calls for one relay before the others get their turn
+#define RELAY_BURST 16
+// Timing index entries which are written at once
+#define RELAY_INDEX_ENTRIES 256
+
+struct relay {
+  size_t pidx;
+  // Read end of the writer's pipe, write end of the reader's pipe
+  int in;
+  int out;
+  uint64_t bytes;
+  uint64_t chunks;
+  uint64_t stall_usec;
+  // Start of the running stall; 0: no stall
+  uint64_t stall_start;
+  // The tap: the samples are tee'd into tap_pipe and moved from there
+  // to tap_sock.
+  int tap_sock;
+  int tap_pipe[2];
+  int tap_size;
+  unsigned int tap_every;
+  uint64_t tap_rate;
+  uint64_t tap_seq;
+  // Byte budget: tokens and the time of the last refill
+  int64_t tap_tokens;
+  uint64_t tap_refill;
+  // Bytes at the head of 'in' which are already in tap_pipe
+  size_t tap_pending;
+  // tap_pipe has data which did not fit into tap_sock
+  int tap_queued;
+  uint64_t tap_bytes;
+  uint64_t tap_drops;
+  // The recording: each chunk is tee'd into rec_pipe and moved from
+  // there to rec_fd before it goes on.
+  char const *rec_path;
+  int rec_fd;
+  int rec_pipe[2];
+  // Timing index: -1 if not wanted
+  int rec_idx_fd;
+  struct recording_entry *rec_entries;
+  size_t rec_entry_cnt;
+  uint64_t rec_start;
+  // Bytes at the head of 'in' which are already recorded
+  size_t rec_pending;
+  uint64_t rec_bytes;
+  // Of the first failed write: the recording is stopped then.
+  int rec_errno;
+};
+
+static struct relay *g_relays = NULL;
+static size_t g_relay_cnt = 0;
+// The relay of each pipe - or NULL.
+static struct relay **g_relay_of = NULL;
+static size_t g_relay_of_cnt = 0;
+// Wakes up the thread to stop it.
+static int g_wakeup[2] = {-1, -1};
+static pthread_t g_thread;
+static int g_thread_running = 0;
+
+static uint64_t now_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// The fd is marked as closed before it is closed: a child forked in
+// between does not close an fd which is reused by the supervisor.
+static void relay_close_fd(int *const fd) {
+  int const cfd = __atomic_exchange_n(fd, -1, __ATOMIC_SEQ_CST);
+  if (cfd != -1) {
+    close(cfd);
+  }
+}
+
+static void relay_stall_end(struct relay *const relay) {
+  uint64_t const start = __atomic_load_n(&relay->stall_start, __ATOMIC_RELAXED);
+  if (start != 0) {
+    __atomic_add_fetch(&relay->stall_usec, now_usec() - start,
+                       __ATOMIC_RELAXED);
+    __atomic_store_n(&relay->stall_start, 0, __ATOMIC_RELAXED);
+  }
+}
+
+static void relay_record_fail(struct relay *const relay) {
+  relay->rec_errno = errno;
+  relay_close_fd(&relay->rec_fd);
+  relay_close_fd(&relay->rec_idx_fd);
+}
+
+static void relay_record_write_index(struct relay *const relay) {
+  char const *buf = (char const *)relay->rec_entries;
+  size_t len = relay->rec_entry_cnt * sizeof(struct recording_entry);
+  relay->rec_entry_cnt = 0;
+  while (len > 0) {
+    ssize_t const wr = write(relay->rec_idx_fd, buf, len);
+    if (wr == -1 && errno == EINTR) {
+      continue;
+    }
+    if (wr <= 0) {
+      relay_record_fail(relay);
+      return;
+    }
+    buf += wr;
+    len -= wr;
+  }
+}
+
+// Writes the waiting chunk to the recording.  Unlike a tap the
+// recording is complete: the edge waits for the file.  Returns -1 if
+// nothing is waiting.
+static int relay_record(struct relay *const relay) {
+  // rec_pipe is empty and as large as 'in': all waiting data fits.
+  ssize_t teed;
+  do {
+    teed = tee(relay->in, relay->rec_pipe[1], RELAY_CHUNK, SPLICE_F_NONBLOCK);
+  } while (teed == -1 && errno == EINTR);
+  if (teed == -1 && errno == EAGAIN) {
+    return -1;
+  }
+  if (teed == 0) {
+    // EOF
+    return 0;
+  }
+  if (teed == -1) {
+    relay_record_fail(relay);
+    return 0;
+  }
+  for (ssize_t moved = 0; moved < teed;) {
+    ssize_t const spl = splice(relay->rec_pipe[0], NULL, relay->rec_fd, NULL,
+                               teed - moved, SPLICE_F_MOVE);
+    if (spl == -1 && errno == EINTR) {
+      continue;
+    }
+    if (spl <= 0) {
+      relay_record_fail(relay);
+      return 0;
+    }
+    moved += spl;
+  }
+  relay->rec_pending = teed;
+  __atomic_add_fetch(&relay->rec_bytes, teed, __ATOMIC_RELAXED);
+
+  if (relay->rec_idx_fd == -1) {
+    return 0;
+  }
+  struct recording_entry *const entry =
+      &relay->rec_entries[relay->rec_entry_cnt++];
+  entry->usec = now_usec() - relay->rec_start;
+  entry->bytes = teed;
+  if (relay->rec_entry_cnt == RELAY_INDEX_ENTRIES) {
+    relay_record_write_index(relay);
+  }
+  return 0;
+}
+
+static int relay_tapped(struct relay const *const relay) {
+  return __atomic_load_n(&relay->tap_sock, __ATOMIC_ACQUIRE) != -1;
+}
+
+// tap_sock is closed last: then the supervisor can set up a new tap.
+static void relay_tap_close(struct relay *const relay) {
+  relay_close_fd(&relay->tap_pipe[0]);
+  relay_close_fd(&relay->tap_pipe[1]);
+  relay->tap_pending = 0;
+  relay->tap_queued = 0;
+  relay_close_fd(&relay->tap_sock);
+}
+
+// Moves the samples to the tap reader - as much as it takes now.
+static void relay_tap_flush(struct relay *const relay) {
+  while (1) {
+    ssize_t const spl =
+        splice(relay->tap_pipe[0], NULL, relay->tap_sock, NULL, RELAY_CHUNK,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (spl > 0 || (spl == -1 && errno == EINTR)) {
+      continue;
+    }
+    if (spl == -1 && errno == EAGAIN) {
+      int queued = 0;
+      relay->tap_queued =
+          ioctl(relay->tap_pipe[0], FIONREAD, &queued) == 0 && queued > 0;
+      return;
+    }
+    // The tap reader is gone.
+    relay_tap_close(relay);
+    return;
+  }
+}
+
+// Every Nth chunk within the byte budget per second is a sample.
+static int relay_tap_due(struct relay *const relay) {
+  if (relay->tap_seq++ % relay->tap_every != 0) {
+    return 0;
+  }
+  if (relay->tap_rate == 0) {
+    return 1;
+  }
+  uint64_t const now = now_usec();
+  uint64_t const elapsed =
+      now - relay->tap_refill < 1000000 ? now - relay->tap_refill : 1000000;
+  relay->tap_refill = now;
+  relay->tap_tokens += elapsed * relay->tap_rate / 1000000;
+  if (relay->tap_tokens > (int64_t)relay->tap_rate) {
+    relay->tap_tokens = relay->tap_rate;
+  }
+  return relay->tap_tokens > 0;
+}
+
+// Duplicates the waiting chunk - as much of it as the byte budget
+// allows - into the tap pipe.  If it does not fit, the sample is
+// dropped: the edge never waits for the tap reader.
+static void relay_tap_sample(struct relay *const relay) {
+  int avail = 0;
+  if (ioctl(relay->in, FIONREAD, &avail) != 0 || avail <= 0 ||
+      !relay_tap_due(relay)) {
+    return;
+  }
+  int const len = relay->tap_rate != 0 && relay->tap_tokens < avail
+                      ? (int)relay->tap_tokens
+                      : avail;
+  int queued = 0;
+  ssize_t teed = -1;
+  if (ioctl(relay->tap_pipe[1], FIONREAD, &queued) == 0 &&
+      relay->tap_size - queued >= len) {
+    teed = tee(relay->in, relay->tap_pipe[1], len, SPLICE_F_NONBLOCK);
+  }
+  if (teed <= 0) {
+    __atomic_add_fetch(&relay->tap_drops, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  relay->tap_pending = teed;
+  relay->tap_tokens -= teed;
+  __atomic_add_fetch(&relay->tap_bytes, teed, __ATOMIC_RELAXED);
+  relay_tap_flush(relay);
+}
+
+// Moves what is possible without blocking.
+static void relay_pump(struct relay *const relay) {
+  for (int burst = 0; burst < RELAY_BURST; ++burst) {
+    if (relay->rec_fd != -1 && relay->rec_pending == 0 &&
+        relay_record(relay) == -1) {
+      // Nothing to read
+      return;
+    }
+    int const tapped = relay_tapped(relay);
+    if (tapped && relay->tap_pending == 0) {
+      relay_tap_sample(relay);
+    }
+    // While recording only the recorded bytes are moved: the writer
+    // may have added more in between.
+    size_t const len = relay->rec_fd != -1 && relay->rec_pending > 0 &&
+                               relay->rec_pending < RELAY_CHUNK
+                           ? relay->rec_pending
+                           : RELAY_CHUNK;
+    ssize_t const spl = splice(relay->in, NULL, relay->out, NULL, len,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (spl > 0) {
+      relay_stall_end(relay);
+      __atomic_add_fetch(&relay->bytes, spl, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&relay->chunks, 1, __ATOMIC_RELAXED);
+      relay->rec_pending =
+          relay->rec_pending > (size_t)spl ? relay->rec_pending - spl : 0;
+      if (tapped) {
+        relay->tap_pending =
+            relay->tap_pending > (size_t)spl ? relay->tap_pending - spl : 0;
+      }
+      continue;
+    }
+    if (spl == -1 && errno == EINTR) {
+      continue;
+    }
+    if (spl == -1 && errno == EAGAIN) {
+      // Either nothing to read or the reader's pipe is full.
+      int avail = 0;
+      if (ioctl(relay->in, FIONREAD, &avail) == 0 && avail > 0 &&
+          __atomic_load_n(&relay->stall_start, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(&relay->stall_start, now_usec(), __ATOMIC_RELAXED);
+      }
+      return;
+    }
+    // EOF from the writer or the reader is gone (EPIPE): pass it on.
+    relay_stall_end(relay);
+    relay_close_fd(&relay->out);
+    relay_close_fd(&relay->in);
+    if (tapped) {
+      relay_tap_flush(relay);
+    }
+    if (relay_tapped(relay)) {
+      relay_tap_close(relay);
+    }
+    return;
+  }
+}
+
+static void *relay_thread(void *data) {
+  (void)data;
+  // Per relay: the edge and the tap
+  struct pollfd *const pfds =
+      calloc(2 * g_relay_cnt + 1, sizeof(struct pollfd));
+  size_t *const ridxs = calloc(2 * g_relay_cnt + 1, sizeof(size_t));
+  if (pfds == NULL || ridxs == NULL) {
+    abort();
+  }
+
+  while (1) {
+    pfds[0].fd = g_wakeup[0];
+    pfds[0].events = POLLIN;
+    size_t pcnt = 1;
+    for (size_t ridx = 0; ridx < g_relay_cnt; ++ridx) {
+      struct relay *const relay = &g_relays[ridx];
+      if (relay_tapped(relay)) {
+        if (relay->in == -1) {
+          // Tapped after the end of the edge
+          relay_tap_close(relay);
+        } else {
+          // Waits for room only if there is something to send; a
+          // closed tap is reported anyway (POLLHUP).
+          pfds[pcnt].fd = relay->tap_sock;
+          pfds[pcnt].events = relay->tap_queued ? POLLOUT : 0;
+          ridxs[pcnt] = ridx;
+          ++pcnt;
+        }
+      }
+      if (relay->in == -1) {
+        continue;
+      }
+      // During a stall wait until the reader made some room.
+      int const stalled =
+          __atomic_load_n(&relay->stall_start, __ATOMIC_RELAXED) != 0;
+      pfds[pcnt].fd = stalled ? relay->out : relay->in;
+      pfds[pcnt].events = stalled ? POLLOUT : POLLIN;
+      ridxs[pcnt] = ridx;
+      ++pcnt;
+    }
+
+    if (poll(pfds, pcnt, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      abort();
+    }
+    if (pfds[0].revents != 0) {
+      // 's': stop; 't': a new tap
+      char cmd = 's';
+      if (read(g_wakeup[0], &cmd, 1) != 1 || cmd == 's') {
+        break;
+      }
+      continue;
+    }
+    for (size_t pidx = 1; pidx < pcnt; ++pidx) {
+      if (pfds[pidx].revents == 0) {
+        continue;
+      }
+      struct relay *const relay = &g_relays[ridxs[pidx]];
+      if (pfds[pidx].fd != relay->tap_sock) {
+        relay_pump(relay);
+      } else if (pfds[pidx].revents & (POLLHUP | POLLERR)) {
+        relay_tap_close(relay);
+      } else {
+        relay_tap_flush(relay);
+      }
+    }
+  }
+
+  free(pfds);
+  free(ridxs);
+  return NULL;
+}
+
+static int relay_record_create(char const *const path) {
+  int const fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "relay", "error", "Cannot create recording", 3,
+            "path", path, "errno", serrno, "error", strerror(errno));
+  }
+  return fd;
+}
+
+// Each start of the graph overwrites the recording.  Returns -1 on
+// error.
+static int relay_record_open(struct relay *const relay,
+                             pipe_info_t const *const ipipe,
+                             int const size) {
+  relay->rec_fd = relay_record_create(ipipe->record_path);
+  if (relay->rec_fd == -1) {
+    return -1;
+  }
+  if (pipe2(relay->rec_pipe, O_CLOEXEC) == -1) {
+    logging(lid_internal, "relay", "error", "Cannot create recording pipe",
+            1, "path", ipipe->record_path);
+    return -1;
+  }
+  // From here the recording is reported when the relay is stopped.
+  relay->rec_path = ipipe->record_path;
+  if (size > 0) {
+    fcntl(relay->rec_pipe[1], F_SETPIPE_SZ, size);
+  }
+  relay->rec_start = now_usec();
+
+  if (!ipipe->record_timing) {
+    return 0;
+  }
+  size_t const plen = strlen(ipipe->record_path);
+  char *const idx_path = malloc(plen + sizeof(RECORDING_INDEX_SUFFIX));
+  relay->rec_entries =
+      malloc(RELAY_INDEX_ENTRIES * sizeof(struct recording_entry));
+  if (idx_path == NULL || relay->rec_entries == NULL) {
+    free(idx_path);
+    relay_record_fail(relay);
+    return -1;
+  }
+  memcpy(idx_path, ipipe->record_path, plen);
+  memcpy(idx_path + plen, RECORDING_INDEX_SUFFIX,
+         sizeof(RECORDING_INDEX_SUFFIX));
+  relay->rec_idx_fd = relay_record_create(idx_path);
+  free(idx_path);
+  if (relay->rec_idx_fd == -1) {
+    relay_record_fail(relay);
+    return -1;
+  }
+  if (write(relay->rec_idx_fd, RECORDING_INDEX_MAGIC,
+            RECORDING_INDEX_MAGIC_LEN) != RECORDING_INDEX_MAGIC_LEN) {
+    relay_record_fail(relay);
+  }
+  return 0;
+}
+
+int relay_start(pipe_info_t *ipipe, size_t pipe_cnt) {
+  size_t cnt = 0;
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    cnt += ipipe[pidx].relay;
+  }
+  if (cnt == 0) {
+    return 0;
+  }
+
+  g_relays = calloc(cnt, sizeof(struct relay));
+  g_relay_of = calloc(pipe_cnt, sizeof(struct relay *));
+  g_relay_of_cnt = pipe_cnt;
+  if (g_relays == NULL || g_relay_of == NULL ||
+      pipe2(g_wakeup, O_CLOEXEC) == -1) {
+    logging(lid_internal, "relay", "error", "Cannot create relays", 0);
+    relay_stop();
+    return -1;
+  }
+  g_relay_cnt = 0;
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    if (!ipipe[pidx].relay) {
+      continue;
+    }
+    int down[2];
+    if (pipe2(down, O_CLOEXEC) == -1) {
+      logging(lid_internal, "relay", "error", "Cannot create relays", 0);
+      relay_stop();
+      return -1;
+    }
+    struct relay *const relay = &g_relays[g_relay_cnt++];
+    g_relay_of[pidx] = relay;
+    relay->pidx = pidx;
+    relay->tap_sock = -1;
+    relay->tap_pipe[0] = -1;
+    relay->tap_pipe[1] = -1;
+    relay->rec_fd = -1;
+    relay->rec_pipe[0] = -1;
+    relay->rec_pipe[1] = -1;
+    relay->rec_idx_fd = -1;
+    // The reader gets the new pipe.
+    relay->in = ipipe[pidx].pipefds[0];
+    relay->out = down[1];
+    fcntl(relay->in, F_SETFD, FD_CLOEXEC);
+    ipipe[pidx].pipefds[0] = down[0];
+    // The size of the reader's pipe is what the writer sees.
+    int const size = fcntl(relay->in, F_GETPIPE_SZ);
+    if (size > 0) {
+      fcntl(down[1], F_SETPIPE_SZ, size);
+    }
+    if (ipipe[pidx].record_path != NULL &&
+        relay_record_open(relay, &ipipe[pidx], size) == -1) {
+      relay_stop();
+      return -1;
+    }
+
+    SIZETTOCHAR(spidx, 20, pidx);
+    ITOCHAR(sin, 16, relay->in);
+    ITOCHAR(sout, 16, relay->out);
+    logging(lid_internal, "relay", "info", "Relay created", 3,
+            "pipe_index", spidx, "in_fd", sin, "out_fd", sout);
+  }
+
+  // The signals are handled by the supervisor - and a tap reader which
+  // is gone must not raise SIGPIPE: the thread gets EPIPE.
+  sigset_t all;
+  sigset_t old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  int const created = pthread_create(&g_thread, NULL, relay_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (created != 0) {
+    logging(lid_internal, "relay", "error", "Cannot create relay thread", 0);
+    relay_stop();
+    errno = created;
+    return -1;
+  }
+  g_thread_running = 1;
+  return 0;
+}
+
+// The thread is stopped: the rest of the index is written.
+static void relay_record_close(struct relay *const relay) {
+  if (relay->rec_path == NULL) {
+    return;
+  }
+  if (relay->rec_idx_fd != -1 && relay->rec_entry_cnt > 0) {
+    relay_record_write_index(relay);
+  }
+  SIZETTOCHAR(sbytes, 24, (size_t)relay->rec_bytes);
+  if (relay->rec_errno != 0) {
+    ITOCHAR(serrno, 16, relay->rec_errno);
+    logging(lid_internal, "relay", "error", "Recording failed", 4,
+            "path", relay->rec_path, "bytes", sbytes, "errno", serrno,
+            "error", strerror(relay->rec_errno));
+  } else {
+    logging(lid_internal, "relay", "info", "Recording written", 2,
+            "path", relay->rec_path, "bytes", sbytes);
+  }
+  free(relay->rec_entries);
+  relay->rec_entries = NULL;
+}
+
+void relay_stop() {
+  if (g_thread_running) {
+    ssize_t const wr = write(g_wakeup[1], "s", 1);
+    (void)wr;
+    pthread_join(g_thread, NULL);
+    g_thread_running = 0;
+  }
+  for (size_t ridx = 0; ridx < g_relay_cnt; ++ridx) {
+    relay_stats_t stats;
+    relay_stats(g_relays[ridx].pidx, &stats);
+    SIZETTOCHAR(spidx, 20, g_relays[ridx].pidx);
+    SIZETTOCHAR(sbytes, 20, stats.bytes);
+    SIZETTOCHAR(schunks, 20, stats.chunks);
+    SIZETTOCHAR(sstall_usec, 20, stats.stall_usec);
+    SIZETTOCHAR(stap_bytes, 20, stats.tap_bytes);
+    SIZETTOCHAR(stap_drops, 20, stats.tap_drops);
+    logging(lid_internal, "relay", "info", "Relay statistics", 6,
+            "pipe_index", spidx, "bytes", sbytes, "chunks", schunks,
+            "stall_usec", sstall_usec, "tap_bytes", stap_bytes,
+            "tap_drops", stap_drops);
+    relay_record_close(&g_relays[ridx]);
+  }
+  relay_close_in_child();
+  relay_close_fd(&g_wakeup[0]);
+  relay_close_fd(&g_wakeup[1]);
+  free(g_relays);
+  g_relays = NULL;
+  g_relay_cnt = 0;
+  free(g_relay_of);
+  g_relay_of = NULL;
+  g_relay_of_cnt = 0;
+}
+
+void relay_close_in_child() {
+  for (size_t ridx = 0; ridx < g_relay_cnt; ++ridx) {
+    relay_close_fd(&g_relays[ridx].in);
+    relay_close_fd(&g_relays[ridx].out);
+    relay_close_fd(&g_relays[ridx].tap_pipe[0]);
+    relay_close_fd(&g_relays[ridx].tap_pipe[1]);
+    relay_close_fd(&g_relays[ridx].tap_sock);
+    relay_close_fd(&g_relays[ridx].rec_fd);
+    relay_close_fd(&g_relays[ridx].rec_pipe[0]);
+    relay_close_fd(&g_relays[ridx].rec_pipe[1]);
+    relay_close_fd(&g_relays[ridx].rec_idx_fd);
+  }
+}
+
+static struct relay *relay_of(size_t const pidx) {
+  return pidx < g_relay_of_cnt ? g_relay_of[pidx] : NULL;
+}
+
+int relay_tap(size_t pidx, int fd, unsigned int every, uint64_t rate) {
+  struct relay *const relay = relay_of(pidx);
+  if (relay == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (relay_tapped(relay)) {
+    errno = EBUSY;
+    return -1;
+  }
+  if (__atomic_load_n(&relay->in, __ATOMIC_RELAXED) == -1) {
+    errno = EPIPE;
+    return -1;
+  }
+  if (fd == -1) {
+    return 0;
+  }
+  int tpipe[2];
+  if (pipe2(tpipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+    return -1;
+  }
+  // A larger pipe takes bursts; if the limit does not allow it, the
+  // default size is used.
+  fcntl(tpipe[1], F_SETPIPE_SZ, RELAY_CHUNK);
+  relay->tap_size = fcntl(tpipe[1], F_GETPIPE_SZ);
+  relay->tap_pipe[0] = tpipe[0];
+  relay->tap_pipe[1] = tpipe[1];
+  relay->tap_every = every > 0 ? every : 1;
+  relay->tap_rate = rate;
+  relay->tap_seq = 0;
+  relay->tap_tokens = rate;
+  relay->tap_refill = now_usec();
+  relay->tap_pending = 0;
+  relay->tap_queued = 0;
+  __atomic_store_n(&relay->tap_sock, fd, __ATOMIC_RELEASE);
+
+  ssize_t const wr = write(g_wakeup[1], "t", 1);
+  (void)wr;
+  return 0;
+}
+
+int relay_stats(size_t pidx, relay_stats_t *stats) {
+  struct relay *const relay = relay_of(pidx);
+  if (relay != NULL) {
+    stats->bytes = __atomic_load_n(&relay->bytes, __ATOMIC_RELAXED);
+    stats->chunks = __atomic_load_n(&relay->chunks, __ATOMIC_RELAXED);
+    stats->stall_usec = __atomic_load_n(&relay->stall_usec, __ATOMIC_RELAXED);
+    stats->tap_bytes = __atomic_load_n(&relay->tap_bytes, __ATOMIC_RELAXED);
+    stats->tap_drops = __atomic_load_n(&relay->tap_drops, __ATOMIC_RELAXED);
+    stats->tapped = relay_tapped(relay);
+    uint64_t const start =
+        __atomic_load_n(&relay->stall_start, __ATOMIC_RELAXED);
+    stats->stalled = start != 0;
+    if (start != 0) {
+      stats->stall_usec += now_usec() - start;
+    }
+    return 0;
+  }
+  return -1;
+}
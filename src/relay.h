@@ -0,0 +1,67 @@
+#ifndef PIPEXEC_RELAY_H
+#define PIPEXEC_RELAY_H
+
+/*
+ * Relays for instrumented edges
+ *
+ * For pipes with the 'relay' option a second pipe is created: the
+ * writing process uses the first, the reading process the second one.
+ * An I/O thread of the supervisor moves the data from the first to
+ * the second pipe with splice(2) - without copying it to user space -
+ * and counts the bytes, the chunks (successful splice calls) and the
+ * time the second pipe was full while data was waiting.
+ *
+ * A tap mirrors samples of the data of a running edge to a reader:
+ * before a sampled chunk is moved on, it is duplicated with tee(2)
+ * into a tap pipe and from there moved to the reader's fd.  When the
+ * tap pipe has no room for the chunk, the sample is dropped - a slow
+ * tap reader never slows down the edge.
+ *
+ * A recording (pipe option 'record') is written the same way, but
+ * each chunk is written to the file before it is moved on.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "src/pipe_info.h"
+
+#include <stdint.h>
+
+struct relay_stats {
+  uint64_t bytes;
+  uint64_t chunks;
+  uint64_t stall_usec;
+  // Mirrored and dropped samples of all taps
+  uint64_t tap_bytes;
+  uint64_t tap_drops;
+  int tapped;
+  // The reader's pipe is full right now.
+  int stalled;
+};
+
+typedef struct relay_stats relay_stats_t;
+
+// Inserts the relays into the (just created) pipes and starts the
+// I/O thread.  Returns -1 if this is not possible (the error is
+// logged and the relays created so far are stopped).
+int relay_start(pipe_info_t *ipipe, size_t pipe_cnt);
+// Stops the I/O thread and closes all fds of the relays.
+void relay_stop();
+// To be called in a forked child: closes the fds of the relays.
+void relay_close_in_child();
+
+// Attaches a tap to the relay of the pipe: every Nth chunk (splice
+// call) is a sample; with a rate only rate bytes per second are
+// sampled (0: no limit).  On success the relay owns fd (a non-blocking
+// socket or pipe): it is closed when the reader is gone or the edge
+// ends.  With fd -1 it is only checked whether a tap can be attached.
+// Returns -1 with errno ENOENT (no relay), EBUSY (already tapped),
+// EPIPE (edge ended) or of pipe(2).
+int relay_tap(size_t pidx, int fd, unsigned int every, uint64_t rate);
+
+// Returns 0 and fills stats if the pipe has a relay, else -1.
+// The stall time includes a running stall.
+int relay_stats(size_t pidx, relay_stats_t *stats);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Listening sockets of the supervisor
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "src/server_socket.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define SERVER_SOCKET_BACKLOG 16
+
+void server_socket_set_flags(int fd) {
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static int server_socket_listen(int fd, struct sockaddr const *addr,
+                                socklen_t addr_len) {
+  if (bind(fd, addr, addr_len) == -1 ||
+      listen(fd, SERVER_SOCKET_BACKLOG) == -1) {
+    int const serrno = errno;
+    close(fd);
+    errno = serrno;
+    return -1;
+  }
+  return fd;
+}
+
+int server_socket_unix(char const *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  server_socket_set_flags(fd);
+
+  // A socket left over from a former run
+  unlink(path);
+  mode_t const old_umask = umask(0177);
+  int const res =
+      server_socket_listen(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(old_umask);
+  return res;
+}
+
+int server_socket_tcp(char const *addr_str) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  char const *port = addr_str;
+  char const *const colon = strrchr(addr_str, ':');
+  if (colon != NULL) {
+    char host[INET_ADDRSTRLEN];
+    size_t const host_len = colon - addr_str;
+    if (host_len >= sizeof(host)) {
+      errno = EINVAL;
+      return -1;
+    }
+    memcpy(host, addr_str, host_len);
+    host[host_len] = '\0';
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+      errno = EINVAL;
+      return -1;
+    }
+    port = colon + 1;
+  }
+  int const port_nr = atoi(port);
+  if (port_nr <= 0 || port_nr > 65535) {
+    errno = EINVAL;
+    return -1;
+  }
+  addr.sin_port = htons(port_nr);
+
+  int const fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1) {
+    return -1;
+  }
+  server_socket_set_flags(fd);
+  int const one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  return server_socket_listen(fd, (struct sockaddr *)&addr, sizeof(addr));
+}
@@ -0,0 +1,26 @@
+#ifndef PIPEXEC_SERVER_SOCKET_H
+#define PIPEXEC_SERVER_SOCKET_H
+
+/*
+ * Listening sockets of the supervisor
+ *
+ * Used for the control socket and the metrics exporter.  All sockets
+ * are non-blocking and are not passed to the children (FD_CLOEXEC).
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Creates a unix domain stream socket which is only accessible by
+// the owner.  A socket left over at path is removed first.
+// Returns the fd or -1 (errno is set).
+int server_socket_unix(char const *path);
+
+// Creates a TCP socket.  addr is 'port' (listen on 127.0.0.1) or
+// 'ipv4-address:port'.  Returns the fd or -1 (errno is set).
+int server_socket_tcp(char const *addr);
+
+// Sets FD_CLOEXEC and O_NONBLOCK.
+void server_socket_set_flags(int fd);
+
+#endif
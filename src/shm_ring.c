@@ -0,0 +1,364 @@
+/*
+ * Shared memory ring buffer
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _GNU_SOURCE
+
+#include "src/shm_ring.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#define SHM_RING_MAGIC 0x70726e67u
+#define SHM_RING_VERSION 1u
+
+/*
+ * The header lives in the first page of the memfd.  Producer and
+ * consumer owned fields are kept in different cache lines.
+ * All positions are free running 32 bit counters: the fill level is
+ * always (head - tail) in unsigned arithmetic.
+ */
+struct shm_ring_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  char pad0[52];
+
+  // Written by the producer
+  uint32_t head;
+  uint32_t data_seq;
+  uint32_t writer_closed;
+  uint32_t writer_waiting;
+  char pad1[48];
+
+  // Written by the consumer
+  uint32_t tail;
+  uint32_t space_seq;
+  uint32_t reader_closed;
+  uint32_t reader_waiting;
+  // Bytes read since creation: for statistics only.
+  uint64_t read_total;
+  char pad2[40];
+};
+
+struct shm_ring {
+  struct shm_ring_header *hdr;
+  char *data;
+  size_t size;
+  size_t page_size;
+};
+
+#ifdef __linux__
+
+static void futex_wait(uint32_t *addr, uint32_t val) {
+  syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static size_t shm_ring_round_size(size_t size, size_t page_size) {
+  size_t rsize = page_size;
+  while (rsize < size && rsize < SHM_RING_MAX_SIZE) {
+    rsize <<= 1;
+  }
+  return rsize;
+}
+
+int shm_ring_create(size_t size) {
+  size_t const page_size = sysconf(_SC_PAGESIZE);
+  size_t const rsize =
+      shm_ring_round_size(size == 0 ? SHM_RING_DEFAULT_SIZE : size, page_size);
+
+  int const fd = memfd_create("pipexec-shm-ring", 0);
+  if (fd == -1) {
+    return -1;
+  }
+  if (ftruncate(fd, page_size + rsize) == -1) {
+    int const serrno = errno;
+    close(fd);
+    errno = serrno;
+    return -1;
+  }
+
+  struct shm_ring_header *const hdr = mmap(
+      NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (hdr == MAP_FAILED) {
+    int const serrno = errno;
+    close(fd);
+    errno = serrno;
+    return -1;
+  }
+  memset(hdr, 0, sizeof(struct shm_ring_header));
+  hdr->version = SHM_RING_VERSION;
+  hdr->size = rsize;
+  __atomic_store_n(&hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+  munmap(hdr, page_size);
+
+  return fd;
+}
+
+shm_ring_t *shm_ring_attach(int fd) {
+  size_t const page_size = sysconf(_SC_PAGESIZE);
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return NULL;
+  }
+  if ((size_t)st.st_size <= page_size) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  struct shm_ring_header *const hdr = mmap(
+      NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (hdr == MAP_FAILED) {
+    return NULL;
+  }
+  size_t const size = hdr->size;
+  if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC ||
+      hdr->version != SHM_RING_VERSION ||
+      (size_t)st.st_size != page_size + size) {
+    munmap(hdr, page_size);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  // Reserve address space for two consecutive mappings of the data.
+  char *const data = mmap(NULL, 2 * size, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    munmap(hdr, page_size);
+    return NULL;
+  }
+  for (int midx = 0; midx < 2; ++midx) {
+    void *const m = mmap(data + midx * size, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_FIXED, fd, page_size);
+    if (m == MAP_FAILED) {
+      int const serrno = errno;
+      munmap(data, 2 * size);
+      munmap(hdr, page_size);
+      errno = serrno;
+      return NULL;
+    }
+  }
+
+  shm_ring_t *const self = malloc(sizeof(shm_ring_t));
+  if (self == NULL) {
+    munmap(data, 2 * size);
+    munmap(hdr, page_size);
+    errno = ENOMEM;
+    return NULL;
+  }
+  self->hdr = hdr;
+  self->data = data;
+  self->size = size;
+  self->page_size = page_size;
+  return self;
+}
+
+void shm_ring_detach(shm_ring_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  munmap(self->data, 2 * self->size);
+  munmap(self->hdr, self->page_size);
+  free(self);
+}
+
+size_t shm_ring_size(shm_ring_t const *self) { return self->size; }
+
+size_t shm_ring_fill(shm_ring_t const *self) {
+  uint32_t const head = __atomic_load_n(&self->hdr->head, __ATOMIC_ACQUIRE);
+  uint32_t const tail = __atomic_load_n(&self->hdr->tail, __ATOMIC_ACQUIRE);
+  return (uint32_t)(head - tail);
+}
+
+uint64_t shm_ring_read_total(shm_ring_t const *self) {
+  return __atomic_load_n(&self->hdr->read_total, __ATOMIC_RELAXED);
+}
+
+void *shm_ring_write_reserve(shm_ring_t *self, size_t *len) {
+  struct shm_ring_header *const hdr = self->hdr;
+  uint32_t const head = hdr->head;
+  while (1) {
+    if (__atomic_load_n(&hdr->reader_closed, __ATOMIC_ACQUIRE)) {
+      errno = EPIPE;
+      return NULL;
+    }
+    uint32_t const tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    size_t const space = self->size - (uint32_t)(head - tail);
+    if (space > 0) {
+      *len = space;
+      return self->data + (head & (self->size - 1));
+    }
+
+    uint32_t const seq = __atomic_load_n(&hdr->space_seq, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&hdr->writer_waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->tail, __ATOMIC_SEQ_CST) == tail &&
+        !__atomic_load_n(&hdr->reader_closed, __ATOMIC_SEQ_CST)) {
+      futex_wait(&hdr->space_seq, seq);
+    }
+    __atomic_store_n(&hdr->writer_waiting, 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+void shm_ring_write_commit(shm_ring_t *self, size_t len) {
+  struct shm_ring_header *const hdr = self->hdr;
+  __atomic_store_n(&hdr->head, hdr->head + (uint32_t)len, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&hdr->data_seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&hdr->reader_waiting, __ATOMIC_SEQ_CST)) {
+    futex_wake(&hdr->data_seq);
+  }
+}
+
+void shm_ring_close_writer(shm_ring_t *self) {
+  struct shm_ring_header *const hdr = self->hdr;
+  __atomic_store_n(&hdr->writer_closed, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&hdr->data_seq, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&hdr->data_seq);
+}
+
+void const *shm_ring_read_acquire(shm_ring_t *self, size_t *len) {
+  struct shm_ring_header *const hdr = self->hdr;
+  uint32_t const tail = hdr->tail;
+  while (1) {
+    uint32_t const head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      *len = (uint32_t)(head - tail);
+      return self->data + (tail & (self->size - 1));
+    }
+    if (__atomic_load_n(&hdr->writer_closed, __ATOMIC_ACQUIRE)) {
+      *len = 0;
+      return self->data;
+    }
+
+    uint32_t const seq = __atomic_load_n(&hdr->data_seq, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&hdr->reader_waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST) == head &&
+        !__atomic_load_n(&hdr->writer_closed, __ATOMIC_SEQ_CST)) {
+      futex_wait(&hdr->data_seq, seq);
+    }
+    __atomic_store_n(&hdr->reader_waiting, 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+void shm_ring_read_release(shm_ring_t *self, size_t len) {
+  struct shm_ring_header *const hdr = self->hdr;
+  __atomic_store_n(&hdr->tail, hdr->tail + (uint32_t)len, __ATOMIC_RELEASE);
+  __atomic_store_n(&hdr->read_total, hdr->read_total + len, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&hdr->space_seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&hdr->writer_waiting, __ATOMIC_SEQ_CST)) {
+    futex_wake(&hdr->space_seq);
+  }
+}
+
+void shm_ring_close_reader(shm_ring_t *self) {
+  struct shm_ring_header *const hdr = self->hdr;
+  __atomic_store_n(&hdr->reader_closed, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&hdr->space_seq, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&hdr->space_seq);
+}
+
+#else
+
+// Shared memory rings need memfd and futex: not available.
+
+int shm_ring_create(size_t size) {
+  (void)size;
+  errno = ENOSYS;
+  return -1;
+}
+
+shm_ring_t *shm_ring_attach(int fd) {
+  (void)fd;
+  errno = ENOSYS;
+  return NULL;
+}
+
+void shm_ring_detach(shm_ring_t *self) { (void)self; }
+
+size_t shm_ring_size(shm_ring_t const *self) { return self->size; }
+
+size_t shm_ring_fill(shm_ring_t const *self) {
+  (void)self;
+  return 0;
+}
+
+uint64_t shm_ring_read_total(shm_ring_t const *self) {
+  (void)self;
+  return 0;
+}
+
+void *shm_ring_write_reserve(shm_ring_t *self, size_t *len) {
+  (void)self;
+  (void)len;
+  errno = ENOSYS;
+  return NULL;
+}
+
+void shm_ring_write_commit(shm_ring_t *self, size_t len) {
+  (void)self;
+  (void)len;
+}
+
+void shm_ring_close_writer(shm_ring_t *self) { (void)self; }
+
+void const *shm_ring_read_acquire(shm_ring_t *self, size_t *len) {
+  (void)self;
+  *len = 0;
+  return NULL;
+}
+
+void shm_ring_read_release(shm_ring_t *self, size_t len) {
+  (void)self;
+  (void)len;
+}
+
+void shm_ring_close_reader(shm_ring_t *self) { (void)self; }
+
+#endif
+
+ssize_t shm_ring_write(shm_ring_t *self, void const *buf, size_t len) {
+  char const *cbuf = buf;
+  size_t left = len;
+  while (left > 0) {
+    size_t space;
+    void *const dest = shm_ring_write_reserve(self, &space);
+    if (dest == NULL) {
+      return -1;
+    }
+    size_t const chunk = left < space ? left : space;
+    memcpy(dest, cbuf, chunk);
+    shm_ring_write_commit(self, chunk);
+    cbuf += chunk;
+    left -= chunk;
+  }
+  return len;
+}
+
+ssize_t shm_ring_read(shm_ring_t *self, void *buf, size_t len) {
+  size_t avail;
+  void const *const src = shm_ring_read_acquire(self, &avail);
+  if (avail == 0) {
+    return 0;
+  }
+  size_t const chunk = len < avail ? len : avail;
+  memcpy(buf, src, chunk);
+  shm_ring_read_release(self, chunk);
+  return chunk;
+}
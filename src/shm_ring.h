@@ -0,0 +1,70 @@
+#ifndef PIPEXEC_SHM_RING_H
+#define PIPEXEC_SHM_RING_H
+
+/*
+ * Shared memory ring buffer
+ *
+ * A single-producer / single-consumer ring buffer which lives in a
+ * memfd.  pipexec creates the memfd for each pipe description with the
+ * 'shm' option and passes it to both processes at the given fd.  The
+ * processes attach to it and exchange data without copying it through
+ * the kernel; futexes are used for wakeups.
+ *
+ * The data area is mapped twice back-to-back: every reserved or
+ * acquired region is contiguous, even when it wraps around.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct shm_ring shm_ring_t;
+
+// Default size of the data area of a ring.
+#define SHM_RING_DEFAULT_SIZE (1024 * 1024)
+// Largest size of the data area.
+#define SHM_RING_MAX_SIZE (1u << 30)
+
+// Creates a new ring with (at least) the given data size.
+// Returns the memfd or -1 (errno is set).
+int shm_ring_create(size_t size);
+
+// Maps the ring which is accessible by fd.
+// Returns NULL on error (errno is set).
+shm_ring_t *shm_ring_attach(int fd);
+void shm_ring_detach(shm_ring_t *self);
+
+// Size of the data area.
+size_t shm_ring_size(shm_ring_t const *self);
+// Number of bytes which are currently in the ring.
+size_t shm_ring_fill(shm_ring_t const *self);
+// Number of bytes the consumer read since the ring was created.
+uint64_t shm_ring_read_total(shm_ring_t const *self);
+
+// Producer interface.
+// shm_ring_write_reserve() blocks until there is space available and
+// returns a pointer to it; 'len' is set to the number of contiguous
+// bytes which can be written.  Returns NULL (errno EPIPE) when the
+// reader closed the ring.
+void *shm_ring_write_reserve(shm_ring_t *self, size_t *len);
+void shm_ring_write_commit(shm_ring_t *self, size_t len);
+// Copies all the data into the ring; returns len or -1.
+ssize_t shm_ring_write(shm_ring_t *self, void const *buf, size_t len);
+// Signals EOF to the reader.
+void shm_ring_close_writer(shm_ring_t *self);
+
+// Consumer interface.
+// shm_ring_read_acquire() blocks until data is available and returns
+// a pointer to it; 'len' is set to the number of readable bytes.
+// On EOF 'len' is set to 0.
+void const *shm_ring_read_acquire(shm_ring_t *self, size_t *len);
+void shm_ring_read_release(shm_ring_t *self, size_t len);
+// Copies at most len bytes out of the ring; returns 0 on EOF.
+ssize_t shm_ring_read(shm_ring_t *self, void *buf, size_t len);
+// Signals the writer that nobody reads any longer.
+void shm_ring_close_reader(shm_ring_t *self);
+
+#endif
@@ -0,0 +1,2241 @@
+/*
+ * Supervisor
+ *
+ * Starts all the processes of the graph, waits for their termination
+ * and restarts them if needed.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "src/supervisor.h"
+#include "src/event_loop.h"
+#include "src/control.h"
+#include "src/metrics.h"
+#include "src/topology.h"
+#include "src/relay.h"
+#include "src/cache.h"
+#include "src/pid_map.h"
+#include "src/graph_export.h"
+#include "src/logging.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+/**
+ * Globals
+ * Used for communication between signal handler and main program.
+ */
+volatile int g_restart = 0;
+volatile int g_terminate = 0;
+volatile int g_kill_child_processes = 0;
+// A termination signal was received: never start anything again.
+static volatile int g_shutdown = 0;
+// The termination signal asks for a drain: done by the main loop.
+static volatile int g_drain_requested = 0;
+// All processes were asked to terminate (or a drain runs): the
+// terminated ones are not restarted; when all are gone the graph is
+// restarted or finished.
+static int g_stopping = 0;
+// A system call failed while (re)starting the graph: the graph is
+// stopped.  supervisor_start() returns -1 with this errno.
+static int g_setup_errno = 0;
+// The signal handlers only set these: the children are killed and
+// waited for by the main loop (signals_handle()).
+static volatile sig_atomic_t g_term_signal = 0;
+static volatile sig_atomic_t g_restart_signal = 0;
+
+/**
+ * Should the processes restart - pass in a 1.
+ * If the process in the termination phase (e.g. it received itself
+ * a signal) - this has no effect.
+ */
+void set_restart(int rs) {
+  if (g_terminate) {
+    logging(lid_internal, "status", "warning",
+	    "Cannot set restart flag - process will terminate", 0);
+    return;
+  }
+  g_restart = rs;
+}
+
+/**
+ * If an appropriate signal was sent to this process,
+ * it will terminate - indeptendent of the results the childs return
+ * during their shutdown.
+ */
+void set_terminate() {
+  g_terminate = 1;
+  g_restart = 0;
+}
+
+void set_kill_child_processes() {
+  g_kill_child_processes = 1;
+}
+
+// Logs the failed system call (errno) and stops the graph: nothing is
+// started any more and the running processes are killed by the main
+// loop.
+static void setup_failed(char const *const msg) {
+  int const serr = errno;
+  ITOCHAR(serrno, 16, serr);
+  logging(lid_internal, "status", "error", msg, 2,
+          "errno", serrno, "error", strerror(serr));
+  if (g_setup_errno == 0) {
+    g_setup_errno = serr != 0 ? serr : EIO;
+  }
+  g_shutdown = 1;
+  set_terminate();
+  set_kill_child_processes();
+}
+
+/**
+ * An array with the pids of all child processes.
+ * If a child is not running (e.g. during cleanup or restart phase)
+ * the appropriate entry it set to 0.
+ *
+ * This needs to be global, because it is also accessed from the
+ * interrupt handler.
+ */
+volatile int g_child_cnt = 0;
+volatile pid_t *g_child_pids = NULL;
+
+/**
+ * All the pids of the processes: nodes, standbys and replicas.
+ * With the number of the running nodes and replicas the exit of a
+ * child is handled in constant time - also for thousands of nodes.
+ */
+static pid_map_t *g_pid_map = NULL;
+static volatile int g_running_cnt = 0;
+static volatile int g_replica_cnt = 0;
+// Standby processes which are not reaped yet - also the killed ones.
+static int g_standby_cnt = 0;
+
+// The limit of open files when pipexec was started: the children
+// get it back.
+static struct rlimit g_nofile_limit;
+static int g_nofile_raised = 0;
+
+/**
+ * The graph and the run time state of all nodes.
+ * The index of a node is the same as the index in g_child_pids.
+ */
+static node_info_t *g_nodes = NULL;
+static command_info_t *g_icmd = NULL;
+static pipe_info_t *g_ipipe = NULL;
+static size_t g_pipe_cnt = 0;
+static supervisor_config_t const *g_config = NULL;
+static topology_t *g_topology = NULL;
+
+char const *node_state_name(enum node_state const state) {
+  switch (state) {
+  case ns_stopped:
+    return "stopped";
+  case ns_running:
+    return "running";
+  case ns_paused:
+    return "paused";
+  case ns_exited:
+    return "exited";
+  }
+  return "unknown";
+}
+
+/**
+ * Returns the index of the node with the given pid - or -1 if not found.
+ */
+static int child_pids_index(pid_t cpid) {
+  enum pid_owner owner;
+  int const child_idx = pid_map_find(g_pid_map, cpid, &owner);
+  return child_idx != -1 && owner == po_node ? child_idx : -1;
+}
+
+/**
+ * Unset the given pid.
+ */
+static void child_pids_unset(pid_t cpid) {
+  int const child_idx = child_pids_index(cpid);
+  if (child_idx != -1) {
+    pid_map_remove(g_pid_map, cpid);
+    g_child_pids[child_idx] = 0;
+    --g_running_cnt;
+    return;
+  }
+  ITOCHAR(spid, 16, cpid);
+  logging(lid_internal, "status", "warning",
+	  "child_pids_unset: PID not found in list", 1, "pid", spid);
+}
+
+static void child_pids_print() {
+  // Building the list is linear in the number of nodes.
+  if (!logging_enabled()) {
+    return;
+  }
+  int pilen = 4096;
+  char *pbuf = (char *)malloc(pilen * sizeof(char));
+  if (pbuf == NULL) {
+    logging(lid_internal, "status", "error", "Memory allocation failed", 0);
+    return;
+  }
+  pbuf[0] = '[';
+  int poffset = 1;
+  bool first = true;
+
+  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
+    if (g_child_pids[child_idx] == 0) {
+      continue;
+    }
+
+    if (!first) {
+      pbuf[poffset++] = ',';
+    }
+
+    while (poffset + 32 >= pilen) { // Ensure enough space for new data
+      pilen *= 2;
+      char *new_pbuf = (char *)realloc(pbuf, pilen * sizeof(char));
+      if (new_pbuf == NULL) {
+        free(pbuf);
+        logging(lid_internal, "status", "error", "Memory reallocation failed", 0);
+        return;
+      }
+      pbuf = new_pbuf;
+    }
+
+    int const written = snprintf(pbuf + poffset, pilen - poffset, "%d", g_child_pids[child_idx]);
+    if (written < 0) {
+      free(pbuf);
+      logging(lid_internal, "status", "error", "snprintf failed", 0);
+      return;
+    }
+    poffset += written;
+    first = false;
+  }
+
+  pbuf[poffset++] = ']';
+  pbuf[poffset] = '\0';
+
+  logging(lid_internal, "status", "info", "Child pids", 1, "pids", pbuf);
+  free(pbuf);
+}
+
+static void supervisor_event(enum supervisor_event const event,
+                             int const child_idx, pid_t const cpid,
+                             int const status);
+
+// Hot standby and autoscaling - see below
+static void standby_spawn(int const child_idx);
+static void standby_kill(int const child_idx);
+static void standby_kill_all();
+static void replica_spawn(int const child_idx);
+static void replicas_signal(int const child_idx, int const signum);
+static int auxiliary_reaped(pid_t const cpid, int const status);
+static void drain_begin();
+static void drain_advance();
+
+static void child_pids_kill_all() {
+  // The standby processes and the supervisor itself (FIFOs) hold the
+  // pipes open.
+  standby_kill_all();
+  pipe_info_fifo_close(g_ipipe, g_pipe_cnt);
+
+  // A paused process must be continued: else it will never see the
+  // SIGTERM and waiting for it would block forever.
+  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
+    if (g_child_pids[child_idx] != 0 && g_nodes[child_idx].state == ns_paused) {
+      kill(g_child_pids[child_idx], SIGCONT);
+      g_nodes[child_idx].state = ns_running;
+    }
+  }
+
+  if(! g_kill_child_processes) {
+    logging(lid_internal, "tracing", "info", "Do not kill child processes", 0);
+    return;
+  }
+
+  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
+    replicas_signal(child_idx, SIGTERM);
+    if (g_child_pids[child_idx] != 0) {
+      pid_t const to_kill = g_child_pids[child_idx];
+      ITOCHAR(skill, 16, to_kill);
+      logging(lid_internal, "tracing", "info", "Sending SIGTERM", 1, "pid", skill);
+      kill(to_kill, SIGTERM);
+    }
+  }
+}
+
+/**
+ * Bookkeeping for a terminated child: logs the exit and updates the
+ * node state.  Returns the index of the node - or -1 if the pid is not
+ * known.
+ */
+static int child_reaped(pid_t const cpid, int const status,
+                        struct rusage const *usage) {
+  ITOCHAR(spid, 16, cpid);
+  ITOCHAR(snormal_exit, 16, WIFEXITED(status));
+  ITOCHAR(schild_status, 16, WEXITSTATUS(status));
+  ITOCHAR(schild_signaled, 16, WIFSIGNALED(status));
+  logging(lid_child_exit, "exec", "info", "child exit", 5,
+	  "command_pid", spid, "status", schild_status,
+	  "normal_exit", snormal_exit, "child_status", schild_status,
+	  "child_signaled", schild_signaled);
+
+  int const child_idx = child_pids_index(cpid);
+  if (child_idx != -1) {
+    g_nodes[child_idx].state = ns_exited;
+    g_nodes[child_idx].pid = 0;
+    g_nodes[child_idx].last_status = status;
+    ++g_nodes[child_idx].exit_cnt;
+    // A requested restart terminates the process with SIGTERM.
+    if (status != 0 && !g_nodes[child_idx].restart_requested) {
+      ++g_nodes[child_idx].failure_cnt;
+    }
+    g_nodes[child_idx].cpu_usec +=
+        (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000ULL +
+        usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+  }
+  child_pids_unset(cpid);
+  if (child_idx != -1) {
+    supervisor_event(se_exited, child_idx, cpid, status);
+  }
+  return child_idx;
+}
+
+// The node is finished and will not be started again (until the
+// whole graph is restarted): close the pipe ends kept for it.
+static void node_finished(int const child_idx) {
+  standby_kill(child_idx);
+  pipe_info_command_exited(g_ipipe, g_pipe_cnt, g_icmd[child_idx].cmd_name);
+}
+
+// The reaper of the event loop: waits only for the processes of the
+// graph - the program which embeds the library can have children of
+// its own.  The terminated child the kernel reports first is looked at
+// without reaping it; if it is not one of the graph, all the pids of
+// the graph are tried.
+static pid_t graph_reap(int *status, struct rusage *usage) {
+  siginfo_t info;
+  info.si_pid = 0;
+  if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1) {
+    return errno == EINTR ? 0 : -1;
+  }
+  if (info.si_pid == 0) {
+    return 0;
+  }
+  if (pid_map_find(g_pid_map, info.si_pid, NULL) != -1) {
+    return wait4(info.si_pid, status, WNOHANG, usage);
+  }
+  size_t pos = 0;
+  pid_t cpid;
+  while ((cpid = pid_map_next(g_pid_map, &pos)) != 0) {
+    pid_t const rw = wait4(cpid, status, WNOHANG, usage);
+    if (rw != 0) {
+      return rw;
+    }
+  }
+  return 0;
+}
+
+static void node_started(int const child_idx, pid_t const cpid) {
+  if (g_child_pids[child_idx] == 0) {
+    ++g_running_cnt;
+  }
+  pid_map_insert(g_pid_map, cpid, child_idx, po_node);
+  g_child_pids[child_idx] = cpid;
+  g_nodes[child_idx].pid = cpid;
+  g_nodes[child_idx].state = ns_running;
+  g_nodes[child_idx].start_time = time(NULL);
+  g_nodes[child_idx].restart_requested = 0;
+  supervisor_event(se_started, child_idx, cpid, 0);
+}
+
+// Bookkeeping for a child which terminated while the graph stops: it
+// is not restarted.
+static void child_stopped(pid_t const cpid, int const status,
+                          struct rusage const *usage) {
+  if (auxiliary_reaped(cpid, status)) {
+    return;
+  }
+
+  int const child_idx = child_reaped(cpid, status, usage);
+  if (child_idx != -1) {
+    node_finished(child_idx);
+  }
+
+  if (WIFSIGNALED(status)) {
+    ITOCHAR(spid, 16, cpid);
+    ITOCHAR(ssignal, 16, WTERMSIG(status));
+    logging(lid_internal, "tracing", "info", "Signaled child",
+	    2, "pid", spid, "signaled_with", ssignal);
+    if (WTERMSIG(status) != SIGTERM) {
+      logging(lid_internal, "tracing", "error",
+	      "Child terminated because of a different signal - not SIGTERM "
+	      "Do not restart",
+	      1, "pid", spid);
+      set_terminate();
+    }
+  }
+}
+
+// Waits for all the children of the graph: the pipe ends which are
+// kept for a terminated child must be closed before the others can
+// see EOF.
+static void child_pids_wait_all() {
+  logging(lid_internal, "tracing", "info", "Wait for children to terminate", 0);
+  while (g_running_cnt > 0 || g_replica_cnt > 0 || g_standby_cnt > 0) {
+    int status;
+    struct rusage usage;
+    pid_t const rw = event_loop_wait_child(&status, &usage, -1);
+    if (rw == 0) {
+      // Interrupted by a signal: only the signals for the graph stop
+      // the waiting.
+      continue;
+    }
+    if (rw == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ITOCHAR(serrno, 16, errno);
+      logging(lid_internal, "tracing", "error", "Error waiting", 2,
+	      "error", strerror(errno), "errno", serrno);
+      break;
+    }
+    child_stopped(rw, status, &usage);
+  }
+  logging(lid_internal, "tracing", "debug", "Finished waiting for all children", 0);
+}
+
+static void child_pids_kill_all_and_wait() {
+  child_pids_kill_all();
+  child_pids_wait_all();
+}
+
+// Stops all processes without waiting for them: supervisor_step()
+// reaps them.
+static void child_pids_stop_all() {
+  child_pids_kill_all();
+  g_stopping = 1;
+}
+
+/**
+ * Signal Related.
+ */
+
+static void sh_term(int signum, siginfo_t *siginfo, void *ucontext) {
+  (void)siginfo;
+  (void)ucontext;
+
+  // Never start anything again: kill all children (or drain) and stop
+  g_shutdown = 1;
+  set_terminate();
+  if (g_config->drain_timeout > 0) {
+    g_drain_requested = 1;
+  }
+  g_term_signal = signum;
+  event_loop_break();
+}
+
+static void sh_restart(int signum, siginfo_t *siginfo, void *ucontext) {
+  (void)siginfo;
+  (void)ucontext;
+
+  // Kill all children and restart
+  g_restart_signal = signum;
+  event_loop_break();
+}
+
+/**
+ * The work for the signals received since the last call - in the main
+ * loop: the structures of the supervisor might be in the middle of a
+ * change when the signal handler runs.
+ * Returns 1 if there was a signal.
+ */
+static int signals_handle() {
+  int handled = 0;
+  int const restart_signal = g_restart_signal;
+  if (restart_signal != 0) {
+    g_restart_signal = 0;
+    ITOCHAR(ssignum, 16, restart_signal);
+    logging(lid_internal, "signal", "info",
+	    "signal restart handler called - signal received",
+	    1, "signal", ssignum);
+    set_restart(1);
+    child_pids_stop_all();
+    handled = 1;
+  }
+  int const term_signal = g_term_signal;
+  if (term_signal != 0) {
+    g_term_signal = 0;
+    ITOCHAR(ssignum, 16, term_signal);
+    logging(lid_internal, "signal", "info",
+	    "signal terminate handler called - signal received",
+	    1, "signal", ssignum);
+    if (g_drain_requested) {
+      g_drain_requested = 0;
+      drain_begin();
+    } else {
+      child_pids_stop_all();
+    }
+    handled = 1;
+  }
+  return handled;
+}
+
+// The handlers of the program before the start: restored when the
+// graph is finished.
+static int const g_handled_signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM};
+#define HANDLED_SIGNAL_CNT \
+  (sizeof(g_handled_signals) / sizeof(g_handled_signals[0]))
+static struct sigaction g_former_handlers[HANDLED_SIGNAL_CNT];
+static int g_handlers_installed = 0;
+
+static int install_signal_handler() {
+  if (event_loop_init() == -1) {
+    return -1;
+  }
+  // An embedding program keeps its own handlers.
+  if (!g_config->signal_handlers) {
+    return 0;
+  }
+
+  struct sigaction sa_term;
+  sa_term.sa_sigaction = sh_term;
+  sigemptyset(&sa_term.sa_mask);
+  sa_term.sa_flags = SA_SIGINFO | SA_NODEFER;
+
+  struct sigaction sa_restart;
+  sa_restart.sa_sigaction = sh_restart;
+  sigemptyset(&sa_restart.sa_mask);
+  sa_restart.sa_flags = SA_SIGINFO | SA_NODEFER;
+
+  for (size_t sidx = 0; sidx < HANDLED_SIGNAL_CNT; ++sidx) {
+    sigaction(g_handled_signals[sidx],
+              g_handled_signals[sidx] == SIGHUP ? &sa_restart : &sa_term,
+              &g_former_handlers[sidx]);
+  }
+  g_handlers_installed = 1;
+  return 0;
+}
+
+static void restore_signal_handler() {
+  if (!g_handlers_installed) {
+    return;
+  }
+  for (size_t sidx = 0; sidx < HANDLED_SIGNAL_CNT; ++sidx) {
+    sigaction(g_handled_signals[sidx], &g_former_handlers[sidx], NULL);
+  }
+  g_handlers_installed = 0;
+}
+
+static void uninstall_signal_handler() {
+
+  struct sigaction sa_default;
+  sa_default.sa_handler = SIG_DFL;
+  sigemptyset(&sa_default.sa_mask);
+  sa_default.sa_flags = SA_SIGINFO | SA_NODEFER;
+
+  sigaction(SIGHUP, &sa_default, NULL);
+  sigaction(SIGINT, &sa_default, NULL);
+  sigaction(SIGQUIT, &sa_default, NULL);
+  sigaction(SIGTERM, &sa_default, NULL);
+}
+
+// Functions using the upper data structures
+// A standby process waits before its pipes are attached and before the
+// exec until the supervisor writes 'GO' to (or closes) hold_fd.  The
+// pipes of the other processes are closed before: they must not be
+// held open by the waiting process.
+static void pipe_execv_one(command_info_t const *params,
+                           pipe_info_t *const ipipe, size_t const pipe_cnt,
+                           int const notify_fd, int const hold_fd) {
+  relay_close_in_child();
+  if (hold_fd != -1) {
+    pipe_info_close_foreign(ipipe, pipe_cnt, params->cmd_name);
+    // The whole line: with notify fd the same socket is used later.
+    char go = '\0';
+    while (go != '\n') {
+      ssize_t const rd = read(hold_fd, &go, 1);
+      if (rd == -1 && errno == EINTR) {
+        continue;
+      }
+      if (rd != 1) {
+        // Not needed any longer
+        _exit(0);
+      }
+    }
+  }
+  // All pipe fds are close-on-exec.
+  pipe_info_dup_in_pipes(ipipe, pipe_cnt, params->cmd_name, 0);
+  if (g_nofile_raised) {
+    setrlimit(RLIMIT_NOFILE, &g_nofile_limit);
+  }
+
+  if (notify_fd != -1) {
+    // dup2() clears FD_CLOEXEC - but not when both fds are the same.
+    if (notify_fd == params->notify_fd) {
+      fcntl(notify_fd, F_SETFD, 0);
+    } else {
+      dup2(notify_fd, params->notify_fd);
+    }
+  }
+
+  if (params->cache) {
+    cache_run(params, g_config->cache_dir,
+              (uint64_t)g_config->cache_size << 20);
+  }
+
+  logging(lid_internal, "exec", "info", "Calling execv",
+	  2, "command", params->cmd_name, "path", params->path);
+  execv(params->path, params->argv);
+
+  ITOCHAR(serrno, 16, errno);
+  logging(lid_internal, "exec", "error", "Calling execv",
+	  2, "command", params->cmd_name, "path", params->path,
+	  "errno", serrno, "error", strerror(errno));
+  abort();
+}
+
+// Returns the pid - or -1 if the fork failed (logged).
+static pid_t pipe_execv_fork_one(command_info_t const *params,
+                                 pipe_info_t *const ipipe,
+                                 size_t const pipe_cnt, int const notify_fd,
+                                 int const hold_fd) {
+  command_info_print(params);
+  pid_t const fpid = fork();
+
+  if (fpid == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "exec", "error", "Error during fork()", 2,
+	    "errno", serrno, "error", strerror(errno));
+    return -1;
+  } else if (fpid == 0) {
+    uninstall_signal_handler();
+    event_loop_uninstall();
+    pipe_execv_one(params, ipipe, pipe_cnt, notify_fd, hold_fd);
+    // Neverreached
+    abort();
+  }
+
+  ITOCHAR(spid, 16, fpid);
+  logging(lid_command_pid, "exec", "info", "New child forked", 2,
+	  "command", params->cmd_name, "command_pid", spid);
+
+  // fpid>0: parent
+  return fpid;
+}
+
+/**
+ * Readiness
+ * A process is ready when it wrote something to (or closed) its notify
+ * fd - or, without notify fd, when the exec succeeded.  The exec is
+ * detected by a FD_CLOEXEC pipe: the read end sees EOF.
+ */
+
+static long usec_since(struct timespec const *const start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000L +
+         (now.tv_nsec - start->tv_nsec) / 1000L;
+}
+
+static int cloexec_pipe(int pipefds[2]) {
+  if (pipe(pipefds) == -1) {
+    return -1;
+  }
+  fcntl(pipefds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(pipefds[1], F_SETFD, FD_CLOEXEC);
+  return 0;
+}
+
+// Nodes with standby get a socketpair: the process waits after the
+// ready notification until the supervisor answers 'GO'.  A standby
+// process gets the answer when it is promoted.
+static int notify_channel(command_info_t const *const cmd, int fds[2]) {
+  if (!cmd->standby) {
+    return cloexec_pipe(fds);
+  }
+  return socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+}
+
+static void notify_go(int const fd) {
+  static char const go[] = "GO\n";
+  ssize_t wr;
+  do {
+    wr = send(fd, go, sizeof(go) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+  } while (wr == -1 && errno == EINTR);
+}
+
+static void node_ready(int const child_idx) {
+  node_info_t *const node = &g_nodes[child_idx];
+  node->ready = 1;
+  node->ready_usec = usec_since(&node->fork_time);
+  if (g_icmd[child_idx].standby && node->notify_fd != -1) {
+    notify_go(node->notify_fd);
+  }
+
+  ITOCHAR(spid, 16, node->pid);
+  char sexec_usec[24];
+  snprintf(sexec_usec, sizeof(sexec_usec), "%ld", node->exec_usec);
+  char sready_usec[24];
+  snprintf(sready_usec, sizeof(sready_usec), "%ld", node->ready_usec);
+  logging(lid_command_ready, "exec", "info", "Child ready", 4,
+	  "command", g_icmd[child_idx].cmd_name, "command_pid", spid,
+	  "exec_usec", sexec_usec, "ready_usec", sready_usec);
+}
+
+// Reads the notify fd during run time: the process might send more
+// than one notification.  The fd is closed when the process is gone.
+static void node_notify_read(int fd, void *data) {
+  int const child_idx = (int)(intptr_t)data;
+  char buf[256];
+  ssize_t const rd = read(fd, buf, sizeof(buf));
+  if (rd == -1 && (errno == EINTR || errno == EAGAIN)) {
+    return;
+  }
+  // The fd of a former run of the node is only closed.
+  int const current = g_nodes[child_idx].notify_fd == fd;
+  if (current && !g_nodes[child_idx].ready) {
+    node_ready(child_idx);
+  }
+  if (rd <= 0) {
+    event_loop_remove_fd(fd);
+    close(fd);
+    if (current) {
+      g_nodes[child_idx].notify_fd = -1;
+    }
+  }
+}
+
+static void pair_close(int fds[2]) {
+  for (int fidx = 0; fidx < 2; ++fidx) {
+    if (fds[fidx] != -1) {
+      close(fds[fidx]);
+    }
+  }
+}
+
+// Forks the node.  Returns the read end of the exec pipe if want_exec
+// is set, else -1.  If the node cannot be started, the graph is
+// stopped (see setup_failed()) and node->pid stays 0.
+static int node_spawn(int const child_idx, int const want_exec) {
+  node_info_t *const node = &g_nodes[child_idx];
+  int exec_pipe[2] = {-1, -1};
+  int notify_pipe[2] = {-1, -1};
+  if ((want_exec && cloexec_pipe(exec_pipe) == -1) ||
+      (g_icmd[child_idx].notify_fd != -1 &&
+       notify_channel(&g_icmd[child_idx], notify_pipe) == -1)) {
+    setup_failed("Cannot create pipe");
+    pair_close(exec_pipe);
+    pair_close(notify_pipe);
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &node->fork_time);
+  pid_t const cpid = pipe_execv_fork_one(&g_icmd[child_idx], g_ipipe,
+                                         g_pipe_cnt, notify_pipe[1], -1);
+  if (cpid == -1) {
+    setup_failed("Cannot start child");
+    pair_close(exec_pipe);
+    pair_close(notify_pipe);
+    return -1;
+  }
+  node_started(child_idx, cpid);
+  node->ready = 0;
+  node->exec_usec = -1;
+  node->notify_fd = notify_pipe[0];
+  if (notify_pipe[0] != -1) {
+    close(notify_pipe[1]);
+    fcntl(notify_pipe[0], F_SETFL, fcntl(notify_pipe[0], F_GETFL, 0) | O_NONBLOCK);
+  }
+  if (exec_pipe[0] != -1) {
+    close(exec_pipe[1]);
+  }
+  return exec_pipe[0];
+}
+
+/**
+ * Startup of the whole graph.
+ * A process is started when all the processes it writes to are ready:
+ * the consumers are ready before the producers start pushing data.
+ * All processes which can be started are started at once.
+ * Processes in cycles (and behind) have no order: they are started
+ * first.
+ */
+struct startup {
+  // Number of consumers which are not yet ready.
+  size_t *pending;
+  int *exec_fds;
+  // The started nodes which are not yet ready - and the position of
+  // each node in this list: only these are polled.
+  size_t *waiting;
+  size_t *waiting_pos;
+  size_t not_ready;
+};
+
+static void startup_spawn(struct startup *const su, size_t const cidx) {
+  su->exec_fds[cidx] = node_spawn(cidx, 1);
+  if (g_nodes[cidx].pid == 0) {
+    return;
+  }
+  su->waiting[su->not_ready] = cidx;
+  su->waiting_pos[cidx] = su->not_ready;
+  ++su->not_ready;
+}
+
+static void startup_ready(struct startup *const su, size_t const cidx) {
+  node_ready(cidx);
+  --su->not_ready;
+  size_t const last = su->waiting[su->not_ready];
+  su->waiting[su->waiting_pos[cidx]] = last;
+  su->waiting_pos[last] = su->waiting_pos[cidx];
+  if (g_shutdown) {
+    return;
+  }
+  for (size_t pidx = g_topology->pred_first[cidx];
+       pidx < g_topology->pred_first[cidx + 1]; ++pidx) {
+    size_t const pred = g_topology->pred[pidx];
+    if (--su->pending[pred] == 0) {
+      startup_spawn(su, pred);
+    }
+  }
+}
+
+// Handles the readable exec or notify fd of a node.
+static void startup_event(struct startup *const su, size_t const cidx) {
+  node_info_t *const node = &g_nodes[cidx];
+  char buf[256];
+  if (su->exec_fds[cidx] != -1) {
+    ssize_t const rd = read(su->exec_fds[cidx], buf, sizeof(buf));
+    if (rd == -1 && errno == EINTR) {
+      return;
+    }
+    close(su->exec_fds[cidx]);
+    su->exec_fds[cidx] = -1;
+    node->exec_usec = usec_since(&node->fork_time);
+    if (node->notify_fd == -1) {
+      startup_ready(su, cidx);
+    }
+    return;
+  }
+
+  ssize_t const rd = read(node->notify_fd, buf, sizeof(buf));
+  if (rd == -1 && (errno == EINTR || errno == EAGAIN)) {
+    return;
+  }
+  if (rd <= 0) {
+    close(node->notify_fd);
+    node->notify_fd = -1;
+  }
+  startup_ready(su, cidx);
+}
+
+static void startup_run(struct startup *const su) {
+  size_t const cnt = g_child_cnt;
+  struct pollfd *const pfds = malloc((cnt + 1) * sizeof(struct pollfd));
+  size_t *const pidx2cidx = malloc((cnt + 1) * sizeof(size_t));
+  if (pfds == NULL || pidx2cidx == NULL) {
+    setup_failed("Memory allocation failed");
+    free(pfds);
+    free(pidx2cidx);
+    return;
+  }
+  long const ready_timeout_usec = g_config->ready_timeout * 1000000L;
+
+  while (su->not_ready > 0 && !g_shutdown) {
+    // Nodes in time out are handled as ready.  The producers started
+    // by them are appended to the list: they are not visited here.
+    for (size_t widx = su->not_ready; widx > 0; --widx) {
+      size_t const cidx = su->waiting[widx - 1];
+      if (ready_timeout_usec - usec_since(&g_nodes[cidx].fork_time) <= 0) {
+        if (ready_timeout_usec > 0) {
+          logging(lid_internal, "exec", "warning",
+                  "Child not ready in time - continue", 1,
+                  "command", g_icmd[cidx].cmd_name);
+        }
+        startup_ready(su, cidx);
+      }
+    }
+
+    size_t pcnt = 0;
+    long wait_usec = -1;
+    for (size_t widx = 0; widx < su->not_ready; ++widx) {
+      size_t const cidx = su->waiting[widx];
+      node_info_t *const node = &g_nodes[cidx];
+      long const left = ready_timeout_usec - usec_since(&node->fork_time);
+      if (wait_usec == -1 || left < wait_usec) {
+        wait_usec = left > 0 ? left : 0;
+      }
+      pfds[pcnt].fd =
+          su->exec_fds[cidx] != -1 ? su->exec_fds[cidx] : node->notify_fd;
+      pfds[pcnt].events = POLLIN;
+      pidx2cidx[pcnt] = cidx;
+      ++pcnt;
+    }
+    if (pcnt == 0) {
+      break;
+    }
+
+    int const pres = poll(pfds, pcnt, (int)((wait_usec + 999) / 1000));
+    if (pres == -1 && errno != EINTR) {
+      setup_failed("Error during poll()");
+      break;
+    }
+    for (size_t pidx = 0; pres > 0 && pidx < pcnt; ++pidx) {
+      if (pfds[pidx].revents != 0) {
+        startup_event(su, pidx2cidx[pidx]);
+      }
+    }
+  }
+  free(pfds);
+  free(pidx2cidx);
+}
+
+static void pipe_execv(size_t const command_cnt, pipe_info_t *const ipipe,
+                       size_t const pipe_cnt) {
+
+  // The relays of the last run are stopped before their pipes are closed.
+  relay_stop();
+  if (pipe_info_block_used_fds(ipipe, pipe_cnt) == -1 ||
+      pipe_info_create_pipes(ipipe, pipe_cnt) == -1 ||
+      relay_start(ipipe, pipe_cnt) == -1) {
+    setup_failed("Cannot create the pipes");
+    pipe_info_close_all(ipipe, pipe_cnt);
+    return;
+  }
+
+  // Looks that messing around with the pipes (storing them and propagating
+  // them to all children) is not a good idea.
+  // ... but in this case there is no other way....
+  struct startup su;
+  su.pending = malloc((command_cnt + 1) * sizeof(size_t));
+  su.exec_fds = malloc((command_cnt + 1) * sizeof(int));
+  su.waiting = malloc((command_cnt + 1) * sizeof(size_t));
+  su.waiting_pos = malloc((command_cnt + 1) * sizeof(size_t));
+  su.not_ready = 0;
+  if (su.pending == NULL || su.exec_fds == NULL || su.waiting == NULL ||
+      su.waiting_pos == NULL) {
+    setup_failed("Memory allocation failed");
+    free(su.pending);
+    free(su.exec_fds);
+    free(su.waiting);
+    free(su.waiting_pos);
+    return;
+  }
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    su.pending[cidx] = g_topology->out_cnt[cidx];
+    su.exec_fds[cidx] = -1;
+  }
+  for (size_t oidx = g_topology->sorted_cnt; oidx < command_cnt; ++oidx) {
+    su.pending[g_topology->order[oidx]] = 0;
+  }
+  // The sinks are last in the topological order.
+  for (size_t oidx = command_cnt; oidx > 0 && !g_shutdown; --oidx) {
+    size_t const cidx = g_topology->order[oidx - 1];
+    if (su.pending[cidx] == 0) {
+      startup_spawn(&su, cidx);
+    }
+  }
+  startup_run(&su);
+
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    if (su.exec_fds[cidx] != -1) {
+      close(su.exec_fds[cidx]);
+    }
+    if (g_nodes[cidx].notify_fd != -1) {
+      event_loop_add_fd(g_nodes[cidx].notify_fd, node_notify_read,
+                        (void *)(intptr_t)cidx);
+    }
+  }
+  free(su.pending);
+  free(su.exec_fds);
+  free(su.waiting);
+  free(su.waiting_pos);
+
+  // When single nodes can be restarted, all the pipes are needed later.
+  // For metrics and the watchdog the read ends tell the fill level.
+  enum pipe_keep keep = pk_none;
+  if (g_config->node_restart) {
+    keep = pk_all;
+  } else if (g_config->control_path != NULL ||
+             g_config->metrics_addr != NULL ||
+             g_config->watchdog_timeout > 0 ||
+             g_config->graph_path != NULL) {
+    keep = pk_read;
+  }
+  pipe_info_close_unkept(ipipe, pipe_cnt, keep);
+
+  for (size_t cidx = 0; cidx < command_cnt && !g_shutdown; ++cidx) {
+    if (g_icmd[cidx].standby) {
+      standby_spawn(cidx);
+    }
+    for (unsigned int ridx = 1; ridx < g_icmd[cidx].scale_min; ++ridx) {
+      replica_spawn(cidx);
+    }
+  }
+}
+
+// Number of nodes waiting for their restart timer
+static int g_restart_pending = 0;
+// Restart of the whole graph: the timer and if it expired
+static int g_restart_timer = -1;
+static int g_restart_due = 0;
+
+// Starts one node again; all the pipes were kept.
+static void node_restart(int const child_idx) {
+  ++g_nodes[child_idx].restart_cnt;
+  logging(lid_internal, "exec", "info", "Restart single child", 1,
+          "command", g_icmd[child_idx].cmd_name);
+  node_spawn(child_idx, 0);
+  if (g_nodes[child_idx].pid == 0) {
+    return;
+  }
+  if (g_nodes[child_idx].notify_fd != -1) {
+    event_loop_add_fd(g_nodes[child_idx].notify_fd, node_notify_read,
+                      (void *)(intptr_t)child_idx);
+  }
+  if (g_icmd[child_idx].standby && g_nodes[child_idx].standby_pid == 0) {
+    standby_spawn(child_idx);
+  }
+}
+
+static void node_restart_tick(void *data) {
+  int const child_idx = (int)(intptr_t)data;
+  event_loop_remove_timer(g_nodes[child_idx].restart_timer);
+  g_nodes[child_idx].restart_timer = -1;
+  --g_restart_pending;
+  event_loop_break();
+  if (!g_shutdown && !g_stopping) {
+    node_restart(child_idx);
+  }
+}
+
+// Restarts the node after the sleep timer - without blocking the
+// event loop.
+static void node_restart_later(int const child_idx) {
+  int const timer = event_loop_add_timer(g_config->sleep_timer * 1000,
+                                         node_restart_tick,
+                                         (void *)(intptr_t)child_idx);
+  if (timer == -1) {
+    logging(lid_internal, "exec", "warning",
+            "Cannot create restart timer - restart now", 1,
+            "command", g_icmd[child_idx].cmd_name);
+    node_restart(child_idx);
+    return;
+  }
+  g_nodes[child_idx].restart_timer = timer;
+  ++g_restart_pending;
+}
+
+static void graph_restart_tick(void *data) {
+  (void)data;
+  event_loop_remove_timer(g_restart_timer);
+  g_restart_timer = -1;
+  g_restart_due = 1;
+  event_loop_break();
+}
+
+// Returns 1 if the whole graph can be restarted now.  Else the sleep
+// timer is started (if not yet) and the events are dispatched up to
+// timeout_ms.
+static int graph_restart_due(int const timeout_ms) {
+  if (g_config->sleep_timer == 0 || g_restart_due) {
+    g_restart_due = 0;
+    return 1;
+  }
+  if (g_restart_timer == -1) {
+    ITOCHAR(ssleep_timer, 16, g_config->sleep_timer);
+    logging(lid_internal, "tracing", "info", "Waiting for before restart", 1,
+            "sleep_timer", ssleep_timer);
+    g_restart_timer = event_loop_add_timer(g_config->sleep_timer * 1000,
+                                           graph_restart_tick, NULL);
+    if (g_restart_timer == -1) {
+      logging(lid_internal, "tracing", "warning",
+              "Cannot create restart timer - restart now", 0);
+      return 1;
+    }
+  }
+  event_loop_wait(timeout_ms);
+  if (!g_restart_due) {
+    return 0;
+  }
+  g_restart_due = 0;
+  logging(lid_internal, "tracing", "info", "Continue restarting", 0);
+  return 1;
+}
+
+static void restart_timers_cancel() {
+  for (int cidx = 0; cidx < g_child_cnt; ++cidx) {
+    if (g_nodes[cidx].restart_timer != -1) {
+      event_loop_remove_timer(g_nodes[cidx].restart_timer);
+      g_nodes[cidx].restart_timer = -1;
+    }
+  }
+  g_restart_pending = 0;
+  if (g_restart_timer != -1) {
+    event_loop_remove_timer(g_restart_timer);
+    g_restart_timer = -1;
+  }
+  g_restart_due = 0;
+}
+
+/**
+ * Hot standby
+ * For nodes with the 'standby' option a second process is forked and
+ * held before its pipes are attached and before the exec: it waits on
+ * the hold fd until it is promoted.  With notify fd the hold fd is the
+ * notify socket: after the exec the promoted process notifies and
+ * waits for 'GO' as the running one does.  When the running process
+ * terminates, the standby is promoted and a new standby is started.
+ * This needs '-R': the supervisor keeps the pipe ends which are passed
+ * to the standby.
+ */
+
+static void standby_spawn(int const child_idx) {
+  node_info_t *const node = &g_nodes[child_idx];
+  command_info_t const *const cmd = &g_icmd[child_idx];
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "standby", "warning", "Cannot create standby", 3,
+            "command", cmd->cmd_name, "errno", serrno,
+            "error", strerror(errno));
+    return;
+  }
+  int const has_notify = cmd->notify_fd != -1;
+  pid_t const cpid = pipe_execv_fork_one(cmd, g_ipipe, g_pipe_cnt,
+                                         has_notify ? sv[1] : -1, sv[1]);
+  if (cpid == -1) {
+    // The node runs without standby.
+    close(sv[0]);
+    close(sv[1]);
+    return;
+  }
+  node->standby_pid = cpid;
+  pid_map_insert(g_pid_map, node->standby_pid, child_idx, po_standby);
+  ++g_standby_cnt;
+  close(sv[1]);
+  node->standby_fd = sv[0];
+  node->standby_ready = 1;
+}
+
+// Kills the standby: it never got any data.  It is reaped by the event
+// loop like the other children.
+static void standby_kill(int const child_idx) {
+  node_info_t *const node = &g_nodes[child_idx];
+  if (node->standby_pid == 0) {
+    return;
+  }
+  kill(node->standby_pid, SIGKILL);
+  node->standby_pid = 0;
+  node->standby_ready = 0;
+  if (node->standby_fd != -1) {
+    close(node->standby_fd);
+    node->standby_fd = -1;
+  }
+}
+
+static void standby_kill_all() {
+  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
+    standby_kill(child_idx);
+  }
+}
+
+// A standby which terminates on its own is started again - but only
+// if it was ready before: else it would be started again and again.
+static void standby_reaped(int const child_idx, pid_t const cpid,
+                           int const status) {
+  pid_map_remove(g_pid_map, cpid);
+  --g_standby_cnt;
+  node_info_t *const node = &g_nodes[child_idx];
+  if (node->standby_pid != cpid) {
+    // Killed before
+    return;
+  }
+  int const was_ready = node->standby_ready;
+  ITOCHAR(spid, 16, cpid);
+  ITOCHAR(sstatus, 16, status);
+  logging(lid_internal, "standby", "warning", "Standby terminated", 3,
+          "command", g_icmd[child_idx].cmd_name, "pid", spid,
+          "status", sstatus);
+  node->standby_pid = 0;
+  node->standby_ready = 0;
+  if (node->standby_fd != -1) {
+    close(node->standby_fd);
+    node->standby_fd = -1;
+  }
+  if (was_ready && !g_shutdown && !g_stopping && node->pid != 0) {
+    standby_spawn(child_idx);
+  }
+}
+
+// Makes the standby the running process of the node.
+// Returns 0 if there is no standby which is ready.
+static int standby_promote(int const child_idx) {
+  node_info_t *const node = &g_nodes[child_idx];
+  if (node->standby_pid == 0 || !node->standby_ready) {
+    return 0;
+  }
+  ++node->restart_cnt;
+  ITOCHAR(spid, 16, node->standby_pid);
+  logging(lid_internal, "standby", "info", "Promoting standby", 2,
+          "command", g_icmd[child_idx].cmd_name, "pid", spid);
+
+  int const fd = node->standby_fd;
+  int const has_notify = g_icmd[child_idx].notify_fd != -1;
+  clock_gettime(CLOCK_MONOTONIC, &node->fork_time);
+  // From now on a node process
+  --g_standby_cnt;
+  node_started(child_idx, node->standby_pid);
+  // With notify fd the process gets its 'GO' after the exec when it
+  // is ready.
+  node->ready = !has_notify;
+  node->exec_usec = -1;
+  node->ready_usec = 0;
+  node->standby_pid = 0;
+  node->standby_fd = -1;
+  node->standby_ready = 0;
+  notify_go(fd);
+  if (has_notify) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    node->notify_fd = fd;
+    event_loop_add_fd(fd, node_notify_read, (void *)(intptr_t)child_idx);
+  } else {
+    close(fd);
+  }
+
+  standby_spawn(child_idx);
+  return 1;
+}
+
+/**
+ * Autoscaling
+ * Nodes with the 'scale=MIN-MAX' option get additional processes
+ * (replicas) when their input pipes fill up and lose them when the
+ * pipes are empty again.  All processes of a node share the same pipe
+ * ends: the pipe hands each read the next part of the data and the
+ * writes of all of them are merged in the output pipe.  Needs '-R':
+ * the supervisor keeps the pipe ends to pass them to new replicas.
+ */
+
+static unsigned int replicas_active(node_info_t const *const node) {
+  unsigned int active = 0;
+  for (unsigned int ridx = 0; ridx < node->replica_cnt; ++ridx) {
+    active += !node->replicas[ridx].stopping;
+  }
+  return active;
+}
+
+static void replica_spawn(int const child_idx) {
+  node_info_t *const node = &g_nodes[child_idx];
+  if (node->replica_cnt == 2 * g_icmd[child_idx].scale_max) {
+    // Too many which do not terminate after SIGTERM
+    return;
+  }
+  pid_t const cpid = pipe_execv_fork_one(&g_icmd[child_idx], g_ipipe,
+                                         g_pipe_cnt, -1, -1);
+  if (cpid == -1) {
+    // The next check of the autoscaler tries it again.
+    return;
+  }
+  node->replicas[node->replica_cnt].pid = cpid;
+  node->replicas[node->replica_cnt].stopping = 0;
+  ++node->replica_cnt;
+  pid_map_insert(g_pid_map, cpid, child_idx, po_replica);
+  ++g_replica_cnt;
+}
+
+// Terminates the newest replica.
+static void replica_stop(int const child_idx) {
+  node_info_t *const node = &g_nodes[child_idx];
+  for (unsigned int ridx = node->replica_cnt; ridx > 0; --ridx) {
+    struct replica *const replica = &node->replicas[ridx - 1];
+    if (!replica->stopping) {
+      kill(replica->pid, SIGTERM);
+      replica->stopping = 1;
+      return;
+    }
+  }
+}
+
+static void replicas_signal(int const child_idx, int const signum) {
+  node_info_t *const node = &g_nodes[child_idx];
+  for (unsigned int ridx = 0; ridx < node->replica_cnt; ++ridx) {
+    kill(node->replicas[ridx].pid, signum);
+    node->replicas[ridx].stopping = 1;
+  }
+}
+
+static void replica_reaped(int const child_idx, pid_t const cpid,
+                           int const status) {
+  node_info_t *const node = &g_nodes[child_idx];
+  for (unsigned int ridx = 0; ridx < node->replica_cnt; ++ridx) {
+    if (node->replicas[ridx].pid != cpid) {
+      continue;
+    }
+    ITOCHAR(spid, 16, cpid);
+    ITOCHAR(sstatus, 16, status);
+    logging(lid_internal, "autoscale", "info", "Replica terminated", 3,
+            "command", g_icmd[child_idx].cmd_name, "pid", spid,
+            "status", sstatus);
+    node->replicas[ridx] = node->replicas[--node->replica_cnt];
+    pid_map_remove(g_pid_map, cpid);
+    --g_replica_cnt;
+    return;
+  }
+}
+
+// Processes which are not nodes themselves
+static int auxiliary_reaped(pid_t const cpid, int const status) {
+  enum pid_owner owner;
+  int const child_idx = pid_map_find(g_pid_map, cpid, &owner);
+  if (child_idx == -1 || owner == po_node) {
+    return 0;
+  }
+  if (owner == po_standby) {
+    standby_reaped(child_idx, cpid, status);
+  } else {
+    replica_reaped(child_idx, cpid, status);
+  }
+  return 1;
+}
+
+static void autoscale_tick(void *data) {
+  (void)data;
+  if (g_shutdown || g_stopping) {
+    return;
+  }
+  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
+    command_info_t const *const cmd = &g_icmd[child_idx];
+    node_info_t *const node = &g_nodes[child_idx];
+    if (cmd->scale_max == 0 || node->pid == 0) {
+      continue;
+    }
+
+    long fill = 0;
+    long capacity = 0;
+    for (size_t iidx = g_topology->in_pipe_first[child_idx];
+         iidx < g_topology->in_pipe_first[child_idx + 1]; ++iidx) {
+      pipe_info_t const *const pipe = &g_ipipe[g_topology->in_pipe[iidx]];
+      long const pfill = pipe_info_fill(pipe);
+      long const pcapacity = pipe_info_capacity(pipe);
+      if (pfill != -1 && pcapacity != -1) {
+        fill += pfill;
+        capacity += pcapacity;
+      }
+    }
+
+    unsigned int const cnt = 1 + replicas_active(node);
+    int const change = autoscale_decide(&node->scale, fill, capacity, cnt,
+                                        cmd->scale_min, cmd->scale_max);
+    if (change == 0) {
+      continue;
+    }
+    SIZETTOCHAR(sfill, 20, (size_t)fill);
+    SIZETTOCHAR(scapacity, 20, (size_t)capacity);
+    ITOCHAR(scnt, 16, cnt + change);
+    logging(lid_internal, "autoscale", "info",
+            change > 0 ? "Adding replica" : "Removing replica", 4,
+            "command", cmd->cmd_name, "fill", sfill, "capacity", scapacity,
+            "processes", scnt);
+    if (change > 0) {
+      replica_spawn(child_idx);
+    } else {
+      replica_stop(child_idx);
+    }
+  }
+}
+
+/**
+ * Watchdog
+ * A node makes progress when it uses CPU time or data is moved on one
+ * of its relayed edges.  When there is no progress for the watchdog
+ * timeout while data is waiting in one of its input pipes, the node
+ * is stalled: this is logged and - if configured - the node is
+ * restarted.  A node without input is idle, not stalled.  A node
+ * which waits on a full output pipe sees backpressure: it is not
+ * stalled either.
+ */
+
+static double node_progress(int const child_idx) {
+  double cpu = 0;
+  long rss;
+  metrics_proc_sample(g_nodes[child_idx].pid, &cpu, &rss);
+
+  double bytes = 0;
+  size_t const *const pipes[2] = {g_topology->in_pipe, g_topology->out_pipe};
+  size_t const *const firsts[2] = {g_topology->in_pipe_first,
+                                   g_topology->out_pipe_first};
+  for (int dir = 0; dir < 2; ++dir) {
+    for (size_t eidx = firsts[dir][child_idx];
+         eidx < firsts[dir][child_idx + 1]; ++eidx) {
+      relay_stats_t stats;
+      if (relay_stats(pipes[dir][eidx], &stats) == 0) {
+        bytes += stats.bytes;
+      }
+    }
+  }
+  // The sum only needs to change when one of them changes.
+  return cpu + bytes;
+}
+
+static long node_input_fill(int const child_idx) {
+  long fill = 0;
+  for (size_t iidx = g_topology->in_pipe_first[child_idx];
+       iidx < g_topology->in_pipe_first[child_idx + 1]; ++iidx) {
+    long const pfill = pipe_info_fill(&g_ipipe[g_topology->in_pipe[iidx]]);
+    if (pfill > 0) {
+      fill += pfill;
+    }
+  }
+  return fill;
+}
+
+// Returns 1 if one of the output pipes of the node is full: a write
+// of the node waits for the consumer.
+static int node_output_blocked(int const child_idx) {
+  for (size_t oidx = g_topology->out_pipe_first[child_idx];
+       oidx < g_topology->out_pipe_first[child_idx + 1]; ++oidx) {
+    size_t const pidx = g_topology->out_pipe[oidx];
+    relay_stats_t stats;
+    if (relay_stats(pidx, &stats) == 0 && stats.stalled) {
+      return 1;
+    }
+    long const fill = pipe_info_fill(&g_ipipe[pidx]);
+    long const capacity = pipe_info_capacity(&g_ipipe[pidx]);
+    if (fill != -1 && capacity > 0 && capacity - fill < PIPE_BUF) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void watchdog_tick(void *data) {
+  (void)data;
+  if (g_shutdown || g_stopping) {
+    return;
+  }
+  time_t const now = time(NULL);
+  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
+    node_info_t *const node = &g_nodes[child_idx];
+    if (node->pid == 0 || node->state != ns_running) {
+      continue;
+    }
+    double const progress = node_progress(child_idx);
+    long const fill = node_input_fill(child_idx);
+    if (node->watch_pid != node->pid || progress != node->watch_progress ||
+        fill == 0 || node_output_blocked(child_idx)) {
+      node->watch_pid = node->pid;
+      node->watch_progress = progress;
+      node->watch_since = now;
+      node->stalled = 0;
+      continue;
+    }
+    if (node->stalled || now - node->watch_since < g_config->watchdog_timeout) {
+      continue;
+    }
+
+    node->stalled = 1;
+    ++node->stall_cnt;
+    ITOCHAR(spid, 16, node->pid);
+    SIZETTOCHAR(sfill, 20, (size_t)fill);
+    ITOCHAR(sseconds, 16, (int)(now - node->watch_since));
+    logging(lid_node_stalled, "watchdog", "warning", "Node stalled", 4,
+            "command", g_icmd[child_idx].cmd_name, "command_pid", spid,
+            "input_bytes", sfill, "seconds", sseconds);
+    if (g_config->watchdog_restart) {
+      supervisor_node_restart(g_icmd[child_idx].cmd_name);
+    }
+  }
+}
+
+/**
+ * Drain: stop the graph along the pipes.
+ * First the sources are terminated; each following process should see
+ * EOF on its inputs and terminate on its own.  Each stage gets
+ * drain_timeout seconds before it is terminated (SIGTERM) and after
+ * another timeout killed (SIGKILL).  The drain is a state of the main
+ * loop: a timer moves a stage on, the reaped processes finish it.
+ */
+
+static struct {
+  int active;
+  // The stage: nodes [first, first + cnt) of the topological order
+  size_t first;
+  size_t cnt;
+  // 0: waiting for the stage, 1: terminated, 2: killed
+  int phase;
+  int timer;
+} g_drain = {0, 0, 0, 0, -1};
+
+static void nodes_signal(size_t const *nodes, size_t const cnt,
+                         int const signum, char const *msg) {
+  for (size_t nidx = 0; nidx < cnt; ++nidx) {
+    replicas_signal(nodes[nidx], signum);
+    pid_t const cpid = g_child_pids[nodes[nidx]];
+    if (cpid != 0) {
+      ITOCHAR(spid, 16, cpid);
+      logging(lid_internal, "drain", "info", msg, 2,
+              "command", g_icmd[nodes[nidx]].cmd_name, "pid", spid);
+      kill(cpid, signum);
+    }
+  }
+}
+
+static size_t drain_stage_running() {
+  size_t running = 0;
+  for (size_t nidx = g_drain.first; nidx < g_drain.first + g_drain.cnt;
+       ++nidx) {
+    size_t const cidx = g_topology->order[nidx];
+    running += (g_child_pids[cidx] != 0) + g_nodes[cidx].replica_cnt;
+  }
+  return running;
+}
+
+static void drain_timer_stop() {
+  if (g_drain.timer != -1) {
+    event_loop_remove_timer(g_drain.timer);
+    g_drain.timer = -1;
+  }
+}
+
+// The timeout of the phase of the stage elapsed.
+static void drain_tick(void *data) {
+  (void)data;
+  size_t const *const nodes = &g_topology->order[g_drain.first];
+  if (g_drain.phase == 0) {
+    nodes_signal(nodes, g_drain.cnt, SIGTERM, "Drain: timeout - terminating");
+  } else {
+    nodes_signal(nodes, g_drain.cnt, SIGKILL, "Drain: timeout - killing");
+    // Nothing to wait for any longer but the reaping.
+    drain_timer_stop();
+  }
+  ++g_drain.phase;
+}
+
+// Starts the next stage; terminate: without the chance to terminate on
+// their own.
+static void drain_stage_start(size_t const first, size_t const cnt,
+                              int const terminate) {
+  g_drain.first = first;
+  g_drain.cnt = cnt;
+  g_drain.phase = 0;
+  if (terminate) {
+    nodes_signal(&g_topology->order[first], cnt, SIGTERM,
+                 "Drain: terminating");
+    g_drain.phase = 1;
+  }
+  drain_timer_stop();
+  g_drain.timer = event_loop_add_timer(g_config->drain_timeout * 1000,
+                                       drain_tick, NULL);
+  if (g_drain.timer == -1) {
+    logging(lid_internal, "drain", "warning",
+            "Cannot create timer - killing", 0);
+    nodes_signal(&g_topology->order[first], cnt, SIGKILL,
+                 "Drain: killing");
+    g_drain.phase = 2;
+  }
+}
+
+// Moves on to the next stage as long as the current one is finished.
+static void drain_advance() {
+  while (g_drain.active && drain_stage_running() == 0) {
+    size_t const next = g_drain.first + g_drain.cnt;
+    if (next < g_topology->sorted_cnt) {
+      drain_stage_start(next, 1, 0);
+    } else if (next < g_topology->node_cnt) {
+      // Cycles have no order: all of them get the timeout together.
+      drain_stage_start(next, g_topology->node_cnt - next, 0);
+    } else {
+      drain_timer_stop();
+      g_drain.active = 0;
+      logging(lid_internal, "drain", "info", "Drain finished", 0);
+    }
+  }
+}
+
+static void drain_begin() {
+  if (g_drain.active) {
+    return;
+  }
+  logging(lid_internal, "drain", "info", "Draining the graph", 0);
+  g_stopping = 1;
+  standby_kill_all();
+  pipe_info_fifo_close(g_ipipe, g_pipe_cnt);
+
+  // A paused process would never see EOF.
+  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
+    if (g_child_pids[child_idx] != 0 && g_nodes[child_idx].state == ns_paused) {
+      kill(g_child_pids[child_idx], SIGCONT);
+      g_nodes[child_idx].state = ns_running;
+    }
+  }
+
+  // All the sources come first in the order: stop them together.
+  size_t src_cnt = 0;
+  while (src_cnt < g_topology->sorted_cnt &&
+         g_topology->in_cnt[g_topology->order[src_cnt]] == 0) {
+    ++src_cnt;
+  }
+  g_drain.active = 1;
+  drain_stage_start(0, src_cnt, 1);
+  drain_advance();
+}
+
+static int node_index(char const *const name) {
+  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
+    if (strcmp(g_icmd[child_idx].cmd_name, name) == 0) {
+      return child_idx;
+    }
+  }
+  return -1;
+}
+
+static char const *pipe_end_name(pipes_end_info_t const *const pend) {
+  switch (pend->type) {
+  case pet_command:
+    return pend->name;
+  case pet_file:
+    return "FILE";
+  case pet_parent:
+    return "PARENT";
+  case pet_fifo:
+    return "FIFO";
+  }
+  return "?";
+}
+
+void supervisor_print_nodes(FILE *out) {
+  time_t const now = time(NULL);
+  for (int child_idx = 0; child_idx < g_child_cnt; ++child_idx) {
+    node_info_t const *const node = &g_nodes[child_idx];
+    fprintf(out, "node %d name=%s pid=%d state=%s restarts=%u uptime=%ld",
+            child_idx, g_icmd[child_idx].cmd_name, (int)node->pid,
+            node_state_name(node->state), node->restart_cnt,
+            node->pid != 0 ? (long)(now - node->start_time) : 0L);
+    if (g_icmd[child_idx].standby) {
+      fprintf(out, " standby=%d%s", (int)node->standby_pid,
+              node->standby_ready ? "" : "(starting)");
+    }
+    if (g_icmd[child_idx].scale_max != 0) {
+      fprintf(out, " replicas=%u", replicas_active(node));
+    }
+    fputc('\n', out);
+  }
+}
+
+void supervisor_print_pipes(FILE *out) {
+  for (size_t pidx = 0; pidx < g_pipe_cnt; ++pidx) {
+    pipe_info_t const *const pipe = &g_ipipe[pidx];
+    fprintf(out, "pipe %zu from=%s:%d to=%s:%d type=%s", pidx,
+            pipe_end_name(&pipe->from), pipe->from.fd,
+            pipe_end_name(&pipe->to), pipe->to.fd, pipe_type_name(pipe->type));
+    relay_stats_t stats;
+    if (relay_stats(pidx, &stats) == 0) {
+      fprintf(out, " bytes=%llu chunks=%llu stall=%.3f",
+              (unsigned long long)stats.bytes,
+              (unsigned long long)stats.chunks, stats.stall_usec / 1e6);
+      if (stats.tapped || stats.tap_bytes != 0 || stats.tap_drops != 0) {
+        fprintf(out, " tap=%s tap_bytes=%llu tap_drops=%llu",
+                stats.tapped ? "on" : "off",
+                (unsigned long long)stats.tap_bytes,
+                (unsigned long long)stats.tap_drops);
+      }
+    }
+    fputc('\n', out);
+  }
+}
+
+void supervisor_print_metrics(FILE *out) {
+  metrics_write(out, g_icmd, g_nodes, g_child_cnt, g_ipipe, g_pipe_cnt);
+}
+
+char const *supervisor_print_graph(FILE *out, char const *format) {
+  int const gformat = graph_export_format(format);
+  if (gformat == -1) {
+    return "unknown format";
+  }
+  graph_export_write(out, gformat, g_icmd, g_nodes, g_child_cnt, g_ipipe,
+                     g_pipe_cnt);
+  return NULL;
+}
+
+// The graph after the start: with pids and the (empty) pipes.
+node_info_t const *supervisor_nodes() {
+  return g_nodes;
+}
+
+static void export_graph() {
+  if (g_config->graph_path == NULL) {
+    return;
+  }
+  if (graph_export_file(g_config->graph_path, g_icmd, g_nodes, g_child_cnt,
+                        g_ipipe, g_pipe_cnt) == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "graph", "warning", "Cannot export graph", 3,
+            "path", g_config->graph_path, "errno", serrno,
+            "error", strerror(errno));
+  }
+}
+
+char const *supervisor_node_signal(char const *name, int signum) {
+  int const child_idx = node_index(name);
+  if (child_idx == -1) {
+    return "no such node";
+  }
+  if (g_child_pids[child_idx] == 0) {
+    return "node not running";
+  }
+  ITOCHAR(ssignum, 16, signum);
+  logging(lid_internal, "control", "info", "Sending signal", 2,
+          "command", name, "signal", ssignum);
+  if (kill(g_child_pids[child_idx], signum) == -1) {
+    return strerror(errno);
+  }
+  if (signum == SIGSTOP) {
+    g_nodes[child_idx].state = ns_paused;
+  } else if (signum == SIGCONT) {
+    g_nodes[child_idx].state = ns_running;
+  }
+  return NULL;
+}
+
+char const *supervisor_pipe_tap(char const *index, int fd, unsigned int every,
+                               uint64_t rate) {
+  char *end = NULL;
+  unsigned long const pidx = strtoul(index, &end, 10);
+  if (*index < '0' || *index > '9' || *end != '\0' || pidx >= g_pipe_cnt) {
+    return "no such pipe";
+  }
+  if (relay_tap(pidx, fd, every, rate) == -1) {
+    switch (errno) {
+    case ENOENT:
+      return "pipe has no relay";
+    case EBUSY:
+      return "pipe is already tapped";
+    case EPIPE:
+      return "pipe is closed";
+    default:
+      return strerror(errno);
+    }
+  }
+  if (fd == -1) {
+    return NULL;
+  }
+  SIZETTOCHAR(spidx, 24, (size_t)pidx);
+  ITOCHAR(severy, 16, (int)every);
+  SIZETTOCHAR(srate, 24, (size_t)rate);
+  logging(lid_internal, "control", "info", "Tap attached", 3,
+          "pipe_index", spidx, "every", severy, "rate", srate);
+  return NULL;
+}
+
+char const *supervisor_node_pause(char const *name, int pause) {
+  return supervisor_node_signal(name, pause ? SIGSTOP : SIGCONT);
+}
+
+char const *supervisor_node_restart(char const *name) {
+  if (!g_config->node_restart) {
+    return "restarting single nodes needs option -R";
+  }
+  int const child_idx = node_index(name);
+  if (child_idx == -1) {
+    return "no such node";
+  }
+  if (g_child_pids[child_idx] == 0) {
+    return "node not running";
+  }
+  g_nodes[child_idx].restart_requested = 1;
+  if (g_nodes[child_idx].state == ns_paused) {
+    supervisor_node_signal(name, SIGCONT);
+  }
+  return supervisor_node_signal(name, SIGTERM);
+}
+
+// The notify fd must not be one of the fds the pipes use.
+static int notify_fd_check(command_info_t const *const cmd,
+                           pipe_info_t const *const ipipe,
+                           size_t const pipe_cnt) {
+  if (cmd->notify_fd == -1) {
+    return 0;
+  }
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    if ((ipipe[pidx].from.fd == cmd->notify_fd &&
+         strcmp(ipipe[pidx].from.name, cmd->cmd_name) == 0) ||
+        (ipipe[pidx].to.fd == cmd->notify_fd &&
+         strcmp(ipipe[pidx].to.name, cmd->cmd_name) == 0)) {
+      ITOCHAR(sfd, 16, cmd->notify_fd);
+      logging(lid_internal, "exec", "error",
+              "Notify fd is also used by a pipe", 2,
+              "command", cmd->cmd_name, "fd", sfd);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// The cache key is made of stdin only: other pipe ends of the process
+// would be inputs (or outputs) the cache does not know about.
+static int cache_check(command_info_t const *const cmd,
+                       pipe_info_t const *const ipipe, size_t const pipe_cnt) {
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    // The end of the process: the output is fd 1, the input fd 0.
+    pipes_end_info_t const *const ends[2] = {&ipipe[pidx].from,
+                                             &ipipe[pidx].to};
+    for (int eidx = 0; eidx < 2; ++eidx) {
+      if (ends[eidx]->type != pet_command ||
+          strcmp(ends[eidx]->name, cmd->cmd_name) != 0 ||
+          ends[eidx]->fd == 1 - eidx) {
+        continue;
+      }
+      ITOCHAR(sfd, 16, ends[eidx]->fd);
+      logging(lid_internal, "command_line", "error",
+              "The cache option allows only pipes on stdin and stdout", 2,
+              "command", cmd->cmd_name, "fd", sfd);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// All processes of a scaled node share the pipe ends: only seqpacket
+// sockets keep the records whole - a stream would be split between
+// the readers and interleaved between the writers.
+static int scale_check(command_info_t const *const cmd,
+                       pipe_info_t const *const ipipe, size_t const pipe_cnt,
+                       supervisor_config_t const *const config) {
+  if (!config->node_restart) {
+    logging(lid_internal, "command_line", "error",
+            "The scale option needs -R", 1, "command", cmd->cmd_name);
+    return -1;
+  }
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    if (ipipe[pidx].type != pt_seqpacket &&
+        ((ipipe[pidx].from.type == pet_command &&
+          strcmp(ipipe[pidx].from.name, cmd->cmd_name) == 0) ||
+         (ipipe[pidx].to.type == pet_command &&
+          strcmp(ipipe[pidx].to.name, cmd->cmd_name) == 0))) {
+      logging(lid_internal, "command_line", "error",
+              "The scale option needs seqpacket pipes", 1,
+              "command", cmd->cmd_name);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Open files
+ * During the start all the pipes are open at once in the supervisor:
+ * two fds per pipe (four for a relay), the exec pipe of each starting
+ * node and the notify and standby channels.  The soft limit is raised
+ * as far as needed; if the hard limit is too low, nothing is started.
+ */
+static int nofile_limit_raise(command_info_t const *const icmd,
+                               size_t const command_cnt,
+                               pipe_info_t const *const ipipe,
+                               size_t const pipe_cnt) {
+  // stdio, logging, control and metrics clients, timers
+  rlim_t need = 64;
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    need += ipipe[pidx].relay ? 4 : 2;
+  }
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    need += 1 + (icmd[cidx].notify_fd != -1) + 2 * icmd[cidx].standby;
+  }
+
+  if (getrlimit(RLIMIT_NOFILE, &g_nofile_limit) == -1 ||
+      g_nofile_limit.rlim_cur == RLIM_INFINITY ||
+      g_nofile_limit.rlim_cur >= need) {
+    return 0;
+  }
+
+  char sneed[24];
+  snprintf(sneed, sizeof(sneed), "%lu", (unsigned long)need);
+  if (g_nofile_limit.rlim_max != RLIM_INFINITY &&
+      g_nofile_limit.rlim_max < need) {
+    char slimit[24];
+    snprintf(slimit, sizeof(slimit), "%lu",
+             (unsigned long)g_nofile_limit.rlim_max);
+    logging(lid_internal, "command_line", "error",
+            "The graph needs more open files than the hard limit allows", 2,
+            "open_files", sneed, "hard_limit", slimit);
+    errno = EMFILE;
+    return -1;
+  }
+
+  struct rlimit const raised = {need, g_nofile_limit.rlim_max};
+  if (setrlimit(RLIMIT_NOFILE, &raised) == -1) {
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "status", "error",
+            "Cannot raise the limit of open files", 3,
+            "open_files", sneed, "errno", serrno, "error", strerror(errno));
+    return -1;
+  }
+  g_nofile_raised = 1;
+  logging(lid_internal, "status", "info", "Raised the limit of open files", 1,
+          "open_files", sneed);
+  return 0;
+}
+
+// State of the graph between supervisor_start() and supervisor_finish()
+static bool g_child_failed = false;
+static int g_scale_timer = -1;
+static int g_watchdog_timer = -1;
+
+static void supervisor_event(enum supervisor_event const event,
+                             int const child_idx, pid_t const cpid,
+                             int const status) {
+  if (g_config->event_cb != NULL) {
+    g_config->event_cb(event, child_idx, cpid, status, g_config->event_data);
+  }
+}
+
+static void graph_start() {
+  restart_timers_cancel();
+  set_restart(0);
+  SIZETTOCHAR(schild_count, 20, (size_t)g_child_cnt);
+  logging(lid_internal, "exec", "info", "Start all children", 1,
+          "child_count", schild_count);
+  pipe_execv(g_child_cnt, g_ipipe, g_pipe_cnt);
+  export_graph();
+  logging(lid_internal, "exec", "info", "Wait for termination of children", 0);
+}
+
+// The options of the graph which are not checked by the parser.
+static int graph_check(supervisor_config_t const *config,
+                       command_info_t const *icmd, size_t command_cnt,
+                       pipe_info_t const *ipipe, size_t pipe_cnt) {
+  if (config->watchdog_restart &&
+      (!config->node_restart || config->watchdog_timeout <= 0)) {
+    logging(lid_internal, "command_line", "error",
+            "Option -G needs -R and -g", 0);
+    return -1;
+  }
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    if (notify_fd_check(&icmd[cidx], ipipe, pipe_cnt) == -1) {
+      return -1;
+    }
+    if (icmd[cidx].standby && !config->node_restart) {
+      logging(lid_internal, "command_line", "error",
+              "The standby option needs -R", 1,
+              "command", icmd[cidx].cmd_name);
+      return -1;
+    }
+    if (icmd[cidx].scale_max != 0 &&
+        scale_check(&icmd[cidx], ipipe, pipe_cnt, config) == -1) {
+      return -1;
+    }
+    if (icmd[cidx].cache && cache_check(&icmd[cidx], ipipe, pipe_cnt) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Undoes what was done by a start which failed.  Returns -1 with
+// errno serr.
+static int start_failed(int const serr) {
+  child_pids_kill_all_and_wait();
+  supervisor_finish();
+  errno = serr;
+  return -1;
+}
+
+int supervisor_start(supervisor_config_t const *config,
+                     command_info_t *icmd, size_t command_cnt,
+                     pipe_info_t *ipipe, size_t pipe_cnt) {
+  if (graph_check(config, icmd, command_cnt, ipipe, pipe_cnt) == -1) {
+    errno = EINVAL;
+    return -1;
+  }
+  g_config = config;
+  g_icmd = icmd;
+  g_ipipe = ipipe;
+  g_pipe_cnt = pipe_cnt;
+  g_shutdown = 0;
+  g_stopping = 0;
+  g_drain_requested = 0;
+  g_term_signal = 0;
+  g_restart_signal = 0;
+  g_setup_errno = 0;
+  g_child_failed = false;
+  if (config->sleep_timer == 0) {
+    // When there is no restart: terminate all processes when done
+    set_restart(0);
+    set_terminate();
+  }
+
+  // Provide memory for child_pids and nodes and initialize.
+  pid_t *const child_pids = calloc(command_cnt, sizeof(pid_t));
+  g_nodes = calloc(command_cnt, sizeof(node_info_t));
+  if (child_pids == NULL || g_nodes == NULL) {
+    logging(lid_internal, "status", "error", "Memory allocation failed", 0);
+    free(child_pids);
+    free(g_nodes);
+    g_nodes = NULL;
+    return start_failed(ENOMEM);
+  }
+  g_child_pids = child_pids;
+  g_child_cnt = command_cnt;
+  int scaled = 0;
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    g_nodes[cidx].notify_fd = -1;
+    g_nodes[cidx].standby_fd = -1;
+    g_nodes[cidx].restart_timer = -1;
+    if (icmd[cidx].scale_max != 0) {
+      g_nodes[cidx].replicas =
+          calloc(2 * icmd[cidx].scale_max, sizeof(struct replica));
+      if (g_nodes[cidx].replicas == NULL) {
+        logging(lid_internal, "status", "error", "Memory allocation failed", 0);
+        return start_failed(ENOMEM);
+      }
+      scaled = 1;
+    }
+  }
+
+  // A process of each node, its standby (and a killed one which is
+  // not reaped yet) and up to twice its maximum of replicas (stopping
+  // replicas are replaced).
+  size_t pid_cnt = 0;
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    pid_cnt += 1 + 2 * icmd[cidx].standby + 2 * icmd[cidx].scale_max;
+  }
+  g_pid_map = pid_map_create(pid_cnt);
+  g_topology = topology_create(icmd, command_cnt, ipipe, pipe_cnt);
+  if (g_pid_map == NULL || g_topology == NULL) {
+    logging(lid_internal, "status", "error", "Memory allocation failed", 0);
+    return start_failed(ENOMEM);
+  }
+  event_loop_set_reaper(graph_reap);
+
+  if (nofile_limit_raise(icmd, command_cnt, ipipe, pipe_cnt) == -1 ||
+      install_signal_handler() == -1 ||
+      (config->control_path != NULL &&
+       control_open(config->control_path) == -1) ||
+      (config->metrics_addr != NULL &&
+       metrics_open(config->metrics_addr) == -1)) {
+    return start_failed(errno);
+  }
+  g_scale_timer =
+      scaled ? event_loop_add_timer(config->scale_interval, autoscale_tick, NULL)
+             : -1;
+  if (scaled && g_scale_timer == -1) {
+    logging(lid_internal, "autoscale", "error", "Cannot create timer", 0);
+    return start_failed(errno);
+  }
+  g_watchdog_timer =
+      config->watchdog_timeout > 0
+          ? event_loop_add_timer(1000, watchdog_tick, NULL)
+          : -1;
+  if (config->watchdog_timeout > 0 && g_watchdog_timer == -1) {
+    logging(lid_internal, "watchdog", "error", "Cannot create timer", 0);
+    return start_failed(errno);
+  }
+
+  graph_start();
+  if (g_setup_errno != 0) {
+    return start_failed(g_setup_errno);
+  }
+  return 0;
+}
+
+enum supervisor_step supervisor_step(int const timeout_ms) {
+  signals_handle();
+  if (g_setup_errno != 0 && !g_stopping &&
+      (g_running_cnt > 0 || g_replica_cnt > 0)) {
+    // A restart failed: stop the rest.
+    child_pids_stop_all();
+    return ss_event;
+  }
+  int const children = g_running_cnt + g_replica_cnt + g_standby_cnt;
+  if (children == 0 && g_restart_pending > 0 && !g_shutdown && !g_stopping) {
+    // Only nodes which wait for their restart: nothing to wait for.
+    event_loop_wait(timeout_ms);
+    return g_running_cnt > 0 ? ss_event : ss_idle;
+  }
+  if (children == 0) {
+    g_stopping = 0;
+    if (!g_restart) {
+      return ss_finished;
+    }
+    if (!graph_restart_due(timeout_ms)) {
+      return ss_idle;
+    }
+    graph_start();
+    return ss_event;
+  }
+
+  // Still running children - or standbys and replicas which are not
+  // reaped yet
+  logging(lid_internal, "exec", "info", "Wait for next child to terminate", 0);
+  child_pids_print();
+  int status;
+  struct rusage usage;
+  logging(lid_internal, "exec", "info", "Calling wait", 0);
+
+  pid_t const cpid = event_loop_wait_child(&status, &usage, timeout_ms);
+
+  if (cpid == 0) {
+    // Timeout - or interrupted by a signal
+    if (!signals_handle()) {
+      return g_running_cnt == 0 ? ss_event : ss_idle;
+    }
+  } else if (cpid == -1) {
+    ITOCHAR(swait, 16, cpid);
+    ITOCHAR(serrno, 16, errno);
+    logging(lid_internal, "tracing", "error", "Error waiting", 3,
+            "pid", swait, "error", strerror(errno),
+            "errno", serrno);
+  } else if (g_stopping) {
+    child_stopped(cpid, status, &usage);
+    drain_advance();
+    return ss_event;
+  } else if (auxiliary_reaped(cpid, status)) {
+    return ss_event;
+  } else {
+    ITOCHAR(spid, 16, cpid);
+    int const requested =
+        child_pids_index(cpid) != -1 &&
+        g_nodes[child_pids_index(cpid)].restart_requested;
+    int const child_idx = child_reaped(cpid, status, &usage);
+    int const abnormal = !WIFEXITED(status) || WIFSIGNALED(status);
+
+    if (child_idx != -1 && !g_shutdown &&
+        (requested || (g_config->node_restart && abnormal && !g_terminate))) {
+      if (!requested) {
+        g_child_failed = true;
+      }
+      if (standby_promote(child_idx)) {
+        return ss_event;
+      }
+      if (!requested && g_config->sleep_timer != 0) {
+        ITOCHAR(ssleep_timer, 16, g_config->sleep_timer);
+        logging(lid_internal, "tracing", "info",
+                "Waiting before restart of single child", 2,
+                "pid", spid, "sleep_timer", ssleep_timer);
+        node_restart_later(child_idx);
+      } else {
+        node_restart(child_idx);
+      }
+      return ss_event;
+    }
+
+    if (child_idx != -1) {
+      node_finished(child_idx);
+    }
+
+    if (status != 0) {
+      g_child_failed = true;
+    }
+
+    if (abnormal) {
+      logging(lid_internal, "tracing", "warning",
+              "Unnormal termination/signaling of child - restarting", 1,
+              "pid", spid);
+      set_restart(1);
+      child_pids_stop_all();
+    }
+  }
+
+  logging(lid_internal, "tracing", "debug", "Remaining children", 0);
+  child_pids_print();
+  return cpid == -1 && g_running_cnt > 0 ? ss_idle : ss_event;
+}
+
+void supervisor_stop() {
+  logging(lid_internal, "tracing", "info", "Stopping the graph", 0);
+  g_shutdown = 1;
+  set_terminate();
+  // The fd of the loop gets readable: also when there is nothing left
+  // to reap.
+  event_loop_break();
+  if (g_config->drain_timeout > 0) {
+    drain_begin();
+    return;
+  }
+  set_kill_child_processes();
+  child_pids_stop_all();
+}
+
+int supervisor_finish() {
+  restart_timers_cancel();
+  g_drain.active = 0;
+  drain_timer_stop();
+  standby_kill_all();
+  if (g_scale_timer != -1) {
+    event_loop_remove_timer(g_scale_timer);
+    g_scale_timer = -1;
+  }
+  if (g_watchdog_timer != -1) {
+    event_loop_remove_timer(g_watchdog_timer);
+    g_watchdog_timer = -1;
+  }
+  relay_stop();
+  // Replicas of a sink might still be working on the last data; the
+  // killed standbys are not reaped yet.
+  if (g_replica_cnt > 0 || g_standby_cnt > 0) {
+    child_pids_wait_all();
+  }
+  pipe_info_close_all(g_ipipe, g_pipe_cnt);
+  pipe_info_release(g_ipipe, g_pipe_cnt);
+  if (g_config->control_path != NULL) {
+    control_close();
+  }
+  if (g_config->metrics_addr != NULL) {
+    metrics_close();
+  }
+
+  // Everything is gone: another graph can be started.
+  for (int cidx = 0; cidx < g_child_cnt; ++cidx) {
+    free(g_nodes[cidx].replicas);
+  }
+  free(g_nodes);
+  g_nodes = NULL;
+  free((pid_t *)g_child_pids);
+  g_child_pids = NULL;
+  g_child_cnt = 0;
+  pid_map_destroy(g_pid_map);
+  g_pid_map = NULL;
+  topology_destroy(g_topology);
+  g_topology = NULL;
+  g_running_cnt = 0;
+  g_replica_cnt = 0;
+  g_standby_cnt = 0;
+  g_restart = 0;
+  g_terminate = 0;
+  g_kill_child_processes = 0;
+  if (g_nofile_raised) {
+    setrlimit(RLIMIT_NOFILE, &g_nofile_limit);
+    g_nofile_raised = 0;
+  }
+  restore_signal_handler();
+  event_loop_release();
+  return g_child_failed || g_setup_errno != 0 ? 1 : 0;
+}
+
+int supervisor_run(supervisor_config_t const *config,
+                   command_info_t *icmd, size_t command_cnt,
+                   pipe_info_t *ipipe, size_t pipe_cnt) {
+  if (supervisor_start(config, icmd, command_cnt, ipipe, pipe_cnt) == -1) {
+    return -1;
+  }
+  while (supervisor_step(-1) != ss_finished) {
+  }
+  return supervisor_finish();
+}
@@ -0,0 +1,190 @@
+#ifndef PIPEXEC_SUPERVISOR_H
+#define PIPEXEC_SUPERVISOR_H
+
+/*
+ * Supervisor
+ *
+ * Starts all the processes of the graph, waits for their termination
+ * and restarts them if needed.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "src/command_info.h"
+#include "src/pipe_info.h"
+#include "src/autoscale.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Run time state of one node (process) of the graph.
+ */
+enum node_state {
+  ns_stopped = 0,
+  ns_running = 1,
+  ns_paused = 2,
+  ns_exited = 3
+};
+
+char const *node_state_name(enum node_state const state);
+
+struct node_info {
+  enum node_state state;
+  pid_t pid;
+  unsigned int restart_cnt;
+  time_t start_time;
+  // Status of the last termination as returned by wait(2)
+  int last_status;
+  // Restart was requested: start again after termination.
+  int restart_requested;
+  // Timer until the restart after a failure (-1: none)
+  int restart_timer;
+  // Statistics of all former runs
+  unsigned int exit_cnt;
+  unsigned int failure_cnt;
+  uint64_t cpu_usec;
+  // Readiness of the current run: the process wrote to its notify fd
+  // (read end here; -1 if none) or the exec succeeded.
+  int notify_fd;
+  int ready;
+  struct timespec fork_time;
+  // Micro seconds from fork until exec / ready; -1: unknown
+  long exec_usec;
+  long ready_usec;
+  // Hot standby: pid (0: none), channel to it and if it can be promoted
+  pid_t standby_pid;
+  int standby_fd;
+  int standby_ready;
+  // Autoscaling: the additional processes of the node.  A replica
+  // which got SIGTERM is kept until it is reaped.
+  struct replica {
+    pid_t pid;
+    int stopping;
+  } *replicas;
+  unsigned int replica_cnt;
+  autoscale_t scale;
+  // Watchdog: last seen progress (CPU time and relayed bytes) of the
+  // process with pid watch_pid and since when it did not change.
+  pid_t watch_pid;
+  double watch_progress;
+  time_t watch_since;
+  int stalled;
+  unsigned int stall_cnt;
+};
+
+typedef struct node_info node_info_t;
+
+// Events for an embedding program
+enum supervisor_event { se_started, se_exited };
+
+// status: as returned by wait(2) for se_exited
+typedef void (*supervisor_event_cb_t)(enum supervisor_event event,
+                                      size_t node, pid_t pid, int status,
+                                      void *data);
+
+/*
+ * Configuration of the supervisor; filled in by the command line or
+ * the library interface.
+ */
+struct supervisor_config {
+  // Seconds to wait before a restart; 0: no restart at all.
+  int sleep_timer;
+  // Restart single nodes instead of the whole graph.  The supervisor
+  // keeps all pipes open to be able to do this.
+  int node_restart;
+  // Path of the control socket - or NULL.
+  char const *control_path;
+  // Address of the metrics exporter - or NULL.
+  char const *metrics_addr;
+  // Seconds each stage gets during a drain; 0: no drain, terminate
+  // all processes at once.
+  int drain_timeout;
+  // Seconds to wait for a process to get ready during start up before
+  // its producers are started anyway; 0: do not wait.
+  int ready_timeout;
+  // Milli seconds between two looks at the fill levels for autoscaling
+  int scale_interval;
+  // Seconds without progress (while there is input) after which a
+  // node is seen as stalled; 0: no watchdog.
+  int watchdog_timeout;
+  // Restart stalled nodes (needs node_restart).
+  int watchdog_restart;
+  // File the graph is exported to after each start - or NULL.
+  char const *graph_path;
+  // Handle SIGHUP (restart), SIGINT, SIGQUIT and SIGTERM (stop).
+  int signal_handlers;
+  // Directory of the cache for nodes with the option 'cache' - or
+  // NULL - and its size in MiB.
+  char const *cache_dir;
+  int cache_size;
+  // Called for each start and exit of a node - or NULL.
+  supervisor_event_cb_t event_cb;
+  void *event_data;
+};
+
+typedef struct supervisor_config supervisor_config_t;
+
+void set_restart(int rs);
+void set_terminate();
+void set_kill_child_processes();
+
+// Runs the graph until all processes are finished.
+// Returns 1 if any child failed, else 0 - and -1 if supervisor_start()
+// failed.
+int supervisor_run(supervisor_config_t const *config,
+                   command_info_t *icmd, size_t command_cnt,
+                   pipe_info_t *ipipe, size_t pipe_cnt);
+
+// supervisor_run() in steps: for a program with its own event loop.
+// There is only one graph at a time: the supervisor state is global
+// (the signal handlers need it).
+// Returns -1 with errno set if the graph cannot be started: EINVAL if
+// its options do not fit together.  The error is logged and all which
+// was started is stopped again.
+int supervisor_start(supervisor_config_t const *config,
+                     command_info_t *icmd, size_t command_cnt,
+                     pipe_info_t *ipipe, size_t pipe_cnt);
+
+enum supervisor_step {
+  // Nothing happened within the timeout.
+  ss_idle,
+  // A child exited or the graph was (re)started: call again.
+  ss_event,
+  // All processes are finished: call supervisor_finish().
+  ss_finished
+};
+
+// Waits up to timeout_ms (-1: no limit) for the next event.  When
+// the fd of event_loop_fd() is readable there is something to do.
+enum supervisor_step supervisor_step(int timeout_ms);
+// Terminates all processes (with a drain if configured) without
+// waiting for them: supervisor_step() reaps them and returns
+// ss_finished when all are gone.
+void supervisor_stop();
+// Releases everything; returns 1 if any child failed, else 0.
+int supervisor_finish();
+// The run time state of the nodes of the running graph - or NULL.
+node_info_t const *supervisor_nodes();
+
+// Interface for the control socket.
+// The functions which change something return NULL on success or an
+// error message.
+void supervisor_print_nodes(FILE *out);
+void supervisor_print_pipes(FILE *out);
+void supervisor_print_metrics(FILE *out);
+// format: 'dot' or 'json'
+char const *supervisor_print_graph(FILE *out, char const *format);
+char const *supervisor_node_signal(char const *name, int signum);
+char const *supervisor_node_pause(char const *name, int pause);
+char const *supervisor_node_restart(char const *name);
+// Attaches a tap (see relay.h) to the pipe with the index (as a
+// string); on success fd belongs to the relay.  With fd -1 it is only
+// checked whether a tap can be attached.
+char const *supervisor_pipe_tap(char const *index, int fd, unsigned int every,
+                                uint64_t rate);
+
+#endif
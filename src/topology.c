@@ -0,0 +1,171 @@
+/*
+ * Topology of the graph
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "src/topology.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+long topology_command_index(command_info_t const *icmd, size_t command_cnt,
+                            char const *name) {
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    if (strcmp(icmd[cidx].cmd_name, name) == 0) {
+      return (long)cidx;
+    }
+  }
+  return -1;
+}
+
+void topology_destroy(topology_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  free(self->order);
+  free(self->in_cnt);
+  free(self->out_cnt);
+  free(self->pred_first);
+  free(self->pred);
+  free(self->in_pipe_first);
+  free(self->in_pipe);
+  free(self->out_pipe_first);
+  free(self->out_pipe);
+  free(self);
+}
+
+// Kahn's algorithm on an adjacency list in compressed form:
+// the consumers of command c are succ[first[c] .. first[c + 1]).
+// edge_from / edge_to are the commands at the ends of a pipe (-1: no
+// command); only pipes between two commands are edges of the order.
+topology_t *topology_create(command_info_t const *icmd, size_t command_cnt,
+                            pipe_info_t const *ipipe, size_t pipe_cnt) {
+  topology_t *const self = calloc(1, sizeof(topology_t));
+  long *const edge_from = malloc((pipe_cnt + 1) * sizeof(long));
+  long *const edge_to = malloc((pipe_cnt + 1) * sizeof(long));
+  size_t *const first = calloc(command_cnt + 1, sizeof(size_t));
+  size_t *const succ = malloc((pipe_cnt + 1) * sizeof(size_t));
+  size_t *const pending = calloc(command_cnt + 1, sizeof(size_t));
+  size_t *const fill = malloc((command_cnt + 1) * sizeof(size_t));
+  char *const placed = calloc(command_cnt + 1, 1);
+  if (self != NULL) {
+    self->node_cnt = command_cnt;
+    self->order = malloc((command_cnt + 1) * sizeof(size_t));
+    self->in_cnt = calloc(command_cnt + 1, sizeof(size_t));
+    self->out_cnt = calloc(command_cnt + 1, sizeof(size_t));
+    self->pred_first = calloc(command_cnt + 1, sizeof(size_t));
+    self->pred = malloc((pipe_cnt + 1) * sizeof(size_t));
+    self->in_pipe_first = calloc(command_cnt + 1, sizeof(size_t));
+    self->in_pipe = malloc((pipe_cnt + 1) * sizeof(size_t));
+    self->out_pipe_first = calloc(command_cnt + 1, sizeof(size_t));
+    self->out_pipe = malloc((pipe_cnt + 1) * sizeof(size_t));
+  }
+  if (self == NULL || self->order == NULL || self->in_cnt == NULL ||
+      self->out_cnt == NULL || self->pred_first == NULL ||
+      self->pred == NULL || self->in_pipe_first == NULL ||
+      self->in_pipe == NULL || self->out_pipe_first == NULL ||
+      self->out_pipe == NULL ||
+      edge_from == NULL || edge_to == NULL || first == NULL ||
+      succ == NULL || pending == NULL || fill == NULL || placed == NULL) {
+    topology_destroy(self);
+    free(edge_from);
+    free(edge_to);
+    free(first);
+    free(succ);
+    free(pending);
+    free(fill);
+    free(placed);
+    return NULL;
+  }
+
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    edge_from[pidx] =
+        ipipe[pidx].from.type == pet_command
+            ? topology_command_index(icmd, command_cnt, ipipe[pidx].from.name)
+            : -1;
+    edge_to[pidx] =
+        ipipe[pidx].to.type == pet_command
+            ? topology_command_index(icmd, command_cnt, ipipe[pidx].to.name)
+            : -1;
+    if (edge_from[pidx] != -1) {
+      ++self->out_pipe_first[edge_from[pidx] + 1];
+    }
+    if (edge_to[pidx] != -1) {
+      ++self->in_pipe_first[edge_to[pidx] + 1];
+    }
+    if (edge_from[pidx] == -1 || edge_to[pidx] == -1) {
+      continue;
+    }
+    ++first[edge_from[pidx] + 1];
+    ++self->pred_first[edge_to[pidx] + 1];
+    ++self->in_cnt[edge_to[pidx]];
+    ++self->out_cnt[edge_from[pidx]];
+  }
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    first[cidx + 1] += first[cidx];
+    self->pred_first[cidx + 1] += self->pred_first[cidx];
+    self->in_pipe_first[cidx + 1] += self->in_pipe_first[cidx];
+    self->out_pipe_first[cidx + 1] += self->out_pipe_first[cidx];
+    pending[cidx] = self->in_cnt[cidx];
+  }
+  memcpy(fill, first, command_cnt * sizeof(size_t));
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    if (edge_from[pidx] != -1 && edge_to[pidx] != -1) {
+      succ[fill[edge_from[pidx]]++] = edge_to[pidx];
+    }
+  }
+  memcpy(fill, self->pred_first, command_cnt * sizeof(size_t));
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    if (edge_from[pidx] != -1 && edge_to[pidx] != -1) {
+      self->pred[fill[edge_to[pidx]]++] = edge_from[pidx];
+    }
+  }
+  memcpy(fill, self->in_pipe_first, command_cnt * sizeof(size_t));
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    if (edge_to[pidx] != -1) {
+      self->in_pipe[fill[edge_to[pidx]]++] = pidx;
+    }
+  }
+  memcpy(fill, self->out_pipe_first, command_cnt * sizeof(size_t));
+  for (size_t pidx = 0; pidx < pipe_cnt; ++pidx) {
+    if (edge_from[pidx] != -1) {
+      self->out_pipe[fill[edge_from[pidx]]++] = pidx;
+    }
+  }
+
+  // The order array is also the queue.
+  size_t tail = 0;
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    if (pending[cidx] == 0) {
+      self->order[tail++] = cidx;
+      placed[cidx] = 1;
+    }
+  }
+  for (size_t head = 0; head < tail; ++head) {
+    size_t const cidx = self->order[head];
+    for (size_t sidx = first[cidx]; sidx < first[cidx + 1]; ++sidx) {
+      if (--pending[succ[sidx]] == 0) {
+        self->order[tail++] = succ[sidx];
+        placed[succ[sidx]] = 1;
+      }
+    }
+  }
+  self->sorted_cnt = tail;
+
+  // Cycles: in command line order
+  for (size_t cidx = 0; cidx < command_cnt; ++cidx) {
+    if (!placed[cidx]) {
+      self->order[tail++] = cidx;
+    }
+  }
+
+  free(edge_from);
+  free(edge_to);
+  free(first);
+  free(succ);
+  free(pending);
+  free(fill);
+  free(placed);
+  return self;
+}
@@ -0,0 +1,57 @@
+#ifndef PIPEXEC_TOPOLOGY_H
+#define PIPEXEC_TOPOLOGY_H
+
+/*
+ * Topology of the graph
+ *
+ * Orders the processes along the pipes between them: a process comes
+ * after all the processes which write into it.  Pipes from or to
+ * files and the parent do not count.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "src/command_info.h"
+#include "src/pipe_info.h"
+
+#include <stddef.h>
+
+struct topology {
+  size_t node_cnt;
+  // Indices of the commands: sources first, then their consumers.
+  size_t *order;
+  // order[0 .. sorted_cnt) is a topological order.  The remaining
+  // commands are part of a cycle (or behind one) and are appended
+  // in command line order.
+  size_t sorted_cnt;
+  // Number of pipes from other commands into the command.
+  size_t *in_cnt;
+  // Number of pipes from the command to other commands.
+  size_t *out_cnt;
+  // The commands which write into command c are
+  // pred[pred_first[c] .. pred_first[c + 1]).
+  size_t *pred_first;
+  size_t *pred;
+  // The pipes into command c are in_pipe[in_pipe_first[c] ..
+  // in_pipe_first[c + 1]), the pipes out of it are the same in
+  // out_pipe: these include the pipes from and to files, FIFOs and
+  // the parent.
+  size_t *in_pipe_first;
+  size_t *in_pipe;
+  size_t *out_pipe_first;
+  size_t *out_pipe;
+};
+
+typedef struct topology topology_t;
+
+// Returns the index of the command with the given name or -1.
+long topology_command_index(command_info_t const *icmd, size_t command_cnt,
+                            char const *name);
+
+// Returns NULL if memory allocation fails.
+topology_t *topology_create(command_info_t const *icmd, size_t command_cnt,
+                            pipe_info_t const *ipipe, size_t pipe_cnt);
+void topology_destroy(topology_t *self);
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ * Minimal io_uring wrapper
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _DEFAULT_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "src/uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct uring {
+  int fd;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_entries;
+  unsigned sq_local_tail;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ptr;
+  size_t sq_len;
+  void *cq_ptr;
+  size_t cq_len;
+  size_t sqes_len;
+};
+
+uring_t *uring_create(unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int const fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  uring_t *const self = calloc(1, sizeof(uring_t));
+  if (self == NULL) {
+    close(fd);
+    return NULL;
+  }
+  self->fd = fd;
+
+  self->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  self->cq_len =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  int const single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && self->cq_len > self->sq_len) {
+    self->sq_len = self->cq_len;
+  }
+
+  self->sq_ptr = mmap(NULL, self->sq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (self->sq_ptr == MAP_FAILED) {
+    goto error_close;
+  }
+  if (single_mmap) {
+    self->cq_ptr = self->sq_ptr;
+  } else {
+    self->cq_ptr = mmap(NULL, self->cq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (self->cq_ptr == MAP_FAILED) {
+      goto error_unmap_sq;
+    }
+  }
+  self->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  self->sqes = mmap(NULL, self->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (self->sqes == MAP_FAILED) {
+    goto error_unmap_cq;
+  }
+
+  char *const sq = self->sq_ptr;
+  self->sq_head = (unsigned *)(sq + params.sq_off.head);
+  self->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  self->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  self->sq_array = (unsigned *)(sq + params.sq_off.array);
+  self->sq_entries = params.sq_entries;
+  self->sq_local_tail = *self->sq_tail;
+
+  char *const cq = self->cq_ptr;
+  self->cq_head = (unsigned *)(cq + params.cq_off.head);
+  self->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  self->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  self->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  return self;
+
+error_unmap_cq:
+  if (self->cq_ptr != self->sq_ptr) {
+    munmap(self->cq_ptr, self->cq_len);
+  }
+error_unmap_sq:
+  munmap(self->sq_ptr, self->sq_len);
+error_close:
+  close(fd);
+  free(self);
+  return NULL;
+}
+
+void uring_destroy(uring_t *self) {
+  if (self == NULL) {
+    return;
+  }
+  munmap(self->sqes, self->sqes_len);
+  if (self->cq_ptr != self->sq_ptr) {
+    munmap(self->cq_ptr, self->cq_len);
+  }
+  munmap(self->sq_ptr, self->sq_len);
+  close(self->fd);
+  free(self);
+}
+
+int uring_register_buffers(uring_t *self, struct iovec const *iov,
+                           unsigned cnt) {
+  return syscall(__NR_io_uring_register, self->fd, IORING_REGISTER_BUFFERS,
+                 iov, cnt);
+}
+
+int uring_register_files(uring_t *self, int const *fds, unsigned cnt) {
+  return syscall(__NR_io_uring_register, self->fd, IORING_REGISTER_FILES,
+                 fds, cnt);
+}
+
+static struct io_uring_sqe *uring_get_sqe(uring_t *self) {
+  unsigned const head = __atomic_load_n(self->sq_head, __ATOMIC_ACQUIRE);
+  if (self->sq_local_tail - head >= self->sq_entries) {
+    return NULL;
+  }
+  unsigned const idx = self->sq_local_tail & *self->sq_mask;
+  struct io_uring_sqe *const sqe = &self->sqes[idx];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  self->sq_array[idx] = idx;
+  ++self->sq_local_tail;
+  return sqe;
+}
+
+static int uring_prep_rw(uring_t *self, int op, unsigned file_idx,
+                         void const *addr, unsigned len, unsigned buf_idx,
+                         uint64_t user_data) {
+  struct io_uring_sqe *const sqe = uring_get_sqe(self);
+  if (sqe == NULL) {
+    return -1;
+  }
+  sqe->opcode = op;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = file_idx;
+  // -1: use (and update) the current file position
+  sqe->off = (uint64_t)-1;
+  sqe->addr = (uint64_t)(uintptr_t)addr;
+  sqe->len = len;
+  sqe->buf_index = buf_idx;
+  sqe->user_data = user_data;
+  return 0;
+}
+
+int uring_prep_read_fixed(uring_t *self, unsigned file_idx, void *buf,
+                          unsigned len, unsigned buf_idx, uint64_t user_data) {
+  return uring_prep_rw(self, IORING_OP_READ_FIXED, file_idx, buf, len,
+                       buf_idx, user_data);
+}
+
+int uring_prep_write_fixed(uring_t *self, unsigned file_idx, void const *buf,
+                           unsigned len, unsigned buf_idx, uint64_t user_data) {
+  return uring_prep_rw(self, IORING_OP_WRITE_FIXED, file_idx, buf, len,
+                       buf_idx, user_data);
+}
+
+int uring_prep_writev(uring_t *self, unsigned file_idx,
+                      struct iovec const *iov, unsigned cnt,
+                      uint64_t user_data) {
+  return uring_prep_rw(self, IORING_OP_WRITEV, file_idx, iov, cnt, 0,
+                       user_data);
+}
+
+int uring_submit_and_wait(uring_t *self, unsigned wait_nr) {
+  unsigned const to_submit =
+      self->sq_local_tail - __atomic_load_n(self->sq_tail, __ATOMIC_RELAXED);
+  __atomic_store_n(self->sq_tail, self->sq_local_tail, __ATOMIC_RELEASE);
+
+  unsigned const flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while (1) {
+    int const ret = syscall(__NR_io_uring_enter, self->fd, to_submit,
+                            wait_nr, flags, NULL, 0);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    return ret;
+  }
+}
+
+int uring_next_cqe(uring_t *self, uint64_t *user_data, int *res) {
+  unsigned const head = *self->cq_head;
+  if (head == __atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+  struct io_uring_cqe const *const cqe = &self->cqes[head & *self->cq_mask];
+  *user_data = cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(self->cq_head, head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+#else
+
+// io_uring is not available on this system: always fall back.
+
+uring_t *uring_create(unsigned entries) {
+  (void)entries;
+  errno = ENOSYS;
+  return NULL;
+}
+
+void uring_destroy(uring_t *self) { (void)self; }
+
+int uring_register_buffers(uring_t *self, struct iovec const *iov,
+                           unsigned cnt) {
+  (void)self;
+  (void)iov;
+  (void)cnt;
+  errno = ENOSYS;
+  return -1;
+}
+
+int uring_register_files(uring_t *self, int const *fds, unsigned cnt) {
+  (void)self;
+  (void)fds;
+  (void)cnt;
+  errno = ENOSYS;
+  return -1;
+}
+
+int uring_prep_read_fixed(uring_t *self, unsigned file_idx, void *buf,
+                          unsigned len, unsigned buf_idx, uint64_t user_data) {
+  (void)self;
+  (void)file_idx;
+  (void)buf;
+  (void)len;
+  (void)buf_idx;
+  (void)user_data;
+  return -1;
+}
+
+int uring_prep_write_fixed(uring_t *self, unsigned file_idx, void const *buf,
+                           unsigned len, unsigned buf_idx, uint64_t user_data) {
+  (void)self;
+  (void)file_idx;
+  (void)buf;
+  (void)len;
+  (void)buf_idx;
+  (void)user_data;
+  return -1;
+}
+
+int uring_prep_writev(uring_t *self, unsigned file_idx,
+                      struct iovec const *iov, unsigned cnt,
+                      uint64_t user_data) {
+  (void)self;
+  (void)file_idx;
+  (void)iov;
+  (void)cnt;
+  (void)user_data;
+  return -1;
+}
+
+int uring_submit_and_wait(uring_t *self, unsigned wait_nr) {
+  (void)self;
+  (void)wait_nr;
+  errno = ENOSYS;
+  return -1;
+}
+
+int uring_next_cqe(uring_t *self, uint64_t *user_data, int *res) {
+  (void)self;
+  (void)user_data;
+  (void)res;
+  return 0;
+}
+
+#endif
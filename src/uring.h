@@ -0,0 +1,49 @@
+#ifndef PIPEXEC_URING_H
+#define PIPEXEC_URING_H
+
+/*
+ * Minimal io_uring wrapper
+ *
+ * Only the small subset which is needed by ptee and peet: fixed files,
+ * registered buffers, read / write and writev.  The system calls are
+ * used directly - there is no dependency to liburing.
+ * When io_uring is not available (not compiled in, old kernel or
+ * disabled by the administrator) uring_create() returns NULL and the
+ * callers fall back to their read / write loop.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+typedef struct uring uring_t;
+
+uring_t *uring_create(unsigned entries);
+void uring_destroy(uring_t *self);
+
+int uring_register_buffers(uring_t *self, struct iovec const *iov,
+                           unsigned cnt);
+int uring_register_files(uring_t *self, int const *fds, unsigned cnt);
+
+// The prep functions return -1 if the submission queue is full.
+// file_idx is the index into the registered files; buf_idx the index
+// into the registered buffers.
+int uring_prep_read_fixed(uring_t *self, unsigned file_idx, void *buf,
+                          unsigned len, unsigned buf_idx, uint64_t user_data);
+int uring_prep_write_fixed(uring_t *self, unsigned file_idx, void const *buf,
+                           unsigned len, unsigned buf_idx, uint64_t user_data);
+int uring_prep_writev(uring_t *self, unsigned file_idx,
+                      struct iovec const *iov, unsigned cnt,
+                      uint64_t user_data);
+
+// Submits all prepared entries and waits for at least wait_nr
+// completions - all with one system call.
+int uring_submit_and_wait(uring_t *self, unsigned wait_nr);
+
+// Returns 1 and fills in user_data and res when there was a completion,
+// else 0.  res is the result of the operation or -errno.
+int uring_next_cqe(uring_t *self, uint64_t *user_data, int *res);
+
+#endif
@@ -45,3 +45,505 @@ RES=$(./bin/pipexec -- [ ECHO /bin/echo Hello World ] [ CAT /bin/cat ] [ GREP $G
 if test "${RES}" != "Hello World"; then
     fail
 fi
+
+echo "TEST: stream socketpair"
+RES=$(./bin/pipexec -- [ ECHO /bin/echo Hello World ] [ CAT /bin/cat ] '{ECHO:1>CAT:0,stream,sndbuf=65536}')
+if test "${RES}" != "Hello World"; then
+    fail
+fi
+
+echo "TEST: seqpacket socketpair"
+RES=$(./bin/pipexec -- [ ECHO /bin/echo Hello World ] [ CAT /bin/cat ] '{ECHO:1>CAT:0,seqpacket}')
+if test "${RES}" != "Hello World"; then
+    fail
+fi
+
+echo "TEST: unknown pipe option"
+if ./bin/pipexec -- [ ECHO /bin/echo Hello World ] [ CAT /bin/cat ] '{ECHO:1>CAT:0,nonsense}' 2>/dev/null; then
+    fail
+fi
+
+echo "TEST: shm ring pipe with adapters"
+RES=$(./bin/pipexec -- [ ECHO /bin/echo Hello World ] [ TORING ./bin/pshm -o 5 ] [ FROMRING ./bin/pshm -i 6 ] '{ECHO:1>TORING:0}' '{TORING:5>FROMRING:6,shm,size=65536}')
+if test "${RES}" != "Hello World"; then
+    fail
+fi
+
+echo "TEST: shm ring larger than the maximum"
+if ./bin/pipexec -- [ TORING ./bin/pshm -o 5 ] [ FROMRING ./bin/pshm -i 6 ] '{TORING:5>FROMRING:6,shm,size=2147483648}' </dev/null 2>/dev/null; then
+    fail
+fi
+
+echo "TEST: shm ring pipe with large data"
+RES=$(./bin/pipexec -- [ SEQ /usr/bin/seq 1 200000 ] [ TORING ./bin/pshm -o 5 ] [ FROMRING ./bin/pshm -i 6 ] [ WC /usr/bin/wc -l ] '{SEQ:1>TORING:0}' '{TORING:5>FROMRING:6,shm,size=4096}' '{FROMRING:1>WC:0}')
+if test "${RES}" != "200000"; then
+    fail
+fi
+
+echo "TEST: ptee and peet with io_uring"
+RES=$(./bin/pipexec -- [ SEQ /usr/bin/seq 1 100000 ] [ PTEE ./bin/ptee -u 5 6 ] [ PEET ./bin/peet -u 7 8 ] [ WC /usr/bin/wc -l ] '{SEQ:1>PTEE:0}' '{PTEE:5>PEET:7}' '{PTEE:6>PEET:8}' '{PEET:1>WC:0}')
+if test "${RES}" != "200000"; then
+    fail
+fi
+
+echo "TEST: ptee with writer threads"
+RES=$(./bin/pipexec -- [ SEQ /usr/bin/seq 1 100000 ] [ PTEE ./bin/ptee -t 5 6 7 ] [ PEET ./bin/peet 8 9 10 ] [ WC /usr/bin/wc -l ] '{SEQ:1>PTEE:0}' '{PTEE:5>PEET:8}' '{PTEE:6>PEET:9}' '{PTEE:7>PEET:10}' '{PEET:1>WC:0}')
+if test "${RES}" != "300000"; then
+    fail
+fi
+
+echo "TEST: ptee and peet with splice and huge pages"
+RES=$(./bin/pipexec -- [ SEQ /usr/bin/seq 1 100000 ] [ PTEE ./bin/ptee -H 5 ] [ PEET ./bin/peet -H -m 8192 7 ] [ WC /usr/bin/wc -l ] '{SEQ:1>PTEE:0}' '{PTEE:5>PEET:7}' '{PEET:1>WC:0}')
+if test "${RES}" != "100000"; then
+    fail
+fi
+
+echo "TEST: peet merge policies"
+for POLICY in rr wfq prio; do
+    RES=$(./bin/pipexec -- [ SEQ1 /usr/bin/seq 1 100000 ] [ SEQ2 /usr/bin/seq 1 50000 ] [ PEET ./bin/peet -s -p ${POLICY} -q 4096 7:3 8 ] [ WC /usr/bin/wc -l ] '{SEQ1:1>PEET:7}' '{SEQ2:1>PEET:8}' '{PEET:1>WC:0}' 2>/dev/null)
+    if test "${RES}" != "150000"; then
+        fail
+    fi
+done
+RES=$(./bin/pipexec -- [ SEQ /usr/bin/seq 1 1000 ] [ PEET ./bin/peet -s -p wfq 7:2 ] [ CAT /bin/cat ] '{SEQ:1>PEET:7}' '{PEET:1>CAT:0}' 2>&1 >/dev/null)
+echo "${RES}" | grep -q "^STAT fd \[7\] weight \[2\] bytes \[3893\]" || fail
+# Two flooded inputs, H with weight 3.  prio: (nearly) all of H comes
+# before the rest of L.  wfq: after the start H gets about 3/4.
+for POLICY in prio wfq; do
+    RES=$(./bin/pipexec -- [ L /bin/sh -c 'yes L | head -n 2000000' ] \
+        [ H /bin/sh -c 'yes H | head -n 2000000' ] \
+        [ PEET ./bin/peet -p ${POLICY} -q 4096 7 8:3 ] \
+        '{L:1>PEET:7}' '{H:1>PEET:8}' </dev/null \
+        | awk '$1 == "H" { last_h = NR }
+               NR > 400000 && NR <= 800000 { w[$1]++ }
+               END { print last_h - 2000000, w["H"] + 0, w["L"] + 0 }')
+    read L_EARLY H_WIN L_WIN <<< "${RES}"
+    if test "${POLICY}" = "prio"; then
+        test "${L_EARLY}" -lt 200000 || fail
+    else
+        test "${H_WIN}" -ge $((2 * L_WIN)) -a "${H_WIN}" -le $((5 * L_WIN)) || fail
+    fi
+done
+
+echo "TEST: ppart partitions by key"
+TMPDIR_PE=$(mktemp -d)
+/usr/bin/seq 1 10000 | awk '{print $1 % 13 "," $1}' >${TMPDIR_PE}/in.txt
+./bin/pipexec -- [ PART ./bin/ppart -d , -f 1 5 6 7 ] "{FILE:${TMPDIR_PE}/in.txt>PART:0}" "{PART:5>FILE:${TMPDIR_PE}/p0}" "{PART:6>FILE:${TMPDIR_PE}/p1}" "{PART:7>FILE:${TMPDIR_PE}/p2}"
+RES=$(cat ${TMPDIR_PE}/p0 ${TMPDIR_PE}/p1 ${TMPDIR_PE}/p2 | wc -l)
+KEYS=$(for P in p0 p1 p2; do cut -d , -f 1 ${TMPDIR_PE}/${P} | sort -u; done | sort | uniq -d | wc -l)
+rm -rf ${TMPDIR_PE}
+if test "${RES}" != "10000" -o "${KEYS}" != "0"; then
+    fail
+fi
+
+echo "TEST: file ends"
+TMPDIR_PE=$(mktemp -d)
+printf "Hello World\n" >${TMPDIR_PE}/in.txt
+./bin/pipexec -- [ CAT /bin/cat ] "{FILE:${TMPDIR_PE}/in.txt>CAT:0}" "{CAT:1>FILE:${TMPDIR_PE}/out.txt}"
+./bin/pipexec -- [ CAT /bin/cat ] "{FILE:${TMPDIR_PE}/in.txt>CAT:0}" "{CAT:1>FILE:${TMPDIR_PE}/out.txt,append,prealloc=4096}"
+RES=$(cat ${TMPDIR_PE}/out.txt)
+rm -rf ${TMPDIR_PE}
+if test "${RES}" != "Hello World
+Hello World"; then
+    fail
+fi
+
+echo "TEST: fds of parent"
+RES=$(echo "Hello World" | ./bin/pipexec -- [ CAT /bin/cat ] [ GREP $GREPPATH/grep Hello ] '{PARENT:0=CAT:0}' '{CAT:1>GREP:0}' '{GREP:1=PARENT:1}')
+if test "${RES}" != "Hello World"; then
+    fail
+fi
+RES=$(./bin/pipexec -- [ CAT /bin/cat ] [ GREP $GREPPATH/grep Hello ] '{PARENT:5=CAT:5}' '{CAT:1>GREP:0}' 5< <(echo "Hello World") </dev/null 2>/dev/null || true)
+if test "${RES}" != ""; then
+    fail
+fi
+RES=$(./bin/pipexec -- [ CAT /bin/cat ] [ GREP $GREPPATH/grep Hello ] '{PARENT:5=CAT:0}' '{CAT:1>GREP:0}' 5< <(echo "Hello World"))
+if test "${RES}" != "Hello World"; then
+    fail
+fi
+
+echo "TEST: control socket"
+if which python3 >/dev/null 2>&1; then
+    CTLDIR=$(mktemp -d)
+    ${PE} -R -s 1 -c ${CTLDIR}/ctl -- [ A /bin/sleep 2 ] [ B /bin/cat ] '{A:1>B:0}' &
+    PEPID=$!
+    for i in $(seq 1 50); do test -S ${CTLDIR}/ctl && break; sleep 0.1; done
+    RES=$(python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(b"pause B\nlist\nresume B\nrestart A\nbogus\n")
+buf = b""
+while buf.count(b"ok\n") + buf.count(b"error:") < 5:
+    buf += s.recv(4096)
+sys.stdout.write(buf.decode())
+' ${CTLDIR}/ctl)
+    wait ${PEPID}
+    rm -rf ${CTLDIR}
+    echo "${RES}" | grep -q "name=B .*state=paused" || fail
+    test "$(echo "${RES}" | grep -c '^ok$')" = "4" || fail
+    echo "${RES}" | grep -q "^error: unknown command" || fail
+else
+    echo "python3 not available - skipped"
+fi
+
+echo "TEST: metrics exporter"
+if which python3 >/dev/null 2>&1; then
+    METDIR=$(mktemp -d)
+    ${PE} -m ${METDIR}/metrics -- [ A /bin/sh -c 'seq 1 100000; sleep 1' ] [ B /bin/sleep 1 ] '{A:1>B:0}' &
+    PEPID=$!
+    for i in $(seq 1 50); do test -S ${METDIR}/metrics && break; sleep 0.1; done
+    sleep 0.2
+    RES=$(python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+buf = b""
+while True:
+    d = s.recv(65536)
+    if not d:
+        break
+    buf += d
+sys.stdout.write(buf.decode())
+' ${METDIR}/metrics)
+    wait ${PEPID}
+    rm -rf ${METDIR}
+    echo "${RES}" | grep -q "^HTTP/1.0 200 OK" || fail
+    echo "${RES}" | grep -q '^pipexec_node_up{node="A"} 1' || fail
+    echo "${RES}" | grep -q '^pipexec_edge_fill_bytes{edge="0",from="A:1",to="B:0"} [1-9]' || fail
+    echo "${RES}" | grep -q "^# EOF" || fail
+else
+    echo "python3 not available - skipped"
+fi
+
+echo "TEST: drain on termination"
+DRDIR=$(mktemp -d)
+${PE} -k -d 5 -- [ A /usr/bin/yes ] [ B /bin/sh -c "sleep 1; wc -l >${DRDIR}/out" ] '{A:1>B:0}' </dev/null &
+PEPID=$!
+sleep 0.5
+kill -TERM ${PEPID}
+wait ${PEPID}
+RES=$(cat ${DRDIR}/out)
+rm -rf ${DRDIR}
+if test -z "${RES}" || test "${RES}" -eq 0; then
+    fail
+fi
+
+echo "TEST: start up order with notify fd"
+RES=$(${PE} -l 2 -- [ A /bin/echo hello ] \
+    [ B,notify=4 /bin/sh -c 'sleep 0.5; echo READY=1 >&4; cat' ] \
+    '{A:1>B:0}' 2>&1 </dev/null)
+echo "${RES}" | grep -q "^hello$" || fail
+# A must be forked after B is ready
+echo "${RES}" | grep "Child ready\|New child forked" | \
+    sed -n '2p;3p' | tr '\n' ' ' | \
+    grep -q "Child ready;\[command\]=\[B\].*New child forked;\[command\]=\[A\]" || fail
+
+echo "TEST: hot standby"
+SBDIR=$(mktemp -d)
+${PE} -R -s 3 -l 2 -- \
+    [ A /bin/sh -c 'i=0; while test $i -lt 20; do echo $i; i=$((i+1)); sleep 0.05; done' ] \
+    [ B,standby /bin/sh -c "i=0; while read l; do echo \$l >>${SBDIR}/out; i=\$((i+1)); test \$i -eq 5 && kill -9 \$\$; done" ] \
+    '{A:1>B:0}' </dev/null 2>${SBDIR}/log || true
+RES=$(tr '\n' ' ' <${SBDIR}/out)
+grep -q "Promoting standby" ${SBDIR}/log || fail
+rm -rf ${SBDIR}
+test "${RES}" = "0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 " || fail
+
+echo "TEST: hot standby with notify fd"
+SBDIR=$(mktemp -d)
+${PE} -R -s 3 -l 2 -- \
+    [ A /bin/sh -c 'i=0; while test $i -lt 20; do echo $i; i=$((i+1)); sleep 0.05; done' ] \
+    [ B,standby,notify=4 /bin/sh -c "echo READY=1 >&4; read GO <&4; i=0; while read l; do echo \$l >>${SBDIR}/out; i=\$((i+1)); test \$i -eq 5 && kill -9 \$\$; done" ] \
+    '{A:1>B:0}' </dev/null 2>${SBDIR}/log || true
+RES=$(tr '\n' ' ' <${SBDIR}/out)
+grep -q "Promoting standby" ${SBDIR}/log || fail
+rm -rf ${SBDIR}
+test "${RES}" = "0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 " || fail
+
+echo "TEST: autoscaling"
+ASDIR=$(mktemp -d)
+${PE} -R -s 1 -a 100 -l 2 -- \
+    [ A /bin/sh -c 'i=0; while test $i -lt 400; do echo $i; i=$((i+1)); done' ] \
+    [ B,scale=1-4 /bin/sh -c 'while l=$(dd bs=65536 count=1 2>/dev/null) && test -n "$l"; do echo "$l"; sleep 0.01; done' ] \
+    [ C /bin/sh -c "sort -n >${ASDIR}/out" ] \
+    '{A:1>B:0,seqpacket}' '{B:1>C:0,seqpacket}' </dev/null 2>${ASDIR}/log
+seq 0 399 | cmp -s - ${ASDIR}/out || fail
+grep -q "Adding replica" ${ASDIR}/log || fail
+# A stream would split the records between the replicas.
+if ${PE} -R -s 1 -- [ A /bin/echo ] [ B,scale=1-4 /bin/cat ] '{A:1>B:0}' \
+    </dev/null >/dev/null 2>&1; then
+    fail
+fi
+rm -rf ${ASDIR}
+
+echo "TEST: relay edge"
+RES=$(${PE} -l 2 -- [ A /bin/sh -c 'head -c 3000000 /dev/zero' ] \
+    [ B /bin/sh -c 'sleep 0.3; wc -c' ] '{A:1>B:0,relay}' 2>&1 </dev/null)
+echo "${RES}" | grep -q "^3000000$" || fail
+echo "${RES}" | grep -q "Relay statistics;.*\[bytes\]=\[3000000\]" || fail
+echo "${RES}" | grep -q "Relay statistics;.*\[stall_usec\]=\[[1-9]" || fail
+
+echo "TEST: tap on a relay edge"
+if which python3 >/dev/null 2>&1; then
+    TAPDIR=$(mktemp -d)
+    ${PE} -c ${TAPDIR}/ctl -- \
+        [ A /bin/sh -c 'sleep 0.5; for i in $(seq 1 20); do echo line $i; sleep 0.05; done' ] \
+        [ B /bin/sh -c 'wc -l' ] '{A:1>B:0,relay}' >${TAPDIR}/out </dev/null &
+    PEPID=$!
+    for i in $(seq 1 50); do test -S ${TAPDIR}/ctl && break; sleep 0.1; done
+    # The tap ends with the edge.
+    RES=$(python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(b"tap 1\ntap 0 every=2\n")
+buf = b""
+while True:
+    data = s.recv(4096)
+    if not data:
+        break
+    buf += data
+sys.stdout.write(buf.decode())
+' ${TAPDIR}/ctl)
+    wait ${PEPID}
+    echo "${RES}" | grep -q "^error: no such pipe" || fail
+    echo "${RES}" | grep -q "^ok$" || fail
+    test "$(echo "${RES}" | grep -c '^line')" = "10" || fail
+    echo "${RES}" | grep -q "^line 2$" && fail
+    test "$(cat ${TAPDIR}/out)" = "20" || fail
+
+    # A tap reader which does not read does not slow down the edge.
+    ${PE} -l 2 -c ${TAPDIR}/ctl2 -- \
+        [ A /bin/sh -c 'sleep 0.5; head -c 50000000 /dev/zero' ] \
+        [ B /bin/sh -c 'wc -c' ] '{A:1>B:0,relay}' >${TAPDIR}/log 2>&1 </dev/null &
+    PEPID=$!
+    for i in $(seq 1 50); do test -S ${TAPDIR}/ctl2 && break; sleep 0.1; done
+    python3 -c '
+import socket, sys, time
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(b"tap 0\n")
+time.sleep(15)
+' ${TAPDIR}/ctl2 &
+    PYPID=$!
+    wait ${PEPID}
+    kill ${PYPID}
+    wait ${PYPID} 2>/dev/null || true
+    grep -q "^50000000$" ${TAPDIR}/log || fail
+    grep -q "Relay statistics;.*\[tap_drops\]=\[[1-9]" ${TAPDIR}/log || fail
+
+    # Full chunks are waiting: the samples are cut to the rate budget.
+    ${PE} -c ${TAPDIR}/ctl3 -- \
+        [ A /bin/sh -c 'sleep 0.5; head -c 5000000 /dev/zero' ] \
+        [ B /bin/sh -c 'sleep 2; wc -c' ] '{A:1>B:0,relay}' >${TAPDIR}/out3 </dev/null &
+    PEPID=$!
+    for i in $(seq 1 50); do test -S ${TAPDIR}/ctl3 && break; sleep 0.1; done
+    RES=$(python3 -c '
+import socket, sys, time
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+start = time.time()
+s.sendall(b"tap 0 rate=1000\n")
+size = 0
+while True:
+    data = s.recv(65536)
+    if not data:
+        break
+    size += len(data)
+print(size - len(b"ok\n"), int(1000 * (time.time() - start + 1)))
+' ${TAPDIR}/ctl3)
+    wait ${PEPID}
+    test "$(cat ${TAPDIR}/out3)" = "5000000" || fail
+    read TAPPED BUDGET <<< "${RES}"
+    test "${TAPPED}" -gt 0 && test "${TAPPED}" -le "${BUDGET}" || fail
+    rm -rf ${TAPDIR}
+else
+    echo "python3 not available - skipped"
+fi
+
+echo "TEST: edge recording and preplay"
+RECDIR=$(mktemp -d)
+${PE} -- [ A /bin/sh -c 'for i in $(seq 1 10); do echo line $i; sleep 0.1; done' ] \
+    [ B /usr/bin/wc -l ] "{A:1>B:0,record=${RECDIR}/rec,timing}" >${RECDIR}/out
+test "$(cat ${RECDIR}/out)" = "10" || fail
+seq 1 10 | sed 's/^/line /' | cmp -s - ${RECDIR}/rec || fail
+test -s ${RECDIR}/rec.idx || fail
+# Original timing, twice as fast and as fast as possible
+RES=$(./bin/pipexec -- [ R ./bin/preplay ${RECDIR}/rec ] [ C /bin/cat ] \
+    '{R:1>C:0}' 2>${RECDIR}/err)
+test "$(echo "${RES}" | wc -l)" = "10" || fail
+grep -q "^preplay: 71 bytes in 0\.[89].* (recorded: 0\.[89]" ${RECDIR}/err || fail
+./bin/preplay -s 2 ${RECDIR}/rec 2>&1 >/dev/null | grep -q "bytes in 0\.[45]" || fail
+./bin/preplay -a -q ${RECDIR}/rec | cmp -s - ${RECDIR}/rec || fail
+# A writer which is always ahead: the recording has each byte.
+${PE} -- [ A /usr/bin/head -c 300000000 /dev/zero ] [ B /usr/bin/wc -c ] \
+    "{A:1>B:0,record=${RECDIR}/big,timing}" >${RECDIR}/out
+test "$(cat ${RECDIR}/out)" = "300000000" || fail
+test "$(stat -c %s ${RECDIR}/big)" = "300000000" || fail
+test "$(./bin/preplay -a -q ${RECDIR}/big | wc -c)" = "300000000" || fail
+rm -rf ${RECDIR}
+
+echo "TEST: stall watchdog"
+RES=$(${PE} -g 1 -l 2 -- [ A /usr/bin/yes ] [ B /bin/sh -c 'sleep 3' ] \
+    '{A:1>B:0}' 2>&1 </dev/null || true)
+echo "${RES}" | grep -q "Node stalled;\[command\]=\[B\]" || fail
+# B waits for C: backpressure, B is not stalled.
+RES=$(${PE} -g 1 -l 2 -- [ A /usr/bin/yes ] [ B /bin/cat ] [ C /bin/sh -c 'sleep 4' ] \
+    '{A:1>B:0}' '{B:1>C:0}' 2>&1 </dev/null || true)
+echo "${RES}" | grep -q "Node stalled;\[command\]=\[C\]" || fail
+echo "${RES}" | grep -q "Node stalled;\[command\]=\[B\]" && fail
+
+echo "TEST: batch mode"
+TMPDIR_PE=$(mktemp -d)
+for N in 1 2 3 4 5; do
+    /usr/bin/seq 1 ${N}000 >${TMPDIR_PE}/in${N}
+    echo ${TMPDIR_PE}/in${N}
+done >${TMPDIR_PE}/list
+RES=$(${PE} -B ${TMPDIR_PE}/list -P 3 -j 2 -- [ A /bin/cat ] [ B /usr/bin/wc -l ] \
+    '{FILE:@INPUT@>A:0}' '{A:1>B:0}' '{B:1>FILE:@INPUT@.cnt}' 2>&1 </dev/null)
+echo "${RES}" | grep -q '"id":6,.*"instances":"5","failed":"0"' || fail
+CNT=$(cat ${TMPDIR_PE}/in*.cnt | tr '\n' ' ')
+rm -rf ${TMPDIR_PE}
+if test "${CNT}" != "1000 2000 3000 4000 5000 "; then
+    fail
+fi
+
+echo "TEST: cache of deterministic processes"
+TMPDIR_PE=$(mktemp -d)
+for N in 1 2 1 2 1; do
+    /usr/bin/seq 1 ${N}000 >${TMPDIR_PE}/in${N}
+    echo ${TMPDIR_PE}/in${N}
+done >${TMPDIR_PE}/list
+# Only the first run of each input runs the process.
+${PE} -B ${TMPDIR_PE}/list -C ${TMPDIR_PE}/cache -- \
+    [ A,cache /bin/sh -c "echo run >>${TMPDIR_PE}/runs; wc -l" ] \
+    '{FILE:@INPUT@>A:0}' '{A:1>FILE:@INPUT@.cnt}' </dev/null || fail
+test "$(wc -l <${TMPDIR_PE}/runs)" = "2" || fail
+test "$(cat ${TMPDIR_PE}/in1.cnt ${TMPDIR_PE}/in2.cnt | tr '\n' ' ')" = "1000 2000 " || fail
+test "$(ls ${TMPDIR_PE}/cache | wc -l)" = "2" || fail
+# Entries which do not fit are evicted.
+${PE} -M 1 -C ${TMPDIR_PE}/cache -- \
+    [ A,cache /bin/sh -c 'head -c 2000000 /dev/zero' ] </dev/null | wc -c \
+    | grep -q "^2000000$" || fail
+test "$(ls ${TMPDIR_PE}/cache | wc -l)" = "0" || fail
+# The input of a batch instance is part of the key.
+printf 'x\ny\nx\n' >${TMPDIR_PE}/list2
+${PE} -B ${TMPDIR_PE}/list2 -C ${TMPDIR_PE}/cache -- \
+    [ A,cache /bin/sh -c "echo run >>${TMPDIR_PE}/runs2; echo \${PIPEXEC_INPUT}\${PIPEXEC_INSTANCE}" ] \
+    "{A:1>FILE:${TMPDIR_PE}/@INPUT@.out}" </dev/null || fail
+test "$(wc -l <${TMPDIR_PE}/runs2)" = "2" || fail
+test "$(cat ${TMPDIR_PE}/x.out ${TMPDIR_PE}/y.out | tr '\n' ' ')" = "x y " || fail
+rm -rf ${TMPDIR_PE}/cache
+# Only stdin is part of the key: other inputs are refused.
+echo one >${TMPDIR_PE}/a
+echo two >${TMPDIR_PE}/b
+for IN in a b; do
+    if ${PE} -C ${TMPDIR_PE}/cache -- [ A,cache /bin/sh -c 'cat <&3' ] \
+        "{FILE:${TMPDIR_PE}/${IN}>A:3}" </dev/null >${TMPDIR_PE}/out 2>/dev/null; then
+        fail
+    fi
+    test -s ${TMPDIR_PE}/out && fail
+done
+rm -rf ${TMPDIR_PE}
+
+echo "TEST: graph export"
+GEDIR=$(mktemp -d)
+${PE} -x ${GEDIR}/graph.json -- [ A /bin/echo hello ] [ B /bin/cat ] \
+    "{A:1>B:0}" "{B:1>FILE:${GEDIR}/out}" </dev/null
+grep -q '^{"name":"A","path":"/bin/echo","pid":[1-9]' ${GEDIR}/graph.json || fail
+grep -q '"from":{"node":"A","fd":1},"to":{"node":"B","fd":0},"type":"pipe","capacity_bytes":[1-9]' \
+    ${GEDIR}/graph.json || fail
+grep -q "\"to\":{\"file\":\"${GEDIR}/out\"}" ${GEDIR}/graph.json || fail
+${PE} -x ${GEDIR}/graph.dot -- [ A /bin/echo hello ] [ B /bin/cat ] \
+    "{A:1>B:0}" "{B:1>FILE:${GEDIR}/out}" </dev/null
+grep -q '^  "A" -> "B" \[label="1>0 pipe' ${GEDIR}/graph.dot || fail
+grep -q "^  \"B\" -> \"FILE:${GEDIR}/out\"" ${GEDIR}/graph.dot || fail
+rm -rf ${GEDIR}
+
+echo "TEST: open file limit preflight"
+ARGS=""
+for N in $(seq 1 200); do
+    ARGS="${ARGS} [ N${N} /bin/true ] {N${N}:1>N$((N+1)):0}"
+done
+RES=$( (ulimit -n 256; ${PE} -l 2 -- ${ARGS} [ N201 /bin/true ]) 2>&1 </dev/null || true)
+echo "${RES}" | grep -q "needs more open files than the hard limit" || fail
+
+echo "TEST: FIFO attach points"
+FIFO_IN=$(mktemp -u)
+FIFO_OUT=$(mktemp -u)
+OUTPUT=$(mktemp)
+${PE} -- [ A /bin/cat ] "{FIFO:${FIFO_IN}>A:0}" "{A:1>FIFO:${FIFO_OUT}}" &
+PEPID=$!
+for I in $(seq 1 50); do
+    test -p ${FIFO_IN} && test -p ${FIFO_OUT} && break
+    sleep 0.1
+done
+# The second writer attaches after the first one detached: A does not
+# see EOF in between.  The reader attaches later: nothing is lost.
+echo first >${FIFO_IN}
+echo second >${FIFO_IN}
+cat ${FIFO_OUT} >${OUTPUT} &
+READER=$!
+for I in $(seq 1 50); do
+    test "$(wc -l <${OUTPUT})" = "2" && break
+    sleep 0.1
+done
+kill -TERM ${PEPID}
+wait ${PEPID} || true
+wait ${READER}
+test "$(cat ${OUTPUT})" = "$(printf 'first\nsecond')" || fail
+test ! -e ${FIFO_IN} || fail
+test ! -e ${FIFO_OUT} || fail
+rm -f ${OUTPUT}
+
+echo "TEST: library in an own event loop"
+RES=$(./test/plib </dev/null)
+echo "${RES}" | grep -qx "refused pipe" || fail
+echo "${RES}" | grep -qx "refused node" || fail
+echo "${RES}" | grep -qx "refused start" || fail
+echo "${RES}" | grep -qx "stop does not block" || fail
+echo "${RES}" | grep -qx "batch keeps handlers" || fail
+echo "${RES}" | grep -qx "batch own child 3" || fail
+echo "${RES}" | grep -qx "Hello Library" || fail
+test "$(echo "${RES}" | grep -c "^started")" = "3" || fail
+test "$(echo "${RES}" | grep -c "^exited AB 0$")" = "2" || fail
+echo "${RES}" | grep -qx "C running pid" || fail
+echo "${RES}" | grep -qx "exited C -15" || fail
+echo "${RES}" | grep -qx "finished graph" || fail
+echo "${RES}" | grep -qx "result 0" || fail
+echo "${RES}" | grep -qx "own child 7" || fail
+
+# Start, restart (SIGHUP) and stop 5000 nodes and pipes: the soft
+# limit of open files is raised on the way.
+echo "TEST: 5000 nodes within 120 seconds"
+if test "$(ulimit -Hn)" = "unlimited" || test "$(ulimit -Hn)" -ge 16000; then
+    ARGS=""
+    for N in $(seq 1 4999); do
+        ARGS="${ARGS} [ N${N} /bin/sleep 600 ] {N${N}:1>N$((N+1)):0}"
+    done
+    START=$(date +%s)
+    (ulimit -Sn 1024; exec ${PE} -k -s 1 -- ${ARGS} [ N5000 /bin/sleep 600 ]) </dev/null &
+    PEPID=$!
+    function wait_for_nodes() {
+        while test "$(pgrep -c -x sleep -P ${PEPID} || true)" != "5000"; do
+            test $(($(date +%s) - START)) -lt 120 || fail
+            sleep 0.2
+        done
+        # The startup is finished when all processes are ready.
+        sleep 1
+    }
+    wait_for_nodes
+    FIRST=$(pgrep -x sleep -P ${PEPID} | head -1)
+    kill -HUP ${PEPID}
+    while pgrep -x sleep -P ${PEPID} | grep -qx ${FIRST}; do
+        sleep 0.2
+    done
+    wait_for_nodes
+    kill -TERM ${PEPID}
+    wait ${PEPID} || true
+    test $(($(date +%s) - START)) -lt 120 || fail
+else
+    echo "hard limit of open files too low - skipped"
+fi
@@ -0,0 +1,201 @@
+/*
+ * plib: runs a graph with libpipexec in an own epoll loop
+ *
+ * A and B are a pipe which finishes on its own; C runs until the graph
+ * is stopped.  Prints the events and the status of C.  Before that the
+ * errors of a wrong graph are checked: they must not end the program.
+ * A child of the program itself which terminates while the graph runs
+ * must be left to the program.  A stop with a drain must not block the
+ * loop of the program.  The batch mode keeps the signal handlers of
+ * the program.
+ *
+ * Copyright 2015,2022 by Andreas Florath
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "src/libpipexec.h"
+
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+static char const *const event_names[] = {"started", "exited", "finished"};
+
+// Prints what is refused with EINVAL.
+static void bad_graphs() {
+  pipexec_t *const pe = pipexec_new();
+  if (pipexec_add_pipe(pe, "A:1B:0") == -1 && errno == EINVAL) {
+    printf("refused pipe\n");
+  }
+  if (pipexec_add_node(pe, "A,notify=x", "/bin/true", NULL) == -1 &&
+      errno == EINVAL) {
+    printf("refused node\n");
+  }
+  // A standby needs node restarts.
+  if (pipexec_add_node(pe, "A,standby", "/bin/true", NULL) == 0 &&
+      pipexec_start(pe) == -1 && errno == EINVAL) {
+    printf("refused start\n");
+  }
+  pipexec_free(pe);
+}
+
+static long now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+// D ignores SIGTERM: the drain kills it after one second.
+static void nonblocking_stop() {
+  pipexec_t *const pe = pipexec_new();
+  char const *const args[] = {"-c", "trap '' TERM; sleep 10", NULL};
+  if (pe == NULL || pipexec_set_int(pe, pipexec_opt_drain_timeout, 1) == -1 ||
+      pipexec_add_node(pe, "D", "/bin/sh", args) == -1 ||
+      pipexec_start(pe) == -1) {
+    perror("plib");
+    exit(10);
+  }
+  struct timespec const delay = {0, 200000000L};
+  nanosleep(&delay, NULL);
+  long const start = now_ms();
+  pipexec_stop(pe);
+  int const finished = pipexec_dispatch(pe, 0);
+  long const blocked = now_ms() - start;
+  while (pipexec_dispatch(pe, -1) == 0) {
+  }
+  if (finished == 0 && blocked < 500 && now_ms() - start >= 1000) {
+    printf("stop does not block\n");
+  }
+  pipexec_free(pe);
+}
+
+static void sh_own(int signum) {
+  (void)signum;
+}
+
+static void batch_keeps_handlers() {
+  struct sigaction sa_own;
+  sa_own.sa_handler = sh_own;
+  sigemptyset(&sa_own.sa_mask);
+  sa_own.sa_flags = 0;
+  sigaction(SIGTERM, &sa_own, NULL);
+  char list_path[] = "/tmp/plib_list_XXXXXX";
+  int const fd = mkstemp(list_path);
+  if (fd == -1 || write(fd, "a\nb\n", 4) != 4) {
+    perror("plib");
+    exit(10);
+  }
+  close(fd);
+  pid_t const own = fork();
+  if (own == 0) {
+    _exit(3);
+  }
+
+  pipexec_t *const pe = pipexec_new();
+  char const *const args[] = {"0.2", NULL};
+  if (pe == NULL || pipexec_add_node(pe, "E", "/bin/sleep", args) == -1 ||
+      pipexec_run_batch(pe, list_path, 1) != 0) {
+    perror("plib");
+    exit(10);
+  }
+  pipexec_free(pe);
+  unlink(list_path);
+
+  struct sigaction sa_now;
+  sigaction(SIGTERM, NULL, &sa_now);
+  if (sa_now.sa_handler == sh_own) {
+    printf("batch keeps handlers\n");
+  }
+  int own_status;
+  if (waitpid(own, &own_status, 0) == own && WIFEXITED(own_status)) {
+    printf("batch own child %d\n", WEXITSTATUS(own_status));
+  }
+  signal(SIGTERM, SIG_DFL);
+}
+
+int main() {
+  // The output of B is in between.
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  if (getenv("PLIB_LOG") != NULL) {
+    pipexec_log_text(2);
+  }
+  bad_graphs();
+  nonblocking_stop();
+  batch_keeps_handlers();
+  pid_t const own = fork();
+  if (own == 0) {
+    struct timespec const delay = {0, 100000000L};
+    nanosleep(&delay, NULL);
+    _exit(7);
+  }
+  pipexec_t *const pe = pipexec_new();
+  char const *const echo_args[] = {"Hello", "Library", NULL};
+  char const *const sleep_args[] = {"600", NULL};
+  if (pe == NULL || pipexec_add_node(pe, "A", "/bin/echo", echo_args) == -1 ||
+      pipexec_add_node(pe, "B", "/bin/cat", NULL) == -1 ||
+      pipexec_add_pipe(pe, "A:1>B:0") == -1 ||
+      pipexec_add_node(pe, "C", "/bin/sleep", sleep_args) == -1 ||
+      pipexec_start(pe) == -1) {
+    perror("plib");
+    return 10;
+  }
+
+  int const epfd = epoll_create1(0);
+  struct epoll_event ev = {EPOLLIN, {.fd = pipexec_fd(pe)}};
+  if (epfd == -1 || ev.data.fd == -1 ||
+      epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+    perror("plib");
+    return 10;
+  }
+
+  int const cidx = pipexec_node_index(pe, "C");
+  int exited = 0;
+  int finished = 0;
+  while (!finished) {
+    int const ready = epoll_wait(epfd, &ev, 1, 10000);
+    if (ready == -1 && errno == EINTR) {
+      // SIGCHLD
+      continue;
+    }
+    if (ready != 1) {
+      fprintf(stderr, "plib: no event within 10 seconds\n");
+      return 1;
+    }
+    finished = pipexec_dispatch(pe, 0);
+
+    struct pipexec_event event;
+    while (pipexec_next_event(pe, &event) == 0) {
+      printf("%s %s", event_names[event.type],
+             event.type == pipexec_ev_finished ? "graph"
+             : (int)event.node == cidx         ? "C"
+                                                : "AB");
+      if (event.type == pipexec_ev_exited) {
+        printf(" %d", WIFEXITED(event.status) ? WEXITSTATUS(event.status)
+                                               : -WTERMSIG(event.status));
+      }
+      printf("\n");
+      if (event.type == pipexec_ev_exited && (int)event.node != cidx &&
+          ++exited == 2) {
+        struct pipexec_node_status status;
+        if (pipexec_node_status(pe, cidx, &status) == 0) {
+          printf("%s %s %s\n", status.name, status.state,
+                 status.pid > 0 ? "pid" : "no pid");
+        }
+        pipexec_stop(pe);
+      }
+    }
+  }
+  printf("result %d\n", pipexec_result(pe));
+  pipexec_free(pe);
+  int own_status;
+  if (waitpid(own, &own_status, 0) == own && WIFEXITED(own_status)) {
+    printf("own child %d\n", WEXITSTATUS(own_status));
+  }
+  return 0;
+}